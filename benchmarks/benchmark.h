@@ -0,0 +1,116 @@
+#ifndef GNL_BENCHMARK_H
+#define GNL_BENCHMARK_H
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+
+/**
+ * Small helpers shared by the benchmark executables.
+ */
+namespace bench
+{
+
+using clock_type = std::chrono::steady_clock;
+
+inline std::uint64_t now_ns()
+{
+    return static_cast<std::uint64_t>(
+             std::chrono::duration_cast<std::chrono::nanoseconds>( clock_type::now().time_since_epoch() ).count() );
+}
+
+/**
+ * @brief The latency class
+ *
+ * Collects latency samples (in nanoseconds) and reports percentiles.
+ */
+class latency
+{
+public:
+    void reserve(std::size_t n) { m_samples.reserve(n); }
+
+    void add(std::uint64_t ns) { m_samples.push_back(ns); }
+
+    std::size_t size() const { return m_samples.size(); }
+
+    /**
+     * @brief percentile
+     * @param p - between 0 and 100
+     * @return the sample at the p'th percentile in nanoseconds
+     */
+    std::uint64_t percentile(double p)
+    {
+        if( m_samples.empty() )
+            return 0;
+        std::sort( m_samples.begin(), m_samples.end() );
+        std::size_t i = static_cast<std::size_t>( p / 100.0 * static_cast<double>(m_samples.size()-1) + 0.5 );
+        return m_samples[i];
+    }
+
+    /**
+     * @brief print
+     * @param name
+     *
+     * Prints one line with the p50/p90/p99/p99.9 and max latency in
+     * microseconds.
+     */
+    void print(std::string const & name)
+    {
+        std::printf("%-36s n=%-8zu p50=%8.2fus p90=%8.2fus p99=%8.2fus p99.9=%8.2fus max=%8.2fus\n",
+                    name.c_str(), m_samples.size(),
+                    percentile(50)   / 1000.0,
+                    percentile(90)   / 1000.0,
+                    percentile(99)   / 1000.0,
+                    percentile(99.9) / 1000.0,
+                    percentile(100)  / 1000.0);
+    }
+
+    void merge(latency const & other)
+    {
+        m_samples.insert( m_samples.end(), other.m_samples.begin(), other.m_samples.end() );
+    }
+
+protected:
+    std::vector<std::uint64_t> m_samples;
+};
+
+/**
+ * @brief print_throughput
+ * @param name
+ * @param bytes - total bytes transferred
+ * @param messages - total messages transferred
+ * @param ns - time it took in nanoseconds
+ *
+ * Prints one line with the rate in MB/s and messages per second.
+ */
+inline void print_throughput(std::string const & name, std::uint64_t bytes, std::uint64_t messages, std::uint64_t ns)
+{
+    double s = static_cast<double>(ns) / 1e9;
+    std::printf("%-36s %10.1f MB/s %12.0f msg/s\n", name.c_str(),
+                static_cast<double>(bytes) / s / (1024.0*1024.0),
+                static_cast<double>(messages) / s);
+}
+
+/**
+ * @brief arg
+ * @return the value of the command line argument "--name=value", or
+ *         default_value if it was not given.
+ */
+inline std::size_t arg(int argc, char ** argv, std::string const & name, std::size_t default_value)
+{
+    std::string prefix = "--" + name + "=";
+    for(int i=1; i < argc; i++)
+    {
+        std::string a(argv[i]);
+        if( a.compare(0, prefix.size(), prefix) == 0 )
+            return static_cast<std::size_t>( std::stoull( a.substr(prefix.size()) ) );
+    }
+    return default_value;
+}
+
+}
+
+#endif
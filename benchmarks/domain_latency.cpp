@@ -0,0 +1,118 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <string>
+
+#include <gnl/gnl_socket.h>
+#include "benchmark.h"
+
+/**
+ * Unix domain stream socket round trip latency. Like tcp_latency, each of
+ * the --concurrency clients has its own connection and thread and waits
+ * for the echo of its --size byte request.
+ *
+ *   domain_latency --size=64 --concurrency=1 --iterations=20000
+ */
+
+#if defined __linux__
+
+bool recv_all(gnl::domain_stream_socket & S, char * data, std::size_t size)
+{
+    std::size_t got = 0;
+    while( got < size )
+    {
+        auto n = S.recv(data + got, size - got);
+        if( n <= 0 )
+            return false;
+        got += static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+int main(int argc, char ** argv)
+{
+    auto size        = bench::arg(argc, argv, "size", 64);
+    auto concurrency = bench::arg(argc, argv, "concurrency", 1);
+    auto iterations  = bench::arg(argc, argv, "iterations", 20000);
+
+    std::string path = "/tmp/gnl_domain_latency_" + std::to_string( ::getpid() ) + ".socket";
+
+    gnl::domain_stream_socket server;
+    if( !server.bind(path.c_str()) || !server.listen(concurrency) )
+    {
+        std::cout << "Could not bind to " << path << std::endl;
+        return 1;
+    }
+
+    std::vector<std::thread> servers;
+    std::thread acceptor( [&]()
+    {
+        for(std::size_t i=0; i < concurrency; i++)
+        {
+            gnl::domain_stream_socket client = server.accept();
+            servers.emplace_back( [client, size]() mutable
+            {
+                std::vector<char> buf(size);
+                while( recv_all(client, buf.data(), size) )
+                    client.send(buf.data(), size);
+                client.close();
+            });
+        }
+    });
+
+    std::vector<bench::latency> results(concurrency);
+    std::vector<std::thread>    clients;
+
+    auto t0 = bench::now_ns();
+    for(std::size_t c=0; c < concurrency; c++)
+    {
+        clients.emplace_back( [&, c]()
+        {
+            gnl::domain_stream_socket S;
+            S.create();
+            if( !S.connect(path.c_str()) )
+                return;
+
+            std::vector<char> buf(size, 'x');
+            results[c].reserve(iterations);
+            for(std::size_t i=0; i < iterations; i++)
+            {
+                auto start = bench::now_ns();
+                S.send(buf.data(), size);
+                if( !recv_all(S, buf.data(), size) )
+                    break;
+                results[c].add( bench::now_ns() - start );
+            }
+            S.close();
+        });
+    }
+
+    for(auto & t : clients)
+        t.join();
+    auto elapsed = bench::now_ns() - t0;
+
+    acceptor.join();
+    for(auto & t : servers)
+        t.join();
+    server.close();
+    server.unlink(path.c_str());
+
+    bench::latency all;
+    for(auto & r : results)
+        all.merge(r);
+
+    std::cout << "unix domain request/response, " << size << " bytes, " << concurrency << " connection(s)" << std::endl;
+    all.print("round trip");
+    bench::print_throughput("requests", all.size() * size * 2, all.size(), elapsed);
+    return 0;
+}
+
+#else
+
+int main()
+{
+    std::cout << "This only works on Linux" << std::endl;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,81 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <gnl/gnl_rpc.h>
+#include "benchmark.h"
+
+/**
+ * RPC calls over one loopback connection, first waiting for each response
+ * before making the next call, then with --depth calls in flight at once.
+ *
+ *   rpc_pipelining --iterations=20000 --depth=32 --port=30440
+ */
+int main(int argc, char ** argv)
+{
+    auto iterations = bench::arg(argc, argv, "iterations", 20000);
+    auto depth      = bench::arg(argc, argv, "depth", 32);
+    auto port       = static_cast<std::uint16_t>( bench::arg(argc, argv, "port", 30440) );
+
+    gnl::tcp_socket listener;
+    listener.create();
+    listener.set_option( gnl::socket_options::reuse_address(true) );
+    if( !listener.bind(port) || !listener.listen(1) )
+    {
+        std::cout << "Could not bind to port " << port << std::endl;
+        return 1;
+    }
+
+    gnl::rpc_server server;
+    server.bind("add", [](gnl::json const & params)
+    {
+        return gnl::json( params.get("a", 0.0f) + params.get("b", 0.0f) );
+    });
+
+    std::thread T( [&]{ server.serve( listener.accept() ); } );
+
+    gnl::rpc_client client;
+    if( !client.connect("127.0.0.1", port) )
+    {
+        std::cout << "Could not connect" << std::endl;
+        return 1;
+    }
+
+    gnl::json params;
+    params["a"] = 1;
+    params["b"] = 2;
+
+    // one call at a time
+    bench::latency sequential;
+    auto t0 = bench::now_ns();
+    for(std::size_t i=0; i < iterations; i++)
+    {
+        auto s = bench::now_ns();
+        client.call("add", params).get();
+        sequential.add( bench::now_ns() - s );
+    }
+    auto t1 = bench::now_ns();
+    sequential.print("rpc sequential");
+    bench::print_throughput("rpc sequential", 0, iterations, t1 - t0);
+
+    // keep "depth" calls in flight
+    std::vector< std::future<gnl::json> > in_flight;
+    in_flight.reserve(depth);
+
+    t0 = bench::now_ns();
+    for(std::size_t i=0; i < iterations; i += depth)
+    {
+        for(std::size_t j=0; j < depth; j++)
+            in_flight.push_back( client.call("add", params) );
+        for(auto & f : in_flight)
+            f.get();
+        in_flight.clear();
+    }
+    t1 = bench::now_ns();
+    bench::print_throughput("rpc pipelined depth=" + std::to_string(depth), 0, iterations, t1 - t0);
+
+    client.close();
+    T.join();
+    listener.close();
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <gnl/gnl_shm_channel.h>
+#include "benchmark.h"
+
+/**
+ * Compares a pair of shm_channels against a domain_stream_socket for
+ * same-host messaging:
+ *
+ *   - ping/pong round trip latency
+ *   - one way throughput
+ *
+ * The two endpoints are threads in this process. The data path is the
+ * same as between two processes, both sides only share the memfd/socket.
+ *
+ *   shm_channel --size=64 --iterations=100000 --megabytes=1024
+ */
+
+#if defined __linux__ && defined SYS_memfd_create
+
+void socket_latency(std::size_t size, std::size_t iterations)
+{
+    gnl::domain_stream_socket a, b;
+    gnl::domain_stream_socket::pair(a, b);
+
+    std::thread T( [&]()
+    {
+        std::vector<char> buf(size);
+        for(std::size_t i=0; i < iterations; i++)
+        {
+            std::size_t got = 0;
+            while( got < size )
+                got += static_cast<std::size_t>( b.recv(buf.data() + got, size - got) );
+            b.send(buf.data(), size);
+        }
+    });
+
+    std::vector<char> buf(size, 'x');
+    bench::latency L;
+    L.reserve(iterations);
+    for(std::size_t i=0; i < iterations; i++)
+    {
+        std::uint64_t t0 = bench::now_ns();
+        a.send(buf.data(), size);
+        std::size_t got = 0;
+        while( got < size )
+            got += static_cast<std::size_t>( a.recv(buf.data() + got, size - got) );
+        L.add( bench::now_ns() - t0 );
+    }
+    T.join();
+    L.print("domain_stream_socket round trip");
+}
+
+void shm_latency(std::size_t size, std::size_t iterations)
+{
+    gnl::domain_stream_socket a, b;
+    gnl::domain_stream_socket::pair(a, b);
+
+    // one channel in each direction, both set up through the socket
+    gnl::shm_channel ping_w, ping_r, pong_w, pong_r;
+    ping_w.create(a);
+    ping_r.open(b);
+    pong_w.create(b);
+    pong_r.open(a);
+
+    std::thread T( [&]()
+    {
+        std::vector<char> buf(size);
+        for(std::size_t i=0; i < iterations; i++)
+        {
+            ping_r.recv(buf.data(), size);
+            pong_w.send(buf.data(), size);
+        }
+    });
+
+    std::vector<char> buf(size, 'x');
+    bench::latency L;
+    L.reserve(iterations);
+    for(std::size_t i=0; i < iterations; i++)
+    {
+        std::uint64_t t0 = bench::now_ns();
+        ping_w.send(buf.data(), size);
+        pong_r.recv(buf.data(), size);
+        L.add( bench::now_ns() - t0 );
+    }
+    T.join();
+    L.print("shm_channel round trip");
+}
+
+void socket_throughput(std::size_t size, std::size_t total)
+{
+    gnl::domain_stream_socket a, b;
+    gnl::domain_stream_socket::pair(a, b);
+
+    std::size_t messages = total / size;
+    std::uint64_t t0 = bench::now_ns();
+
+    std::thread T( [&]()
+    {
+        std::vector<char> buf(size, 'x');
+        for(std::size_t i=0; i < messages; i++)
+            a.send(buf.data(), size);
+    });
+
+    std::vector<char> buf(1u<<16);
+    std::size_t got = 0;
+    while( got < messages * size )
+        got += static_cast<std::size_t>( b.recv(buf.data(), buf.size()) );
+
+    std::uint64_t ns = bench::now_ns() - t0;
+    T.join();
+    bench::print_throughput("domain_stream_socket throughput", got, messages, ns);
+}
+
+void shm_throughput(std::size_t size, std::size_t total)
+{
+    gnl::domain_stream_socket a, b;
+    gnl::domain_stream_socket::pair(a, b);
+
+    gnl::shm_channel w, r;
+    w.create(a, 4u<<20);
+    r.open(b);
+
+    std::size_t messages = total / size;
+    std::uint64_t t0 = bench::now_ns();
+
+    std::thread T( [&]()
+    {
+        std::vector<char> buf(size, 'x');
+        for(std::size_t i=0; i < messages; i++)
+            w.send(buf.data(), size);
+    });
+
+    std::vector<char> buf(size);
+    std::size_t got = 0;
+    for(std::size_t i=0; i < messages; i++)
+        got += static_cast<std::size_t>( r.recv(buf.data(), size) );
+
+    std::uint64_t ns = bench::now_ns() - t0;
+    T.join();
+    bench::print_throughput("shm_channel throughput", got, messages, ns);
+}
+
+int main(int argc, char ** argv)
+{
+    std::size_t size       = bench::arg(argc, argv, "size", 64);
+    std::size_t iterations = bench::arg(argc, argv, "iterations", 100000);
+    std::size_t megabytes  = bench::arg(argc, argv, "megabytes", 1024);
+
+    std::cout << "message size: " << size << " bytes" << std::endl;
+
+    socket_latency(size, iterations);
+    shm_latency(size, iterations);
+
+    socket_throughput(size, megabytes << 20);
+    shm_throughput(size, megabytes << 20);
+
+    return 0;
+}
+
+#else
+
+int main()
+{
+    std::cout << "This only works on Linux" << std::endl;
+    return 0;
+}
+
+#endif
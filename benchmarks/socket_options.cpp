@@ -0,0 +1,254 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+
+#include <gnl/gnl_socket.h>
+#include "benchmark.h"
+
+/**
+ * Measures the tcp request/response latency over loopback with different
+ * socket options applied. Each request is written as two small writes
+ * (a 4 byte header and the payload), which is the pattern where Nagle's
+ * algorithm and delayed ACKs hurt the most.
+ *
+ *   socket_options --size=64 --iterations=5000 --port=30400
+ */
+
+struct config
+{
+    char const * name;
+    bool         nodelay      = false;
+    bool         quickack     = false;
+    bool         cork         = false;
+    int          buffer_size  = 0;   // 0 = leave at the default
+    int          busy_poll_us = 0;
+};
+
+template<typename Option>
+void apply(gnl::tcp_socket & S, Option const & opt, char const * name)
+{
+    if( !S.set_option(opt) )
+        std::cout << "  (could not set " << name << ": " << strerror(errno) << ")" << std::endl;
+}
+
+void apply(gnl::tcp_socket & S, config const & c)
+{
+    if( c.nodelay )
+        apply(S, gnl::socket_options::tcp_nodelay(true), "TCP_NODELAY");
+#if defined TCP_QUICKACK
+    if( c.quickack )
+        apply(S, gnl::socket_options::tcp_quickack(true), "TCP_QUICKACK");
+#endif
+    if( c.buffer_size )
+    {
+        apply(S, gnl::socket_options::send_buffer_size(c.buffer_size), "SO_SNDBUF");
+        apply(S, gnl::socket_options::recv_buffer_size(c.buffer_size), "SO_RCVBUF");
+    }
+#if defined SO_BUSY_POLL
+    if( c.busy_poll_us )
+        apply(S, gnl::socket_options::busy_poll(c.busy_poll_us), "SO_BUSY_POLL");
+#endif
+}
+
+bool recv_request(gnl::tcp_socket & S, std::vector<char> & buf, config const & c)
+{
+    std::uint32_t size = 0;
+    if( S.recv(&size, sizeof(size)) != sizeof(size) )
+        return false;
+    buf.resize(size);
+    if( size && S.recv(buf.data(), size) != static_cast<gnl::tcp_socket::msg_size_t>(size) )
+        return false;
+#if defined TCP_QUICKACK
+    // quickack is not sticky, the kernel can switch back to delayed acks
+    if( c.quickack )
+        S.set_option( gnl::socket_options::tcp_quickack(true) );
+#endif
+    return true;
+}
+
+void send_request(gnl::tcp_socket & S, std::vector<char> const & payload, config const & c)
+{
+    std::uint32_t size = static_cast<std::uint32_t>(payload.size());
+#if defined TCP_CORK
+    if( c.cork )
+        S.set_option( gnl::socket_options::tcp_cork(true) );
+#endif
+    S.send(&size, sizeof(size));
+    S.send(payload.data(), payload.size());
+#if defined TCP_CORK
+    if( c.cork )
+        S.set_option( gnl::socket_options::tcp_cork(false) );
+#endif
+}
+
+void run(config const & c, std::uint16_t port, std::size_t size, std::size_t iterations)
+{
+    gnl::tcp_socket server;
+    server.create();
+    server.set_option( gnl::socket_options::reuse_address(true) );
+    if( !server.bind(port) || !server.listen(1) )
+    {
+        std::cout << "Could not bind to port " << port << std::endl;
+        return;
+    }
+
+    std::thread T( [&]()
+    {
+        auto client = server.accept();
+        apply(client, c);
+
+        std::vector<char> buf;
+        while( recv_request(client, buf, c) )
+            send_request(client, buf, c);
+        client.close();
+    });
+
+    gnl::tcp_socket C;
+    C.create();
+    apply(C, c);
+    C.connect("127.0.0.1", port);
+
+    // read back the options to show what the kernel actually applied
+    gnl::socket_options::tcp_nodelay      nodelay;
+    gnl::socket_options::send_buffer_size sndbuf;
+    gnl::socket_options::recv_buffer_size rcvbuf;
+    C.get_option(nodelay);
+    C.get_option(sndbuf);
+    C.get_option(rcvbuf);
+
+    std::vector<char> payload(size, 'x');
+    std::vector<char> reply;
+
+    bench::latency L;
+    L.reserve(iterations);
+
+    // stop early if the configuration is very slow (eg: nagle + delayed ack)
+    auto deadline = bench::now_ns() + 3000000000ull;
+
+    for(std::size_t i=0; i < iterations && bench::now_ns() < deadline; i++)
+    {
+        auto t0 = bench::now_ns();
+        send_request(C, payload, c);
+        if( !recv_request(C, reply, c) )
+            break;
+        L.add( bench::now_ns() - t0 );
+    }
+
+    C.close();
+    T.join();
+    server.close();
+
+    L.print(c.name);
+    std::cout << "    nodelay=" << nodelay.value() << " sndbuf=" << sndbuf.value() << " rcvbuf=" << rcvbuf.value() << std::endl;
+}
+
+/**
+ * Time to connect, send one request and read the reply on a fresh
+ * connection, with and without TCP fast open.
+ */
+void run_connect(bool fastopen, std::uint16_t port, std::size_t iterations)
+{
+    gnl::tcp_socket server;
+    server.create();
+    server.set_option( gnl::socket_options::reuse_address(true) );
+#if defined TCP_FASTOPEN
+    if( fastopen )
+        apply(server, gnl::socket_options::tcp_fastopen(64), "TCP_FASTOPEN");
+#endif
+    if( !server.bind(port) || !server.listen(128) )
+    {
+        std::cout << "Could not bind to port " << port << std::endl;
+        return;
+    }
+
+    config c;
+    c.nodelay = true;
+
+    std::atomic<bool> done(false);
+    std::thread T( [&]()
+    {
+        std::vector<char> buf;
+        while( !done )
+        {
+            auto client = server.accept();
+            if( !client )
+                break;
+            if( recv_request(client, buf, c) )
+                send_request(client, buf, c);
+            client.close();
+        }
+    });
+
+    std::vector<char> payload(32, 'x');
+    std::vector<char> reply;
+
+    bench::latency L;
+    for(std::size_t i=0; i < iterations; i++)
+    {
+        auto t0 = bench::now_ns();
+
+        gnl::tcp_socket C;
+        C.create();
+        C.set_option( gnl::socket_options::tcp_nodelay(true) );
+#if defined TCP_FASTOPEN_CONNECT
+        if( fastopen )
+            C.set_option( gnl::socket_options::tcp_fastopen_connect(true) );
+#endif
+        C.connect("127.0.0.1", port);
+        send_request(C, payload, c);
+        recv_request(C, reply, c);
+        C.close();
+
+        L.add( bench::now_ns() - t0 );
+    }
+
+    done = true;
+    // wake up the accept call
+    gnl::tcp_socket W;
+    W.create();
+    W.connect("127.0.0.1", port);
+    W.close();
+
+    T.join();
+    server.close();
+
+    L.print( fastopen ? "connect+request (fastopen)" : "connect+request" );
+}
+
+int main(int argc, char ** argv)
+{
+    auto size       = bench::arg(argc, argv, "size", 64);
+    auto iterations = bench::arg(argc, argv, "iterations", 5000);
+    auto port       = static_cast<std::uint16_t>( bench::arg(argc, argv, "port", 30400) );
+
+    std::cout << "tcp request/response over loopback, " << size << " byte payload" << std::endl;
+
+    std::vector<config> configs(8);
+    configs[0].name = "default";
+    configs[1].name = "TCP_NODELAY";
+    configs[1].nodelay = true;
+    configs[2].name = "TCP_QUICKACK";
+    configs[2].quickack = true;
+    configs[3].name = "TCP_CORK";
+    configs[3].cork = true;
+    configs[4].name = "TCP_NODELAY + SO_SNDBUF/RCVBUF 4k";
+    configs[4].nodelay = true;
+    configs[4].buffer_size = 4096;
+    configs[5].name = "TCP_NODELAY + SO_SNDBUF/RCVBUF 4M";
+    configs[5].nodelay = true;
+    configs[5].buffer_size = 4*1024*1024;
+    configs[6].name = "TCP_NODELAY + SO_BUSY_POLL 50us";
+    configs[6].nodelay = true;
+    configs[6].busy_poll_us = 50;
+    configs[7].name = "TCP_NODELAY + TCP_QUICKACK";
+    configs[7].nodelay = true;
+    configs[7].quickack = true;
+
+    for(auto & c : configs)
+        run(c, port, size, iterations);
+
+    run_connect(false, port, iterations / 10);
+    run_connect(true,  port, iterations / 10);
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <gnl/gnl_socket.h>
+#include "benchmark.h"
+
+/**
+ * TCP request/response latency over loopback. Each of the --concurrency
+ * clients has its own connection and thread, sends a --size byte request
+ * and waits for the echo before sending the next one. The server uses
+ * one blocking thread per connection.
+ *
+ *   tcp_latency --size=64 --concurrency=1 --iterations=20000 --port=30410
+ */
+
+bool recv_all(gnl::tcp_socket & S, char * data, std::size_t size)
+{
+    return S.recv(data, size) == static_cast<gnl::tcp_socket::msg_size_t>(size);
+}
+
+int main(int argc, char ** argv)
+{
+    auto size        = bench::arg(argc, argv, "size", 64);
+    auto concurrency = bench::arg(argc, argv, "concurrency", 1);
+    auto iterations  = bench::arg(argc, argv, "iterations", 20000);
+    auto port        = static_cast<std::uint16_t>( bench::arg(argc, argv, "port", 30410) );
+
+    gnl::tcp_socket server;
+    server.create();
+    server.set_option( gnl::socket_options::reuse_address(true) );
+    if( !server.bind(port) || !server.listen(concurrency) )
+    {
+        std::cout << "Could not bind to port " << port << std::endl;
+        return 1;
+    }
+
+    std::vector<std::thread> servers;
+    std::thread acceptor( [&]()
+    {
+        for(std::size_t i=0; i < concurrency; i++)
+        {
+            gnl::tcp_socket client = server.accept();
+            servers.emplace_back( [client, size]() mutable
+            {
+                client.set_option( gnl::socket_options::tcp_nodelay(true) );
+                std::vector<char> buf(size);
+                while( recv_all(client, buf.data(), size) )
+                    client.send(buf.data(), size);
+                client.close();
+            });
+        }
+    });
+
+    std::vector<bench::latency> results(concurrency);
+    std::vector<std::thread>    clients;
+
+    auto t0 = bench::now_ns();
+    for(std::size_t c=0; c < concurrency; c++)
+    {
+        clients.emplace_back( [&, c]()
+        {
+            gnl::tcp_socket S;
+            S.create();
+            S.set_option( gnl::socket_options::tcp_nodelay(true) );
+            if( !S.connect("127.0.0.1", port) )
+                return;
+
+            std::vector<char> buf(size, 'x');
+            results[c].reserve(iterations);
+            for(std::size_t i=0; i < iterations; i++)
+            {
+                auto start = bench::now_ns();
+                S.send(buf.data(), size);
+                if( !recv_all(S, buf.data(), size) )
+                    break;
+                results[c].add( bench::now_ns() - start );
+            }
+            S.close();
+        });
+    }
+
+    for(auto & t : clients)
+        t.join();
+    auto elapsed = bench::now_ns() - t0;
+
+    acceptor.join();
+    for(auto & t : servers)
+        t.join();
+    server.close();
+
+    bench::latency all;
+    for(auto & r : results)
+        all.merge(r);
+
+    std::cout << "tcp request/response, " << size << " bytes, " << concurrency << " connection(s)" << std::endl;
+    all.print("round trip");
+    bench::print_throughput("requests", all.size() * size * 2, all.size(), elapsed);
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <atomic>
+
+#include <gnl/gnl_socket.h>
+#include "benchmark.h"
+
+/**
+ * TCP streaming throughput over loopback. Each of the --concurrency
+ * connections sends --size byte writes as fast as it can for --seconds.
+ * The receiving side reads into a large buffer and counts the bytes.
+ *
+ *   tcp_throughput --size=65536 --concurrency=1 --seconds=3 --port=30420
+ */
+int main(int argc, char ** argv)
+{
+    auto size        = bench::arg(argc, argv, "size", 65536);
+    auto concurrency = bench::arg(argc, argv, "concurrency", 1);
+    auto seconds     = bench::arg(argc, argv, "seconds", 3);
+    auto port        = static_cast<std::uint16_t>( bench::arg(argc, argv, "port", 30420) );
+
+    gnl::tcp_socket server;
+    server.create();
+    server.set_option( gnl::socket_options::reuse_address(true) );
+    if( !server.bind(port) || !server.listen(concurrency) )
+    {
+        std::cout << "Could not bind to port " << port << std::endl;
+        return 1;
+    }
+
+    std::atomic<std::uint64_t> recieved(0);
+    std::vector<std::thread>   readers;
+    std::thread acceptor( [&]()
+    {
+        for(std::size_t i=0; i < concurrency; i++)
+        {
+            gnl::tcp_socket client = server.accept();
+            readers.emplace_back( [client, &recieved]() mutable
+            {
+                std::vector<char> buf(1u<<18);
+                std::uint64_t total = 0;
+                for(;;)
+                {
+                    auto n = client.recv_some(buf.data(), buf.size());
+                    if( n <= 0 )
+                        break;
+                    total += static_cast<std::uint64_t>(n);
+                }
+                recieved += total;
+            });
+        }
+    });
+
+    std::atomic<bool>          stop(false);
+    std::atomic<std::uint64_t> writes(0);
+    std::vector<std::thread>   writers;
+
+    auto t0 = bench::now_ns();
+    for(std::size_t c=0; c < concurrency; c++)
+    {
+        writers.emplace_back( [&]()
+        {
+            gnl::tcp_socket S;
+            S.create();
+            if( !S.connect("127.0.0.1", port) )
+                return;
+
+            std::vector<char> buf(size, 'x');
+            std::uint64_t count = 0;
+            while( !stop )
+            {
+                std::size_t sent = 0;
+                while( sent < size )
+                {
+                    auto n = S.send(buf.data() + sent, size - sent);
+                    if( n <= 0 )
+                        break;
+                    sent += static_cast<std::size_t>(n);
+                }
+                count++;
+            }
+            writes += count;
+            S.close();
+        });
+    }
+
+    std::this_thread::sleep_for( std::chrono::seconds(seconds) );
+    stop = true;
+
+    for(auto & t : writers)
+        t.join();
+    acceptor.join();
+    for(auto & t : readers)
+        t.join();
+    auto elapsed = bench::now_ns() - t0;
+    server.close();
+
+    std::cout << "tcp streaming, " << size << " byte writes, " << concurrency << " connection(s)" << std::endl;
+    bench::print_throughput("throughput", recieved, writes, elapsed);
+    return 0;
+}
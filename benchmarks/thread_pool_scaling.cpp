@@ -0,0 +1,102 @@
+#include <iostream>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <functional>
+
+#include <gnl/gnl_threadpool.h>
+#include "benchmark.h"
+
+/**
+ * Throughput of fine-grained tasks for an increasing number of workers,
+ * with the locked and the lock-free shared queue, each with and without
+ * work stealing.
+ *
+ * "flat":  the main thread pushes --tasks tasks.
+ * "bulk":  the same tasks queued with a single push_bulk( ).
+ * "tree":  every task pushes two more, --depth levels deep, so almost all
+ *          tasks are pushed from inside the pool.
+ *
+ *   thread_pool_scaling --tasks=200000 --depth=16 --work=200 --max_threads=32
+ */
+
+using lockfree_pool = gnl::basic_thread_pool<gnl::lockfree_queue>;
+
+std::size_t g_work = 200;
+
+// a few hundred nanoseconds of work
+void spin()
+{
+    volatile std::size_t x = 0;
+    for(std::size_t i=0; i < g_work; i++)
+        x = x + i;
+}
+
+void wait_for(std::atomic<std::size_t> & done, std::size_t count)
+{
+    while( done.load(std::memory_order_acquire) < count )
+        std::this_thread::yield();
+}
+
+template<typename Pool>
+void tree(Pool & P, std::atomic<std::size_t> & done, int depth)
+{
+    spin();
+    if( depth > 0 )
+    {
+        P.push( tree<Pool>, std::ref(P), std::ref(done), depth - 1 );
+        P.push( tree<Pool>, std::ref(P), std::ref(done), depth - 1 );
+    }
+    done.fetch_add(1, std::memory_order_release);
+}
+
+template<typename Pool>
+void run(std::string const & name, std::size_t threads, bool stealing, std::size_t tasks, int depth)
+{
+    gnl::thread_pool_options options;
+    options.work_stealing = stealing;
+    Pool P(threads, options);
+
+    std::atomic<std::size_t> done(0);
+
+    auto t0 = bench::now_ns();
+    for(std::size_t i=0; i < tasks; i++)
+        P.push( [&done]{ spin(); done.fetch_add(1, std::memory_order_release); } );
+    wait_for(done, tasks);
+    auto t1 = bench::now_ns();
+    bench::print_throughput(name + " flat threads=" + std::to_string(threads), 0, tasks, t1 - t0);
+
+    std::vector< std::function<void()> > bulk( tasks, [&done]{ spin(); done.fetch_add(1, std::memory_order_release); } );
+    done = 0;
+    t0 = bench::now_ns();
+    P.push_bulk( bulk.begin(), bulk.end() );
+    wait_for(done, tasks);
+    t1 = bench::now_ns();
+    bench::print_throughput(name + " bulk threads=" + std::to_string(threads), 0, tasks, t1 - t0);
+
+    std::size_t tree_tasks = (std::size_t(1) << (depth + 1)) - 1;
+    done = 0;
+    t0 = bench::now_ns();
+    P.push( tree<Pool>, std::ref(P), std::ref(done), depth );
+    wait_for(done, tree_tasks);
+    t1 = bench::now_ns();
+    bench::print_throughput(name + " tree threads=" + std::to_string(threads), 0, tree_tasks, t1 - t0);
+}
+
+int main(int argc, char ** argv)
+{
+    auto tasks       = bench::arg(argc, argv, "tasks", 200000);
+    auto depth       = static_cast<int>( bench::arg(argc, argv, "depth", 16) );
+    auto max_threads = bench::arg(argc, argv, "max_threads", std::max(1u, std::thread::hardware_concurrency()) );
+    g_work           = bench::arg(argc, argv, "work", 200);
+
+    for(std::size_t threads=1; threads <= max_threads; threads *= 2)
+    {
+        run<gnl::thread_pool>("locked         ", threads, false, tasks, depth);
+        run<gnl::thread_pool>("locked+steal   ", threads, true,  tasks, depth);
+        run<lockfree_pool>   ("lock-free      ", threads, false, tasks, depth);
+        run<lockfree_pool>   ("lock-free+steal", threads, true,  tasks, depth);
+    }
+    return 0;
+}
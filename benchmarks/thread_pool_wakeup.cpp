@@ -0,0 +1,53 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+
+#include <gnl/gnl_threadpool.h>
+#include "benchmark.h"
+
+/**
+ * Latency from submitting a task to an idle pool until its result is
+ * back, with workers that go to sleep straight away and with workers
+ * that spin and yield for a while first. The main thread pauses between
+ * tasks so the workers have gone idle each time. Spinning only helps when
+ * the worker has a core to itself, on a single core it gets in the way.
+ *
+ *   thread_pool_wakeup --samples=20000 --gap_us=20 --spin=2000 --yield=100
+ */
+
+void run(std::string const & name, gnl::thread_pool_options const & options, std::size_t samples, std::size_t gap_us)
+{
+    gnl::thread_pool P(1, options);
+    bench::latency   L;
+    L.reserve(samples);
+
+    for(std::size_t i=0; i < samples; i++)
+    {
+        auto end = bench::now_ns() + gap_us * 1000;
+        while( bench::now_ns() < end )
+        {
+        }
+
+        auto t0 = bench::now_ns();
+        P.submit( []{ return 1; } ).get();
+        L.add( bench::now_ns() - t0 );
+    }
+    L.print(name);
+}
+
+int main(int argc, char ** argv)
+{
+    auto samples = bench::arg(argc, argv, "samples", 20000);
+    auto gap_us  = bench::arg(argc, argv, "gap_us", 20);
+
+    gnl::thread_pool_options park;
+    run("park", park, samples, gap_us);
+
+    gnl::thread_pool_options spin;
+    spin.spin_count  = bench::arg(argc, argv, "spin", 2000);
+    spin.yield_count = bench::arg(argc, argv, "yield", 100);
+    run("spin then park", spin, samples, gap_us);
+
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <atomic>
+
+#include <gnl/gnl_socket.h>
+#include "benchmark.h"
+
+/**
+ * UDP packets per second over loopback. --concurrency threads each send
+ * --size byte datagrams to one receiving socket for --seconds. Both the
+ * send rate and the rate which actually arrived are printed, the
+ * difference is what the kernel dropped.
+ *
+ *   udp_pps --size=64 --concurrency=1 --seconds=3 --port=30430
+ */
+int main(int argc, char ** argv)
+{
+    auto size        = bench::arg(argc, argv, "size", 64);
+    auto concurrency = bench::arg(argc, argv, "concurrency", 1);
+    auto seconds     = bench::arg(argc, argv, "seconds", 3);
+    auto port        = static_cast<std::uint16_t>( bench::arg(argc, argv, "port", 30430) );
+
+    gnl::udp_socket server;
+    server.create();
+    server.set_option( gnl::socket_options::reuse_address(true) );
+    server.set_option( gnl::socket_options::recv_buffer_size(4*1024*1024) );
+    if( !server.bind( gnl::socket_address(port) ) )
+    {
+        std::cout << "Could not bind to port " << port << std::endl;
+        return 1;
+    }
+
+    std::atomic<bool>     stop(false);
+    std::uint64_t         packets_recieved = 0;
+    std::uint64_t         bytes_recieved   = 0;
+
+    std::thread reader( [&]()
+    {
+        std::vector<char>   buf(65536);
+        gnl::socket_address from;
+        while( !stop )
+        {
+            if( !server.wait_readable( std::chrono::milliseconds(100) ) )
+                continue;
+            auto n = server.recv(buf.data(), buf.size(), from);
+            if( n < 0 )
+                continue;
+            packets_recieved++;
+            bytes_recieved += static_cast<std::uint64_t>(n);
+        }
+    });
+
+    std::atomic<std::uint64_t> packets_sent(0);
+    std::atomic<bool>          stop_senders(false);
+    std::vector<std::thread>   senders;
+
+    auto t0 = bench::now_ns();
+    for(std::size_t c=0; c < concurrency; c++)
+    {
+        senders.emplace_back( [&]()
+        {
+            gnl::udp_socket S;
+            S.create();
+            gnl::socket_address to("127.0.0.1", port);
+
+            std::vector<char> buf(size, 'x');
+            std::uint64_t count = 0;
+            while( !stop_senders )
+            {
+                if( S.send(buf.data(), size, to) == static_cast<gnl::udp_socket::msg_size_t>(size) )
+                    count++;
+            }
+            packets_sent += count;
+            S.close();
+        });
+    }
+
+    std::this_thread::sleep_for( std::chrono::seconds(seconds) );
+    stop_senders = true;
+    for(auto & t : senders)
+        t.join();
+    auto elapsed = bench::now_ns() - t0;
+
+    // let the reader drain what is still queued
+    std::this_thread::sleep_for( std::chrono::milliseconds(200) );
+    stop = true;
+    reader.join();
+    server.close();
+
+    std::cout << "udp, " << size << " byte datagrams, " << concurrency << " sender(s)" << std::endl;
+    bench::print_throughput("sent",      packets_sent * size, packets_sent, elapsed);
+    bench::print_throughput("recieved",  bytes_recieved, packets_recieved, elapsed);
+    return 0;
+}
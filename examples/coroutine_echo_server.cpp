@@ -0,0 +1,78 @@
+#include <iostream>
+
+#include <gnl/gnl_async_socket.h>
+
+#if defined GNL_HAS_COROUTINES
+
+#if defined __GNUC__ && !defined __clang__
+    #pragma GCC diagnostic ignored "-Wswitch-default"
+#endif
+
+#define PORT 30300
+
+/*
+ * An echo server where every client is handled by its own coroutine,
+ * all running on a single thread. Connect with: nc localhost 30300
+ */
+gnl::task<> echo(gnl::event_loop & loop, gnl::tcp_socket client)
+{
+    std::cout << "Client connected: " << client.get_address().ip() << std::endl;
+
+    char buf[1024];
+    for(;;)
+    {
+        // disconnect clients which are idle for a minute
+        auto r = co_await gnl::async_recv_some(loop, client, buf, sizeof(buf), std::chrono::seconds(60));
+        if( !r )
+            break;
+
+        auto s = co_await gnl::async_send(loop, client, buf, r.bytes);
+        if( !s )
+            break;
+    }
+
+    std::cout << "Client disconnected" << std::endl;
+    client.close();
+}
+
+gnl::task<> server(gnl::event_loop & loop, gnl::tcp_socket & listener)
+{
+    for(;;)
+    {
+        auto c = co_await gnl::async_accept(loop, listener);
+        if( c )
+            gnl::spawn( echo(loop, std::move(c.socket)) );
+    }
+}
+
+int main()
+{
+    gnl::event_loop loop;
+
+    gnl::tcp_socket listener;
+    listener.create();
+    listener.set_option( gnl::socket_options::reuse_address(true) );
+
+    if( !listener.bind(PORT) || !listener.listen(100) )
+    {
+        std::cout << "Error binding to port " << PORT << std::endl;
+        return 1;
+    }
+
+    std::cout << "Listening on port " << PORT << std::endl;
+
+    gnl::spawn( loop, server(loop, listener) );
+    loop.run();
+
+    return 0;
+}
+
+#else
+
+int main()
+{
+    std::cout << "This requires C++20 coroutines and Linux" << std::endl;
+    return 0;
+}
+
+#endif
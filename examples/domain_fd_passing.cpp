@@ -0,0 +1,80 @@
+#include <iostream>
+
+#if defined __linux__
+
+#include <thread>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <gnl/gnl_socket.h>
+
+#define BUFFER_SIZE (1024*1024)
+
+/*
+ * Shares a large buffer between two endpoints by passing a memfd over a
+ * unix domain seqpacket socket. Only the file descriptor and a short
+ * message go through the socket, the data itself is never copied.
+ *
+ * The two endpoints are threads here, but the same works between two
+ * processes, eg: after a fork( ) or through a socket bound to a path.
+ */
+int main()
+{
+    gnl::domain_seqpacket_socket producer;
+    gnl::domain_seqpacket_socket consumer;
+
+    if( !gnl::domain_seqpacket_socket::pair(producer, consumer) )
+    {
+        std::cout << "Error creating the socket pair" << std::endl;
+        return 1;
+    }
+
+    std::thread t( [&]()
+    {
+        int mem = static_cast<int>( syscall(SYS_memfd_create, "gnl_example", 0) );
+        if( ftruncate(mem, BUFFER_SIZE) != 0 )
+            return;
+
+        char * p = static_cast<char*>( mmap(nullptr, BUFFER_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, mem, 0) );
+        for(int i=0; i < BUFFER_SIZE; i++)
+            p[i] = static_cast<char>('a' + i % 26);
+
+        std::cout << "[Producer] sending a " << BUFFER_SIZE << " byte buffer" << std::endl;
+
+        producer.send_fds("buffer", 6, &mem, 1);
+
+        munmap(p, BUFFER_SIZE);
+        ::close(mem);
+    });
+
+    char        msg[64] = {0};
+    int         mem     = -1;
+    std::size_t count   = 0;
+
+    consumer.recv_fds(msg, sizeof(msg), &mem, 1, count);
+
+    if( count == 1 )
+    {
+        char * p = static_cast<char*>( mmap(nullptr, BUFFER_SIZE, PROT_READ, MAP_SHARED, mem, 0) );
+        std::cout << "[Consumer] recieved \"" << msg << "\", starts with: " << std::string(p, 26) << std::endl;
+        munmap(p, BUFFER_SIZE);
+        ::close(mem);
+    }
+
+    t.join();
+
+    producer.close();
+    consumer.close();
+    return 0;
+}
+
+#else
+
+int main()
+{
+    std::cout << "This only works on Linux" << std::endl;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,65 @@
+#include <iostream>
+
+#if defined __linux__
+
+#include <thread>
+#include <gnl/gnl_socket.h>
+
+#define PORT 30000
+
+/**
+ * An echo server which accepts clients on 4 threads. Each thread has its
+ * own listening socket (SO_REUSEPORT) and its own event loop, and serves
+ * the clients it accepts on that same loop.
+ */
+int main()
+{
+    gnl::listener_group G;
+
+    bool started = G.start(PORT, 4, [](gnl::tcp_socket && client, gnl::event_loop & loop)
+    {
+        std::cout << "Client connected on thread " << std::this_thread::get_id() << std::endl;
+
+        // the loop owns the client from now on
+        auto C = std::make_shared<gnl::tcp_socket>( std::move(client) );
+
+        loop.add( C->native_handle(), gnl::event_loop::readable, [C, &loop](std::uint32_t)
+        {
+            char buf[1024];
+            auto n = C->recv_some(buf, sizeof(buf));
+
+            if( n <= 0 )
+            {
+                loop.remove( C->native_handle() );
+                C->close();
+                std::cout << "Client disconnected" << std::endl;
+                return;
+            }
+            C->send(buf, static_cast<std::size_t>(n) );
+        });
+    });
+
+    if( !started )
+    {
+        std::cout << "Could not bind to port " << PORT << std::endl;
+        return 1;
+    }
+
+    std::cout << "Server started on " << G.size() << " threads" << std::endl;
+
+    // the listener threads do all the work
+    for(;;)
+        std::this_thread::sleep_for( std::chrono::seconds(1) );
+
+    return 0;
+}
+
+#else
+int main()
+{
+    std::cout << "This only works on Linux" << std::endl;
+
+    return 0;
+}
+
+#endif
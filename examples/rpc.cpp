@@ -0,0 +1,78 @@
+#include <iostream>
+#include <thread>
+#include <cctype>
+
+#include <gnl/gnl_rpc.h>
+
+#define PORT 30301
+
+/*
+ * A server with a json method and a binary method, and a client which
+ * makes several calls without waiting for each answer.
+ */
+int main()
+{
+    gnl::tcp_socket listener;
+    listener.create();
+    listener.set_option( gnl::socket_options::reuse_address(true) );
+    if( !listener.bind(PORT) || !listener.listen(10) )
+    {
+        std::cout << "Error binding to port " << PORT << std::endl;
+        return 1;
+    }
+
+    gnl::rpc_server server;
+
+    server.bind("multiply", [](gnl::json const & params)
+    {
+        gnl::json result;
+        result["product"] = params.get("x", 0.0f) * params.get("y", 0.0f);
+        return result;
+    });
+
+    server.bind_binary("upper", [](char const * data, std::size_t size)
+    {
+        std::string s(data, size);
+        for(auto & c : s)
+            c = static_cast<char>( std::toupper(c) );
+        return s;
+    });
+
+    std::thread T( [&]{ server.serve( listener.accept() ); } );
+
+    {
+        gnl::rpc_client client;
+        if( !client.connect("127.0.0.1", PORT) )
+        {
+            std::cout << "Could not connect" << std::endl;
+            return 1;
+        }
+
+        std::vector< std::future<gnl::json> > results;
+        for(int i=1; i <= 5; i++)
+        {
+            gnl::json params;
+            params["x"] = i;
+            params["y"] = 10;
+            results.push_back( client.call("multiply", params) );
+        }
+
+        for(auto & r : results)
+            std::cout << "product: " << r.get()["product"].as<float>() << std::endl;
+
+        std::cout << client.call_binary("upper", std::string("hello rpc")).get() << std::endl;
+
+        try
+        {
+            client.call("divide", gnl::json()).get();
+        }
+        catch(gnl::rpc_error & e)
+        {
+            std::cout << "error: " << e.what() << std::endl;
+        }
+    }
+
+    T.join();
+    listener.close();
+    return 0;
+}
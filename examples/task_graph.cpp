@@ -0,0 +1,31 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+
+#include <gnl/gnl_task_graph.h>
+
+// A small frame pipeline: input and physics can run at the same time,
+// animation needs physics, and rendering needs everything else.
+int main(int argc, char ** argv)
+{
+    gnl::thread_pool P(4);
+    gnl::task_graph  G;
+
+    int frame = 0;
+
+    auto input   = G.add( [&]{ std::this_thread::sleep_for( std::chrono::milliseconds(2) ); } );
+    auto physics = G.add( [&]{ std::this_thread::sleep_for( std::chrono::milliseconds(5) ); } );
+    auto animate = G.add( [&]{ std::this_thread::sleep_for( std::chrono::milliseconds(3) ); } );
+    auto render  = G.add( [&]{ std::cout << "rendered frame " << frame << std::endl; } );
+
+    G.add_edge(physics, animate);
+    G.add_edge(input,   render);
+    G.add_edge(animate, render);
+
+    G.compile();
+
+    for(frame=0; frame < 10; frame++)
+        G.run(P);
+
+    return 0;
+}
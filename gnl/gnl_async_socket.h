@@ -0,0 +1,807 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org>
+ */
+
+#ifndef GNL_ASYNC_SOCKET_H
+#define GNL_ASYNC_SOCKET_H
+
+#include <gnl/gnl_socket.h>
+
+/**
+ * Coroutine versions of the async_* socket functions. These need C++20,
+ * with an older standard this header is empty and only the blocking and
+ * callback based APIs in gnl_socket.h are available.
+ *
+ * A connection handler is written as straight-line code:
+ *
+ *     gnl::task<> echo(gnl::event_loop & loop, gnl::tcp_socket client)
+ *     {
+ *         char buf[1024];
+ *         for(;;)
+ *         {
+ *             auto r = co_await gnl::async_recv_some(loop, client, buf, sizeof(buf));
+ *             if( !r )
+ *                 break;
+ *             co_await gnl::async_send(loop, client, buf, r.bytes);
+ *         }
+ *         client.close();
+ *     }
+ *
+ *     gnl::task<> server(gnl::event_loop & loop, gnl::tcp_socket & listener)
+ *     {
+ *         for(;;)
+ *         {
+ *             auto c = co_await gnl::async_accept(loop, listener);
+ *             if( c )
+ *                 gnl::spawn( echo(loop, std::move(c.socket)) );
+ *         }
+ *     }
+ *
+ * Each waiting connection costs only its coroutine frame and a
+ * registration in the event_loop, so one thread can serve many thousands
+ * of them. Every operation first tries the system call directly, the
+ * loop is only involved if it would block.
+ *
+ * As with the callback API, everything runs on the loop's thread, only
+ * one operation may be in progress per socket, and the socket and buffers
+ * must outlive the operation. A coroutine which is still waiting when the
+ * loop is destroyed is never resumed or freed, so let them finish first.
+ */
+#if defined __linux__ && __cplusplus >= 202002L && defined __has_include
+#if __has_include(<coroutine>)
+
+#define GNL_HAS_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <string>
+
+// gcc's coroutine lowering generates a switch without a default case
+#if defined __GNUC__ && !defined __clang__
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wswitch-default"
+#endif
+
+#ifndef GNL_NAMESPACE
+    #define GNL_NAMESPACE gnl
+#endif
+namespace GNL_NAMESPACE
+{
+
+template<typename T = void>
+class task;
+
+namespace detail
+{
+    // resumes whoever co_awaited the task once it finishes
+    struct task_final_awaiter
+    {
+        bool await_ready() noexcept { return false; }
+
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+        {
+            auto c = h.promise().continuation;
+            return c ? c : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    struct task_promise_base
+    {
+        std::coroutine_handle<> continuation;
+        std::exception_ptr      exception;
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        task_final_awaiter  final_suspend() noexcept { return {}; }
+
+        void unhandled_exception()
+        {
+            exception = std::current_exception();
+        }
+    };
+}
+
+/**
+ * @brief The task class
+ *
+ * A lazily started coroutine which produces a T. It starts running when
+ * it is co_awaited, and the awaiting coroutine continues when it
+ * finishes. Use spawn( ) to start a task<void> without awaiting it.
+ */
+template<typename T>
+class task
+{
+public:
+    struct promise_type : detail::task_promise_base
+    {
+        std::optional<T> value;
+
+        task get_return_object()
+        {
+            return task( std::coroutine_handle<promise_type>::from_promise(*this) );
+        }
+
+        template<typename U>
+        void return_value(U && v)
+        {
+            value.emplace( std::forward<U>(v) );
+        }
+    };
+
+    task(task && other) noexcept : m_handle(other.m_handle)
+    {
+        other.m_handle = nullptr;
+    }
+
+    task & operator=(task && other) noexcept
+    {
+        if( this != &other )
+        {
+            if( m_handle )
+                m_handle.destroy();
+            m_handle = other.m_handle;
+            other.m_handle = nullptr;
+        }
+        return *this;
+    }
+
+    task(task const &) = delete;
+    task & operator=(task const &) = delete;
+
+    ~task()
+    {
+        if( m_handle )
+            m_handle.destroy();
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        m_handle.promise().continuation = awaiting;
+        return m_handle;
+    }
+
+    T await_resume()
+    {
+        if( m_handle.promise().exception )
+            std::rethrow_exception( m_handle.promise().exception );
+        return std::move( *m_handle.promise().value );
+    }
+
+protected:
+    explicit task(std::coroutine_handle<promise_type> h) : m_handle(h)
+    {
+    }
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+template<>
+class task<void>
+{
+public:
+    struct promise_type : detail::task_promise_base
+    {
+        task get_return_object()
+        {
+            return task( std::coroutine_handle<promise_type>::from_promise(*this) );
+        }
+
+        void return_void()
+        {
+        }
+    };
+
+    task(task && other) noexcept : m_handle(other.m_handle)
+    {
+        other.m_handle = nullptr;
+    }
+
+    task & operator=(task && other) noexcept
+    {
+        if( this != &other )
+        {
+            if( m_handle )
+                m_handle.destroy();
+            m_handle = other.m_handle;
+            other.m_handle = nullptr;
+        }
+        return *this;
+    }
+
+    task(task const &) = delete;
+    task & operator=(task const &) = delete;
+
+    ~task()
+    {
+        if( m_handle )
+            m_handle.destroy();
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        m_handle.promise().continuation = awaiting;
+        return m_handle;
+    }
+
+    void await_resume()
+    {
+        if( m_handle.promise().exception )
+            std::rethrow_exception( m_handle.promise().exception );
+    }
+
+protected:
+    explicit task(std::coroutine_handle<promise_type> h) : m_handle(h)
+    {
+    }
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+namespace detail
+{
+    // a coroutine which starts right away and frees itself when done
+    struct detached_task
+    {
+        struct promise_type
+        {
+            detached_task       get_return_object() { return {}; }
+            std::suspend_never  initial_suspend() noexcept { return {}; }
+            std::suspend_never  final_suspend() noexcept { return {}; }
+            void                return_void() {}
+            void                unhandled_exception() { std::terminate(); }
+        };
+    };
+
+    inline detached_task run_detached(task<void> t)
+    {
+        co_await t;
+    }
+}
+
+/**
+ * @brief spawn
+ * @param t
+ *
+ * Starts a task without waiting for it. It runs on the current thread
+ * until its first suspension, and its frame is freed when it finishes.
+ * An exception escaping the task terminates the program.
+ */
+inline void spawn(task<void> t)
+{
+    detail::run_detached( std::move(t) );
+}
+
+/**
+ * @brief spawn
+ * @param loop
+ * @param t
+ *
+ * Starts a task on the loop's thread. Can be called from any thread.
+ */
+inline void spawn(event_loop & loop, task<void> t)
+{
+    auto p = std::make_shared< task<void> >( std::move(t) );
+    loop.post( [p]()
+    {
+        spawn( std::move(*p) );
+    });
+}
+
+/**
+ * @brief The io_result struct
+ *
+ * The result of an async_recv/async_send. error is 0 on success,
+ * ETIMEDOUT if the timeout expired, or the errno of the failure. It
+ * converts to true if data was transferred without an error.
+ */
+struct io_result
+{
+    socket_base::msg_size_t bytes = 0;
+    int                     error = 0;
+
+    explicit operator bool() const
+    {
+        return error == 0 && bytes > 0;
+    }
+};
+
+/**
+ * @brief The socket_result struct
+ *
+ * The result of an async_accept/async_connect.
+ */
+struct socket_result
+{
+    tcp_socket socket;
+    int        error = 0;
+
+    explicit operator bool() const
+    {
+        return error == 0;
+    }
+};
+
+namespace detail
+{
+    // Shared by all the socket awaitables. Derived classes implement
+    // attempt( ) which makes the system call and returns true once the
+    // operation is finished (successfully or not). If it returns false,
+    // the coroutine is suspended until the socket is ready, or the
+    // timeout expires, in which case fail(ETIMEDOUT) is called.
+    template<typename Derived>
+    class socket_awaitable
+    {
+    public:
+        socket_awaitable(event_loop & loop, socket_base::socket_t fd, std::uint32_t events, std::chrono::milliseconds timeout)
+            : m_loop(&loop), m_fd(fd), m_events(events), m_timeout(timeout)
+        {
+        }
+
+        bool await_ready()
+        {
+            return self().attempt();
+        }
+
+        bool await_suspend(std::coroutine_handle<> h)
+        {
+            m_handle = h;
+
+            m_op = detail::start_async(*m_loop, m_fd, m_timeout, [this]()
+            {
+                self().fail(ETIMEDOUT);
+                m_handle.resume();
+            });
+
+            bool added = m_loop->add(m_fd, m_events, [this](std::uint32_t)
+            {
+                if( !self().attempt() )
+                    return;
+                if( m_op->finish() )
+                    m_handle.resume();
+            });
+
+            if( !added )
+            {
+                // don't use finish( ), fd may be registered by someone else
+                self().fail( socket_base::last_error() );
+                m_op->done = true;
+                if( m_op->timer )
+                    m_loop->cancel_timer(m_op->timer);
+            }
+            return added;
+        }
+
+    protected:
+        Derived & self()
+        {
+            return static_cast<Derived&>(*this);
+        }
+
+        event_loop *                             m_loop;
+        socket_base::socket_t                    m_fd;
+        std::uint32_t                            m_events;
+        std::chrono::milliseconds                m_timeout;
+        std::coroutine_handle<>                  m_handle;
+        std::shared_ptr<detail::async_operation> m_op;
+    };
+
+    class recv_awaitable : public socket_awaitable<recv_awaitable>
+    {
+    public:
+        recv_awaitable(event_loop & loop, tcp_socket & socket, void * data, std::size_t size, std::chrono::milliseconds timeout, bool all)
+            : socket_awaitable(loop, socket.native_handle(), event_loop::readable, timeout),
+              m_socket(&socket), m_data(static_cast<char*>(data)), m_size(size), m_all(all)
+        {
+        }
+
+        bool attempt()
+        {
+            while( m_done < m_size )
+            {
+                auto n = m_socket->try_recv(m_data + m_done, m_size - m_done);
+                if( n == 0 ) // closed
+                    break;
+                if( n < 0 )
+                {
+                    if( socket_base::would_block() && !(m_done > 0 && !m_all) )
+                        return false;
+                    if( !socket_base::would_block() )
+                        m_result.error = socket_base::last_error();
+                    break;
+                }
+                m_done += static_cast<std::size_t>(n);
+                if( !m_all )
+                    break;
+            }
+            m_result.bytes = socket_base::msg_size_t(m_done);
+            return true;
+        }
+
+        void fail(int error)
+        {
+            m_result.bytes = socket_base::msg_size_t(m_done);
+            m_result.error = error;
+        }
+
+        io_result await_resume()
+        {
+            return m_result;
+        }
+
+    protected:
+        tcp_socket * m_socket;
+        char *       m_data;
+        std::size_t  m_size;
+        std::size_t  m_done = 0;
+        bool         m_all;
+        io_result    m_result;
+    };
+
+    class send_awaitable : public socket_awaitable<send_awaitable>
+    {
+    public:
+        send_awaitable(event_loop & loop, tcp_socket & socket, void const * data, std::size_t size, std::chrono::milliseconds timeout)
+            : socket_awaitable(loop, socket.native_handle(), event_loop::writable, timeout),
+              m_socket(&socket), m_data(static_cast<char const*>(data)), m_size(size)
+        {
+        }
+
+        bool attempt()
+        {
+            while( m_done < m_size )
+            {
+                auto n = m_socket->try_send(m_data + m_done, m_size - m_done);
+                if( n < 0 )
+                {
+                    if( socket_base::would_block() )
+                        return false;
+                    m_result.error = socket_base::last_error();
+                    break;
+                }
+                m_done += static_cast<std::size_t>(n);
+            }
+            m_result.bytes = socket_base::msg_size_t(m_done);
+            return true;
+        }
+
+        void fail(int error)
+        {
+            m_result.bytes = socket_base::msg_size_t(m_done);
+            m_result.error = error;
+        }
+
+        io_result await_resume()
+        {
+            return m_result;
+        }
+
+    protected:
+        tcp_socket * m_socket;
+        char const * m_data;
+        std::size_t  m_size;
+        std::size_t  m_done = 0;
+        io_result    m_result;
+    };
+
+    class accept_awaitable : public socket_awaitable<accept_awaitable>
+    {
+    public:
+        accept_awaitable(event_loop & loop, tcp_socket & listener, std::chrono::milliseconds timeout)
+            : socket_awaitable(loop, listener.native_handle(), event_loop::readable, timeout),
+              m_listener(&listener)
+        {
+            listener.set_blocking(false);
+        }
+
+        bool attempt()
+        {
+            m_result.socket = m_listener->accept();
+            if( m_result.socket )
+                return true;
+            if( socket_base::would_block() )
+                return false;
+            m_result.error = socket_base::last_error();
+            return true;
+        }
+
+        void fail(int error)
+        {
+            m_result.error = error;
+        }
+
+        socket_result await_resume()
+        {
+            return std::move(m_result);
+        }
+
+    protected:
+        tcp_socket *  m_listener;
+        socket_result m_result;
+    };
+
+    class connect_awaitable : public socket_awaitable<connect_awaitable>
+    {
+    public:
+        connect_awaitable(event_loop & loop, socket_address const & addr, std::chrono::milliseconds timeout)
+            : socket_awaitable(loop, socket_base::invalid_socket, event_loop::writable, timeout)
+        {
+            tcp_socket & S = m_result.socket;
+            if( !S.create(addr.family()) || !S.set_blocking(false) )
+            {
+                m_result.error = socket_base::last_error();
+                return;
+            }
+            m_fd = S.native_handle();
+
+            if( ::connect(m_fd, addr.data(), addr.size()) == socket_base::socket_error )
+            {
+                if( socket_base::would_block() )
+                    m_started = true;
+                else
+                    m_result.error = socket_base::last_error();
+            }
+        }
+
+        bool attempt()
+        {
+            if( m_started )
+            {
+                if( m_waited )
+                    m_result.error = m_result.socket.pending_error();
+                else
+                {
+                    m_waited = true; // connect( ) returned EINPROGRESS
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        void fail(int error)
+        {
+            m_result.error = error;
+        }
+
+        socket_result await_resume()
+        {
+            if( m_result.error )
+                m_result.socket.close();
+            else
+                m_result.socket.set_blocking(true);
+            return std::move(m_result);
+        }
+
+    protected:
+        bool          m_started = false;
+        bool          m_waited  = false;
+        socket_result m_result;
+    };
+
+    class resolve_awaitable
+    {
+    public:
+        resolve_awaitable(event_loop & loop, std::string host, std::uint16_t port) : m_loop(&loop), m_host(std::move(host)), m_port(port)
+        {
+        }
+
+        bool await_ready()
+        {
+            return resolver::global().try_resolve(m_host, m_port, m_addresses);
+        }
+
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            event_loop * L = m_loop;
+            resolver::global().resolve_async(m_host, m_port, [this, L, h](resolver::addresses_t const & a)
+            {
+                // called from the resolver's thread, continue on the loop
+                L->post( [this, a, h]()
+                {
+                    m_addresses = a;
+                    h.resume();
+                });
+            });
+        }
+
+        resolver::addresses_t await_resume()
+        {
+            return std::move(m_addresses);
+        }
+
+    protected:
+        event_loop *          m_loop;
+        std::string           m_host;
+        std::uint16_t         m_port;
+        resolver::addresses_t m_addresses;
+    };
+
+    class sleep_awaitable
+    {
+    public:
+        sleep_awaitable(event_loop & loop, std::chrono::milliseconds delay) : m_loop(&loop), m_delay(delay)
+        {
+        }
+
+        bool await_ready() const
+        {
+            return m_delay.count() <= 0;
+        }
+
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            m_loop->add_timer(m_delay, [h]() { h.resume(); });
+        }
+
+        void await_resume() const
+        {
+        }
+
+    protected:
+        event_loop *              m_loop;
+        std::chrono::milliseconds m_delay;
+    };
+}
+
+/**
+ * @brief async_recv
+ * @param loop
+ * @param socket
+ * @param data - buffer to fill
+ * @param size - number of bytes to recieve
+ * @param timeout
+ * @return co_await gives an io_result. Fewer than size bytes with no
+ *         error means the peer closed the connection.
+ *
+ * Recieves exactly size bytes.
+ */
+inline detail::recv_awaitable async_recv(event_loop & loop, tcp_socket & socket, void * data, std::size_t size,
+                                         std::chrono::milliseconds timeout = std::chrono::milliseconds::max())
+{
+    return detail::recv_awaitable(loop, socket, data, size, timeout, true);
+}
+
+/**
+ * @brief async_recv_some
+ * @param loop
+ * @param socket
+ * @param data - buffer to fill
+ * @param size - size of the buffer
+ * @param timeout
+ * @return co_await gives an io_result, 0 bytes means the peer closed the
+ *         connection.
+ *
+ * Recieves whatever is available, at least one byte.
+ */
+inline detail::recv_awaitable async_recv_some(event_loop & loop, tcp_socket & socket, void * data, std::size_t size,
+                                              std::chrono::milliseconds timeout = std::chrono::milliseconds::max())
+{
+    return detail::recv_awaitable(loop, socket, data, size, timeout, false);
+}
+
+/**
+ * @brief async_send
+ * @param loop
+ * @param socket
+ * @param data
+ * @param size
+ * @param timeout
+ * @return co_await gives an io_result
+ *
+ * Sends all the data.
+ */
+inline detail::send_awaitable async_send(event_loop & loop, tcp_socket & socket, void const * data, std::size_t size,
+                                         std::chrono::milliseconds timeout = std::chrono::milliseconds::max())
+{
+    return detail::send_awaitable(loop, socket, data, size, timeout);
+}
+
+/**
+ * @brief async_accept
+ * @param loop
+ * @param listener - a listening socket, it is switched to non-blocking
+ * @param timeout
+ * @return co_await gives a socket_result with the new client
+ */
+inline detail::accept_awaitable async_accept(event_loop & loop, tcp_socket & listener,
+                                             std::chrono::milliseconds timeout = std::chrono::milliseconds::max())
+{
+    return detail::accept_awaitable(loop, listener, timeout);
+}
+
+/**
+ * @brief async_connect
+ * @param loop
+ * @param addr - address of the server
+ * @param timeout
+ * @return co_await gives a socket_result with the connected socket
+ */
+inline detail::connect_awaitable async_connect(event_loop & loop, socket_address const & addr,
+                                               std::chrono::milliseconds timeout = std::chrono::milliseconds::max())
+{
+    return detail::connect_awaitable(loop, addr, timeout);
+}
+
+/**
+ * @brief async_connect
+ * @param loop
+ * @param server - ip address or host name
+ * @param port
+ * @param timeout
+ * @return a task giving a socket_result with the connected socket
+ *
+ * Host names are looked up with resolver::global( ) without blocking the
+ * loop.
+ */
+inline task<socket_result> async_connect(event_loop & loop, std::string server, std::uint16_t port,
+                                         std::chrono::milliseconds timeout = std::chrono::milliseconds::max())
+{
+    resolver::addresses_t addresses = co_await detail::resolve_awaitable(loop, server, port);
+
+    socket_result r;
+    r.error = EHOSTUNREACH;
+    for(auto & a : addresses)
+    {
+        r = co_await detail::connect_awaitable(loop, a, timeout);
+        if( r )
+            break;
+    }
+    co_return r;
+}
+
+/**
+ * @brief async_sleep
+ * @param loop
+ * @param delay
+ * @return co_await resumes after the delay
+ */
+inline detail::sleep_awaitable async_sleep(event_loop & loop, std::chrono::milliseconds delay)
+{
+    return detail::sleep_awaitable(loop, delay);
+}
+
+}
+
+#if defined __GNUC__ && !defined __clang__
+    #pragma GCC diagnostic pop
+#endif
+
+#endif
+#endif
+
+#endif
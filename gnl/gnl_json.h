@@ -159,7 +159,7 @@ class json
             _jsons._float = f;
         }
 
-        json( const std::initializer_list<json> & l)
+        json( const std::initializer_list<json> & l) : _type(BOOL)
         {
            // std::cout << "Initializer list: Jjson" << std::endl;
             clear();
@@ -191,7 +191,7 @@ class json
             return *this;
         }
 
-        json(json && T)
+        json(json && T) : _type(BOOL)
         {
             //std::cout << "Move constructor\n";
             *this = std::move( T );
@@ -936,12 +936,14 @@ inline bool json::parseBool(std::istringstream & S)
         while( !(c == ',' || c == '}' || c==']' || std::isspace(c)) )
         {
             c = (char)S.get();
+            if( !S ) break;
         }
         return true;
     }
     while( !(c == ',' || c == '}' || c==']' || std::isspace(c)) )
     {
         c = (char)S.get();
+        if( !S ) break;
     }
     return false;
 
@@ -981,6 +983,13 @@ inline std::vector<json>  json::parseArray(std::istringstream &S)
 
     if( c == '[' )
     {
+        REMOVEWHITESPACE;
+        if( S.peek() == ']' ) // empty array
+        {
+            S.get();
+            return A;
+        }
+
         while( c != ']' )
         {
             REMOVEWHITESPACE;
@@ -995,6 +1004,7 @@ inline std::vector<json>  json::parseArray(std::istringstream &S)
             REMOVEWHITESPACE;
 
             c = (char)S.get();
+            if( S.eof() ) throw parse_error(); // truncated
             if(c != ',' && c!=']')
             {
            //     std::cout << "comma not found\n";
@@ -1054,6 +1064,7 @@ inline std::string json::parseString(std::istringstream & S)
             }
             Key += c;
             c = (char)S.get();
+            if( !S ) throw parse_error(); // unterminated string
         }
 
     }
@@ -1082,6 +1093,7 @@ inline std::string json::parseKey(std::istringstream & S)
         {
             Key += c;
             c = (char)S.get();
+            if( !S ) throw parse_error();
         }
 
     }
@@ -1094,6 +1106,7 @@ inline std::string json::parseKey(std::istringstream & S)
             Key += c;
             S.get();
             c    = (char)S.peek();
+            if( !S ) throw parse_error();
         }
 
     }
@@ -1112,6 +1125,14 @@ inline std::map<std::string, json> json::parseObject(std::istringstream &S)
 
     std::map<std::string, json> vMap;
     int count = 0;
+
+    REMOVEWHITESPACE;
+    if( S.peek() == '}' ) // empty object
+    {
+        S.get();
+        return vMap;
+    }
+
     while(c != '}')
     {
         std::string key = json::parseKey(S);
@@ -1133,6 +1154,7 @@ inline std::map<std::string, json> json::parseObject(std::istringstream &S)
         REMOVEWHITESPACE;
 
          c = (char)S.peek();
+         if( S.eof() ) throw parse_error(); // truncated
          if(c == ',' || c =='}' ) c = (char)S.get();
 
     }
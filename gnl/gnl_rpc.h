@@ -0,0 +1,809 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org>
+ */
+
+#ifndef GNL_RPC_H
+#define GNL_RPC_H
+
+#include <gnl/gnl_json.h>
+#include <gnl/gnl_socket.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+/**
+ * A small request/response RPC layer on top of framed_connection.
+ *
+ * Every request carries an id, and the client does not wait for the
+ * response before sending the next request. Any number of calls can be in
+ * flight on a single connection, and the server may answer them in any
+ * order, so a slow call does not hold up the ones behind it.
+ *
+ * Server:
+ *
+ *   gnl::rpc_server server;
+ *   server.bind("add", [](gnl::json const & params)
+ *   {
+ *       return gnl::json( params.get("a", 0.0f) + params.get("b", 0.0f) );
+ *   });
+ *
+ *   // in a thread per client
+ *   server.serve( listener.accept() );
+ *
+ * Client:
+ *
+ *   gnl::rpc_client client;
+ *   client.connect("localhost", 5000);
+ *
+ *   gnl::json params;
+ *   params["a"] = 1;
+ *   params["b"] = 2;
+ *
+ *   auto f1 = client.call("add", params);
+ *   auto f2 = client.call("add", params); // sent without waiting for f1
+ *   float x = f1.get();
+ *
+ * Payloads are either gnl::json, or opaque binary data for methods bound
+ * with bind_binary( ), which can be used for any other encoding.
+ *
+ * Each message is a single frame:
+ *
+ *   uint8  type        request, notification, response or error
+ *   uint8  encoding    json or binary
+ *   uint16 method size (requests and notifications only)
+ *   uint32 id          matches a response to its request
+ *   method name
+ *   payload            json text, binary data, or the error message
+ *
+ * all in network byte order.
+ */
+
+#ifndef GNL_NAMESPACE
+    #define GNL_NAMESPACE gnl
+#endif
+namespace GNL_NAMESPACE
+{
+
+/**
+ * @brief The rpc_error class
+ *
+ * Thrown by the futures returned from rpc_client when the remote method
+ * failed, the method does not exist, or the connection was lost.
+ */
+class rpc_error : public std::runtime_error
+{
+public:
+    explicit rpc_error(std::string const & what) : std::runtime_error(what)
+    {
+    }
+};
+
+enum class rpc_encoding : std::uint8_t
+{
+    json   = 0,
+    binary = 1
+};
+
+/**
+ * @brief The rpc_message struct
+ *
+ * A decoded rpc frame. data points into the frame which it was decoded
+ * from.
+ */
+struct rpc_message
+{
+    enum type_t : std::uint8_t
+    {
+        request      = 1,
+        notification = 2,
+        response     = 3,
+        error        = 4
+    };
+
+    static const std::size_t header_size = 8;
+
+    type_t        type     = request;
+    rpc_encoding  encoding = rpc_encoding::json;
+    std::uint32_t id       = 0;
+    std::string   method;
+    char const *  data     = nullptr;
+    std::size_t   size     = 0;
+
+    /**
+     * @brief decode
+     * @param frame
+     * @param msg
+     * @return false if the frame is not a valid rpc message
+     */
+    static bool decode(frame_view const & frame, rpc_message & msg)
+    {
+        if( frame.size < header_size )
+            return false;
+
+        auto const * p = reinterpret_cast<unsigned char const*>(frame.data);
+
+        if( p[0] < request || p[0] > error || p[1] > static_cast<std::uint8_t>(rpc_encoding::binary) )
+            return false;
+
+        std::uint16_t method_size;
+        std::uint32_t id;
+        memcpy(&method_size, p + 2, sizeof(method_size));
+        memcpy(&id,          p + 4, sizeof(id));
+        method_size = ntohs(method_size);
+
+        if( frame.size - header_size < method_size )
+            return false;
+
+        msg.type     = static_cast<type_t>(p[0]);
+        msg.encoding = static_cast<rpc_encoding>(p[1]);
+        msg.id       = ntohl(id);
+        msg.method.assign( frame.data + header_size, method_size );
+        msg.data     = frame.data + header_size + method_size;
+        msg.size     = frame.size - header_size - method_size;
+        return true;
+    }
+
+    /**
+     * @brief encode
+     * @return the frame for a message
+     */
+    static std::string encode(type_t type, rpc_encoding encoding, std::uint32_t id,
+                              std::string const & method, char const * data, std::size_t size)
+    {
+        std::string out(header_size, '\0');
+        out[0] = static_cast<char>(type);
+        out[1] = static_cast<char>(encoding);
+
+        std::uint16_t method_size = htons( static_cast<std::uint16_t>(method.size()) );
+        std::uint32_t nid         = htonl(id);
+        memcpy(&out[2], &method_size, sizeof(method_size));
+        memcpy(&out[4], &nid, sizeof(nid));
+
+        out.reserve(header_size + method.size() + size);
+        out += method;
+        out.append(data, size);
+        return out;
+    }
+};
+
+namespace detail
+{
+    inline void rpc_write_string(std::string & out, std::string const & s)
+    {
+        out += '"';
+        for(char c : s)
+        {
+            switch(c)
+            {
+                case '"' : out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n";  break;
+                case '\r': out += "\\r";  break;
+                case '\t': out += "\\t";  break;
+                case '\f': out += "\\f";  break;
+                default  : out += c;      break;
+            }
+        }
+        out += '"';
+    }
+
+    // Compact json writer. Unlike operator<< it escapes strings and
+    // writes numbers with enough digits to be read back exactly.
+    inline void rpc_write_json(std::string & out, json const & j)
+    {
+        switch( j._type )
+        {
+            case json::NUMBER:
+            {
+                char buf[32];
+                std::snprintf(buf, sizeof(buf), "%.9g", static_cast<double>(j._jsons._float) );
+                out += buf;
+                break;
+            }
+            case json::STRING:
+                rpc_write_string(out, *j._jsons._string);
+                break;
+            case json::ARRAY:
+            {
+                out += '[';
+                bool first = true;
+                for(auto & a : *j._jsons._array)
+                {
+                    if( !first )
+                        out += ',';
+                    first = false;
+                    rpc_write_json(out, a);
+                }
+                out += ']';
+                break;
+            }
+            case json::OBJECT:
+            {
+                out += '{';
+                bool first = true;
+                for(auto & a : *j._jsons._object)
+                {
+                    if( !first )
+                        out += ',';
+                    first = false;
+                    // the parser does not unescape keys
+                    out += '"';
+                    out += a.first;
+                    out += '"';
+                    out += ':';
+                    rpc_write_json(out, a.second);
+                }
+                out += '}';
+                break;
+            }
+            case json::BOOL:
+                out += j._jsons._bool ? "true" : "false";
+                break;
+            case json::UNKNOWN:
+            default:
+                out += "false";
+                break;
+        }
+    }
+
+    inline std::string rpc_to_text(json const & j)
+    {
+        std::string out;
+        rpc_write_json(out, j);
+        return out;
+    }
+
+    inline json rpc_from_text(char const * data, std::size_t size)
+    {
+        json j;
+        j.parse( std::string(data, size) );
+        return j;
+    }
+
+    // Wakes up a thread blocked reading the socket. This uses a copy of
+    // the descriptor, since the reading thread may be changing the socket.
+    inline void rpc_shutdown(socket_base::socket_t fd)
+    {
+    #if defined _MSC_VER
+        ::shutdown( fd, SD_BOTH );
+    #else
+        ::shutdown( fd, SHUT_RDWR );
+    #endif
+    }
+}
+
+
+/**
+ * @brief The rpc_server class
+ *
+ * Holds the table of methods, and answers the requests recieved over
+ * a connection.
+ *
+ * By default each request is handled on the thread calling serve( ),
+ * in the order they arrive. Responses to requests which arrived together
+ * are sent together. If an executor is given (eg: one which pushes onto a
+ * thread_pool), requests are handled concurrently and each response is
+ * sent as soon as it is ready.
+ */
+class rpc_server
+{
+public:
+    using json_handler   = std::function<json(json const & params)>;
+    using binary_handler = std::function<std::string(char const * data, std::size_t size)>;
+    using executor_t     = std::function<void(std::function<void()>)>;
+
+    /**
+     * @brief bind
+     * @param method - name of the method
+     * @param handler - called with the parameters, returns the result.
+     *                  If it throws, the caller gets an rpc_error with
+     *                  the exception's message.
+     *
+     * Adds a method which takes and returns json. Methods should be bound
+     * before serve( ) is called.
+     */
+    void bind(std::string const & method, json_handler handler)
+    {
+        m_methods[method] = [handler](rpc_message const & m, rpc_encoding & encoding) -> std::string
+        {
+            if( m.encoding != rpc_encoding::json )
+                throw rpc_error("method expects json");
+
+            encoding = rpc_encoding::json;
+            return detail::rpc_to_text( handler( detail::rpc_from_text(m.data, m.size) ) );
+        };
+    }
+
+    /**
+     * @brief bind_binary
+     * @param method - name of the method
+     * @param handler - called with the raw payload, returns the raw result
+     *
+     * Adds a method which takes and returns binary data.
+     */
+    void bind_binary(std::string const & method, binary_handler handler)
+    {
+        m_methods[method] = [handler](rpc_message const & m, rpc_encoding & encoding) -> std::string
+        {
+            encoding = rpc_encoding::binary;
+            return handler(m.data, m.size);
+        };
+    }
+
+    /**
+     * @brief has
+     * @param method
+     * @return true if the method has been bound
+     */
+    bool has(std::string const & method) const
+    {
+        return m_methods.count(method) != 0;
+    }
+
+    /**
+     * @brief dispatch
+     * @param request - a decoded request or notification
+     * @return the encoded response frame, or an empty string for
+     *         notifications
+     *
+     * Calls the method for a request.
+     */
+    std::string dispatch(rpc_message const & request) const
+    {
+        rpc_encoding        encoding = rpc_encoding::binary;
+        rpc_message::type_t type     = rpc_message::response;
+        std::string         result;
+
+        try
+        {
+            auto it = m_methods.find(request.method);
+            if( it == m_methods.end() )
+                throw rpc_error("unknown method: " + request.method);
+
+            result = it->second(request, encoding);
+        }
+        catch(std::exception & e)
+        {
+            type     = rpc_message::error;
+            encoding = rpc_encoding::binary;
+            result   = e.what();
+        }
+
+        if( request.type == rpc_message::notification )
+            return std::string();
+
+        return rpc_message::encode(type, encoding, request.id, std::string(), result.data(), result.size());
+    }
+
+    /**
+     * @brief serve
+     * @param client - a connected socket
+     * @param executor - runs a handler, or nullptr to run them inline
+     *
+     * Answers requests until the client disconnects or sends a malformed
+     * message. Blocks until all the requests have been answered.
+     */
+    void serve(tcp_socket && client, executor_t executor = nullptr)
+    {
+        client.set_option( socket_options::tcp_nodelay(true) );
+        framed_connection F( std::move(client) );
+
+        struct shared_state
+        {
+            std::mutex              mutex;
+            std::condition_variable cv;
+            std::size_t             running = 0;
+        } state;
+
+        frame_view  frame;
+        rpc_message msg;
+        for(;;)
+        {
+            // answer everything that is already buffered before writing
+            if( !F.try_recv(frame) )
+            {
+                {
+                    std::lock_guard<std::mutex> L(state.mutex);
+                    F.flush();
+                }
+                if( !F.recv(frame) )
+                    break;
+            }
+
+            if( !rpc_message::decode(frame, msg) ||
+                (msg.type != rpc_message::request && msg.type != rpc_message::notification) )
+                break;
+
+            if( !executor )
+            {
+                std::string response = dispatch(msg);
+                if( !response.empty() )
+                    F.queue(response.data(), response.size());
+                continue;
+            }
+
+            // the frame is only valid until the next recv, so copy it
+            auto request = std::make_shared<std::string>(frame.data, frame.size);
+            {
+                std::lock_guard<std::mutex> L(state.mutex);
+                ++state.running;
+            }
+
+            executor( [this, request, &F, &state]()
+            {
+                frame_view f;
+                f.data = request->data();
+                f.size = request->size();
+
+                rpc_message m;
+                rpc_message::decode(f, m);
+                std::string response = dispatch(m);
+
+                std::lock_guard<std::mutex> L(state.mutex);
+                if( !response.empty() )
+                    F.send(response.data(), response.size());
+                if( --state.running == 0 )
+                    state.cv.notify_all();
+            });
+        }
+
+        // the handlers may still be sending, so the socket is only closed
+        // once the last one has finished
+        std::unique_lock<std::mutex> L(state.mutex);
+        state.cv.wait(L, [&state]{ return state.running == 0; });
+        F.close();
+    }
+
+protected:
+    using method_t = std::function<std::string(rpc_message const &, rpc_encoding &)>;
+
+    std::unordered_map<std::string, method_t> m_methods;
+};
+
+
+/**
+ * @brief The rpc_client class
+ *
+ * Calls methods on an rpc_server. Calls can be made from any thread, they
+ * are written to the connection immediately, and the responses are
+ * recieved on a background thread.
+ */
+class rpc_client
+{
+public:
+    using json_callback   = std::function<void(json const & result, std::string const & error)>;
+    using binary_callback = std::function<void(std::string const & result, std::string const & error)>;
+
+    rpc_client()
+    {
+    }
+
+    /**
+     * @brief rpc_client
+     * @param socket - a connected socket
+     */
+    explicit rpc_client(tcp_socket && socket)
+    {
+        start( std::move(socket) );
+    }
+
+    rpc_client(rpc_client const &) = delete;
+    rpc_client & operator=(rpc_client const &) = delete;
+
+    ~rpc_client()
+    {
+        close();
+    }
+
+    /**
+     * @brief connect
+     * @param host
+     * @param port
+     * @return false if the connection could not be made
+     */
+    bool connect(char const * host, std::uint16_t port)
+    {
+        close();
+
+        tcp_socket S;
+        if( !S.connect(host, port) )
+            return false;
+
+        start( std::move(S) );
+        return true;
+    }
+
+    /**
+     * @brief connected
+     * @return true until the connection is closed or lost
+     */
+    bool connected() const
+    {
+        return m_connected;
+    }
+
+    /**
+     * @brief close
+     *
+     * Closes the connection. Calls which are still waiting for a response
+     * fail with an rpc_error.
+     */
+    void close()
+    {
+        if( !m_connection )
+            return;
+
+        detail::rpc_shutdown(m_fd);
+        m_reader.join();
+
+        std::lock_guard<std::mutex> L(m_write_mutex);
+        m_connection->close();
+        m_connection.reset();
+    }
+
+    /**
+     * @brief call
+     * @param method
+     * @param params
+     * @param callback - called with the result, or a non-empty error. It is
+     *                   called from the client's background thread, so it
+     *                   should not block.
+     */
+    void call(std::string const & method, json const & params, json_callback callback)
+    {
+        std::string text = detail::rpc_to_text(params);
+        send_request(method, rpc_encoding::json, text.data(), text.size(),
+                     [callback](rpc_message const * m, std::string const & error)
+        {
+            if( !m )
+            {
+                callback( json(), error );
+                return;
+            }
+
+            json result;
+            try
+            {
+                result = detail::rpc_from_text(m->data, m->size);
+            }
+            catch(std::exception & e)
+            {
+                callback( json(), e.what() );
+                return;
+            }
+            callback( result, std::string() );
+        });
+    }
+
+    /**
+     * @brief call
+     * @param method
+     * @param params
+     * @return a future holding the result. get( ) throws an rpc_error if
+     *         the call failed.
+     */
+    std::future<json> call(std::string const & method, json const & params)
+    {
+        auto p = std::make_shared< std::promise<json> >();
+        auto f = p->get_future();
+
+        call(method, params, [p](json const & result, std::string const & error)
+        {
+            if( error.empty() )
+                p->set_value(result);
+            else
+                p->set_exception( std::make_exception_ptr( rpc_error(error) ) );
+        });
+        return f;
+    }
+
+    /**
+     * @brief call_binary
+     * @param method
+     * @param data
+     * @param size
+     * @param callback - called with the result, or a non-empty error
+     */
+    void call_binary(std::string const & method, void const * data, std::size_t size, binary_callback callback)
+    {
+        send_request(method, rpc_encoding::binary, static_cast<char const*>(data), size,
+                     [callback](rpc_message const * m, std::string const & error)
+        {
+            if( m )
+                callback( std::string(m->data, m->size), std::string() );
+            else
+                callback( std::string(), error );
+        });
+    }
+
+    /**
+     * @brief call_binary
+     * @param method
+     * @param data
+     * @param size
+     * @return a future holding the raw result
+     */
+    std::future<std::string> call_binary(std::string const & method, void const * data, std::size_t size)
+    {
+        auto p = std::make_shared< std::promise<std::string> >();
+        auto f = p->get_future();
+
+        call_binary(method, data, size, [p](std::string const & result, std::string const & error)
+        {
+            if( error.empty() )
+                p->set_value(result);
+            else
+                p->set_exception( std::make_exception_ptr( rpc_error(error) ) );
+        });
+        return f;
+    }
+
+    std::future<std::string> call_binary(std::string const & method, std::string const & data)
+    {
+        return call_binary(method, data.data(), data.size());
+    }
+
+    /**
+     * @brief notify
+     * @param method
+     * @param params
+     * @return false if the connection is closed
+     *
+     * Calls a method without waiting for, or recieving, a response.
+     */
+    bool notify(std::string const & method, json const & params)
+    {
+        std::string text  = detail::rpc_to_text(params);
+        std::string frame = rpc_message::encode(rpc_message::notification, rpc_encoding::json, 0, method, text.data(), text.size());
+
+        std::lock_guard<std::mutex> L(m_write_mutex);
+        return m_connection && m_connected && m_connection->send(frame.data(), frame.size());
+    }
+
+    /**
+     * @brief pending
+     * @return the number of calls waiting for a response
+     */
+    std::size_t pending() const
+    {
+        std::lock_guard<std::mutex> L(m_mutex);
+        return m_pending.size();
+    }
+
+protected:
+    // called with the response, or nullptr and the error message
+    using handler_t = std::function<void(rpc_message const *, std::string const &)>;
+
+    void start(tcp_socket && socket)
+    {
+        socket.set_option( socket_options::tcp_nodelay(true) );
+        m_fd = socket.native_handle();
+
+        // framed_connection::recv( ) leaves the socket alone, so the reader
+        // and the writers (under m_write_mutex) can use it at the same time
+        m_connection.reset( new framed_connection( std::move(socket) ) );
+        m_connected = true;
+        m_reader    = std::thread( [this]{ read_responses(); } );
+    }
+
+    void send_request(std::string const & method, rpc_encoding encoding, char const * data, std::size_t size, handler_t handler)
+    {
+        if( method.size() > 0xFFFF )
+        {
+            handler(nullptr, "method name too long");
+            return;
+        }
+
+        std::uint32_t id    = m_next_id.fetch_add(1, std::memory_order_relaxed);
+        std::string   frame = rpc_message::encode(rpc_message::request, encoding, id, method, data, size);
+
+        {
+            std::unique_lock<std::mutex> L(m_mutex);
+            if( !m_connected )
+            {
+                // the handler may call back into the client
+                L.unlock();
+                handler(nullptr, "not connected");
+                return;
+            }
+            m_pending[id] = std::move(handler);
+        }
+
+        std::lock_guard<std::mutex> L(m_write_mutex);
+        if( m_connection && !m_connection->send(frame.data(), frame.size()) )
+        {
+            // the reader sees the broken connection and fails the call
+            detail::rpc_shutdown(m_fd);
+        }
+    }
+
+    void read_responses()
+    {
+        frame_view  frame;
+        rpc_message msg;
+        std::string error = "connection closed";
+        while( m_connection->recv(frame) )
+        {
+            if( !rpc_message::decode(frame, msg) )
+            {
+                error = "malformed response";
+                break;
+            }
+
+            handler_t h;
+            {
+                std::lock_guard<std::mutex> L(m_mutex);
+                auto it = m_pending.find(msg.id);
+                if( it == m_pending.end() )
+                    continue;
+                h = std::move(it->second);
+                m_pending.erase(it);
+            }
+
+            if( msg.type == rpc_message::error )
+                h(nullptr, std::string(msg.data, msg.size));
+            else
+                h(&msg, std::string());
+        }
+
+        // recv( ) also stops on a response over the frame size limit, and
+        // leaves the socket open. Shut it down so the writers fail and the
+        // server sees the connection end.
+        detail::rpc_shutdown(m_fd);
+
+        std::map<std::uint32_t, handler_t> failed;
+        {
+            std::lock_guard<std::mutex> L(m_mutex);
+            m_connected = false;
+            failed.swap(m_pending);
+        }
+
+        for(auto & f : failed)
+            f.second(nullptr, error);
+    }
+
+    std::unique_ptr<framed_connection>  m_connection;
+    socket_base::socket_t               m_fd = socket_base::invalid_socket;
+    std::thread                         m_reader;
+    std::atomic<bool>                   m_connected{false};
+    std::atomic<std::uint32_t>          m_next_id{1};
+    mutable std::mutex                  m_mutex;        // guards m_pending
+    std::mutex                          m_write_mutex;  // guards writing to m_connection
+    std::map<std::uint32_t, handler_t>  m_pending;
+};
+
+}
+
+#endif
@@ -0,0 +1,614 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org>
+ */
+
+#ifndef GNL_SHM_CHANNEL_H
+#define GNL_SHM_CHANNEL_H
+
+#include <gnl/gnl_socket.h>
+
+#if defined __linux__ && defined SYS_memfd_create
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <new>
+#include <sys/stat.h>
+#include <linux/futex.h>
+
+#ifndef GNL_NAMESPACE
+    #define GNL_NAMESPACE gnl
+#endif
+namespace GNL_NAMESPACE
+{
+
+/**
+ * @brief The shm_channel class
+ *
+ * A one directional message channel between two processes (or threads)
+ * on the same host, backed by a ring buffer in shared memory.
+ *
+ * Sending a message through a domain_stream_socket copies it into the
+ * kernel and back out again and costs a system call on each side. A
+ * shm_channel copies the message straight into memory the reader can see
+ * and only makes a system call (a futex wake) when the other side is
+ * asleep.
+ *
+ * The shared memory is a memfd. The side which creates the channel passes
+ * it over a domain_stream_socket, after that the socket is not needed:
+ *
+ *     // process A                          // process B
+ *     gnl::shm_channel c;                   gnl::shm_channel c;
+ *     c.create(peer, 1<<20);                c.open(peer);
+ *     c.send(data, size);                   c.recv(buf, sizeof(buf));
+ *
+ * Use two channels for a request/response protocol.
+ *
+ * The reader side must be a single thread. The writer side may be used by
+ * several threads/processes at once if the channel was created with
+ * multi_producer = true, otherwise it must also be a single thread.
+ */
+class shm_channel
+{
+public:
+    using msg_size_t = socket_base::msg_size_t;
+
+    static const msg_size_t error = -1;
+
+    shm_channel()
+    {
+    }
+
+    ~shm_channel()
+    {
+        release();
+    }
+
+    shm_channel(shm_channel const & other) = delete;
+    shm_channel & operator=(shm_channel const & other) = delete;
+
+    shm_channel(shm_channel && other) : m_fd(other.m_fd), m_base(other.m_base), m_control(other.m_control), m_data(other.m_data), m_capacity(other.m_capacity), m_broken(other.m_broken)
+    {
+        other.m_fd      = -1;
+        other.m_base    = nullptr;
+        other.m_control = nullptr;
+        other.m_data    = nullptr;
+        other.m_capacity= 0;
+        other.m_broken  = false;
+    }
+
+    shm_channel & operator=(shm_channel && other)
+    {
+        if( this != &other )
+        {
+            release();
+            std::swap(m_fd,       other.m_fd);
+            std::swap(m_base,     other.m_base);
+            std::swap(m_control,  other.m_control);
+            std::swap(m_data,     other.m_data);
+            std::swap(m_capacity, other.m_capacity);
+            std::swap(m_broken,   other.m_broken);
+        }
+        return *this;
+    }
+
+    /**
+     * @brief operator bool
+     *
+     * Converts to true if the shared memory is mapped.
+     */
+    operator bool() const
+    {
+        return m_control != nullptr;
+    }
+
+    /**
+     * @brief create
+     * @param capacity - size of the ring in bytes. Rounded up to a power of
+     *                   two which is at least one page.
+     * @param multi_producer - allow more than one thread to send at once.
+     * @return
+     *
+     * Creates a new channel. Use native_handle( ) to share it with another
+     * process, or one of the overloads below which does that through a
+     * domain socket.
+     */
+    bool create(std::size_t capacity = 1u<<20, bool multi_producer = false)
+    {
+        release();
+
+        std::size_t page = page_size();
+        std::size_t c    = page;
+        while( c < capacity )
+            c *= 2;
+
+        int fd = static_cast<int>( ::syscall(SYS_memfd_create, "gnl_shm_channel", 1u /*MFD_CLOEXEC*/) );
+        if( fd == -1 )
+            return false;
+
+        if( ::ftruncate(fd, static_cast<off_t>(control_size() + c)) == -1 || !map(fd, c) )
+        {
+            ::close(fd);
+            return false;
+        }
+
+        new (m_control) control();
+        m_control->capacity       = c;
+        m_control->multi_producer = multi_producer ? 1u : 0u;
+        m_control->magic          = magic_number;
+        return true;
+    }
+
+    /**
+     * @brief create
+     * @param peer - a connected domain socket to the process which will
+     *               open( ) the other end
+     * @param capacity
+     * @param multi_producer
+     * @return
+     *
+     * Creates a new channel and sends it to the peer.
+     */
+    template<int Type>
+    bool create(basic_domain_socket<Type> & peer, std::size_t capacity = 1u<<20, bool multi_producer = false)
+    {
+        if( !create(capacity, multi_producer) )
+            return false;
+
+        if( peer.send_fds("c", 1, &m_fd, 1) != 1 )
+        {
+            release();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief open
+     * @param fd - a file descriptor of a channel created by create( ). The
+     *             channel takes ownership of it.
+     * @return
+     */
+    bool open(int fd)
+    {
+        release();
+
+        struct stat st;
+        if( ::fstat(fd, &st) == -1 || static_cast<std::size_t>(st.st_size) <= control_size() )
+        {
+            ::close(fd);
+            return false;
+        }
+
+        std::size_t c = static_cast<std::size_t>(st.st_size) - control_size();
+        if( (c & (c-1)) != 0 || !map(fd, c) ) // the ring is always a power of two
+        {
+            ::close(fd);
+            return false;
+        }
+        if( m_control->magic != magic_number || m_control->capacity != c )
+        {
+            release();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief open
+     * @param peer - a connected domain socket to the process which called
+     *               create( )
+     * @return
+     *
+     * Waits for the peer to send the channel and maps it.
+     */
+    template<int Type>
+    bool open(basic_domain_socket<Type> & peer)
+    {
+        char        c;
+        int         fd    = -1;
+        std::size_t count = 0;
+
+        msg_size_t ret = peer.recv_fds(&c, 1, &fd, 1, count);
+        if( count != 1 )
+            return false;
+        if( ret != 1 )
+        {
+            ::close(fd);
+            return false;
+        }
+
+        return open(fd);
+    }
+
+    /**
+     * @brief native_handle
+     * @return the memfd which holds the channel
+     */
+    int native_handle() const
+    {
+        return m_fd;
+    }
+
+    /**
+     * @brief capacity
+     * @return size of the ring in bytes
+     */
+    std::size_t capacity() const
+    {
+        return m_capacity;
+    }
+
+    /**
+     * @brief max_message_size
+     * @return the largest message which can be sent
+     */
+    std::size_t max_message_size() const
+    {
+        return m_capacity / 2 - header_size;
+    }
+
+    /**
+     * @brief try_send
+     * @param data
+     * @param size
+     * @return the number of bytes sent, 0 if there is not enough space in
+     *         the ring right now, or shm_channel::error if the channel
+     *         was closed or is not open, or the message is empty or larger
+     *         than max_message_size( )
+     */
+    msg_size_t try_send(void const * data, std::size_t size)
+    {
+        if( !m_control || closed() || size == 0 || size > max_message_size() )
+            return error;
+
+        lock_producers();
+        msg_size_t ret = write_record(data, size);
+        unlock_producers();
+
+        if( ret > 0 )
+            wake(m_control->consumer_waiting, m_control->data_seq);
+        return ret;
+    }
+
+    /**
+     * @brief send
+     * @param data
+     * @param size
+     * @return the number of bytes sent or shm_channel::error
+     *
+     * Sends one message, blocking while the ring is full.
+     */
+    msg_size_t send(void const * data, std::size_t size)
+    {
+        if( !m_control )
+            return error;
+
+        for(;;)
+        {
+            for(int i=0; i < spin_count; i++)
+            {
+                msg_size_t ret = try_send(data, size);
+                if( ret != 0 )
+                    return ret;
+            }
+
+            std::uint32_t seq = m_control->space_seq.load();
+            m_control->producers_waiting.fetch_add(1);
+
+            msg_size_t ret = try_send(data, size);
+            if( ret == 0 )
+                futex_wait(m_control->space_seq, seq);
+
+            m_control->producers_waiting.fetch_sub(1);
+            if( ret != 0 )
+                return ret;
+        }
+    }
+
+    /**
+     * @brief try_recv
+     * @param data
+     * @param size
+     * @return the size of the message, 0 if there is no message right now,
+     *         or shm_channel::error if the channel was closed and is empty,
+     *         is not open, or the ring holds something which is not a
+     *         valid message.
+     *
+     * Recieves one message. If the buffer is smaller than the message, the
+     * rest of the message is discarded.
+     */
+    msg_size_t try_recv(void * data, std::size_t size)
+    {
+        if( !m_control || m_broken )
+            return error;
+
+        std::uint64_t head = m_control->head.load(std::memory_order_relaxed);
+        std::uint64_t tail = m_control->tail.load(std::memory_order_acquire);
+
+        if( head == tail )
+            return closed() ? error : 0;
+
+        // the positions and lengths are written by the other process, so
+        // they are checked before anything is copied
+        if( tail - head > m_capacity )
+            return set_broken();
+
+        char const * p = m_data + (head & (m_capacity-1));
+
+        std::uint32_t length;
+        std::memcpy(&length, p, sizeof(length));
+        if( length == 0 || length > max_message_size() || record_size(length) > tail - head )
+            return set_broken();
+
+        std::memcpy(data, p + header_size, std::min<std::size_t>(length, size) );
+
+        m_control->head.store( head + record_size(length), std::memory_order_release );
+        wake(m_control->producers_waiting, m_control->space_seq);
+
+        return static_cast<msg_size_t>(length);
+    }
+
+    /**
+     * @brief recv
+     * @param data
+     * @param size
+     * @return the size of the message, 0 if the channel was closed and
+     *         all messages have been read, or shm_channel::error if it is
+     *         not open or is broken.
+     *
+     * Recieves one message, blocking until one is available.
+     */
+    msg_size_t recv(void * data, std::size_t size)
+    {
+        if( !m_control || m_broken )
+            return error;
+
+        for(;;)
+        {
+            for(int i=0; i < spin_count; i++)
+            {
+                msg_size_t ret = try_recv(data, size);
+                if( ret == error )
+                    return m_broken ? error : 0;
+                if( ret != 0 )
+                    return ret;
+            }
+
+            std::uint32_t seq = m_control->data_seq.load();
+            m_control->consumer_waiting.store(1);
+
+            msg_size_t ret = try_recv(data, size);
+            if( ret == 0 )
+                futex_wait(m_control->data_seq, seq);
+
+            m_control->consumer_waiting.store(0);
+            if( ret == error )
+                return m_broken ? error : 0;
+            if( ret != 0 )
+                return ret;
+        }
+    }
+
+    /**
+     * @brief close
+     *
+     * Marks the channel as closed for both sides and unmaps it. The reader
+     * can still recieve the messages which were sent before.
+     */
+    void close()
+    {
+        if( m_control )
+        {
+            m_control->closed.store(1);
+            m_control->data_seq.fetch_add(1);
+            m_control->space_seq.fetch_add(1);
+            futex_wake(m_control->data_seq);
+            futex_wake(m_control->space_seq);
+        }
+        release();
+    }
+
+    /**
+     * @brief closed
+     * @return true if either side has closed the channel, or the reader
+     *         found it broken. False if the channel is not open.
+     */
+    bool closed() const
+    {
+        if( !m_control )
+            return false;
+        return m_broken || m_control->closed.load(std::memory_order_relaxed) != 0;
+    }
+
+protected:
+
+    // Lives at the start of the shared memory. The reader and writer
+    // positions are on separate cache lines so the two sides do not keep
+    // stealing the line from each other.
+    struct control
+    {
+        std::uint32_t magic          = 0;
+        std::uint32_t multi_producer = 0;
+        std::uint64_t capacity       = 0;
+
+        alignas(64) std::atomic<std::uint64_t> head{0};     // read position, only the reader writes it
+        std::atomic<std::uint32_t> consumer_waiting{0};
+        std::atomic<std::uint32_t> data_seq{0};             // futex the reader sleeps on
+
+        alignas(64) std::atomic<std::uint64_t> tail{0};     // write position
+        std::atomic<std::uint32_t> producer_lock{0};
+        std::atomic<std::uint32_t> producers_waiting{0};
+        std::atomic<std::uint32_t> space_seq{0};            // futex the writers sleep on
+        std::atomic<std::uint32_t> closed{0};
+    };
+
+    static const std::uint32_t magic_number = 0x676e6c63; // "gnlc"
+    static const std::size_t   header_size  = 8;
+    static const int           spin_count   = 64;
+
+    static std::size_t page_size()
+    {
+        return static_cast<std::size_t>( ::sysconf(_SC_PAGESIZE) );
+    }
+
+    static std::size_t control_size()
+    {
+        std::size_t page = page_size();
+        return (sizeof(control) + page - 1) / page * page;
+    }
+
+    // a record is an 8 byte header holding the length, followed by the
+    // message padded to 8 bytes
+    static std::uint64_t record_size(std::size_t length)
+    {
+        return header_size + ((length + 7) & ~std::uint64_t(7));
+    }
+
+    // the ring does not hold valid records, so it cannot be read any more.
+    // The writers are told it is closed.
+    msg_size_t set_broken()
+    {
+        m_broken = true;
+        m_control->closed.store(1);
+        m_control->space_seq.fetch_add(1);
+        futex_wake(m_control->space_seq);
+        return error;
+    }
+
+    msg_size_t write_record(void const * data, std::size_t size)
+    {
+        std::uint64_t tail = m_control->tail.load(std::memory_order_relaxed);
+        std::uint64_t head = m_control->head.load(std::memory_order_acquire);
+
+        if( m_capacity - (tail - head) < record_size(size) )
+            return 0;
+
+        // the ring is mapped twice back to back, so a record which runs
+        // past the end simply continues in the second mapping
+        char * p = m_data + (tail & (m_capacity-1));
+
+        std::uint32_t length = static_cast<std::uint32_t>(size);
+        std::memcpy(p, &length, sizeof(length));
+        std::memcpy(p + header_size, data, size);
+
+        m_control->tail.store( tail + record_size(size), std::memory_order_release );
+        return static_cast<msg_size_t>(size);
+    }
+
+    void lock_producers()
+    {
+        if( !m_control->multi_producer )
+            return;
+        while( m_control->producer_lock.exchange(1, std::memory_order_acquire) )
+            std::this_thread::yield();
+    }
+
+    void unlock_producers()
+    {
+        if( m_control->multi_producer )
+            m_control->producer_lock.store(0, std::memory_order_release);
+    }
+
+    // The sleeping side sets its waiting flag and then checks the ring
+    // again, the other side updates the ring and then checks the flag.
+    // Both are sequentially consistent, so at least one of them sees the
+    // other and a wake up is never lost.
+    static void wake(std::atomic<std::uint32_t> & waiting, std::atomic<std::uint32_t> & seq)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if( waiting.load() )
+        {
+            seq.fetch_add(1);
+            futex_wake(seq);
+        }
+    }
+
+    static void futex_wait(std::atomic<std::uint32_t> & word, std::uint32_t value)
+    {
+        ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT, value, nullptr, nullptr, 0);
+    }
+
+    static void futex_wake(std::atomic<std::uint32_t> & word)
+    {
+        ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+    }
+
+    // maps the control block followed by the ring, and the ring a second
+    // time right after it
+    bool map(int fd, std::size_t capacity)
+    {
+        std::size_t c = control_size();
+
+        void * base = ::mmap(nullptr, c + 2*capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if( base == MAP_FAILED )
+            return false;
+
+        char * b = static_cast<char*>(base);
+        if( ::mmap(b,                c + capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+            ::mmap(b + c + capacity, capacity,     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, static_cast<off_t>(c)) == MAP_FAILED )
+        {
+            ::munmap(base, c + 2*capacity);
+            return false;
+        }
+
+        m_fd       = fd;
+        m_base     = b;
+        m_control  = reinterpret_cast<control*>(b);
+        m_data     = b + c;
+        m_capacity = capacity;
+        return true;
+    }
+
+    void release()
+    {
+        if( m_base )
+            ::munmap(m_base, control_size() + 2*m_capacity);
+        if( m_fd != -1 )
+            ::close(m_fd);
+
+        m_fd       = -1;
+        m_base     = nullptr;
+        m_control  = nullptr;
+        m_data     = nullptr;
+        m_capacity = 0;
+        m_broken   = false;
+    }
+
+    int          m_fd       = -1;
+    char       * m_base     = nullptr;
+    control    * m_control  = nullptr;
+    char       * m_data     = nullptr;
+    std::size_t  m_capacity = 0;
+    bool         m_broken   = false; // the reader found an invalid record
+};
+
+}
+
+#endif
+
+#endif
@@ -35,15 +35,34 @@
 
 
 #include <cstdio>
+#include <cstring>
 #include <fcntl.h>
 #include <ctype.h>
 #include <errno.h>
 #include <cstdint>
+#include <vector>
+#include <initializer_list>
+#include <utility>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <unordered_map>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <queue>
+#include <system_error>
 
 
 #if defined _MSC_VER
 
     #include <winsock2.h>
+    #include <ws2tcpip.h>
     #pragma comment(lib,"wsock32.lib")
 
 #else
@@ -52,7 +71,25 @@
     #include <arpa/inet.h>
     #include <sys/select.h>
     #include <sys/socket.h>
+    #include <sys/uio.h>
     #include <sys/un.h>
+    #include <sys/stat.h>
+    #include <poll.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <netdb.h>
+#endif
+
+#if defined __linux__
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <sys/epoll.h>
+    #include <sys/eventfd.h>
+    #include <sys/sendfile.h>
+    #include <linux/errqueue.h>
+    #if defined SO_ZEROCOPY && defined MSG_ZEROCOPY
+        #define GNL_SOCKET_HAS_ZEROCOPY
+    #endif
 #endif
 
 
@@ -128,50 +165,185 @@ enum class SocketError
  * connected socket. It is used by the udp_socket to indicate which
  * client has sent a packet and to indicate which client to send a message
  * to.
+ *
+ * It can hold an IPv4, IPv6 or unix domain address. The address is stored
+ * inline in a sockaddr_storage, so it never allocates.
  */
 class socket_address
 {
-protected:
-
+public:
 #if defined _MSC_VER
-    using address_t = struct ::sockaddr_in;
+    using length_t  = int;
 #else
-    using address_t = struct sockaddr_in;
+    using length_t  = socklen_t;
 #endif
+    using address_t = struct sockaddr_storage;
 
-public:
     socket_address()
     {
-        memset( reinterpret_cast<char*>(&m_address), 0, sizeof(m_address));
+        clear();
     }
 
-    socket_address(uint16_t _port)
+    /**
+     * @brief socket_address
+     * @param _port
+     * @param family - AF_INET or AF_INET6
+     *
+     * The wildcard address (listen on all interfaces) with the given port.
+     * An AF_INET6 wildcard also accepts IPv4 connections unless the
+     * socket was made IPv6 only.
+     */
+    socket_address(uint16_t _port, int family = AF_INET)
     {
-        memset( reinterpret_cast<char *>(&m_address), 0, sizeof(m_address));
-        m_address.sin_family = AF_INET;
-        m_address.sin_port = htons(_port);
-        m_address.sin_addr.s_addr = INADDR_ANY;
+        clear();
+        if( family == AF_INET6 )
+        {
+            struct sockaddr_in6 & a = as<struct sockaddr_in6>();
+            a.sin6_family = AF_INET6;
+            a.sin6_port   = htons(_port);
+            a.sin6_addr   = in6addr_any;
+            m_size        = sizeof(struct sockaddr_in6);
+        }
+        else
+        {
+            struct sockaddr_in & a = as<struct sockaddr_in>();
+            a.sin_family      = AF_INET;
+            a.sin_port        = htons(_port);
+            a.sin_addr.s_addr = INADDR_ANY;
+            m_size            = sizeof(struct sockaddr_in);
+        }
     }
 
+    /**
+     * @brief socket_address
+     * @param ip_address - a numeric IPv4 ("127.0.0.1") or IPv6 ("::1")
+     *                     address. Host names are not looked up here, use
+     *                     the resolver for those.
+     * @param _port
+     *
+     * If ip_address is not a valid address, the socket_address is left
+     * empty and converts to false.
+     */
     socket_address(char const * ip_address, uint16_t _port)
     {
-        //setup address structure
-        memset( reinterpret_cast<char *>(&m_address), 0, sizeof(m_address));
-        m_address.sin_family = AF_INET;
-        m_address.sin_port = htons(_port);
+        clear();
 
+        struct sockaddr_in  & a4 = as<struct sockaddr_in>();
+        struct sockaddr_in6 & a6 = as<struct sockaddr_in6>();
 
-        #if defined _MSC_VER
-        m_address.sin_addr.S_un.S_addr = inet_addr(ip_address);
-        #else
-        m_address.sin_addr.s_addr = inet_addr(ip_address);
+        if( ::inet_pton(AF_INET, ip_address, &a4.sin_addr) == 1 )
+        {
+            a4.sin_family = AF_INET;
+            a4.sin_port   = htons(_port);
+            m_size        = sizeof(struct sockaddr_in);
+        }
+        else if( ::inet_pton(AF_INET6, ip_address, &a6.sin6_addr) == 1 )
+        {
+            a6.sin6_family = AF_INET6;
+            a6.sin6_port   = htons(_port);
+            m_size         = sizeof(struct sockaddr_in6);
+        }
+        else
+        {
+            clear();
+        }
+    }
 
-        #endif
+    /**
+     * @brief socket_address
+     * @param addr - a native address of any family
+     * @param length - its size in bytes
+     */
+    socket_address(struct sockaddr const * addr, length_t length)
+    {
+        clear();
+        if( length > 0 && static_cast<std::size_t>(length) <= sizeof(m_address) )
+        {
+            memcpy(&m_address, addr, static_cast<std::size_t>(length));
+            m_size = length;
+        }
     }
 
-    operator bool()
+#if !defined _MSC_VER
+    /**
+     * @brief unix_path
+     * @param path
+     * @return the address of a unix domain socket at the path. If the path
+     *         does not fit in a sockaddr_un the address is empty and errno
+     *         is set to ENAMETOOLONG.
+     */
+    static socket_address unix_path(char const * path)
+    {
+        socket_address A;
+        struct sockaddr_un & a = A.as<struct sockaddr_un>();
+        if( strlen(path) >= sizeof(a.sun_path) )
+        {
+            errno = ENAMETOOLONG;
+            return A;
+        }
+        a.sun_family = AF_UNIX;
+        strcpy(a.sun_path, path);
+        A.m_size = sizeof(struct sockaddr_un);
+        return A;
+    }
+#endif
+
+    /**
+     * @brief operator bool
+     *
+     * Converts to true if the address has been set.
+     */
+    explicit operator bool() const
+    {
+        return m_address.ss_family != AF_UNSPEC;
+    }
+
+    /**
+     * @brief family
+     * @return AF_INET, AF_INET6, AF_UNIX or AF_UNSPEC if it is empty
+     */
+    int family() const
+    {
+        return m_address.ss_family;
+    }
+
+    /**
+     * @brief data
+     * @return the address as a generic sockaddr, for passing to the
+     *         socket functions together with size( )
+     */
+    struct sockaddr const * data() const
+    {
+        return reinterpret_cast<struct sockaddr const*>(&m_address);
+    }
+
+    struct sockaddr * data()
+    {
+        return reinterpret_cast<struct sockaddr*>(&m_address);
+    }
+
+    /**
+     * @brief size
+     * @return the length of the native address for the family
+     */
+    length_t size() const
+    {
+        return m_size;
+    }
+
+    /**
+     * @brief capacity
+     * @return the largest address that fits, use this as the in/out
+     *         length for accept/recvfrom/getpeername then call resize( )
+     */
+    static length_t capacity()
+    {
+        return static_cast<length_t>( sizeof(address_t) );
+    }
+
+    void resize(length_t length)
     {
-        return m_address.sin_port == 0;
+        m_size = length;
     }
 
     /**
@@ -197,11 +369,37 @@ public:
     /**
      * @brief ip
      * @return
-     * Returns the ipaddress as a character string
+     * Returns the ipaddress as a character string. For a unix domain
+     * address this is the path. The string is valid until the next call
+     * to ip( ) on the same thread.
      */
     char const * ip() const
     {
-        return inet_ntoa(m_address.sin_addr);
+        static thread_local char buffer[256]; // larger than INET6_ADDRSTRLEN and sun_path
+        buffer[0] = 0;
+
+        switch( family() )
+        {
+            case AF_INET:
+                ::inet_ntop(AF_INET, const_cast<struct in_addr*>(&as<struct sockaddr_in>().sin_addr), buffer, sizeof(buffer));
+                break;
+            case AF_INET6:
+                ::inet_ntop(AF_INET6, const_cast<struct in6_addr*>(&as<struct sockaddr_in6>().sin6_addr), buffer, sizeof(buffer));
+                break;
+        #if !defined _MSC_VER
+            case AF_UNIX:
+            {
+                char const * path = as<struct sockaddr_un>().sun_path;
+                std::size_t  n    = strnlen(path, sizeof(as<struct sockaddr_un>().sun_path));
+                memcpy(buffer, path, n);
+                buffer[n] = 0;
+                break;
+            }
+        #endif
+            default:
+                break;
+        }
+        return buffer;
     }
 
     /**
@@ -211,633 +409,4629 @@ public:
      */
     uint16_t port() const
     {
-        return ntohs(m_address.sin_port);
+        switch( family() )
+        {
+            case AF_INET:  return ntohs( as<struct sockaddr_in>().sin_port );
+            case AF_INET6: return ntohs( as<struct sockaddr_in6>().sin6_port );
+            default:       return 0;
+        }
     }
 
-    operator address_t()
+    /**
+     * @brief set_port
+     * @param _port
+     *
+     * Changes the port of an IPv4 or IPv6 address.
+     */
+    void set_port(uint16_t _port)
     {
-        return m_address;
-        static_assert( sizeof(address_t) == sizeof(socket_address), "struct sizes are not the same");
+        switch( family() )
+        {
+            case AF_INET:  as<struct sockaddr_in>().sin_port   = htons(_port); break;
+            case AF_INET6: as<struct sockaddr_in6>().sin6_port = htons(_port); break;
+            default: break;
+        }
     }
+
 protected:
+    template<typename T>
+    T & as()
+    {
+        static_assert( sizeof(T) <= sizeof(address_t), "address does not fit in sockaddr_storage");
+        return *reinterpret_cast<T*>(&m_address);
+    }
+
+    template<typename T>
+    T const & as() const
+    {
+        static_assert( sizeof(T) <= sizeof(address_t), "address does not fit in sockaddr_storage");
+        return *reinterpret_cast<T const*>(&m_address);
+    }
+
+    void clear()
+    {
+        memset( reinterpret_cast<char*>(&m_address), 0, sizeof(m_address));
+        m_address.ss_family = AF_UNSPEC;
+        m_size              = 0;
+    }
+
     address_t m_address;
+    length_t  m_size;
 };
 
-
-class socket_base
+/**
+ * @brief The resolver class
+ *
+ * Looks up host names and caches the results, so connecting to the same
+ * host again does not wait for DNS.
+ *
+ * Once a name has been looked up, the cached addresses are returned
+ * without blocking. When they are older than the time to live they are
+ * still returned, and a new lookup is started in the background to
+ * refresh them. Only the very first lookup of a name has to wait, and
+ * even that can be avoided with try_resolve( ) or resolve_async( ).
+ *
+ * Numeric addresses ("10.0.0.1", "::1") never go to the resolver.
+ */
+class resolver
 {
 public:
-#if defined _WIN32
-    using socket_t = SOCKET;
-    using native_msg_size_input_t        = int;// the input message length type for send/recv/sendto/recvfrom
-    using native_msg_size_return_t = int;// the return type for send/recv/sendto/recvfrom
-    static const socket_t     invalid_socket = INVALID_SOCKET;
-    static const int          socket_error   = SOCKET_ERROR;
-    static const int          msg_error      = -1;
-#else
-    using socket_t                 = int;    //
-    using native_msg_size_input_t        = size_t; // the input message length type for send/recv/sendto/recvfrom
-    using native_msg_size_return_t = ssize_t;// the return type for send/recv/sendto/recvfrom
-    static const socket_t     invalid_socket = -1;
-    static const int          socket_error   = -1;
-    static const ssize_t      msg_error      = -1;
-#endif
-
-    static const int          bind_error     = -1;
-    static const int          listen_error   = -1;
-    static const int          connect_error   = -1;
-
-    typedef std::int32_t   msg_size_t;
-
+    using addresses_t = std::vector<socket_address>;
+    using callback_t  = std::function<void(addresses_t const & addresses)>;
+    using clock_type  = std::chrono::steady_clock;
 
-    static const msg_size_t error = -1;
-
-    socket_base() : m_fd( invalid_socket )
+    /**
+     * @brief resolver
+     * @param ttl - how long results are considered fresh
+     * @param negative_ttl - how long a failed lookup is remembered
+     */
+    explicit resolver(std::chrono::seconds ttl = std::chrono::seconds(60),
+                      std::chrono::seconds negative_ttl = std::chrono::seconds(5)) : m_state( std::make_shared<state>() )
     {
+        m_state->ttl          = ttl;
+        m_state->negative_ttl = negative_ttl;
     }
 
-    socket_base(socket_base const & other) : m_fd(other.m_fd)
+    /**
+     * @brief global
+     * @return the resolver used by tcp_socket::connect( )
+     */
+    static resolver & global()
     {
+        static resolver r;
+        return r;
     }
-    socket_base(socket_base && other) : m_fd(other.m_fd)
+
+    /**
+     * @brief resolve
+     * @param host - host name or numeric address
+     * @param port
+     * @return the addresses of the host, IPv6 and IPv4, in the order the
+     *         system prefers them. Empty if the host could not be found.
+     *
+     * Blocks only if the host has never been looked up before.
+     */
+    addresses_t resolve(std::string const & host, std::uint16_t port)
     {
-        other.m_fd=invalid_socket;
+        addresses_t out;
+        if( numeric(host, port, out) )
+            return out;
+
+        std::unique_lock<std::mutex> L(m_state->mutex);
+        entry & e = m_state->cache[host];
+        if( !usable(host, e) )
+        {
+            start_lookup(m_state, host, e);
+            m_state->cv.wait(L, [&]() { return !m_state->cache[host].pending; });
+        }
+        return with_port( m_state->cache[host].addresses, port );
     }
-    socket_base & operator=(socket_base && other)
+
+    /**
+     * @brief try_resolve
+     * @param host
+     * @param port
+     * @param out - set to the addresses if they are cached
+     * @return false if the host is not cached yet. A lookup is started in
+     *         the background, try again later.
+     *
+     * Never blocks.
+     */
+    bool try_resolve(std::string const & host, std::uint16_t port, addresses_t & out)
     {
-        if( this != &other)
+        if( numeric(host, port, out) )
+            return true;
+
+        std::lock_guard<std::mutex> L(m_state->mutex);
+        entry & e = m_state->cache[host];
+        if( !usable(host, e) )
         {
-            m_fd = other.m_fd;
-            other.m_fd=invalid_socket;
+            start_lookup(m_state, host, e);
+            return false;
         }
-        return *this;
+        out = with_port(e.addresses, port);
+        return true;
     }
 
-    bool create(int __domain, int __type, int __protocol)
+    /**
+     * @brief resolve_async
+     * @param host
+     * @param port
+     * @param callback - called with the addresses. It is called right away
+     *                   if they are cached, otherwise from a background
+     *                   thread once the lookup finishes.
+     */
+    void resolve_async(std::string const & host, std::uint16_t port, callback_t callback)
     {
-    #ifdef _MSC_VER
-        WSADATA wsa;
-        if (WSAStartup(MAKEWORD(2,2),&wsa) != 0)
+        addresses_t out;
+        if( numeric(host, port, out) )
         {
-            //printf("Failed. Error Code : %d",WSAGetLastError());
-            return false;
+            callback(out);
+            return;
         }
-    #endif
-        if ( (m_fd=socket(__domain, __type, __protocol)) == invalid_socket)
+
+        std::unique_lock<std::mutex> L(m_state->mutex);
+        entry & e = m_state->cache[host];
+        if( usable(host, e) )
         {
-            #ifdef _MSC_VER
-          //  printf("Create failed with error code : %d\n" , WSAGetLastError() );
-            #else
-            printf("Create failed with error code : %d : %s\n" , errno,  strerror(errno) );
-            #endif
+            out = with_port(e.addresses, port);
+            L.unlock();
+            callback(out);
+            return;
+        }
+
+        e.waiters.push_back( [callback, port](addresses_t const & a)
+        {
+            callback( with_port(a, port) );
+        });
+        if( !start_lookup(m_state, host, e) )
+        {
+            // there is no thread to call them, so fail them here
+            std::vector<callback_t> failed;
+            failed.swap(e.waiters);
+            L.unlock();
+            for(auto & w : failed)
+                w( addresses_t() );
+        }
+    }
+
+    /**
+     * @brief clear
+     *
+     * Forgets all cached names.
+     */
+    void clear()
+    {
+        std::lock_guard<std::mutex> L(m_state->mutex);
+        for(auto it = m_state->cache.begin(); it != m_state->cache.end(); )
+        {
+            if( it->second.pending )
+                ++it;
+            else
+                it = m_state->cache.erase(it);
+        }
+    }
+
+    /**
+     * @brief lookup
+     * @param host
+     * @return the addresses of the host (with port 0)
+     *
+     * Asks the system resolver directly (getaddrinfo). This always blocks
+     * and does not use the cache.
+     */
+    static addresses_t lookup(std::string const & host)
+    {
+        addresses_t out;
+
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family   = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags    = AI_ADDRCONFIG;
+
+        struct addrinfo * result = nullptr;
+        if( ::getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0 )
+            return out;
+
+        for(struct addrinfo * r = result; r != nullptr; r = r->ai_next)
+            out.push_back( socket_address(r->ai_addr, static_cast<socket_address::length_t>(r->ai_addrlen)) );
+
+        ::freeaddrinfo(result);
+        return out;
+    }
+
+protected:
+    struct entry
+    {
+        addresses_t             addresses;
+        clock_type::time_point  expires;
+        bool                    resolved = false;
+        bool                    pending  = false;
+        std::vector<callback_t> waiters;
+    };
+
+    // shared with the background lookups so they can finish after the
+    // resolver is gone
+    struct state
+    {
+        std::mutex                              mutex;
+        std::condition_variable                 cv;
+        std::unordered_map<std::string, entry>  cache;
+        std::chrono::seconds                    ttl;
+        std::chrono::seconds                    negative_ttl;
+    };
+
+    // returns true if the addresses can be handed out. Starts a refresh
+    // if they are stale.
+    bool usable(std::string const & host, entry & e)
+    {
+        if( !e.resolved )
             return false;
+
+        if( clock_type::now() >= e.expires )
+        {
+            if( e.addresses.empty() )
+                return false;
+            start_lookup(m_state, host, e); // refresh in the background, keep using the old result
         }
         return true;
     }
 
-    bool bind(socket_address const & addr)
+    // must be called with the mutex held. Returns false if the thread
+    // for the lookup could not be started, the entry is left as it was.
+    bool start_lookup(std::shared_ptr<state> const & S, std::string const & host, entry & e)
     {
-        auto ret = ::bind(m_fd, reinterpret_cast<struct sockaddr const*>(&addr.native_address()) , sizeof(socket_address));
+        if( e.pending )
+            return true;
 
-        if( ret == bind_error)
+        std::string name = host;
+        std::thread T;
+        try
+        {
+            T = std::thread( [S, name]()
+            {
+                addresses_t result = lookup(name);
+
+                std::vector<callback_t> waiters;
+                {
+                    std::lock_guard<std::mutex> L(S->mutex);
+                    entry & done = S->cache[name];
+                    if( !result.empty() || done.addresses.empty() )
+                        done.addresses = result;
+                    done.resolved = true;
+                    done.pending  = false;
+                    done.expires  = clock_type::now() + (result.empty() ? S->negative_ttl : S->ttl);
+                    waiters.swap(done.waiters);
+                }
+                S->cv.notify_all();
+
+                for(auto & w : waiters)
+                    w(result);
+            });
+        }
+        catch(std::system_error &)
         {
-            #ifdef _MSC_VER
-            //printf("Bind failed with error code : %d" , WSAGetLastError() );
-            #else
-            //printf("Bind failed with error code : %d : %s" , errno,  strerror(errno) );
-            #endif
             return false;
         }
+
+        e.pending = true;
+        T.detach();
         return true;
     }
 
-
-    /**
-     * @brief close
-     * Closes the socket. The socket will cast to false after this has been
-     * called.
-     */
-    void close()
+    static bool numeric(std::string const & host, std::uint16_t port, addresses_t & out)
     {
-        #ifdef _MSC_VER
-            ::closesocket(m_fd);
-        #else
-            ::shutdown(m_fd, SHUT_RDWR);
-            ::close(m_fd);
-        #endif
-        m_fd = invalid_socket;
+        socket_address a(host.c_str(), port);
+        if( !a )
+            return false;
+        out.assign(1, a);
+        return true;
     }
 
-    /**
-     * @brief native_handle
-     * @return
-     *
-     * Returns the native handle of the socket descriptor
-     */
-    socket_t native_handle() const
+    static addresses_t with_port(addresses_t a, std::uint16_t port)
     {
-        return m_fd;
+        for(auto & x : a)
+            x.set_port(port);
+        return a;
     }
 
-    protected:
-        socket_t m_fd = invalid_socket;
+    std::shared_ptr<state> m_state;
 };
 
+
 /**
- * @brief The udp_socket class
+ * @brief The io_buffer class
  *
- * A udp socket class to send UDP data to various clients.
+ * A single buffer used for scatter/gather I/O. It has exactly the layout of
+ * the native buffer descriptor (iovec on unix, WSABUF on windows), so an array
+ * of io_buffers can be handed to the kernel without being copied.
  */
-class udp_socket : public socket_base
+#if defined _MSC_VER
+struct io_buffer : public WSABUF
 {
-public:
-
-    /**
-     * @brief create
-     *
-     * Creates the socket.  This must be called before you can bind it.
-     */
-    bool create()
+    io_buffer()
     {
-        return socket_base::create(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        buf = nullptr;
+        len = 0;
     }
 
-
-    /**
-     * @brief send
-     * @param data - the data packet to send
-     * @param length - number of bytes in the packet to send
-     * @param addr - the address to send the data to
-     * @return Returns socket::error if an error occurs or returns the number
-     *         of bytes sent if success
-     *
-     *
-     */
-    msg_size_t  send(char const * data, size_t length, socket_address const & addr)
+    io_buffer(void const * _data, std::size_t _size)
     {
-        native_msg_size_return_t ret = ::sendto(m_fd, data, static_cast<native_msg_size_input_t>(length&0xFFFFFFFF) , 0 , reinterpret_cast<struct sockaddr const *>(&addr.native_address()), sizeof(struct sockaddr_in ));
-        if ( ret == msg_error)
-        {
-            #ifdef _MSC_VER
-            //printf("Send failed with error code : %d" , WSAGetLastError() );
-            #else
-            //printf("Send failed with error code : %d : %s" , errno,  strerror(errno) );
-            #endif
-            return msg_size_t(ret);
-        }
-        return msg_size_t(ret);
+        buf = static_cast<CHAR*>( const_cast<void*>(_data) );
+        len = static_cast<ULONG>(_size);
     }
 
-    /**
-     * @brief recv
-     * @param buf - buffer to write the data into
-     * @param length - maximum length of the buffer
-     * @param addr -  reference to a address struct where the ip/port of teh
-     *                client will be stored
-     * @return returns udp_socket::error if error or the number of bytes recieved
-     *
-     * Recieves data from the socket
-     */
-    msg_size_t recv(char * buf, size_t length, socket_address & addr)
-    {
-#if defined _MSC_VER
-        int slen =  sizeof(struct sockaddr_in);
+    void *      data() const { return buf; }
+    std::size_t size() const { return len; }
+};
 #else
-        socklen_t slen = sizeof(struct sockaddr_in);
-#endif
-        native_msg_size_return_t ret  = ::recvfrom( m_fd, buf, static_cast<native_msg_size_input_t>(length&0xFFFFFFFF), 0, reinterpret_cast<struct sockaddr *>(&addr.native_address()), &slen);
-
-        if (ret == msg_error)
-        {
-            #ifdef _MSC_VER
-            //printf("Recv failed with error code : %d" , WSAGetLastError() );
-            #else
-            //printf("Recv failed with error code : %d : %s" , errno,  strerror(errno) );
-            #endif
-            //return msg_error;
-        }
-        return msg_size_t(ret);
+struct io_buffer : public iovec
+{
+    io_buffer()
+    {
+        iov_base = nullptr;
+        iov_len  = 0;
     }
 
-    /**
-     * @brief operator bool
-     *
-     * Conversion to bool. Converts to false if the socket is
-     * not created or if it has an error
-     */
-    operator bool()
+    io_buffer(void const * _data, std::size_t _size)
     {
-        return !( ( m_fd == invalid_socket ) );
+        iov_base = const_cast<void*>(_data);
+        iov_len  = _size;
     }
 
+    void *      data() const { return iov_base; }
+    std::size_t size() const { return iov_len; }
 };
+#endif
 
-
-
-class tcp_socket : public socket_base
+/**
+ * @brief The ring_buffer class
+ *
+ * A fixed size circular byte buffer which sockets can read into and send
+ * from directly.
+ *
+ * On Linux the buffer is a mirrored ring: the same memory is mapped twice,
+ * back to back, so the readable and writable regions are always contiguous
+ * even when they wrap around the end of the buffer. If the mirrored mapping
+ * cannot be created (or on other platforms), a plain buffer is used and the
+ * regions may be split in two. Use read_regions( )/write_regions( ) to get
+ * both halves in that case.
+ *
+ *   gnl::ring_buffer R(64*1024);
+ *   S.recv(R);                      // read as much as is available into R
+ *   auto r = R.read_region();       // process r.data(), r.size()
+ *   R.consume( r.size() );
+ */
+class ring_buffer
 {
 public:
-
-    tcp_socket() : socket_base()
+    /**
+     * @brief ring_buffer
+     * @param capacity - minimum capacity of the ring in bytes. The mirrored
+     *                   ring rounds this up to a multiple of the page size.
+     */
+    explicit ring_buffer(std::size_t capacity = 64*1024)
     {
-    }
+        if( capacity == 0 )
+            capacity = 1;
 
-    tcp_socket( tcp_socket && other)
-    {
-        m_fd       = other.m_fd;
-        m_address  = other.m_address;
-        other.m_fd = invalid_socket;
-        memset(&other.m_address,0,sizeof(other.m_address));
-    }
+    #if defined __linux__ && defined SYS_memfd_create
+        std::size_t page = static_cast<std::size_t>( sysconf(_SC_PAGESIZE) );
+        std::size_t size = (capacity + page - 1) / page * page;
 
-    tcp_socket( const tcp_socket & other) : socket_base( other)
-    {
-        m_fd = other.m_fd;
-        memcpy(&m_address, &other.m_address, sizeof(m_address) );
+        if( map_mirrored(size) )
+            return;
+    #endif
+
+        m_data     = new char[capacity];
+        m_capacity = capacity;
+        m_mirrored = false;
     }
 
-    tcp_socket& operator=( tcp_socket const & other)
+    ring_buffer(ring_buffer const & other) = delete;
+    ring_buffer & operator=(ring_buffer const & other) = delete;
+
+    ring_buffer(ring_buffer && other)
     {
-        m_fd      = other.m_fd;
-        memcpy(&m_address, &other.m_address, sizeof(m_address));
-        return *this;
+        *this = std::move(other);
     }
 
-    tcp_socket& operator=( tcp_socket && other)
+    ring_buffer & operator=(ring_buffer && other)
     {
-        if( this != &other)
+        if( this != &other )
         {
-            m_fd      = other.m_fd;
-            m_address = other.m_address;
-            memset(&other.m_address,0,sizeof(other.m_address));
-            other.m_fd = invalid_socket;
+            release();
+            m_data     = other.m_data;
+            m_capacity = other.m_capacity;
+            m_mirrored = other.m_mirrored;
+            m_read     = other.m_read;
+            m_write    = other.m_write;
+            other.m_data     = nullptr;
+            other.m_capacity = 0;
+            other.m_read     = other.m_write = 0;
         }
         return *this;
     }
 
-    /**
-     * @brief operator bool
-     *
-     * Conversion to bool. Converts to false if the socket is
-     * not created or if it has an error
-     */
-    operator bool()
+    ~ring_buffer()
     {
-        return !( ( m_fd == invalid_socket )  );
+        release();
     }
 
     /**
-     * @brief bind
-     * @param port
+     * @brief capacity
      * @return
      *
-     * Bind the socket to a port so it can start listening for incoming
-     * tcp connections.
+     * Returns the total number of bytes the ring can hold.
      */
-    bool bind( uint16_t port)
-    {
-        return socket_base::bind( socket_address(port) );
-    }
+    std::size_t capacity() const { return m_capacity; }
 
     /**
-     * @brief connect
-     * @param server - the server ip address/host name
-     * @param port - the port number
+     * @brief size
      * @return
      *
-     * Connect to a server
+     * Returns the number of bytes waiting to be read.
      */
-    bool connect( const char * server, std::uint16_t port)
-    {
-        socket_address addr(server, port);
-
-        decltype(socket_error) ret = ::connect( m_fd, reinterpret_cast<struct sockaddr*>(&addr.native_address()), sizeof( addr.native_address()));
-
-        m_address = addr;
-        if( ret == socket_error)
-            return false;
-
-        return true;
-    }
+    std::size_t size() const { return static_cast<std::size_t>(m_write - m_read); }
 
     /**
-     * @brief create
+     * @brief space
      * @return
      *
-     * Create the socket. THis must be called before you do any actions on
-     * the socket.
+     * Returns the number of bytes which can be written.
      */
-    bool create()
-    {
-        return socket_base::create(AF_INET, SOCK_STREAM, IPPROTO_TCP );
-    }
+    std::size_t space() const { return m_capacity - size(); }
+
+    bool empty() const { return m_write == m_read; }
+    bool full()  const { return size() == m_capacity; }
 
     /**
-     * @brief listen
-     * @param max_connections
+     * @brief is_mirrored
      * @return
      *
-     * Puts the socket into listening mode so that it can accept client
-     * connections
+     * Returns true if the ring is double mapped, in which case the read and
+     * write regions never wrap.
      */
-    bool listen( std::size_t max_connections)
-    {
-        decltype(socket_error) code = ::listen( m_fd, static_cast<int>(max_connections));
-
-        if( code == socket_error)
-        {
-            return false;
-        }
-        return true;
-    }
+    bool is_mirrored() const { return m_mirrored; }
 
     /**
-     * @brief accept
+     * @brief read_region
      * @return
      *
-     * Accept a new connected client. This function blocks until
-     * a client connects.
+     * Returns the contiguous block of data which can be read. If the ring
+     * is mirrored this is all the data in the ring.
      */
-    tcp_socket accept()
+    io_buffer read_region() const
     {
-        tcp_socket client;
-
-        int length   = sizeof( m_address.native_address() );
-
-#if defined _MSC_VER
-        using socklen_t = int;
-#endif
-        client.m_fd  = ::accept(m_fd, reinterpret_cast<struct sockaddr*>(&m_address.native_address()), reinterpret_cast<socklen_t*>(&length));
-
-        ::getpeername(client.m_fd , reinterpret_cast<struct sockaddr *>(&client.get_address().native_address()), reinterpret_cast<socklen_t*>(&length) );
-
-        return client;
-
+        std::size_t offset = static_cast<std::size_t>(m_read % m_capacity);
+        std::size_t n      = size();
+        if( !m_mirrored && offset + n > m_capacity )
+            n = m_capacity - offset;
+        return io_buffer(m_data + offset, n);
     }
 
     /**
-     * @brief send
-     * @param data
-     * @param size
-     * @return returns 0 if the client disconnected, otherwise returns the
-     *         number of bytes sent
+     * @brief write_region
+     * @return
      *
-     * Sends data to this socket.
+     * Returns the contiguous block of free space which can be written to.
+     * Call commit( ) after writing to it.
      */
-    msg_size_t send( void const * data, size_t _size)
+    io_buffer write_region() const
     {
-
-        native_msg_size_return_t ret = ::send(m_fd, reinterpret_cast<const char*>(data), static_cast<native_msg_size_input_t>(_size&0xFFFFFFFF), 0);
-
-        return msg_size_t(ret);
+        std::size_t offset = static_cast<std::size_t>(m_write % m_capacity);
+        std::size_t n      = space();
+        if( !m_mirrored && offset + n > m_capacity )
+            n = m_capacity - offset;
+        return io_buffer(m_data + offset, n);
     }
 
     /**
-     * @brief recv
-     * @param data
-     * @param size
-     * @return  the number of bytes read, or zero if the client disconnected.
-     *          returns tcp_socket::error if an error occoured
+     * @brief read_regions
+     * @param regions
+     * @return the number of regions used (0, 1 or 2)
      *
-     * Recieves data from the socket. This function blocks until the total
-     * number of bytes have been recieved.
+     * Returns all the readable data as at most two regions.
      */
-    msg_size_t recv(void * data, size_t _size)
+    std::size_t read_regions(io_buffer (&regions)[2]) const
     {
-        bool wait_for_all = true; // default for now.
-
-        native_msg_size_return_t t = ::recv( m_fd, reinterpret_cast<char*>(data), static_cast<native_msg_size_input_t>(_size&0xFFFFFFFF), wait_for_all ? MSG_WAITALL : 0 );
-
-        if( t == 0 && _size != 0 ) // gracefully closed
-        {
-            m_fd = invalid_socket;
-        }
-        return msg_size_t(t);
+        regions[0] = read_region();
+        regions[1] = io_buffer(m_data, size() - regions[0].size());
+        return regions[0].size() == 0 ? 0 : (regions[1].size() == 0 ? 1 : 2);
     }
 
     /**
-     * @brief size
-     * @return
+     * @brief write_regions
+     * @param regions
+     * @return the number of regions used (0, 1 or 2)
      *
-     * Returns the number of bytes waiting in the buffer.
+     * Returns all the free space as at most two regions.
      */
-    std::size_t size() const
+    std::size_t write_regions(io_buffer (&regions)[2]) const
     {
-        #ifdef _MSC_VER
-            u_long bytes_available;
-            auto ret = ioctlsocket(m_fd, FIONREAD , &bytes_available);
-            if( ret == socket_error)
-                    return 0;
-        #else
-            int bytes_available;
-            auto ret = ioctl(m_fd,FIONREAD, &bytes_available);
-            if( ret == -1)
-                return 0;
-        #endif
-        return std::size_t(bytes_available);
+        regions[0] = write_region();
+        regions[1] = io_buffer(m_data, space() - regions[0].size());
+        return regions[0].size() == 0 ? 0 : (regions[1].size() == 0 ? 1 : 2);
     }
 
     /**
-     * @brief get_address
-     * @return
+     * @brief commit
+     * @param n
      *
-     * Gets the address of the socket.
+     * Marks n bytes of the write region as written.
      */
-    socket_address get_address() const
+    void commit(std::size_t n)
     {
-        return m_address;
+        m_write += n;
     }
-protected:
-    socket_address m_address;
-};
-
-
-#if defined __linux__
 
-/**
- * @brief The domain_stream_socket class
- *
- * Unix domain stream socket.  A unix domain socket exists as a file on the
- * filesystem. This can be opened as a file descriptor in Unix.
- */
-class domain_stream_socket : public socket_base
-{
-public:
     /**
-     * @brief operator bool
+     * @brief consume
+     * @param n
      *
-     * Conversion to bool. Converts to false if the socket is
-     * not created or if it has an error
+     * Marks n bytes of the read region as read, freeing up the space.
      */
-    operator bool()
+    void consume(std::size_t n)
     {
-        return !( ( m_fd == invalid_socket ) );
+        m_read += n;
+        if( m_read == m_write )
+            m_read = m_write = 0;
     }
 
     /**
-     * @brief bind
-     * @param port
-     * @return
+     * @brief clear
      *
-     * Bind the socket to a path so it can start listening for incoming
-     * connections.
+     * Discards all the data in the ring
      */
-    bool bind( const char * path )
+    void clear()
     {
+        m_read = m_write = 0;
+    }
 
-        if( !(*this) )
-            create();
+protected:
 
-        struct sockaddr_un d_name;
-        memset(&d_name, 0 ,sizeof(struct sockaddr_un) );
-        d_name.sun_family = AF_UNIX;
-        strcpy(d_name.sun_path, path);
+#if defined __linux__ && defined SYS_memfd_create
+    bool map_mirrored(std::size_t size)
+    {
+        int fd = static_cast<int>( ::syscall(SYS_memfd_create, "gnl_ring_buffer", 1u /*MFD_CLOEXEC*/) );
+        if( fd == -1 )
+            return false;
 
-        int ret = ::bind(m_fd, reinterpret_cast<const struct sockaddr *>(&d_name),
-                       sizeof(struct sockaddr_un));
+        if( ::ftruncate(fd, static_cast<off_t>(size)) == -1 )
+        {
+            ::close(fd);
+            return false;
+        }
 
-        if( ret == bind_error)
+        // reserve twice the address space, then map the file into both halves
+        void * base = ::mmap(nullptr, 2*size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if( base == MAP_FAILED )
         {
-            #ifdef _MSC_VER
-            //printf("Bind failed with error code : %d" , WSAGetLastError() );
-            #else
-            //printf("Bind failed with error code : %d : %s" , errno,  strerror(errno) );
-            #endif
-            //exit(EXIT_FAILURE);
+            ::close(fd);
+            return false;
+        }
+
+        char * b = static_cast<char*>(base);
+        if( ::mmap(b,        size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+            ::mmap(b + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED )
+        {
+            ::munmap(base, 2*size);
+            ::close(fd);
             return false;
         }
+        ::close(fd); // the mappings keep the memory alive
+
+        m_data     = b;
+        m_capacity = size;
+        m_mirrored = true;
         return true;
     }
+#endif
 
+    void release()
+    {
+        if( !m_data )
+            return;
 
-    /**
-     * @brief unlink
+    #if defined __linux__
+        if( m_mirrored )
+            ::munmap(m_data, 2*m_capacity);
+        else
+            delete [] m_data;
+    #else
+        delete [] m_data;
+    #endif
+        m_data = nullptr;
+    }
+
+    char *        m_data     = nullptr;
+    std::size_t   m_capacity = 0;
+    bool          m_mirrored = false;
+    std::uint64_t m_read     = 0; // total bytes read
+    std::uint64_t m_write    = 0; // total bytes written
+};
+
+/**
+ * @brief The socket_option class
+ *
+ * A typed wrapper around a single setsockopt/getsockopt option. The
+ * options themselves are listed in the socket_options namespace below and
+ * are used with socket_base::set_option( ) and socket_base::get_option( ):
+ *
+ *   S.set_option( gnl::socket_options::tcp_nodelay(true) );
+ *
+ *   gnl::socket_options::recv_buffer_size size;
+ *   S.get_option(size);
+ *   std::cout << size.value() << std::endl;
+ */
+template<int Level, int Name, typename T>
+class socket_option
+{
+public:
+    using value_type = T;
+
+    socket_option() : m_value(0)
+    {
+    }
+
+    explicit socket_option(T v) : m_value( static_cast<int>(v) )
+    {
+    }
+
+    static int level() { return Level; }
+    static int name()  { return Name;  }
+
+    T value() const
+    {
+        return static_cast<T>(m_value);
+    }
+
+    void *       data()       { return &m_value; }
+    void const * data() const { return &m_value; }
+    std::size_t  size() const { return sizeof(m_value); }
+
+protected:
+    int m_value; // all the supported options are ints at the native level
+};
+
+namespace socket_options
+{
+    template<int Level, int Name>
+    using boolean_option = socket_option<Level, Name, bool>;
+
+    template<int Level, int Name>
+    using integer_option = socket_option<Level, Name, int>;
+
+    /// SO_REUSEADDR: allow binding to a port which is still in TIME_WAIT
+    using reuse_address    = boolean_option<SOL_SOCKET, SO_REUSEADDR>;
+
+    /// SO_SNDBUF: size of the kernel send buffer in bytes
+    using send_buffer_size = integer_option<SOL_SOCKET, SO_SNDBUF>;
+
+    /// SO_RCVBUF: size of the kernel recieve buffer in bytes. Note that
+    /// linux doubles the value that is set, and reports the doubled value.
+    using recv_buffer_size = integer_option<SOL_SOCKET, SO_RCVBUF>;
+
+    /// TCP_NODELAY: disable Nagle's algorithm so small writes are sent
+    /// immediately instead of waiting to be coalesced
+    using tcp_nodelay      = boolean_option<IPPROTO_TCP, TCP_NODELAY>;
+
+#if defined IPV6_V6ONLY
+    /// IPV6_V6ONLY: an IPv6 socket only accepts IPv6. When it is off,
+    /// IPv4 clients are seen as IPv4-mapped IPv6 addresses.
+    using ipv6_only        = boolean_option<IPPROTO_IPV6, IPV6_V6ONLY>;
+#endif
+
+#if defined SO_REUSEPORT
+    /// SO_REUSEPORT: allow several sockets to bind to the same port. The
+    /// kernel load balances incoming connections/packets across them.
+    using reuse_port       = boolean_option<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+#if defined SO_BUSY_POLL
+    /// SO_BUSY_POLL: microseconds to busy poll the device queue on a
+    /// blocking recv before sleeping. Raising it may need CAP_NET_ADMIN.
+    using busy_poll        = integer_option<SOL_SOCKET, SO_BUSY_POLL>;
+#endif
+
+#if defined TCP_QUICKACK
+    /// TCP_QUICKACK: send ACKs immediately instead of delaying them. The
+    /// kernel may turn this off again by itself, so it is usually set
+    /// again after each recv.
+    using tcp_quickack     = boolean_option<IPPROTO_TCP, TCP_QUICKACK>;
+#endif
+
+#if defined TCP_CORK
+    /// TCP_CORK: hold back partial frames until the cork is removed, so
+    /// several writes go out as full segments
+    using tcp_cork         = boolean_option<IPPROTO_TCP, TCP_CORK>;
+#endif
+
+#if defined TCP_FASTOPEN
+    /// TCP_FASTOPEN: (server) length of the queue of pending TFO requests.
+    /// Allows clients to send data in the SYN.
+    using tcp_fastopen     = integer_option<IPPROTO_TCP, TCP_FASTOPEN>;
+#endif
+
+#if defined TCP_FASTOPEN_CONNECT
+    /// TCP_FASTOPEN_CONNECT: (client) use TFO on connect if the server
+    /// has handed out a cookie previously
+    using tcp_fastopen_connect = boolean_option<IPPROTO_TCP, TCP_FASTOPEN_CONNECT>;
+#endif
+}
+
+/**
+ * @brief The io_histogram class
+ *
+ * A latency histogram with power of two buckets. Bucket i counts the
+ * calls which took between 2^i and 2^(i+1) nanoseconds.
+ */
+struct io_histogram
+{
+    static const std::size_t bucket_count = 48;
+
+    std::uint64_t buckets[bucket_count] = {};
+
+    static std::size_t bucket(std::uint64_t ns)
+    {
+        if( ns == 0 )
+            return 0;
+    #if defined __GNUC__
+        std::size_t i = static_cast<std::size_t>( 63 - __builtin_clzll(ns) );
+    #else
+        std::size_t i = 0;
+        while( ns >>= 1 )
+            i++;
+    #endif
+        return i < bucket_count ? i : bucket_count-1;
+    }
+
+    /**
+     * @brief count
+     * @return the total number of samples
+     */
+    std::uint64_t count() const
+    {
+        std::uint64_t c = 0;
+        for(auto b : buckets)
+            c += b;
+        return c;
+    }
+
+    /**
+     * @brief percentile
+     * @param p - between 0 and 100
+     * @return an upper bound, in nanoseconds, of the p'th percentile
+     */
+    std::uint64_t percentile(double p) const
+    {
+        std::uint64_t total = count();
+        if( total == 0 )
+            return 0;
+
+        std::uint64_t rank = static_cast<std::uint64_t>( p / 100.0 * static_cast<double>(total) + 0.5 );
+        std::uint64_t c    = 0;
+        for(std::size_t i=0; i < bucket_count; i++)
+        {
+            c += buckets[i];
+            if( c >= rank && c > 0 )
+                return std::uint64_t(1) << (i+1);
+        }
+        return std::uint64_t(1) << bucket_count;
+    }
+
+    io_histogram & operator+=(io_histogram const & other)
+    {
+        for(std::size_t i=0; i < bucket_count; i++)
+            buckets[i] += other.buckets[i];
+        return *this;
+    }
+
+    io_histogram & operator-=(io_histogram const & other)
+    {
+        for(std::size_t i=0; i < bucket_count; i++)
+            buckets[i] -= other.buckets[i];
+        return *this;
+    }
+};
+
+/**
+ * @brief The io_statistics struct
+ *
+ * A snapshot of the I/O counters of one socket, or of the whole process.
+ * Subtract two snapshots to get the activity in between.
+ *
+ * A "message" is one successful send or recv call. A short write/read is
+ * a call which transferred less than was asked for. The latency
+ * histograms are only filled in for sockets which have called
+ * enable_stats( ).
+ */
+struct io_statistics
+{
+    std::uint64_t bytes_sent        = 0;
+    std::uint64_t bytes_recieved    = 0;
+    std::uint64_t messages_sent     = 0;
+    std::uint64_t messages_recieved = 0;
+    std::uint64_t syscalls          = 0;
+    std::uint64_t would_block       = 0; // EAGAIN/EWOULDBLOCK
+    std::uint64_t errors            = 0; // any other failure
+    std::uint64_t short_writes      = 0;
+    std::uint64_t short_reads       = 0;
+
+    io_histogram  send_latency;
+    io_histogram  recv_latency;
+
+    io_statistics & operator+=(io_statistics const & o)
+    {
+        bytes_sent        += o.bytes_sent;
+        bytes_recieved    += o.bytes_recieved;
+        messages_sent     += o.messages_sent;
+        messages_recieved += o.messages_recieved;
+        syscalls          += o.syscalls;
+        would_block       += o.would_block;
+        errors            += o.errors;
+        short_writes      += o.short_writes;
+        short_reads       += o.short_reads;
+        send_latency      += o.send_latency;
+        recv_latency      += o.recv_latency;
+        return *this;
+    }
+
+    io_statistics & operator-=(io_statistics const & o)
+    {
+        bytes_sent        -= o.bytes_sent;
+        bytes_recieved    -= o.bytes_recieved;
+        messages_sent     -= o.messages_sent;
+        messages_recieved -= o.messages_recieved;
+        syscalls          -= o.syscalls;
+        would_block       -= o.would_block;
+        errors            -= o.errors;
+        short_writes      -= o.short_writes;
+        short_reads       -= o.short_reads;
+        send_latency      -= o.send_latency;
+        recv_latency      -= o.recv_latency;
+        return *this;
+    }
+
+    io_statistics operator-(io_statistics const & o) const
+    {
+        io_statistics r(*this);
+        r -= o;
+        return r;
+    }
+};
+
+/**
+ * @brief The io_counters class
+ *
+ * The live counters behind an io_statistics snapshot. All updates are
+ * relaxed atomics. Counters owned by a single thread (the per thread
+ * global counters) are updated with a plain load and store instead of a
+ * locked read-modify-write, they only need to be atomic so snapshot( )
+ * can read them from another thread.
+ */
+class io_counters
+{
+public:
+    explicit io_counters(bool single_writer = false) : m_single_writer(single_writer)
+    {
+    }
+
+    io_counters(io_counters const &) = delete;
+    io_counters & operator=(io_counters const &) = delete;
+
+    static std::uint64_t now_ns()
+    {
+        return static_cast<std::uint64_t>(
+                 std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count() );
+    }
+
+    /**
+     * @brief record_send
+     * @param requested - number of bytes that were asked to be sent
+     * @param result - what the send call returned
+     * @param would_block - the call failed with EAGAIN/EWOULDBLOCK
+     * @param ns - how long the call took, 0 if it was not measured
+     */
+    void record_send(std::size_t requested, std::int64_t result, bool would_block, std::uint64_t ns)
+    {
+        add(m_syscalls, 1);
+        if( result < 0 )
+        {
+            add( would_block ? m_would_block : m_errors, 1);
+            return;
+        }
+        add(m_bytes_sent, static_cast<std::uint64_t>(result));
+        add(m_messages_sent, 1);
+        if( static_cast<std::size_t>(result) < requested )
+            add(m_short_writes, 1);
+        if( ns )
+            add(m_send_latency[ io_histogram::bucket(ns) ], 1);
+    }
+
+    /**
+     * @brief record_recv
+     * @param requested - size of the buffer that was read into
+     * @param result - what the recv call returned
+     * @param would_block - the call failed with EAGAIN/EWOULDBLOCK
+     * @param ns - how long the call took, 0 if it was not measured
+     */
+    void record_recv(std::size_t requested, std::int64_t result, bool would_block, std::uint64_t ns)
+    {
+        add(m_syscalls, 1);
+        if( result < 0 )
+        {
+            add( would_block ? m_would_block : m_errors, 1);
+            return;
+        }
+        add(m_bytes_recieved, static_cast<std::uint64_t>(result));
+        add(m_messages_recieved, 1);
+        if( static_cast<std::size_t>(result) < requested )
+            add(m_short_reads, 1);
+        if( ns )
+            add(m_recv_latency[ io_histogram::bucket(ns) ], 1);
+    }
+
+    /**
+     * @brief snapshot
+     * @return a copy of the current values
+     */
+    io_statistics snapshot() const
+    {
+        io_statistics s;
+        s.bytes_sent        = m_bytes_sent.load(std::memory_order_relaxed);
+        s.bytes_recieved    = m_bytes_recieved.load(std::memory_order_relaxed);
+        s.messages_sent     = m_messages_sent.load(std::memory_order_relaxed);
+        s.messages_recieved = m_messages_recieved.load(std::memory_order_relaxed);
+        s.syscalls          = m_syscalls.load(std::memory_order_relaxed);
+        s.would_block       = m_would_block.load(std::memory_order_relaxed);
+        s.errors            = m_errors.load(std::memory_order_relaxed);
+        s.short_writes      = m_short_writes.load(std::memory_order_relaxed);
+        s.short_reads       = m_short_reads.load(std::memory_order_relaxed);
+        for(std::size_t i=0; i < io_histogram::bucket_count; i++)
+        {
+            s.send_latency.buckets[i] = m_send_latency[i].load(std::memory_order_relaxed);
+            s.recv_latency.buckets[i] = m_recv_latency[i].load(std::memory_order_relaxed);
+        }
+        return s;
+    }
+
+protected:
+    void add(std::atomic<std::uint64_t> & c, std::uint64_t v)
+    {
+        if( m_single_writer )
+            c.store( c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+        else
+            c.fetch_add(v, std::memory_order_relaxed);
+    }
+
+    bool                       m_single_writer;
+
+    std::atomic<std::uint64_t> m_bytes_sent{0};
+    std::atomic<std::uint64_t> m_bytes_recieved{0};
+    std::atomic<std::uint64_t> m_messages_sent{0};
+    std::atomic<std::uint64_t> m_messages_recieved{0};
+    std::atomic<std::uint64_t> m_syscalls{0};
+    std::atomic<std::uint64_t> m_would_block{0};
+    std::atomic<std::uint64_t> m_errors{0};
+    std::atomic<std::uint64_t> m_short_writes{0};
+    std::atomic<std::uint64_t> m_short_reads{0};
+
+    std::atomic<std::uint64_t> m_send_latency[io_histogram::bucket_count] = {};
+    std::atomic<std::uint64_t> m_recv_latency[io_histogram::bucket_count] = {};
+};
+
+namespace detail
+{
+    // Every thread has its own io_counters for the process wide totals, so
+    // the threads never write to the same cache lines. The registry lets
+    // socket_base::global_stats( ) add them up, and keeps the totals of
+    // threads which have exited.
+    struct io_registry
+    {
+        std::mutex                         mutex;
+        std::vector<io_counters const*>    live;
+        io_statistics                      retired;
+
+        static io_registry & get()
+        {
+            static io_registry r;
+            return r;
+        }
+    };
+
+    struct thread_io_counters
+    {
+        io_counters counters{true};
+
+        thread_io_counters()
+        {
+            io_registry & r = io_registry::get();
+            std::lock_guard<std::mutex> L(r.mutex);
+            r.live.push_back(&counters);
+        }
+
+        ~thread_io_counters()
+        {
+            io_registry & r = io_registry::get();
+            std::lock_guard<std::mutex> L(r.mutex);
+            r.retired += counters.snapshot();
+            r.live.erase( std::remove(r.live.begin(), r.live.end(), &counters), r.live.end() );
+        }
+    };
+
+    inline io_counters & local_io_counters()
+    {
+        static thread_local thread_io_counters c;
+        return c.counters;
+    }
+}
+
+class socket_base
+{
+public:
+#if defined _WIN32
+    using socket_t = SOCKET;
+    using native_msg_size_input_t        = int;// the input message length type for send/recv/sendto/recvfrom
+    using native_msg_size_return_t = int;// the return type for send/recv/sendto/recvfrom
+    static const socket_t     invalid_socket = INVALID_SOCKET;
+    static const int          socket_error   = SOCKET_ERROR;
+    static const int          msg_error      = -1;
+#else
+    using socket_t                 = int;    //
+    using native_msg_size_input_t        = size_t; // the input message length type for send/recv/sendto/recvfrom
+    using native_msg_size_return_t = ssize_t;// the return type for send/recv/sendto/recvfrom
+    static const socket_t     invalid_socket = -1;
+    static const int          socket_error   = -1;
+    static const ssize_t      msg_error      = -1;
+#endif
+
+    static const int          bind_error     = -1;
+    static const int          listen_error   = -1;
+    static const int          connect_error   = -1;
+
+    typedef std::int32_t   msg_size_t;
+
+
+    static const msg_size_t error = -1;
+
+    socket_base() : m_fd( invalid_socket )
+    {
+    }
+
+    socket_base(socket_base const & other) : m_fd(other.m_fd), m_family(other.m_family), m_stats(other.m_stats)
+    {
+    }
+    socket_base(socket_base && other) : m_fd(other.m_fd), m_family(other.m_family), m_stats( std::move(other.m_stats) )
+    {
+        other.m_fd=invalid_socket;
+    }
+    socket_base & operator=(socket_base && other)
+    {
+        if( this != &other)
+        {
+            m_fd     = other.m_fd;
+            m_family = other.m_family;
+            m_stats  = std::move(other.m_stats);
+            other.m_fd=invalid_socket;
+        }
+        return *this;
+    }
+
+    bool create(int __domain, int __type, int __protocol)
+    {
+    #ifdef _MSC_VER
+        WSADATA wsa;
+        if (WSAStartup(MAKEWORD(2,2),&wsa) != 0)
+        {
+            //printf("Failed. Error Code : %d",WSAGetLastError());
+            return false;
+        }
+    #endif
+        if ( (m_fd=socket(__domain, __type, __protocol)) == invalid_socket)
+        {
+            #ifdef _MSC_VER
+          //  printf("Create failed with error code : %d\n" , WSAGetLastError() );
+            #else
+            printf("Create failed with error code : %d : %s\n" , errno,  strerror(errno) );
+            #endif
+            return false;
+        }
+        m_family = __domain;
+        return true;
+    }
+
+    /**
+     * @brief family
+     * @return the address family the socket was created with, eg: AF_INET
+     *         or AF_INET6
+     */
+    int family() const
+    {
+        return m_family;
+    }
+
+    bool bind(socket_address const & addr)
+    {
+        auto ret = ::bind(m_fd, addr.data(), addr.size());
+
+        if( ret == bind_error)
+        {
+            #ifdef _MSC_VER
+            //printf("Bind failed with error code : %d" , WSAGetLastError() );
+            #else
+            //printf("Bind failed with error code : %d : %s" , errno,  strerror(errno) );
+            #endif
+            return false;
+        }
+        return true;
+    }
+
+
+    /**
+     * @brief close
+     * Closes the socket. The socket will cast to false after this has been
+     * called.
+     */
+    void close()
+    {
+        #ifdef _MSC_VER
+            ::closesocket(m_fd);
+        #else
+            ::shutdown(m_fd, SHUT_RDWR);
+            ::close(m_fd);
+        #endif
+        m_fd = invalid_socket;
+    }
+
+    /**
+     * @brief set_blocking
+     * @param blocking
+     * @return
+     *
+     * Puts the socket into blocking or non-blocking mode. In non-blocking
+     * mode, calls which would otherwise wait return socket_base::error
+     * immediately (with errno set to EAGAIN/EWOULDBLOCK).
+     */
+    bool set_blocking(bool blocking)
+    {
+    #if defined _MSC_VER
+        u_long mode = blocking ? 0 : 1;
+        return ::ioctlsocket(m_fd, FIONBIO, &mode) == 0;
+    #else
+        int flags = ::fcntl(m_fd, F_GETFL, 0);
+        if( flags == -1 )
+            return false;
+        flags = blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+        return ::fcntl(m_fd, F_SETFL, flags) == 0;
+    #endif
+    }
+
+    /**
+     * @brief wait_readable
+     * @param timeout - maximum time to wait
+     * @return true if the socket became readable (data has arrived, a
+     *         client is waiting to be accepted or the peer closed the
+     *         connection), false on timeout or error
+     */
+    bool wait_readable(std::chrono::milliseconds timeout) const
+    {
+        return wait_for(POLLIN, timeout);
+    }
+
+    /**
+     * @brief wait_writable
+     * @param timeout - maximum time to wait
+     * @return true if data can be written to the socket (or a non-blocking
+     *         connect has finished), false on timeout or error
+     */
+    bool wait_writable(std::chrono::milliseconds timeout) const
+    {
+        return wait_for(POLLOUT, timeout);
+    }
+
+    /**
+     * @brief pending_error
+     * @return
+     *
+     * Returns and clears the pending error on the socket (SO_ERROR). This is
+     * how the result of a non-blocking connect is read.
+     */
+    int pending_error() const
+    {
+        int err = 0;
+    #if defined _MSC_VER
+        int length = sizeof(err);
+    #else
+        socklen_t length = sizeof(err);
+    #endif
+        if( ::getsockopt(m_fd, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&err), &length) == socket_error )
+            return last_error();
+        return err;
+    }
+
+    /**
+     * @brief last_error
+     * @return
+     *
+     * Returns the error code of the last failed socket call on this thread.
+     */
+    static int last_error()
+    {
+    #if defined _MSC_VER
+        return WSAGetLastError();
+    #else
+        return errno;
+    #endif
+    }
+
+    /**
+     * @brief would_block
+     * @return
+     *
+     * Returns true if the last failed call on a non-blocking socket only
+     * failed because it would have had to wait.
+     */
+    static bool would_block()
+    {
+    #if defined _MSC_VER
+        int e = WSAGetLastError();
+        return e == WSAEWOULDBLOCK || e == WSAEINPROGRESS;
+    #else
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS;
+    #endif
+    }
+
+    /**
+     * @brief set_option
+     * @param option - one of the options in gnl::socket_options
+     * @return false if the option could not be set
+     *
+     * Sets a socket option, eg:
+     *
+     *   S.set_option( gnl::socket_options::tcp_nodelay(true) );
+     */
+    template<typename Option>
+    bool set_option(Option const & option)
+    {
+        return ::setsockopt(m_fd, option.level(), option.name(),
+                            static_cast<char const*>(option.data()),
+                            static_cast<int>(option.size()) ) != socket_error;
+    }
+
+    /**
+     * @brief get_option
+     * @param option - one of the options in gnl::socket_options
+     * @return false if the option could not be read
+     *
+     * Reads back the current value of a socket option.
+     */
+    template<typename Option>
+    bool get_option(Option & option) const
+    {
+    #if defined _MSC_VER
+        int length = static_cast<int>(option.size());
+    #else
+        socklen_t length = static_cast<socklen_t>(option.size());
+    #endif
+        return ::getsockopt(m_fd, option.level(), option.name(),
+                            static_cast<char*>(option.data()), &length) != socket_error;
+    }
+
+    /**
+     * @brief native_handle
+     * @return
+     *
+     * Returns the native handle of the socket descriptor
+     */
+    socket_t native_handle() const
+    {
+        return m_fd;
+    }
+
+    /**
+     * @brief enable_stats
+     *
+     * Starts keeping I/O counters and send/recv latency histograms for
+     * this socket. Copies of the socket share the same counters. Sockets
+     * always count towards global_stats( ), whether this is called or not,
+     * but latency is only measured for sockets which enabled stats.
+     */
+    void enable_stats()
+    {
+        if( !m_stats )
+            m_stats = std::make_shared<io_counters>();
+    }
+
+    /**
+     * @brief stats
+     * @return a snapshot of this socket's counters. Everything is 0 if
+     *         enable_stats( ) was not called.
+     */
+    io_statistics stats() const
+    {
+        return m_stats ? m_stats->snapshot() : io_statistics();
+    }
+
+    /**
+     * @brief global_stats
+     * @return the totals over all sockets, from all threads, since the
+     *         program started.
+     *
+     * Define GNL_SOCKET_NO_STATS to compile out all the counting.
+     */
+    static io_statistics global_stats()
+    {
+        detail::io_registry & r = detail::io_registry::get();
+        std::lock_guard<std::mutex> L(r.mutex);
+
+        io_statistics s = r.retired;
+        for(auto c : r.live)
+            s += c->snapshot();
+        return s;
+    }
+
+    protected:
+        // call before a send/recv system call, returns the start time if
+        // this socket measures latency
+        std::uint64_t stats_start() const
+        {
+        #if defined GNL_SOCKET_NO_STATS
+            return 0;
+        #else
+            return m_stats ? io_counters::now_ns() : 0;
+        #endif
+        }
+
+        // call right after a send system call, before errno can change.
+        // Returns the result unchanged.
+        template<typename T>
+        T count_send(std::size_t requested, T result, std::uint64_t start) const
+        {
+        #if !defined GNL_SOCKET_NO_STATS
+            bool          wb = result < 0 && would_block();
+            std::uint64_t ns = start ? std::max<std::uint64_t>(io_counters::now_ns() - start, 1) : 0;
+
+            detail::local_io_counters().record_send(requested, static_cast<std::int64_t>(result), wb, ns);
+            if( m_stats )
+                m_stats->record_send(requested, static_cast<std::int64_t>(result), wb, ns);
+        #endif
+            return result;
+        }
+
+        // call right after a recv system call, before errno can change.
+        // Returns the result unchanged.
+        template<typename T>
+        T count_recv(std::size_t requested, T result, std::uint64_t start) const
+        {
+        #if !defined GNL_SOCKET_NO_STATS
+            bool          wb = result < 0 && would_block();
+            std::uint64_t ns = start ? std::max<std::uint64_t>(io_counters::now_ns() - start, 1) : 0;
+
+            detail::local_io_counters().record_recv(requested, static_cast<std::int64_t>(result), wb, ns);
+            if( m_stats )
+                m_stats->record_recv(requested, static_cast<std::int64_t>(result), wb, ns);
+        #endif
+            return result;
+        }
+
+    protected:
+        /**
+         * @brief send_buffers
+         * @param buffers - array of buffers to send, in order
+         * @param count - number of buffers in the array
+         * @param flags - flags passed to sendmsg/WSASend
+         * @return the number of bytes sent or socket_base::error
+         *
+         * Gathers all the buffers into a single send call.
+         */
+        msg_size_t send_buffers(io_buffer const * buffers, std::size_t count, int flags)
+        {
+        #if defined _MSC_VER
+            DWORD sent = 0;
+            std::uint64_t start = stats_start();
+            auto ret = ::WSASend(m_fd, const_cast<io_buffer*>(buffers), static_cast<DWORD>(count), &sent, static_cast<DWORD>(flags), NULL, NULL);
+            return count_send(total_size(buffers, count), ret == socket_error ? error : msg_size_t(sent), start);
+        #else
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov    = const_cast<io_buffer*>(buffers);
+            msg.msg_iovlen = count;
+
+            std::uint64_t start = stats_start();
+            native_msg_size_return_t ret = count_send(total_size(buffers, count), ::sendmsg(m_fd, &msg, flags), start);
+            return msg_size_t(ret);
+        #endif
+        }
+
+        /**
+         * @brief recv_buffers
+         * @param buffers - array of buffers to fill, in order
+         * @param count - number of buffers in the array
+         * @param flags - flags passed to recvmsg/WSARecv
+         * @return the number of bytes read, 0 if the peer closed the
+         *         connection or socket_base::error
+         *
+         * Scatters the incoming data over all the buffers with a single
+         * recv call.
+         */
+        msg_size_t recv_buffers(io_buffer * buffers, std::size_t count, int flags)
+        {
+        #if defined _MSC_VER
+            DWORD read  = 0;
+            DWORD wflags = static_cast<DWORD>(flags);
+            std::uint64_t start = stats_start();
+            auto ret = ::WSARecv(m_fd, buffers, static_cast<DWORD>(count), &read, &wflags, NULL, NULL);
+            return count_recv(total_size(buffers, count), ret == socket_error ? error : msg_size_t(read), start);
+        #else
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov    = buffers;
+            msg.msg_iovlen = count;
+
+            std::uint64_t start = stats_start();
+            native_msg_size_return_t ret = count_recv(total_size(buffers, count), ::recvmsg(m_fd, &msg, flags), start);
+            return msg_size_t(ret);
+        #endif
+        }
+
+        /**
+         * @brief recv_ring
+         * @param ring
+         * @return the number of bytes read, 0 if the peer closed the
+         *         connection or socket_base::error
+         *
+         * Reads as much data as is available (up to the free space in the
+         * ring) directly into the ring.
+         */
+        msg_size_t recv_ring(ring_buffer & ring)
+        {
+            io_buffer regions[2];
+            std::size_t n = ring.write_regions(regions);
+            if( n == 0 )
+                return 0;
+
+            msg_size_t t = recv_buffers(regions, n, 0);
+            if( t > 0 )
+                ring.commit( static_cast<std::size_t>(t) );
+            return t;
+        }
+
+        /**
+         * @brief send_ring
+         * @param ring
+         * @return the number of bytes sent or socket_base::error
+         *
+         * Sends the data in the ring and removes whatever was sent.
+         */
+        msg_size_t send_ring(ring_buffer & ring)
+        {
+            io_buffer regions[2];
+            std::size_t n = ring.read_regions(regions);
+            if( n == 0 )
+                return 0;
+
+            msg_size_t t = send_buffers(regions, n, 0);
+            if( t > 0 )
+                ring.consume( static_cast<std::size_t>(t) );
+            return t;
+        }
+
+        bool wait_for(short events, std::chrono::milliseconds timeout) const
+        {
+            struct pollfd p;
+            p.fd      = m_fd;
+            p.events  = events;
+            p.revents = 0;
+
+            // milliseconds::max( ) waits forever, anything else beyond what
+            // poll can take is cut down to that
+            int ms = -1;
+            if( timeout != std::chrono::milliseconds::max() )
+            {
+                auto count = timeout.count() < 0 ? 0 : timeout.count();
+                ms = static_cast<int>( std::min<decltype(count)>(count, std::numeric_limits<int>::max()) );
+            }
+        #if defined _MSC_VER
+            int ret = ::WSAPoll(&p, 1, ms);
+        #else
+            int ret = ::poll(&p, 1, ms);
+            while( ret == -1 && errno == EINTR )
+                ret = ::poll(&p, 1, ms);
+        #endif
+            if( ret == 0 )
+            {
+                errno = ETIMEDOUT;
+                return false;
+            }
+            return ret > 0;
+        }
+
+        // now + timeout, saturated so a timeout of milliseconds::max( ) (or
+        // anything else which would overflow) means no deadline
+        static std::chrono::steady_clock::time_point deadline_after(std::chrono::milliseconds timeout)
+        {
+            auto now = std::chrono::steady_clock::now();
+            if( timeout > std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::time_point::max() - now ) )
+                return std::chrono::steady_clock::time_point::max();
+            return now + timeout;
+        }
+
+        // time until the deadline, rounded up to the next millisecond
+        static std::chrono::milliseconds time_left(std::chrono::steady_clock::time_point deadline)
+        {
+            if( deadline == std::chrono::steady_clock::time_point::max() )
+                return std::chrono::milliseconds::max();
+
+            auto left = deadline - std::chrono::steady_clock::now();
+            if( left <= std::chrono::steady_clock::duration::zero() )
+                return std::chrono::milliseconds(0);
+            return std::chrono::duration_cast<std::chrono::milliseconds>( left + std::chrono::milliseconds(1) - std::chrono::steady_clock::duration(1) );
+        }
+
+        static std::size_t total_size(io_buffer const * buffers, std::size_t count)
+        {
+            std::size_t total = 0;
+            for(std::size_t i=0; i < count; i++)
+                total += buffers[i].size();
+            return total;
+        }
+
+    protected:
+        socket_t m_fd     = invalid_socket;
+        int      m_family = AF_UNSPEC;
+
+        std::shared_ptr<io_counters> m_stats; // null unless enable_stats( ) was called
+};
+
+/**
+ * @brief The udp_socket class
+ *
+ * A udp socket class to send UDP data to various clients.
+ */
+class udp_socket : public socket_base
+{
+public:
+
+    /**
+     * @brief create
+     * @param family - AF_INET or AF_INET6
+     *
+     * Creates the socket.  This must be called before you can bind it.
+     */
+    bool create(int family = AF_INET)
+    {
+        return socket_base::create(family, SOCK_DGRAM, IPPROTO_UDP);
+    }
+
+
+    /**
+     * @brief send
+     * @param data - the data packet to send
+     * @param length - number of bytes in the packet to send
+     * @param addr - the address to send the data to
+     * @return Returns socket::error if an error occurs or returns the number
+     *         of bytes sent if success
+     *
+     *
+     */
+    msg_size_t  send(char const * data, size_t length, socket_address const & addr)
+    {
+        std::uint64_t start = stats_start();
+        native_msg_size_return_t ret = count_send(length, ::sendto(m_fd, data, static_cast<native_msg_size_input_t>(length&0xFFFFFFFF) , 0 , addr.data(), addr.size()), start);
+        if ( ret == msg_error)
+        {
+            #ifdef _MSC_VER
+            //printf("Send failed with error code : %d" , WSAGetLastError() );
+            #else
+            //printf("Send failed with error code : %d : %s" , errno,  strerror(errno) );
+            #endif
+            return msg_size_t(ret);
+        }
+        return msg_size_t(ret);
+    }
+
+    /**
+     * @brief recv
+     * @param buf - buffer to write the data into
+     * @param length - maximum length of the buffer
+     * @param addr -  reference to a address struct where the ip/port of teh
+     *                client will be stored
+     * @return returns udp_socket::error if error or the number of bytes recieved
+     *
+     * Recieves data from the socket
+     */
+    msg_size_t recv(char * buf, size_t length, socket_address & addr)
+    {
+        socket_address::length_t slen = socket_address::capacity();
+
+        std::uint64_t start = stats_start();
+        native_msg_size_return_t ret  = count_recv(length, ::recvfrom( m_fd, buf, static_cast<native_msg_size_input_t>(length&0xFFFFFFFF), 0, addr.data(), &slen), start);
+        addr.resize(slen);
+
+        if (ret == msg_error)
+        {
+            #ifdef _MSC_VER
+            //printf("Recv failed with error code : %d" , WSAGetLastError() );
+            #else
+            //printf("Recv failed with error code : %d : %s" , errno,  strerror(errno) );
+            #endif
+            //return msg_error;
+        }
+        return msg_size_t(ret);
+    }
+
+    /**
+     * @brief operator bool
+     *
+     * Conversion to bool. Converts to false if the socket is
+     * not created or if it has an error
+     */
+    operator bool()
+    {
+        return !( ( m_fd == invalid_socket ) );
+    }
+
+};
+
+
+
+class tcp_socket : public socket_base
+{
+public:
+
+    tcp_socket() : socket_base()
+    {
+    }
+
+    tcp_socket( tcp_socket && other)
+    {
+        m_fd       = other.m_fd;
+        m_family   = other.m_family;
+        m_address  = other.m_address;
+        m_zerocopy_threshold = other.m_zerocopy_threshold;
+        m_zerocopy_sent      = other.m_zerocopy_sent;
+        m_zerocopy_completed = other.m_zerocopy_completed;
+        m_stats              = std::move(other.m_stats);
+        m_options            = std::move(other.m_options);
+        other.m_fd = invalid_socket;
+        other.m_address = socket_address();
+        other.m_zerocopy_threshold = 0;
+    }
+
+    tcp_socket( const tcp_socket & other) : socket_base( other)
+    {
+        m_fd = other.m_fd;
+        m_address = other.m_address;
+        m_zerocopy_threshold = other.m_zerocopy_threshold;
+        m_zerocopy_sent      = other.m_zerocopy_sent;
+        m_zerocopy_completed = other.m_zerocopy_completed;
+        m_options            = other.m_options;
+    }
+
+    tcp_socket& operator=( tcp_socket const & other)
+    {
+        m_fd      = other.m_fd;
+        m_family  = other.m_family;
+        m_address = other.m_address;
+        m_zerocopy_threshold = other.m_zerocopy_threshold;
+        m_zerocopy_sent      = other.m_zerocopy_sent;
+        m_zerocopy_completed = other.m_zerocopy_completed;
+        m_stats              = other.m_stats;
+        m_options            = other.m_options;
+        return *this;
+    }
+
+    tcp_socket& operator=( tcp_socket && other)
+    {
+        if( this != &other)
+        {
+            m_fd      = other.m_fd;
+            m_family  = other.m_family;
+            m_address = other.m_address;
+            m_zerocopy_threshold = other.m_zerocopy_threshold;
+            m_zerocopy_sent      = other.m_zerocopy_sent;
+            m_zerocopy_completed = other.m_zerocopy_completed;
+            m_stats              = std::move(other.m_stats);
+            m_options            = std::move(other.m_options);
+            other.m_address = socket_address();
+            other.m_fd = invalid_socket;
+            other.m_zerocopy_threshold = 0;
+        }
+        return *this;
+    }
+
+    /**
+     * @brief operator bool
+     *
+     * Conversion to bool. Converts to false if the socket is
+     * not created or if it has an error
+     */
+    operator bool()
+    {
+        return !( ( m_fd == invalid_socket )  );
+    }
+
+    /**
+     * @brief bind
+     * @param port
+     * @return
+     *
+     * Bind the socket to a port so it can start listening for incoming
+     * tcp connections. If the socket was created with AF_INET6 it listens
+     * on all IPv6 and IPv4 interfaces: IPV6_V6ONLY is turned off, rather
+     * than leaving it to the system's default.
+     */
+    bool bind( uint16_t port)
+    {
+    #if defined IPV6_V6ONLY
+        if( m_family == AF_INET6 && !set_option( socket_options::ipv6_only(false) ) )
+            return false;
+    #endif
+        return socket_base::bind( socket_address(port, m_family) );
+    }
+
+    /**
+     * @brief bind
+     * @param addr
+     * @return
+     *
+     * Bind the socket to a specific local address
+     */
+    bool bind( socket_address const & addr)
+    {
+        return socket_base::bind(addr);
+    }
+
+    /**
+     * @brief connect
+     * @param server - the server ip address/host name
+     * @param port - the port number
+     * @return
+     *
+     * Connect to a server. Host names are looked up through
+     * resolver::global( ), so only the first connect to a host waits for
+     * DNS. Each address of the host is tried in turn.
+     */
+    bool connect( const char * server, std::uint16_t port)
+    {
+        return connect( server, port, std::chrono::milliseconds::max() );
+    }
+
+    /**
+     * @brief connect
+     * @param server - the server ip address/host name
+     * @param port - the port number
+     * @param timeout - maximum time to wait for the connection
+     * @return false if the connection failed or timed out
+     *
+     * Connect to a server, giving up after the timeout instead of waiting
+     * for the operating system's connect timeout (which can be minutes).
+     */
+    bool connect( const char * server, std::uint16_t port, std::chrono::milliseconds timeout)
+    {
+        resolver::addresses_t addresses = resolver::global().resolve(server, port);
+        if( addresses.empty() )
+        {
+            errno = EHOSTUNREACH;
+            return false;
+        }
+
+        for(std::size_t i=0; i < addresses.size(); i++)
+        {
+            // a failed connect leaves the socket unusable
+            if( i > 0 && !recreate(addresses[i].family()) )
+                return false;
+            if( connect(addresses[i], timeout) )
+                return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief connect
+     * @param addr - the address of the server
+     * @param timeout - maximum time to wait for the connection, the
+     *                  default waits as long as the operating system does
+     * @return false if the connection failed or timed out
+     *
+     * If the socket was created for a different address family than addr
+     * (eg: create( ) makes an IPv4 socket but addr is IPv6) it is
+     * recreated with the right family first. The options which were set
+     * with set_option( ) are set again on the new socket.
+     */
+    bool connect( socket_address const & addr, std::chrono::milliseconds timeout = std::chrono::milliseconds::max() )
+    {
+        if( m_fd == invalid_socket )
+        {
+            if( !create(addr.family()) )
+                return false;
+        }
+        else if( m_family != addr.family() )
+        {
+            if( !recreate(addr.family()) )
+                return false;
+        }
+        m_address = addr;
+
+        if( timeout == std::chrono::milliseconds::max() )
+        {
+            return ::connect( m_fd, addr.data(), addr.size()) != socket_error;
+        }
+
+        if( !set_blocking(false) )
+            return false;
+
+        decltype(socket_error) ret = ::connect( m_fd, addr.data(), addr.size());
+
+        bool ok = ret != socket_error;
+        if( !ok && would_block() )
+        {
+            ok = wait_writable(timeout);
+            if( ok )
+            {
+                int err = pending_error();
+                ok = err == 0;
+                if( !ok )
+                    errno = err;
+            }
+        }
+
+        set_blocking(true);
+        return ok;
+    }
+
+    /**
+     * @brief create
+     * @param family - AF_INET or AF_INET6
+     * @return
+     *
+     * Create the socket. THis must be called before you do any actions on
+     * the socket.
+     */
+    bool create(int family = AF_INET)
+    {
+        m_options.clear();
+        return socket_base::create(family, SOCK_STREAM, IPPROTO_TCP );
+    }
+
+    /**
+     * @brief set_option
+     * @param option - one of the options in gnl::socket_options
+     * @return false if the option could not be set
+     *
+     * Same as socket_base::set_option( ), but the option is remembered so
+     * it can be set again if connect( ) has to recreate the socket.
+     */
+    template<typename Option>
+    bool set_option(Option const & option)
+    {
+        if( !socket_base::set_option(option) )
+            return false;
+
+        int value = *static_cast<int const*>( option.data() );
+        for(auto & o : m_options)
+        {
+            if( o.level == option.level() && o.name == option.name() )
+            {
+                o.value = value;
+                return true;
+            }
+        }
+        m_options.push_back( saved_option{option.level(), option.name(), value} );
+        return true;
+    }
+
+    /**
+     * @brief listen
+     * @param max_connections
+     * @return
+     *
+     * Puts the socket into listening mode so that it can accept client
+     * connections
+     */
+    bool listen( std::size_t max_connections)
+    {
+        decltype(socket_error) code = ::listen( m_fd, static_cast<int>(max_connections));
+
+        if( code == socket_error)
+        {
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief accept
+     * @return
+     *
+     * Accept a new connected client. This function blocks until
+     * a client connects.
+     */
+    tcp_socket accept()
+    {
+        tcp_socket client;
+
+        socket_address::length_t length = socket_address::capacity();
+
+        client.m_fd  = ::accept(m_fd, client.m_address.data(), &length);
+        if( client.m_fd != invalid_socket )
+        {
+            client.m_address.resize(length);
+            client.m_family = m_family;
+        }
+
+        return client;
+
+    }
+
+    /**
+     * @brief accept
+     * @param timeout - maximum time to wait for a client
+     * @return the client, which converts to false if no client connected
+     *         before the timeout
+     *
+     * Accept a new connected client, waiting at most timeout. The
+     * listening socket is put into non-blocking mode for the accept
+     * itself, since the client can disconnect, or be accepted by another
+     * thread, after the wait has seen it.
+     */
+    tcp_socket accept(std::chrono::milliseconds timeout)
+    {
+        auto deadline = deadline_after(timeout);
+        for(;;)
+        {
+            if( !wait_readable( time_left(deadline) ) )
+                return tcp_socket();
+
+        #if defined _MSC_VER
+            bool was_blocking = true; // winsock can not be asked
+            int  aborted      = WSAECONNABORTED;
+        #else
+            bool was_blocking = !( ::fcntl(m_fd, F_GETFL, 0) & O_NONBLOCK );
+            int  aborted      = ECONNABORTED;
+        #endif
+            if( was_blocking )
+                set_blocking(false);
+
+            tcp_socket client = accept();
+            bool       retry  = client.native_handle() == invalid_socket && (would_block() || last_error() == aborted);
+
+            if( was_blocking )
+            {
+                int e = errno;
+                set_blocking(true);
+                errno = e;
+            }
+
+            if( !retry )
+                return client;
+        }
+    }
+
+    /**
+     * @brief send
+     * @param data
+     * @param size
+     * @return returns 0 if the client disconnected, otherwise returns the
+     *         number of bytes sent
+     *
+     * Sends data to this socket.
+     */
+    msg_size_t send( void const * data, size_t _size)
+    {
+
+        std::uint64_t start = stats_start();
+        native_msg_size_return_t ret = count_send(_size, ::send(m_fd, reinterpret_cast<const char*>(data), static_cast<native_msg_size_input_t>(_size&0xFFFFFFFF), 0), start);
+
+        return msg_size_t(ret);
+    }
+
+    /**
+     * @brief send
+     * @param buffers - array of buffers to send, in order
+     * @param count - number of buffers
+     * @return returns the total number of bytes sent or tcp_socket::error
+     *
+     * Gathers several buffers into a single send call (writev/sendmsg).
+     * This lets you send a header and a payload without two system calls
+     * and without copying them into one buffer first, eg:
+     *
+     *   io_buffer msg[] = { io_buffer(&header, sizeof(header)),
+     *                       io_buffer(payload, payload_size) };
+     *   S.send(msg);
+     *
+     * If enable_zerocopy( ) has been called and the total size is at least
+     * the zerocopy threshold, the data is sent with MSG_ZEROCOPY. In that
+     * case the buffers must not be modified until zerocopy_completed( )
+     * reports that the send has finished.
+     */
+    msg_size_t send(io_buffer const * buffers, std::size_t count)
+    {
+        int flags = 0;
+    #if defined GNL_SOCKET_HAS_ZEROCOPY
+        bool zerocopy = m_zerocopy_threshold != 0 && total_size(buffers, count) >= m_zerocopy_threshold;
+        if( zerocopy )
+            flags |= MSG_ZEROCOPY;
+    #endif
+
+        msg_size_t ret = send_buffers(buffers, count, flags);
+
+    #if defined GNL_SOCKET_HAS_ZEROCOPY
+        if( zerocopy && ret != error )
+            ++m_zerocopy_sent;
+    #endif
+        return ret;
+    }
+
+    template<std::size_t N>
+    msg_size_t send(io_buffer const (&buffers)[N])
+    {
+        return send(buffers, N);
+    }
+
+    msg_size_t send(std::initializer_list<io_buffer> buffers)
+    {
+        return send(buffers.begin(), buffers.size());
+    }
+
+    msg_size_t send(std::vector<io_buffer> const & buffers)
+    {
+        return send(buffers.data(), buffers.size());
+    }
+
+    /**
+     * @brief recv
+     * @param data
+     * @param size
+     * @return  the number of bytes read, or zero if the client disconnected.
+     *          returns tcp_socket::error if an error occoured
+     *
+     * Recieves data from the socket. This function blocks until the total
+     * number of bytes have been recieved.
+     */
+    msg_size_t recv(void * data, size_t _size)
+    {
+        bool wait_for_all = true; // default for now.
+
+        std::uint64_t start = stats_start();
+        native_msg_size_return_t t = count_recv(_size, ::recv( m_fd, reinterpret_cast<char*>(data), static_cast<native_msg_size_input_t>(_size&0xFFFFFFFF), wait_for_all ? MSG_WAITALL : 0 ), start);
+
+        if( t == 0 && _size != 0 ) // gracefully closed
+        {
+            m_fd = invalid_socket;
+        }
+        return msg_size_t(t);
+    }
+
+    /**
+     * @brief recv_some
+     * @param data
+     * @param size - maximum number of bytes to read
+     * @return the number of bytes read, or zero if the client disconnected.
+     *         returns tcp_socket::error if an error occoured
+     *
+     * Recieves whatever data is currently available, up to size bytes.
+     * Unlike recv( ), this only blocks until at least one byte has arrived,
+     * so a large buffer can be filled with as many messages as are waiting
+     * using a single system call.
+     */
+    msg_size_t recv_some(void * data, size_t _size)
+    {
+        std::uint64_t start = stats_start();
+        native_msg_size_return_t t = count_recv(_size, ::recv( m_fd, reinterpret_cast<char*>(data), static_cast<native_msg_size_input_t>(_size&0xFFFFFFFF), 0 ), start);
+
+        if( t == 0 && _size != 0 ) // gracefully closed
+        {
+            m_fd = invalid_socket;
+        }
+        return msg_size_t(t);
+    }
+
+#if defined MSG_DONTWAIT
+    /**
+     * @brief try_recv
+     * @param data
+     * @param size - maximum number of bytes to read
+     * @return the number of bytes read, 0 if the peer closed the connection
+     *         or tcp_socket::error. If nothing is waiting, the error is
+     *         EAGAIN/EWOULDBLOCK (see would_block( )).
+     *
+     * Recieves whatever data is available without ever blocking, even if
+     * the socket is in blocking mode. Unlike recv( ) the socket is left
+     * open when the peer disconnects, so it can still be closed.
+     */
+    msg_size_t try_recv(void * data, size_t _size)
+    {
+        std::uint64_t start = stats_start();
+        native_msg_size_return_t t = count_recv(_size, ::recv( m_fd, reinterpret_cast<char*>(data), static_cast<native_msg_size_input_t>(_size&0xFFFFFFFF), MSG_DONTWAIT ), start);
+        return msg_size_t(t);
+    }
+
+    /**
+     * @brief try_send
+     * @param data
+     * @param size
+     * @return the number of bytes sent, which can be less than size, or
+     *         tcp_socket::error. If the send buffer is full, the error is
+     *         EAGAIN/EWOULDBLOCK (see would_block( )).
+     *
+     * Sends as much as fits into the socket's send buffer without ever
+     * blocking. A closed connection is reported as EPIPE rather than by
+     * raising SIGPIPE.
+     */
+    msg_size_t try_send(void const * data, size_t _size)
+    {
+    #if defined MSG_NOSIGNAL
+        int flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+    #else
+        int flags = MSG_DONTWAIT;
+    #endif
+        std::uint64_t start = stats_start();
+        native_msg_size_return_t ret = count_send(_size, ::send(m_fd, reinterpret_cast<const char*>(data), static_cast<native_msg_size_input_t>(_size&0xFFFFFFFF), flags), start);
+        return msg_size_t(ret);
+    }
+#endif
+
+    /**
+     * @brief send
+     * @param data
+     * @param size
+     * @param timeout - maximum time to spend sending
+     * @return the number of bytes sent, or tcp_socket::error if the
+     *         timeout expired (errno is set to ETIMEDOUT) or an error
+     *         occured. Some of the data may have been sent on error.
+     *
+     * Sends all the data, giving up if the peer does not accept it
+     * within the timeout. milliseconds::max( ) waits forever.
+     */
+    msg_size_t send( void const * data, size_t _size, std::chrono::milliseconds timeout)
+    {
+        auto deadline = deadline_after(timeout);
+        char const * p = static_cast<char const*>(data);
+        size_t sent = 0;
+
+        while( sent < _size )
+        {
+            auto remaining = time_left(deadline);
+            if( !wait_writable(remaining) )
+                return error;
+
+            std::uint64_t start = stats_start();
+        #if defined MSG_DONTWAIT
+            native_msg_size_return_t ret = count_send(_size-sent, ::send(m_fd, p + sent, static_cast<native_msg_size_input_t>((_size-sent)&0xFFFFFFFF), MSG_DONTWAIT), start);
+        #else
+            native_msg_size_return_t ret = count_send(_size-sent, ::send(m_fd, p + sent, static_cast<native_msg_size_input_t>((_size-sent)&0xFFFFFFFF), 0), start);
+        #endif
+            if( ret == msg_error )
+            {
+                if( would_block() )
+                    continue;
+                return error;
+            }
+            sent += static_cast<size_t>(ret);
+        }
+        return msg_size_t(sent);
+    }
+
+    /**
+     * @brief recv
+     * @param data
+     * @param size
+     * @param timeout - maximum time to wait for all the data
+     * @return the number of bytes read, zero if the client disconnected or
+     *         tcp_socket::error if the timeout expired (errno is set to
+     *         ETIMEDOUT) or an error occured. Some data may have been read
+     *         into the buffer on error.
+     *
+     * Recieves exactly size bytes, giving up if they have not all arrived
+     * within the timeout. A hung peer can then no longer block the calling
+     * thread forever, unless the timeout is milliseconds::max( ).
+     */
+    msg_size_t recv(void * data, size_t _size, std::chrono::milliseconds timeout)
+    {
+        auto deadline = deadline_after(timeout);
+        char * p = static_cast<char*>(data);
+        size_t read = 0;
+
+        while( read < _size )
+        {
+            auto remaining = time_left(deadline);
+            if( !wait_readable(remaining) )
+                return error;
+
+            msg_size_t ret = recv_some(p + read, _size - read);
+            if( ret == 0 )
+                return 0;
+            if( ret == error )
+            {
+                if( would_block() )
+                    continue;
+                return error;
+            }
+            read += static_cast<size_t>(ret);
+        }
+        return msg_size_t(read);
+    }
+
+    /**
+     * @brief recv
+     * @param buffers - array of buffers to fill, in order
+     * @param count - number of buffers
+     * @return the total number of bytes read, or zero if the client
+     *         disconnected. returns tcp_socket::error if an error occoured
+     *
+     * Scatters the incoming data over several buffers with a single
+     * recv call (readv/recvmsg). Like recv( ), this blocks until all the
+     * buffers have been filled.
+     */
+    msg_size_t recv(io_buffer * buffers, std::size_t count)
+    {
+        msg_size_t t = recv_buffers(buffers, count, MSG_WAITALL);
+
+        if( t == 0 && total_size(buffers, count) != 0 ) // gracefully closed
+        {
+            m_fd = invalid_socket;
+        }
+        return t;
+    }
+
+    template<std::size_t N>
+    msg_size_t recv(io_buffer (&buffers)[N])
+    {
+        return recv(buffers, N);
+    }
+
+    msg_size_t recv(std::vector<io_buffer> & buffers)
+    {
+        return recv(buffers.data(), buffers.size());
+    }
+
+    /**
+     * @brief recv
+     * @param ring
+     * @return the number of bytes read, or zero if the client disconnected.
+     *         returns tcp_socket::error if an error occoured
+     *
+     * Reads whatever data is available directly into the free space of the
+     * ring buffer. Nothing is read and 0 is returned if the ring is full.
+     */
+    msg_size_t recv(ring_buffer & ring)
+    {
+        if( ring.full() )
+            return 0;
+
+        msg_size_t t = recv_ring(ring);
+        if( t == 0 ) // gracefully closed
+        {
+            m_fd = invalid_socket;
+        }
+        return t;
+    }
+
+    /**
+     * @brief send
+     * @param ring
+     * @return the number of bytes sent, or tcp_socket::error
+     *
+     * Sends the data waiting in the ring buffer. The bytes which were
+     * sent are consumed from the ring.
+     */
+    msg_size_t send(ring_buffer & ring)
+    {
+        return send_ring(ring);
+    }
+
+#if !defined _MSC_VER
+    /**
+     * @brief send_file
+     * @param fd - an open file descriptor to read from
+     * @param offset - where in the file to start
+     * @param length - number of bytes to send, 0 sends up to the end of the
+     *                 file
+     * @return the number of bytes sent or tcp_socket::error. This is 64 bit,
+     *         unlike the other sends, as files may be larger than 2GB.
+     *
+     * Sends part of a file without reading it into userspace. On Linux the
+     * kernel copies the file's pages straight to the socket with
+     * sendfile( ). If the file cannot be used with sendfile( ), the data is
+     * moved through a pipe with splice( ) instead. As a last resort, and on
+     * other systems, it is read and sent in chunks.
+     *
+     * The file position of fd is not changed. Fewer bytes are sent if the
+     * file is shorter than offset+length or, for a non-blocking socket, if
+     * the socket's send buffer fills up.
+     */
+    std::int64_t send_file(int fd, std::uint64_t offset = 0, std::uint64_t length = 0)
+    {
+        if( length == 0 )
+        {
+            struct stat st;
+            if( ::fstat(fd, &st) == -1 )
+                return error;
+            if( static_cast<std::uint64_t>(st.st_size) <= offset )
+                return 0;
+            length = static_cast<std::uint64_t>(st.st_size) - offset;
+        }
+
+        std::uint64_t sent = 0;
+
+    #if defined __linux__
+        while( sent < length )
+        {
+            off_t       off   = static_cast<off_t>(offset + sent);
+            std::size_t chunk = static_cast<std::size_t>( std::min<std::uint64_t>(length - sent, 1u<<30) );
+
+            std::uint64_t start = stats_start();
+            ssize_t n = count_send(chunk, ::sendfile(m_fd, fd, &off, chunk), start);
+            if( n > 0 )
+            {
+                sent += static_cast<std::uint64_t>(n);
+                continue;
+            }
+            if( n == 0 ) // end of file
+                return static_cast<std::int64_t>(sent);
+            if( errno == EINTR )
+                continue;
+            if( errno == EINVAL || errno == ENOSYS )
+                break;
+            return sent ? static_cast<std::int64_t>(sent) : error;
+        }
+
+        if( sent < length )
+        {
+            std::int64_t n = splice_file(fd, offset + sent, length - sent);
+            if( n == error )
+                return sent ? static_cast<std::int64_t>(sent) : error;
+            sent += static_cast<std::uint64_t>(n);
+        }
+        return static_cast<std::int64_t>(sent);
+    #else
+        return copy_file(fd, offset, length);
+    #endif
+    }
+
+    /**
+     * @brief send_file
+     * @param path - path to the file
+     * @param offset
+     * @param length - 0 sends up to the end of the file
+     * @return the number of bytes sent or tcp_socket::error
+     *
+     * Opens the file and sends it with send_file(fd, offset, length).
+     */
+    std::int64_t send_file(char const * path, std::uint64_t offset = 0, std::uint64_t length = 0)
+    {
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if( fd == -1 )
+            return error;
+
+        std::int64_t n = send_file(fd, offset, length);
+        ::close(fd);
+        return n;
+    }
+
+    std::int64_t send_file(std::string const & path, std::uint64_t offset = 0, std::uint64_t length = 0)
+    {
+        return send_file(path.c_str(), offset, length);
+    }
+
+    /**
+     * @brief send_file
+     * @param path - a gnl::path, or anything else with a to_stdstring( )
+     * @param offset
+     * @param length - 0 sends up to the end of the file
+     * @return the number of bytes sent or tcp_socket::error
+     */
+    template<typename Path>
+    auto send_file(Path const & path, std::uint64_t offset = 0, std::uint64_t length = 0) -> decltype( path.to_stdstring(), std::int64_t() )
+    {
+        return send_file( path.to_stdstring().c_str(), offset, length);
+    }
+#endif
+
+    /**
+     * @brief enable_zerocopy
+     * @param threshold - scatter/gather sends of at least this many bytes
+     *                    will be sent using MSG_ZEROCOPY
+     * @return false if the kernel does not support zerocopy sends
+     *
+     * Enables SO_ZEROCOPY on the socket. Zerocopy only pays off for large
+     * sends, smaller ones are still copied into the kernel as usual.
+     */
+    bool enable_zerocopy(std::size_t threshold = 16*1024)
+    {
+    #if defined GNL_SOCKET_HAS_ZEROCOPY
+        if( !set_option( socket_option<SOL_SOCKET, SO_ZEROCOPY, bool>(true) ) )
+            return false;
+        m_zerocopy_threshold = threshold == 0 ? 1 : threshold;
+        return true;
+    #else
+        return false;
+    #endif
+    }
+
+    /**
+     * @brief zerocopy_sent
+     * @return
+     *
+     * Returns the number of sends which have been made using MSG_ZEROCOPY.
+     */
+    std::uint32_t zerocopy_sent() const
+    {
+        return m_zerocopy_sent;
+    }
+
+    /**
+     * @brief zerocopy_completed
+     * @return
+     *
+     * Reads any zerocopy completion notifications from the socket's error
+     * queue and returns the number of zerocopy sends which the kernel has
+     * finished with. Once zerocopy_completed() == zerocopy_sent() all the
+     * buffers that were passed to send( ) can be reused.
+     *
+     * This does not block. It should be called regularly when zerocopy
+     * is enabled, otherwise the notifications pile up in the kernel.
+     */
+    std::uint32_t zerocopy_completed()
+    {
+    #if defined GNL_SOCKET_HAS_ZEROCOPY
+        for(;;)
+        {
+            char control[128];
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_control    = control;
+            msg.msg_controllen = sizeof(control);
+
+            if( ::recvmsg(m_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1 )
+                break;
+
+            for(struct cmsghdr * cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm))
+            {
+                if( !( (cm->cmsg_level == SOL_IP   && cm->cmsg_type == IP_RECVERR) ||
+                       (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR) ) )
+                    continue;
+
+                struct sock_extended_err err;
+                memcpy(&err, CMSG_DATA(cm), sizeof(err));
+
+                if( err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY )
+                    continue;
+
+                // ee_info..ee_data is the (inclusive) range of sends which completed
+                if( err.ee_data + 1 > m_zerocopy_completed )
+                    m_zerocopy_completed = err.ee_data + 1;
+            }
+        }
+    #endif
+        return m_zerocopy_completed;
+    }
+
+    /**
+     * @brief size
+     * @return
+     *
+     * Returns the number of bytes waiting in the buffer.
+     */
+    std::size_t size() const
+    {
+        #ifdef _MSC_VER
+            u_long bytes_available;
+            auto ret = ioctlsocket(m_fd, FIONREAD , &bytes_available);
+            if( ret == socket_error)
+                    return 0;
+        #else
+            int bytes_available;
+            auto ret = ioctl(m_fd,FIONREAD, &bytes_available);
+            if( ret == -1)
+                return 0;
+        #endif
+        return std::size_t(bytes_available);
+    }
+
+    /**
+     * @brief get_address
+     * @return
+     *
+     * Gets the address of the socket.
+     */
+    socket_address get_address() const
+    {
+        return m_address;
+    }
+protected:
+    struct saved_option
+    {
+        int level;
+        int name;
+        int value;
+    };
+
+    // replaces the socket with a new one of another family, after a failed
+    // connect or for an address of a different family, and sets the
+    // remembered options on it
+    bool recreate(int family)
+    {
+        std::vector<saved_option> options;
+        options.swap(m_options);
+
+        close();
+        if( !socket_base::create(family, SOCK_STREAM, IPPROTO_TCP) )
+            return false;
+
+        for(auto & o : options)
+        {
+            if( ::setsockopt(m_fd, o.level, o.name, reinterpret_cast<char const*>(&o.value), sizeof(o.value)) == socket_error )
+            {
+                if( o.level == IPPROTO_IPV6 && family != AF_INET6 )
+                    continue; // only means something on an IPv6 socket
+
+                int err = errno;
+                close();
+                errno = err;
+                return false;
+            }
+            m_options.push_back(o);
+        }
+        return true;
+    }
+
+#if !defined _MSC_VER
+    #if defined __linux__
+    // moves the file through a pipe: file -> pipe -> socket. The pages are
+    // only referenced by the pipe, never copied into userspace.
+    std::int64_t splice_file(int fd, std::uint64_t offset, std::uint64_t length)
+    {
+        int p[2];
+        if( ::pipe2(p, O_CLOEXEC) == -1 )
+            return copy_file(fd, offset, length);
+
+        std::uint64_t sent = 0;
+        bool          ok   = true;
+        while( ok && sent < length )
+        {
+            loff_t      off   = static_cast<loff_t>(offset + sent);
+            std::size_t chunk = static_cast<std::size_t>( std::min<std::uint64_t>(length - sent, 1u<<16) );
+
+            ssize_t in = ::splice(fd, &off, p[1], nullptr, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if( in == 0 )
+                break;
+            if( in < 0 )
+            {
+                if( errno == EINTR )
+                    continue;
+                if( sent == 0 && errno == EINVAL ) // this file can not be spliced
+                {
+                    ::close(p[0]);
+                    ::close(p[1]);
+                    return copy_file(fd, offset, length);
+                }
+                ok = false;
+                break;
+            }
+
+            // drain the pipe into the socket
+            while( in > 0 )
+            {
+                std::uint64_t start = stats_start();
+                ssize_t out = count_send(static_cast<std::size_t>(in), ::splice(p[0], nullptr, m_fd, nullptr, static_cast<std::size_t>(in), SPLICE_F_MOVE | SPLICE_F_MORE), start);
+                if( out < 0 && errno == EINTR )
+                    continue;
+                if( out <= 0 )
+                {
+                    ok = false;
+                    break;
+                }
+                in   -= out;
+                sent += static_cast<std::uint64_t>(out);
+            }
+        }
+        ::close(p[0]);
+        ::close(p[1]);
+
+        if( !ok && sent == 0 )
+            return error;
+        return static_cast<std::int64_t>(sent);
+    }
+    #endif
+
+    // the plain read and send fallback
+    std::int64_t copy_file(int fd, std::uint64_t offset, std::uint64_t length)
+    {
+        std::vector<char> buffer( static_cast<std::size_t>( std::min<std::uint64_t>(length, 1u<<16) ) );
+
+        std::uint64_t sent = 0;
+        while( sent < length )
+        {
+            std::size_t chunk = static_cast<std::size_t>( std::min<std::uint64_t>(length - sent, buffer.size()) );
+
+            ssize_t n = ::pread(fd, buffer.data(), chunk, static_cast<off_t>(offset + sent));
+            if( n < 0 && errno == EINTR )
+                continue;
+            if( n <= 0 )
+                break;
+
+            std::size_t done = 0;
+            while( done < static_cast<std::size_t>(n) )
+            {
+                msg_size_t w = send(buffer.data() + done, static_cast<std::size_t>(n) - done);
+                if( w <= 0 )
+                    return sent + done ? static_cast<std::int64_t>(sent + done) : error;
+                done += static_cast<std::size_t>(w);
+            }
+            sent += done;
+        }
+        return static_cast<std::int64_t>(sent);
+    }
+#endif
+
+    socket_address m_address;
+
+    std::vector<saved_option> m_options; // set with set_option( ), for recreate( )
+
+    std::size_t    m_zerocopy_threshold = 0; // 0 = zerocopy disabled
+    std::uint32_t  m_zerocopy_sent      = 0;
+    std::uint32_t  m_zerocopy_completed = 0;
+};
+
+
+/**
+ * @brief The frame_view class
+ *
+ * A view of a single message recieved by a framed_connection. It points
+ * directly into the connection's read buffer and is only valid until the
+ * next call to framed_connection::recv( ).
+ */
+struct frame_view
+{
+    char const * data = nullptr;
+    std::size_t  size = 0;
+};
+
+/**
+ * @brief The framed_connection class
+ *
+ * Sends and recieves length-prefixed messages over a tcp_socket. Each
+ * message is prefixed with its size as a 32 bit integer in network byte
+ * order.
+ *
+ * Incoming data is read into an internal buffer using as few system calls
+ * as possible: every read pulls in as many bytes as are available, and
+ * complete messages are handed back as frame_views into that buffer without
+ * being copied.
+ *
+ * Outgoing messages can be queued with queue( ) and written together with
+ * a single call to flush( ).
+ *
+ *   gnl::framed_connection F( std::move(client) );
+ *   gnl::frame_view msg;
+ *   while( F.recv(msg) )
+ *   {
+ *       F.send(msg.data, msg.size); // echo it back
+ *   }
+ */
+class framed_connection
+{
+public:
+    using header_t = std::uint32_t;
+
+    framed_connection( tcp_socket && socket,
+                       std::size_t buffer_size    = 64*1024,
+                       std::size_t max_frame_size = 16*1024*1024)
+        : m_socket( std::move(socket) ),
+          m_in( buffer_size < sizeof(header_t) ? sizeof(header_t) : buffer_size ),
+          m_max_frame_size(max_frame_size)
+    {
+        m_out.reserve(buffer_size);
+    }
+
+    /**
+     * @brief operator bool
+     *
+     * Converts to false once the underlying socket has been closed, the
+     * peer has disconnected or a frame larger than the maximum frame size
+     * has been recieved. The socket itself stays open until close( ).
+     */
+    operator bool()
+    {
+        return !m_failed && static_cast<bool>(m_socket);
+    }
+
+    /**
+     * @brief socket
+     * @return
+     *
+     * Returns the underlying socket.
+     */
+    tcp_socket & socket()
+    {
+        return m_socket;
+    }
+
+    /**
+     * @brief close
+     *
+     * Closes the underlying socket. Any queued messages which have not been
+     * flushed are discarded.
+     */
+    void close()
+    {
+        m_out.clear();
+        m_socket.close();
+    }
+
+    /**
+     * @brief try_recv
+     * @param frame - set to the next frame if one is available
+     * @return true if a complete frame was already in the read buffer.
+     *
+     * Returns the next buffered frame without making any system calls.
+     */
+    bool try_recv(frame_view & frame)
+    {
+        std::size_t available = m_end - m_begin;
+        if( available < sizeof(header_t) )
+            return false;
+
+        std::size_t frame_size = peek_size();
+        if( available - sizeof(header_t) < frame_size )
+            return false;
+
+        frame.data = m_in.data() + m_begin + sizeof(header_t);
+        frame.size = frame_size;
+        m_begin   += sizeof(header_t) + frame_size;
+
+        if( m_begin == m_end )
+            m_begin = m_end = 0;
+
+        return true;
+    }
+
+    /**
+     * @brief recv
+     * @param frame - set to the recieved frame
+     * @return false if the connection was closed, an error occured or
+     *         the peer sent a frame larger than the maximum frame size.
+     *
+     * Recieves the next frame, blocking until it has fully arrived. The
+     * returned frame_view is valid until the next call to recv( ).
+     *
+     * recv( ) never closes or otherwise changes the socket, so one thread
+     * can recieve while another one sends.
+     */
+    bool recv(frame_view & frame)
+    {
+        while( !try_recv(frame) )
+        {
+            if( m_failed )
+                return false;
+
+            std::size_t needed = sizeof(header_t);
+
+            if( m_end - m_begin >= sizeof(header_t) )
+            {
+                std::size_t frame_size = peek_size();
+                if( frame_size > m_max_frame_size )
+                {
+                    m_failed = true;
+                    return false;
+                }
+                needed += frame_size;
+            }
+
+            make_room(needed);
+
+            auto ret = read_some( &m_in[m_end], m_in.size() - m_end );
+            if( ret == 0 )
+                m_failed = true;
+            if( ret == 0 || ret == tcp_socket::error )
+                return false;
+
+            m_end += static_cast<std::size_t>(ret);
+        }
+        return true;
+    }
+
+    /**
+     * @brief queue
+     * @param data
+     * @param size
+     * @return false if the frame is too large for its 32 bit size
+     *
+     * Appends a frame to the write buffer. Queued frames are written
+     * together the next time flush( ) or send( ) is called.
+     */
+    bool queue(void const * data, std::size_t size)
+    {
+        if( !fits_header(size) )
+            return false;
+
+        header_t h = htonl( static_cast<header_t>(size) );
+
+        char const * hp = reinterpret_cast<char const*>(&h);
+        char const * dp = static_cast<char const*>(data);
+
+        m_out.insert( m_out.end(), hp, hp + sizeof(h) );
+        m_out.insert( m_out.end(), dp, dp + size );
+        return true;
+    }
+
+    /**
+     * @brief flush
+     * @return false if the data could not be sent
+     *
+     * Writes all the queued frames to the socket.
+     */
+    bool flush()
+    {
+        if( m_out.empty() )
+            return true;
+
+        io_buffer b( m_out.data(), m_out.size() );
+        bool ok = send_all(&b, 1);
+        m_out.clear();
+        return ok;
+    }
+
+    /**
+     * @brief send
+     * @param data
+     * @param size
+     * @return false if the data could not be sent, or the frame is too
+     *         large for its 32 bit size
+     *
+     * Sends a single frame, together with any frames that have been queued.
+     * When nothing is queued, the header and the payload are written with a
+     * single gathered send, so the payload is not copied.
+     */
+    bool send(void const * data, std::size_t size)
+    {
+        if( !fits_header(size) )
+            return false;
+
+        if( !m_out.empty() )
+        {
+            queue(data, size);
+            return flush();
+        }
+
+        header_t h = htonl( static_cast<header_t>(size) );
+        io_buffer b[] = { io_buffer(&h, sizeof(h)), io_buffer(data, size) };
+        return send_all(b, 2);
+    }
+
+    /**
+     * @brief pending
+     * @return
+     *
+     * Returns the number of bytes queued and waiting for flush( )
+     */
+    std::size_t pending() const
+    {
+        return m_out.size();
+    }
+
+protected:
+    static bool fits_header(std::size_t size)
+    {
+        return static_cast<std::uint64_t>(size) <= std::numeric_limits<header_t>::max();
+    }
+
+    std::size_t peek_size() const
+    {
+        header_t h;
+        memcpy(&h, &m_in[m_begin], sizeof(h));
+        return ntohl(h);
+    }
+
+    // Reads whatever has arrived, waiting for at least one byte. Unlike
+    // tcp_socket::recv_some( ) this leaves the descriptor alone when the
+    // peer disconnects, since another thread may be sending on it.
+    tcp_socket::msg_size_t read_some(char * data, std::size_t size)
+    {
+    #if defined MSG_DONTWAIT
+        for(;;)
+        {
+            auto ret = m_socket.try_recv(data, size);
+            if( ret != tcp_socket::error || !tcp_socket::would_block() )
+                return ret;
+            if( !m_socket.wait_readable( std::chrono::milliseconds::max() ) )
+                return tcp_socket::error;
+        }
+    #else
+        return m_socket.recv_some(data, size);
+    #endif
+    }
+
+    // Makes sure there is room for at least "needed" bytes starting
+    // at m_begin, moving the unread data to the front of the buffer
+    // if required
+    void make_room(std::size_t needed)
+    {
+        if( m_begin != 0 && m_in.size() - m_begin < needed )
+        {
+            memmove(&m_in[0], &m_in[m_begin], m_end - m_begin);
+            m_end  -= m_begin;
+            m_begin = 0;
+        }
+
+        if( m_in.size() - m_begin < needed ) // the frame is bigger than the buffer
+            m_in.resize( m_begin + needed );
+    }
+
+    bool send_all(io_buffer * buffers, std::size_t count)
+    {
+        while( count )
+        {
+            auto ret = m_socket.send(buffers, count);
+            if( ret == tcp_socket::error || ret == 0 )
+                return false;
+
+            // skip over whatever was written
+            std::size_t written = static_cast<std::size_t>(ret);
+            while( count && written >= buffers->size() )
+            {
+                written -= buffers->size();
+                ++buffers;
+                --count;
+            }
+            if( count )
+                *buffers = io_buffer( static_cast<char const*>(buffers->data()) + written, buffers->size() - written );
+        }
+        return true;
+    }
+
+    tcp_socket        m_socket;
+    std::vector<char> m_in;
+    std::size_t       m_begin = 0;  // start of the unread data in m_in
+    std::size_t       m_end   = 0;  // end of the unread data in m_in
+    std::vector<char> m_out;
+    std::size_t       m_max_frame_size;
+    bool              m_failed = false; // the peer disconnected or sent an oversized frame
+};
+
+
+/**
+ * @brief The connection_pool class
+ *
+ * Keeps connected tcp_sockets around so that clients which make many
+ * requests to the same server do not pay for a tcp handshake every time.
+ *
+ * Connections are borrowed with acquire( ), which returns an idle
+ * connection to that host/port if there is a healthy one, or connects a
+ * new one otherwise. The connection is returned to the pool when the handle
+ * goes out of scope:
+ *
+ *   gnl::connection_pool P;
+ *   {
+ *       auto C = P.acquire("127.0.0.1", 30000);
+ *       if( C )
+ *       {
+ *           C->send(...);
+ *           C->recv(...);
+ *       }
+ *   } // C goes back into the pool here
+ *
+ * Idle connections are spread over several shards, each with its own
+ * mutex. Every thread has a home shard which it returns connections to
+ * and looks in first, so threads rarely contend on the same lock. Other
+ * shards are only searched when the home shard has no idle connection for
+ * that host. The limit on idle connections is kept per host, across all
+ * the shards, with an atomic count.
+ *
+ * The pool must outlive all the connections borrowed from it.
+ */
+class connection_pool
+{
+public:
+    using clock_type     = std::chrono::steady_clock;
+    using health_check_t = std::function<bool(tcp_socket & socket)>;
+
+protected:
+    struct host_entry;
+
+public:
+    /**
+     * @brief The connection class
+     *
+     * A borrowed connection. It is returned to the pool when destroyed
+     * unless discard( ) is called.
+     */
+    class connection
+    {
+    public:
+        connection()
+        {
+        }
+
+        connection(connection const & other) = delete;
+        connection & operator=(connection const & other) = delete;
+
+        connection(connection && other)
+        {
+            *this = std::move(other);
+        }
+
+        connection & operator=(connection && other)
+        {
+            if( this != &other )
+            {
+                release();
+                m_pool   = other.m_pool;
+                m_host   = other.m_host;
+                m_key    = std::move(other.m_key);
+                m_socket = std::move(other.m_socket);
+                other.m_pool = nullptr;
+            }
+            return *this;
+        }
+
+        ~connection()
+        {
+            release();
+        }
+
+        /**
+         * @brief operator bool
+         *
+         * Converts to false if the connection could not be made or has
+         * been closed.
+         */
+        operator bool() const
+        {
+            return m_socket.native_handle() != socket_base::invalid_socket;
+        }
+
+        tcp_socket & socket()     { return m_socket; }
+        tcp_socket * operator->() { return &m_socket; }
+        tcp_socket & operator*()  { return m_socket; }
+
+        /**
+         * @brief release
+         *
+         * Returns the connection to the pool now.
+         */
+        void release()
+        {
+            if( m_pool )
+                m_pool->put_back(m_key, m_host, std::move(m_socket));
+            m_pool = nullptr;
+        }
+
+        /**
+         * @brief discard
+         *
+         * Closes the connection instead of returning it to the pool. Use
+         * this if the connection is in an unknown state, eg: a response was
+         * only partially read.
+         */
+        void discard()
+        {
+            if( m_socket )
+                m_socket.close();
+            m_pool = nullptr;
+        }
+
+    protected:
+        friend class connection_pool;
+
+        connection_pool * m_pool = nullptr;
+        host_entry *      m_host = nullptr;
+        std::string       m_key;
+        tcp_socket        m_socket;
+    };
+
+    /**
+     * @brief connection_pool
+     * @param max_idle_per_host - maximum number of idle connections kept for
+     *                            each host/port. 0 closes every connection
+     *                            when it is released.
+     * @param idle_timeout - idle connections older than this are closed
+     *                       instead of being reused
+     * @param num_shards - number of independently locked shards. 0 uses the
+     *                     number of hardware threads.
+     */
+    connection_pool(std::size_t max_idle_per_host = 8,
+                    std::chrono::milliseconds idle_timeout = std::chrono::seconds(30),
+                    std::size_t num_shards = 0)
+        : m_max_idle_per_host(max_idle_per_host),
+          m_idle_timeout(idle_timeout)
+    {
+        if( num_shards == 0 )
+            num_shards = std::max<std::size_t>(1, std::thread::hardware_concurrency() );
+
+        m_shards.resize(num_shards);
+        for(auto & s : m_shards)
+            s.reset( new shard );
+    }
+
+    connection_pool(connection_pool const & other) = delete;
+    connection_pool & operator=(connection_pool const & other) = delete;
+
+    ~connection_pool()
+    {
+        clear();
+    }
+
+    /**
+     * @brief set_health_check
+     * @param check
+     *
+     * Sets a function which is called on an idle connection before it is
+     * handed out. If it returns false the connection is closed and another
+     * one is tried. The default check makes sure the peer has not closed the
+     * connection and that there is no unread data waiting on it.
+     */
+    void set_health_check(health_check_t check)
+    {
+        m_health_check = std::move(check);
+    }
+
+    /**
+     * @brief acquire
+     * @param host - ip address of the server
+     * @param port
+     * @return a connection, which converts to false if no idle connection
+     *         was available and a new one could not be made
+     *
+     * Borrows a connection to host:port.
+     */
+    connection acquire(char const * host, std::uint16_t port)
+    {
+        connection c;
+        c.m_key = make_key(host, port);
+
+        std::size_t home = home_shard();
+        for(std::size_t i=0; i < m_shards.size(); i++)
+        {
+            shard & S = *m_shards[ (home + i) % m_shards.size() ];
+            if( take_idle(S, c.m_key, c.m_socket, c.m_host) )
+            {
+                c.m_pool = this;
+                return c;
+            }
+        }
+
+        // nothing idle, make a new connection
+        if( c.m_socket.create() )
+        {
+            if( c.m_socket.connect(host, port) )
+            {
+                c.m_pool = this;
+                c.m_host = find_host(c.m_key);
+            }
+            else
+            {
+                c.m_socket.close();
+            }
+        }
+        return c;
+    }
+
+    /**
+     * @brief idle
+     * @return
+     *
+     * Returns the total number of idle connections in the pool.
+     */
+    std::size_t idle()
+    {
+        std::size_t count = 0;
+        for(auto & s : m_shards)
+        {
+            std::lock_guard<std::mutex> L(s->mutex);
+            for(auto & h : s->idle)
+                count += h.second.size();
+        }
+        return count;
+    }
+
+    /**
+     * @brief prune
+     * @return the number of connections which were closed
+     *
+     * Closes all the idle connections which have exceeded the idle timeout.
+     * This happens automatically when connections are acquired, but can be
+     * called periodically to release sockets sooner.
+     */
+    std::size_t prune()
+    {
+        std::size_t count = 0;
+        auto now = clock_type::now();
+        for(auto & s : m_shards)
+        {
+            std::lock_guard<std::mutex> L(s->mutex);
+            for(auto & h : s->idle)
+            {
+                auto & V = h.second;
+                for(auto it = V.begin(); it != V.end(); )
+                {
+                    if( now - it->since > m_idle_timeout )
+                    {
+                        it->socket.close();
+                        it->host->idle.fetch_sub(1);
+                        it = V.erase(it);
+                        ++count;
+                    }
+                    else
+                    {
+                        ++it;
+                    }
+                }
+            }
+        }
+        return count;
+    }
+
+    /**
+     * @brief clear
+     *
+     * Closes all the idle connections.
+     */
+    void clear()
+    {
+        for(auto & s : m_shards)
+        {
+            std::lock_guard<std::mutex> L(s->mutex);
+            for(auto & h : s->idle)
+            {
+                for(auto & e : h.second)
+                {
+                    e.socket.close();
+                    e.host->idle.fetch_sub(1);
+                }
+            }
+            s->idle.clear();
+        }
+    }
+
+    /**
+     * @brief is_alive
+     * @param socket
+     * @return
+     *
+     * The default health check. Returns false if the peer has closed the
+     * connection, or if it has sent data that nobody has read (which means
+     * the connection is out of step with the protocol).
+     */
+    static bool is_alive(tcp_socket & socket)
+    {
+        if( !socket )
+            return false;
+
+    #if defined _MSC_VER
+        fd_set read_set;
+        FD_ZERO(&read_set);
+        FD_SET(socket.native_handle(), &read_set);
+        timeval tv = {0, 0};
+        if( ::select(0, &read_set, NULL, NULL, &tv) == 0 )
+            return true; // nothing to read, the connection is idle
+        return false;    // either closed (recv would return 0) or unexpected data
+    #else
+        char c;
+        auto ret = ::recv(socket.native_handle(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        if( ret == socket_base::msg_error )
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        return false;
+    #endif
+    }
+
+protected:
+    struct host_entry
+    {
+        std::atomic<std::size_t> idle{0}; // idle connections in all the shards
+    };
+
+    struct idle_entry
+    {
+        tcp_socket             socket;
+        clock_type::time_point since;
+        host_entry *           host = nullptr;
+    };
+
+    struct shard
+    {
+        std::mutex                                                mutex;
+        std::unordered_map<std::string, std::vector<idle_entry> > idle;
+    };
+
+    static std::string make_key(char const * host, std::uint16_t port)
+    {
+        return std::string(host) + ":" + std::to_string(port);
+    }
+
+    std::size_t home_shard() const
+    {
+        return std::hash<std::thread::id>()( std::this_thread::get_id() ) % m_shards.size();
+    }
+
+    bool healthy(tcp_socket & socket)
+    {
+        return m_health_check ? m_health_check(socket) : is_alive(socket);
+    }
+
+    // only called for new connections, reused ones remember their host
+    host_entry * find_host(std::string const & key)
+    {
+        std::lock_guard<std::mutex> L(m_hosts_mutex);
+        std::unique_ptr<host_entry> & h = m_hosts[key];
+        if( !h )
+            h.reset( new host_entry );
+        return h.get();
+    }
+
+    // takes the most recently used healthy connection from the shard
+    bool take_idle(shard & S, std::string const & key, tcp_socket & out, host_entry *& host)
+    {
+        auto now = clock_type::now();
+        for(;;)
+        {
+            idle_entry e;
+            {
+                std::lock_guard<std::mutex> L(S.mutex);
+                auto it = S.idle.find(key);
+                if( it == S.idle.end() || it->second.empty() )
+                    return false;
+                e = std::move( it->second.back() );
+                it->second.pop_back();
+            }
+            e.host->idle.fetch_sub(1);
+
+            // check the connection outside of the lock
+            if( now - e.since <= m_idle_timeout && healthy(e.socket) )
+            {
+                out  = std::move(e.socket);
+                host = e.host;
+                return true;
+            }
+            e.socket.close();
+        }
+    }
+
+    void put_back(std::string const & key, host_entry * host, tcp_socket && socket)
+    {
+        if( !socket )
+            return;
+
+        // reserve a place in the host's count first, so the limit holds
+        // however the connections are spread over the shards
+        std::size_t n = host->idle.load();
+        do
+        {
+            if( n >= m_max_idle_per_host )
+            {
+                // the pool is full for this host
+                socket.close();
+                return;
+            }
+        } while( !host->idle.compare_exchange_weak(n, n + 1) );
+
+        idle_entry e;
+        e.socket = std::move(socket);
+        e.since  = clock_type::now();
+        e.host   = host;
+
+        shard & S = *m_shards[ home_shard() ];
+        std::lock_guard<std::mutex> L(S.mutex);
+        S.idle[key].push_back( std::move(e) );
+    }
+
+    std::vector< std::unique_ptr<shard> > m_shards;
+    std::size_t                           m_max_idle_per_host;
+    std::chrono::milliseconds             m_idle_timeout;
+    health_check_t                        m_health_check;
+
+    std::mutex                                                    m_hosts_mutex;
+    std::unordered_map<std::string, std::unique_ptr<host_entry> > m_hosts; // never erased, connections point into it
+};
+
+
+#if defined __linux__
+
+/**
+ * @brief The basic_domain_socket class
+ *
+ * Unix domain socket.  A unix domain socket exists as a file on the
+ * filesystem. This can be opened as a file descriptor in Unix.
+ *
+ * Type is the socket type:
+ *   SOCK_STREAM    - a byte stream (domain_stream_socket)
+ *   SOCK_SEQPACKET - connection based, but message boundaries are kept,
+ *                    so every recv returns exactly one send
+ *                    (domain_seqpacket_socket)
+ *   SOCK_DGRAM     - connectionless messages (domain_datagram_socket)
+ *
+ * All of them can pass open file descriptors to the peer with send_fds( )
+ * and recv_fds( ). Passing a memfd lets processes share a large buffer
+ * instead of copying it through the socket.
+ */
+template<int Type>
+class basic_domain_socket : public socket_base
+{
+public:
+    /**
+     * @brief pair
+     * @param a
+     * @param b
+     * @return
+     *
+     * Creates a pair of connected, unnamed sockets (socketpair). This is
+     * useful to talk to a child process or another thread.
+     */
+    static bool pair(basic_domain_socket & a, basic_domain_socket & b)
+    {
+        int fds[2];
+        if( ::socketpair(AF_UNIX, Type | SOCK_CLOEXEC, 0, fds) == -1 )
+            return false;
+        a.m_fd = fds[0];
+        b.m_fd = fds[1];
+        return true;
+    }
+
+    /**
+     * @brief operator bool
+     *
+     * Conversion to bool. Converts to false if the socket is
+     * not created or if it has an error
+     */
+    operator bool()
+    {
+        return !( ( m_fd == invalid_socket ) );
+    }
+
+    /**
+     * @brief bind
+     * @param port
+     * @return
+     *
+     * Bind the socket to a path so it can start listening for incoming
+     * connections.
+     */
+    bool bind( const char * path )
+    {
+
+        if( !(*this) )
+            create();
+
+        struct sockaddr_un d_name;
+        if( !make_address(path, d_name) )
+            return false;
+
+        int ret = ::bind(m_fd, reinterpret_cast<const struct sockaddr *>(&d_name),
+                       sizeof(struct sockaddr_un));
+
+        if( ret == bind_error)
+        {
+            #ifdef _MSC_VER
+            //printf("Bind failed with error code : %d" , WSAGetLastError() );
+            #else
+            //printf("Bind failed with error code : %d : %s" , errno,  strerror(errno) );
+            #endif
+            //exit(EXIT_FAILURE);
+            return false;
+        }
+        return true;
+    }
+
+
+    /**
+     * @brief unlink
      * @param path
      * @return
      *
-     * Unlinks the path from the filesystem.
+     * Unlinks the path from the filesystem.
+     */
+    bool unlink(const char * path)
+    {
+        return ::unlink( path ) == 0;
+    }
+
+    /**
+     * @brief connect
+     * @param server - the server ip address/host name
+     * @param port - the port number
+     * @return
+     *
+     * Connect to a server
+     */
+    bool connect( const char * path)
+    {
+        struct sockaddr_un d_name;
+        if( !make_address(path, d_name) )
+            return false;
+
+        int ret = ::connect( m_fd, reinterpret_cast<struct sockaddr*>(&d_name), sizeof( d_name));
+
+        if( ret == connect_error)
+            return false;
+
+        return true;
+    }
+
+    /**
+     * @brief create
+     * @return
+     *
+     * Create the socket. THis must be called before you do any actions on
+     * the socket.
+     */
+    bool create()
+    {
+        return socket_base::create(AF_UNIX, Type, 0 );
+    }
+
+    /**
+     * @brief listen
+     * @param max_connections
+     * @return
+     *
+     * Puts the socket into listening mode so that it can accept client
+     * connections
+     */
+    bool listen( std::size_t max_connections = 10)
+    {
+        int code = ::listen( m_fd, static_cast<int>(max_connections) );
+
+        if( code == listen_error)
+        {
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief accept
+     * @return
+     *
+     * Accept a new connected client. This function blocks until
+     * a client connects.
+     */
+    basic_domain_socket accept()
+    {
+        basic_domain_socket client;
+
+        client.m_fd = ::accept(m_fd, NULL, NULL);
+
+        return client;
+
+    }
+
+    /**
+     * @brief send
+     * @param data
+     * @param size
+     * @return returns 0 if the client disconnected, otherwise returns the
+     *         number of bytes sent
+     *
+     * Sends data to this socket.
+     */
+    msg_size_t send( char const * data, size_t _size)
+    {
+        std::uint64_t start = stats_start();
+        native_msg_size_return_t ret = count_send(_size, ::send(m_fd, static_cast<const char*>(data), static_cast<native_msg_size_input_t>(_size), 0), start);
+        return msg_size_t(ret);
+    }
+
+    /**
+     * @brief recv
+     * @param data
+     * @param size
+     * @return  the number of bytes read, or zero if the client disconnected.
+     *          returns tcp_socket::error if an error occoured
+     *
+     * Recieves data from the socket. This function blocks until the total
+     * number of bytes have been recieved.
+     */
+    msg_size_t recv(char * data, size_t _size)
+    {
+
+
+        std::uint64_t start = stats_start();
+        native_msg_size_return_t t = count_recv(_size, ::recv( m_fd, reinterpret_cast<char*>(data), static_cast<native_msg_size_input_t>(_size), 0 ), start);
+
+        // an empty datagram is a message, not a disconnect
+        if( t == 0 && _size != 0 && Type != SOCK_DGRAM )
+        {
+            m_fd = invalid_socket;
+        }
+        return msg_size_t(t);
+    }
+
+    /**
+     * @brief recv
+     * @param ring
+     * @return the number of bytes read, or zero if the client disconnected.
+     *         returns domain_stream_socket::error if an error occoured
+     *
+     * Reads whatever data is available directly into the free space of the
+     * ring buffer. Nothing is read and 0 is returned if the ring is full.
+     */
+    msg_size_t recv(ring_buffer & ring)
+    {
+        if( ring.full() )
+            return 0;
+
+        msg_size_t t = recv_ring(ring);
+        if( t == 0 && Type != SOCK_DGRAM )
+        {
+            m_fd = invalid_socket;
+        }
+        return t;
+    }
+
+    /**
+     * @brief send
+     * @param ring
+     * @return the number of bytes sent, or domain_stream_socket::error
+     *
+     * Sends the data waiting in the ring buffer. The bytes which were
+     * sent are consumed from the ring.
+     */
+    msg_size_t send(ring_buffer & ring)
+    {
+        return send_ring(ring);
+    }
+
+    /**
+     * @brief send_fds
+     * @param data - data to send along with the descriptors, at least 1 byte
+     * @param size
+     * @param fds - the file descriptors to pass
+     * @param count - number of file descriptors, if it is 0 only the data
+     *                is sent
+     * @return the number of bytes sent or domain_stream_socket::error
+     *
+     * Sends data together with open file descriptors (SCM_RIGHTS). The peer
+     * recieves its own copies of the descriptors, which refer to the same
+     * open files. The sender can close its copies once this returns.
+     */
+    msg_size_t send_fds(void const * data, std::size_t size, int const * fds, std::size_t count)
+    {
+        io_buffer b(data, size);
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov        = &b;
+        msg.msg_iovlen     = 1;
+
+        std::vector<char> control;
+        if( count > 0 )
+        {
+            control.resize( CMSG_SPACE(sizeof(int) * count) );
+            msg.msg_control    = control.data();
+            msg.msg_controllen = control.size();
+
+            struct cmsghdr * cm = CMSG_FIRSTHDR(&msg);
+            cm->cmsg_level = SOL_SOCKET;
+            cm->cmsg_type  = SCM_RIGHTS;
+            cm->cmsg_len   = CMSG_LEN(sizeof(int) * count);
+            memcpy( CMSG_DATA(cm), fds, sizeof(int) * count );
+        }
+
+        std::uint64_t start = stats_start();
+        native_msg_size_return_t ret = count_send(size, ::sendmsg(m_fd, &msg, 0), start);
+        return msg_size_t(ret);
+    }
+
+    /**
+     * @brief recv_fds
+     * @param data - buffer for the data which was sent with the descriptors
+     * @param size
+     * @param fds - array to store the recieved descriptors in
+     * @param max_fds - size of the fds array
+     * @param fd_count - set to the number of descriptors recieved
+     * @return the number of bytes read, 0 if the peer closed the connection
+     *         or domain_stream_socket::error
+     *
+     * Recieves data and any file descriptors sent with send_fds( ). The
+     * recieved descriptors are owned by the caller, who must close them.
+     * They are created with the close-on-exec flag set.
+     */
+    msg_size_t recv_fds(void * data, std::size_t size, int * fds, std::size_t max_fds, std::size_t & fd_count)
+    {
+        io_buffer b(data, size);
+
+        std::vector<char> control( CMSG_SPACE(sizeof(int) * max_fds) );
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov        = &b;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = control.data();
+        msg.msg_controllen = control.size();
+
+        fd_count = 0;
+        std::uint64_t start = stats_start();
+        native_msg_size_return_t ret = count_recv(size, ::recvmsg(m_fd, &msg, MSG_CMSG_CLOEXEC), start);
+        if( ret == msg_error )
+            return error;
+
+        for(struct cmsghdr * cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            if( cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS )
+                continue;
+
+            std::size_t n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for(std::size_t i=0; i < n; i++)
+            {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cm) + i*sizeof(int), sizeof(int));
+                if( fd_count < max_fds )
+                    fds[fd_count++] = fd;
+                else
+                    ::close(fd);
+            }
+        }
+
+        if( ret == 0 && size != 0 && Type != SOCK_DGRAM )
+        {
+            m_fd = invalid_socket;
+        }
+        return msg_size_t(ret);
+    }
+
+protected:
+    // fails with ENAMETOOLONG rather than cutting the path short, which
+    // would bind or connect to a different file
+    static bool make_address(const char * path, struct sockaddr_un & d_name)
+    {
+        memset(&d_name, 0 ,sizeof(struct sockaddr_un) );
+        if( strlen(path) >= sizeof(d_name.sun_path) )
+        {
+            errno = ENAMETOOLONG;
+            return false;
+        }
+        d_name.sun_family = AF_UNIX;
+        strcpy(d_name.sun_path, path);
+        return true;
+    }
+};
+
+/**
+ * A unix domain byte stream
+ */
+using domain_stream_socket = basic_domain_socket<SOCK_STREAM>;
+
+/**
+ * A connection based unix domain socket which keeps message boundaries
+ */
+using domain_seqpacket_socket = basic_domain_socket<SOCK_SEQPACKET>;
+
+/**
+ * @brief The domain_datagram_socket class
+ *
+ * A connectionless unix domain socket. Each message is sent to, or
+ * recieved from, a path on the filesystem. Unlike udp, datagrams on a
+ * unix domain socket are reliable and ordered.
+ */
+class domain_datagram_socket : public basic_domain_socket<SOCK_DGRAM>
+{
+public:
+    /**
+     * @brief send_to
+     * @param data
+     * @param size
+     * @param path - path of the socket to send to
+     * @return the number of bytes sent or domain_datagram_socket::error
+     */
+    msg_size_t send_to(void const * data, std::size_t size, const char * path)
+    {
+        struct sockaddr_un d_name;
+        if( !make_address(path, d_name) )
+            return error;
+        std::uint64_t start = stats_start();
+        native_msg_size_return_t ret = count_send(size, ::sendto(m_fd, data, size, 0, reinterpret_cast<struct sockaddr const*>(&d_name), sizeof(d_name)), start);
+        return msg_size_t(ret);
+    }
+
+    /**
+     * @brief recv_from
+     * @param data
+     * @param size
+     * @param from - if not null, set to the path of the sender. This is
+     *               empty if the sender's socket was not bound.
+     * @return the size of the message or domain_datagram_socket::error
+     *
+     * Recieves one message. If the buffer is too small the rest of the
+     * message is discarded.
+     */
+    msg_size_t recv_from(void * data, std::size_t size, std::string * from = nullptr)
+    {
+        struct sockaddr_un d_name;
+        memset(&d_name, 0, sizeof(d_name));
+        socklen_t length = sizeof(d_name);
+
+        std::uint64_t start = stats_start();
+        native_msg_size_return_t ret = count_recv(size, ::recvfrom(m_fd, data, size, 0, reinterpret_cast<struct sockaddr*>(&d_name), &length), start);
+
+        if( ret != msg_error && from )
+        {
+            if( length > sizeof(sa_family_t) )
+                *from = d_name.sun_path;
+            else
+                from->clear();
+        }
+        return msg_size_t(ret);
+    }
+};
+
+
+/**
+ * @brief The event_loop class
+ *
+ * A small epoll based reactor. File descriptors are registered together
+ * with a callback, and run( ) calls the callback whenever the descriptor
+ * becomes ready. Timers can be added to call a function at a deadline.
+ * All callbacks are called on the thread which calls run( ).
+ *
+ *   gnl::event_loop L;
+ *   L.add( client.native_handle(), gnl::event_loop::readable, [&](std::uint32_t events)
+ *   {
+ *       ...
+ *   });
+ *   L.run();
+ */
+class event_loop
+{
+public:
+    using socket_t   = socket_base::socket_t;
+    using callback_t = std::function<void(std::uint32_t events)>;
+    using clock_type = std::chrono::steady_clock;
+    using timer_id   = std::uint64_t;
+
+    static const std::uint32_t readable = EPOLLIN;
+    static const std::uint32_t writable = EPOLLOUT;
+    static const std::uint32_t hangup   = EPOLLHUP | EPOLLRDHUP;
+    static const std::uint32_t error    = EPOLLERR;
+
+    event_loop()
+    {
+        m_epoll = ::epoll_create1(EPOLL_CLOEXEC);
+        m_wake  = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events  = EPOLLIN;
+        ev.data.fd = m_wake;
+        ::epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wake, &ev);
+    }
+
+    event_loop(event_loop const & other) = delete;
+    event_loop & operator=(event_loop const & other) = delete;
+
+    ~event_loop()
+    {
+        ::close(m_wake);
+        ::close(m_epoll);
+    }
+
+    /**
+     * @brief add
+     * @param fd - the descriptor to watch
+     * @param events - combination of readable/writable
+     * @param callback - called with the ready events
+     * @return false if the descriptor could not be added
+     *
+     * Starts watching a file descriptor. Must be called from the loop's
+     * thread (or before run( ) has been called), use post( ) otherwise.
+     */
+    bool add(socket_t fd, std::uint32_t events, callback_t callback)
+    {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events  = events;
+        ev.data.fd = fd;
+
+        if( ::epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) == -1 )
+            return false;
+
+        m_handlers[fd] = std::make_shared<callback_t>( std::move(callback) );
+        return true;
+    }
+
+    /**
+     * @brief modify
+     * @param fd
+     * @param events
+     * @return
+     *
+     * Changes the events which are watched for a descriptor.
+     */
+    bool modify(socket_t fd, std::uint32_t events)
+    {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events  = events;
+        ev.data.fd = fd;
+        return ::epoll_ctl(m_epoll, EPOLL_CTL_MOD, fd, &ev) == 0;
+    }
+
+    /**
+     * @brief remove
+     * @param fd
+     * @return
+     *
+     * Stops watching the descriptor. This must be done before the
+     * descriptor is closed. It is safe to call from inside the
+     * descriptor's own callback.
      */
-    bool unlink(const char * path)
+    bool remove(socket_t fd)
     {
-        return ::unlink( path ) == 0;
+        m_handlers.erase(fd);
+        return ::epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr) == 0;
     }
 
     /**
-     * @brief connect
-     * @param server - the server ip address/host name
-     * @param port - the port number
-     * @return
+     * @brief post
+     * @param f
      *
-     * Connect to a server
+     * Queues a function to be called on the loop's thread. This can be
+     * called from any thread.
      */
-    bool connect( const char * path)
+    void post(std::function<void()> f)
     {
-        struct sockaddr_un d_name;
-        memset(&d_name, 0 ,sizeof(struct sockaddr_un) );
-        d_name.sun_family = AF_UNIX;
-        strcpy(d_name.sun_path, path);
+        {
+            std::lock_guard<std::mutex> L(m_posted_mutex);
+            m_posted.push_back( std::move(f) );
+        }
+        wake();
+    }
 
-        int ret = ::connect( m_fd, reinterpret_cast<struct sockaddr*>(&d_name), sizeof( d_name));
+    /**
+     * @brief add_timer
+     * @param deadline - when to call the function
+     * @param f - the function to call
+     * @return an id which can be passed to cancel_timer( )
+     *
+     * Calls f on the loop's thread once the deadline has passed. Like add( ),
+     * this must be called from the loop's thread.
+     */
+    timer_id add_timer(clock_type::time_point deadline, std::function<void()> f)
+    {
+        timer_id id = ++m_last_timer;
+        m_timers[id] = std::move(f);
+        m_deadlines.push( std::make_pair(deadline, id) );
+        return id;
+    }
 
-        if( ret == connect_error)
-            return false;
+    /**
+     * @brief add_timer
+     * @param delay - how long from now to call the function
+     * @param f - the function to call
+     * @return an id which can be passed to cancel_timer( )
+     */
+    timer_id add_timer(std::chrono::milliseconds delay, std::function<void()> f)
+    {
+        return add_timer( clock_type::now() + delay, std::move(f) );
+    }
 
-        return true;
+    /**
+     * @brief cancel_timer
+     * @param id
+     * @return false if the timer has already fired or been cancelled
+     */
+    bool cancel_timer(timer_id id)
+    {
+        return m_timers.erase(id) != 0;
     }
 
     /**
-     * @brief create
-     * @return
+     * @brief run_once
+     * @param timeout_ms - maximum time to wait for an event, -1 waits forever
+     * @return the number of callbacks which were called
      *
-     * Create the socket. THis must be called before you do any actions on
-     * the socket.
+     * Waits for events and dispatches them, then calls any timers
+     * which have expired.
      */
-    bool create()
+    std::size_t run_once(int timeout_ms = -1)
+    {
+        struct epoll_event events[64];
+
+        // don't sleep past the next timer
+        drop_cancelled_timers();
+        if( !m_deadlines.empty() )
+        {
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>( m_deadlines.top().first - clock_type::now() ).count() + 1;
+            if( wait < 0 )
+                wait = 0;
+            if( timeout_ms < 0 || wait < timeout_ms )
+                timeout_ms = static_cast<int>(wait);
+        }
+
+        int n = ::epoll_wait(m_epoll, events, 64, timeout_ms);
+
+        std::size_t count = 0;
+        for(int i=0; i < n; i++)
+        {
+            socket_t fd = events[i].data.fd;
+
+            if( fd == m_wake )
+            {
+                std::uint64_t v;
+                while( ::read(m_wake, &v, sizeof(v)) > 0 ) {}
+                count += run_posted();
+                continue;
+            }
+
+            auto it = m_handlers.find(fd);
+            if( it == m_handlers.end() ) // removed by an earlier callback
+                continue;
+
+            // hold on to the callback in case it removes itself
+            std::shared_ptr<callback_t> cb = it->second;
+            (*cb)( events[i].events );
+            ++count;
+        }
+
+        return count + run_timers();
+    }
+
+    /**
+     * @brief run
+     *
+     * Dispatches events until stop( ) is called.
+     */
+    void run()
+    {
+        while( !m_stop )
+        {
+            run_once(-1);
+        }
+        m_stop = false;
+    }
+
+    /**
+     * @brief stop
+     *
+     * Makes run( ) return. This can be called from any thread.
+     */
+    void stop()
     {
-        return socket_base::create(AF_UNIX, SOCK_STREAM, 0 );
+        m_stop = true;
+        wake();
     }
 
     /**
-     * @brief listen
-     * @param max_connections
+     * @brief size
      * @return
      *
-     * Puts the socket into listening mode so that it can accept client
-     * connections
+     * Returns the number of descriptors being watched.
      */
-    bool listen( std::size_t max_connections = 10)
+    std::size_t size() const
     {
-        int code = ::listen( m_fd, static_cast<int>(max_connections) );
+        return m_handlers.size();
+    }
 
-        if( code == listen_error)
+protected:
+    void wake()
+    {
+        std::uint64_t one = 1;
+        auto r = ::write(m_wake, &one, sizeof(one));
+        (void)r;
+    }
+
+    void drop_cancelled_timers()
+    {
+        while( !m_deadlines.empty() && m_timers.count( m_deadlines.top().second ) == 0 )
+            m_deadlines.pop();
+    }
+
+    std::size_t run_timers()
+    {
+        std::size_t count = 0;
+        auto now = clock_type::now();
+
+        drop_cancelled_timers();
+        while( !m_deadlines.empty() && m_deadlines.top().first <= now )
         {
-            return false;
+            auto it = m_timers.find( m_deadlines.top().second );
+            m_deadlines.pop();
+
+            std::function<void()> f = std::move(it->second);
+            m_timers.erase(it);
+            f();
+            ++count;
+
+            drop_cancelled_timers();
         }
-        return true;
+        return count;
+    }
+
+    std::size_t run_posted()
+    {
+        std::vector< std::function<void()> > posted;
+        {
+            std::lock_guard<std::mutex> L(m_posted_mutex);
+            posted.swap(m_posted);
+        }
+        for(auto & f : posted)
+            f();
+        return posted.size();
+    }
+
+    int                                                       m_epoll;
+    int                                                       m_wake;
+    std::atomic<bool>                                         m_stop{false};
+    std::unordered_map<socket_t, std::shared_ptr<callback_t>> m_handlers;
+    std::mutex                                                m_posted_mutex;
+    std::vector< std::function<void()> >                      m_posted;
+
+    using deadline_t = std::pair<clock_type::time_point, timer_id>;
+
+    timer_id                                                  m_last_timer = 0;
+    std::unordered_map<timer_id, std::function<void()> >      m_timers;
+    std::priority_queue<deadline_t, std::vector<deadline_t>, std::greater<deadline_t> > m_deadlines;
+};
+
+
+/**
+ * The async_* functions start an operation on a socket and return
+ * immediately. The event_loop calls the handler on its own thread once the
+ * operation has finished, failed, or the timeout has expired. The error
+ * passed to the handler is 0 on success, ETIMEDOUT if the timeout expired,
+ * or the errno of the failure.
+ *
+ * A timeout of std::chrono::milliseconds::max() waits forever. While it
+ * waits, an operation costs nothing but a registration in the loop and a
+ * timer entry, so a hung peer no longer ties up a thread.
+ *
+ * These must be called from the loop's thread (use event_loop::post( )
+ * otherwise). Only one operation may be in progress on a socket at a time,
+ * and the socket and buffers must stay alive until the handler is called.
+ * The sockets are switched to non-blocking mode.
+ */
+namespace detail
+{
+    struct async_operation
+    {
+        event_loop *          loop;
+        socket_base::socket_t fd;
+        event_loop::timer_id  timer = 0;
+        bool                  done  = false;
+
+        // stops watching the socket, returns false if the operation
+        // has already completed
+        bool finish()
+        {
+            if( done )
+                return false;
+            done = true;
+            loop->remove(fd);
+            if( timer )
+                loop->cancel_timer(timer);
+            return true;
+        }
+    };
+
+    template<typename OnTimeout>
+    inline std::shared_ptr<async_operation> start_async(event_loop & loop, socket_base::socket_t fd, std::chrono::milliseconds timeout, OnTimeout on_timeout)
+    {
+        auto op  = std::make_shared<async_operation>();
+        op->loop = &loop;
+        op->fd   = fd;
+
+        if( timeout != std::chrono::milliseconds::max() )
+        {
+            std::weak_ptr<async_operation> w = op;
+            op->timer = loop.add_timer(timeout, [w, on_timeout]()
+            {
+                auto o = w.lock();
+                if( o )
+                {
+                    o->timer = 0; // already fired
+                    if( o->finish() )
+                        on_timeout();
+                }
+            });
+        }
+        return op;
+    }
+}
+
+/**
+ * @brief async_connect
+ * @param loop
+ * @param addr - address of the server
+ * @param timeout
+ * @param handler - called with the connected socket and the error code
+ *
+ * Starts a non-blocking connect.
+ */
+inline void async_connect(event_loop & loop, socket_address const & addr, std::chrono::milliseconds timeout,
+                          std::function<void(tcp_socket && socket, int error)> handler)
+{
+    auto S = std::make_shared<tcp_socket>();
+
+    if( !S->create(addr.family()) || !S->set_blocking(false) )
+    {
+        int err = socket_base::last_error();
+        handler( tcp_socket(), err );
+        return;
+    }
+
+    auto ret = ::connect( S->native_handle(), addr.data(), addr.size());
+
+    if( ret == socket_base::socket_error && !socket_base::would_block() )
+    {
+        int err = socket_base::last_error();
+        S->close();
+        handler( tcp_socket(), err );
+        return;
+    }
+
+    auto op = detail::start_async(loop, S->native_handle(), timeout, [S, handler]()
+    {
+        S->close();
+        handler( tcp_socket(), ETIMEDOUT );
+    });
+
+    loop.add( S->native_handle(), event_loop::writable, [S, op, handler](std::uint32_t)
+    {
+        if( !op->finish() )
+            return;
+
+        int err = S->pending_error();
+        if( err != 0 )
+        {
+            S->close();
+            handler( tcp_socket(), err );
+            return;
+        }
+        handler( std::move(*S), 0 );
+    });
+}
+
+/**
+ * @brief async_connect
+ * @param loop
+ * @param server - ip address or host name of the server
+ * @param port
+ * @param timeout
+ * @param handler - called with the connected socket and the error code
+ *
+ * Starts a non-blocking connect. If the host name is not in
+ * resolver::global( )'s cache yet, it is looked up in the background
+ * first and the connect is started from the loop when the lookup is done.
+ * The loop must still exist at that point.
+ */
+inline void async_connect(event_loop & loop, char const * server, std::uint16_t port, std::chrono::milliseconds timeout,
+                          std::function<void(tcp_socket && socket, int error)> handler)
+{
+    resolver::addresses_t addresses;
+    if( resolver::global().try_resolve(server, port, addresses) )
+    {
+        if( addresses.empty() )
+            handler( tcp_socket(), EHOSTUNREACH );
+        else
+            async_connect(loop, addresses.front(), timeout, handler);
+        return;
+    }
+
+    event_loop * L = &loop;
+    resolver::global().resolve_async(server, port, [L, timeout, handler](resolver::addresses_t const & a)
+    {
+        L->post( [L, a, timeout, handler]()
+        {
+            if( a.empty() )
+                handler( tcp_socket(), EHOSTUNREACH );
+            else
+                async_connect(*L, a.front(), timeout, handler);
+        });
+    });
+}
+
+/**
+ * @brief async_accept
+ * @param loop
+ * @param listener - a listening socket
+ * @param timeout
+ * @param handler - called with the accepted client and the error code
+ *
+ * Waits for a client to connect without blocking the loop.
+ */
+inline void async_accept(event_loop & loop, tcp_socket & listener, std::chrono::milliseconds timeout,
+                         std::function<void(tcp_socket && client, int error)> handler)
+{
+    listener.set_blocking(false);
+
+    auto op = detail::start_async(loop, listener.native_handle(), timeout, [handler]()
+    {
+        handler( tcp_socket(), ETIMEDOUT );
+    });
+
+    tcp_socket * L = &listener;
+    loop.add( listener.native_handle(), event_loop::readable, [L, op, handler](std::uint32_t)
+    {
+        tcp_socket client = L->accept();
+        if( !client )
+        {
+            if( socket_base::would_block() ) // someone else took it
+                return;
+            int err = socket_base::last_error();
+            if( op->finish() )
+                handler( tcp_socket(), err );
+            return;
+        }
+        if( op->finish() )
+            handler( std::move(client), 0 );
+    });
+}
+
+/**
+ * @brief async_recv
+ * @param loop
+ * @param socket
+ * @param data - buffer to fill
+ * @param size - number of bytes to recieve
+ * @param timeout
+ * @param handler - called with the number of bytes read (0 if the peer
+ *                  closed the connection) and the error code
+ *
+ * Recieves exactly size bytes without blocking the loop.
+ */
+inline void async_recv(event_loop & loop, tcp_socket & socket, void * data, std::size_t size, std::chrono::milliseconds timeout,
+                       std::function<void(socket_base::msg_size_t bytes, int error)> handler)
+{
+    socket.set_blocking(false);
+
+    auto read = std::make_shared<std::size_t>(0);
+
+    auto op = detail::start_async(loop, socket.native_handle(), timeout, [read, handler]()
+    {
+        handler( socket_base::msg_size_t(*read), ETIMEDOUT );
+    });
+
+    tcp_socket * S = &socket;
+    char *       p = static_cast<char*>(data);
+    loop.add( socket.native_handle(), event_loop::readable, [S, p, size, read, op, handler](std::uint32_t)
+    {
+        while( *read < size )
+        {
+            auto ret = S->recv_some( p + *read, size - *read );
+            if( ret == 0 )
+            {
+                if( op->finish() )
+                    handler(0, 0);
+                return;
+            }
+            if( ret == tcp_socket::error )
+            {
+                if( socket_base::would_block() )
+                    return; // wait for more
+                int err = socket_base::last_error();
+                if( op->finish() )
+                    handler( tcp_socket::error, err );
+                return;
+            }
+            *read += static_cast<std::size_t>(ret);
+        }
+
+        if( op->finish() )
+            handler( socket_base::msg_size_t(*read), 0 );
+    });
+}
+
+/**
+ * @brief async_send
+ * @param loop
+ * @param socket
+ * @param data - the data to send
+ * @param size - number of bytes to send
+ * @param timeout
+ * @param handler - called with the number of bytes sent and the error code
+ *
+ * Sends all the data without blocking the loop.
+ */
+inline void async_send(event_loop & loop, tcp_socket & socket, void const * data, std::size_t size, std::chrono::milliseconds timeout,
+                       std::function<void(socket_base::msg_size_t bytes, int error)> handler)
+{
+    socket.set_blocking(false);
+
+    auto sent = std::make_shared<std::size_t>(0);
+
+    auto op = detail::start_async(loop, socket.native_handle(), timeout, [sent, handler]()
+    {
+        handler( socket_base::msg_size_t(*sent), ETIMEDOUT );
+    });
+
+    tcp_socket *  S = &socket;
+    char const *  p = static_cast<char const*>(data);
+    loop.add( socket.native_handle(), event_loop::writable, [S, p, size, sent, op, handler](std::uint32_t)
+    {
+        while( *sent < size )
+        {
+            auto ret = S->send( p + *sent, size - *sent );
+            if( ret == tcp_socket::error )
+            {
+                if( socket_base::would_block() )
+                    return; // wait until there is room
+                int err = socket_base::last_error();
+                if( op->finish() )
+                    handler( tcp_socket::error, err );
+                return;
+            }
+            *sent += static_cast<std::size_t>(ret);
+        }
+
+        if( op->finish() )
+            handler( socket_base::msg_size_t(*sent), 0 );
+    });
+}
+
+
+/**
+ * @brief The listener_group class
+ *
+ * Accepts tcp connections on several threads at once. Each thread owns its
+ * own listening socket, all bound to the same port with SO_REUSEPORT, and its
+ * own event_loop. The kernel spreads new connections across the sockets, so
+ * there is no single accept loop for connection storms to queue up behind.
+ *
+ * Accepted clients are handed to the callback on the thread which accepted
+ * them, along with that thread's event_loop, so the connection can be served
+ * on the same thread:
+ *
+ *   gnl::listener_group G;
+ *   G.start(30000, 4, [](gnl::tcp_socket && client, gnl::event_loop & loop)
+ *   {
+ *       ...
+ *   });
+ */
+class listener_group
+{
+public:
+    using accept_callback_t = std::function<void(tcp_socket && client, event_loop & loop)>;
+
+    listener_group()
+    {
+    }
+
+    listener_group(listener_group const & other) = delete;
+    listener_group & operator=(listener_group const & other) = delete;
+
+    ~listener_group()
+    {
+        stop();
     }
 
     /**
-     * @brief accept
-     * @return
+     * @brief start
+     * @param port - port to listen on
+     * @param num_threads - number of accepting threads/listening sockets
+     * @param on_accept - called for every accepted client
+     * @param max_connections - listen backlog of each socket
+     * @return false if any of the sockets could not be bound
      *
-     * Accept a new connected client. This function blocks until
-     * a client connects.
+     * Binds the sockets and starts the worker threads.
      */
-    domain_stream_socket accept()
+    bool start(std::uint16_t port, std::size_t num_threads, accept_callback_t on_accept, std::size_t max_connections = 128)
     {
-        domain_stream_socket client;
+        stop();
 
-        client.m_fd = ::accept(m_fd, NULL, NULL);
+        if( num_threads == 0 )
+            num_threads = 1;
 
-        return client;
+        m_on_accept = std::move(on_accept);
+
+        for(std::size_t i=0; i < num_threads; i++)
+        {
+            std::unique_ptr<worker> w(new worker);
+
+            if( !w->listener.create() ||
+                !w->listener.set_option( socket_options::reuse_address(true) ) ||
+                !w->listener.set_option( socket_options::reuse_port(true) ) ||
+                !w->listener.bind(port) ||
+                !w->listener.listen(max_connections) ||
+                !w->listener.set_blocking(false) )
+            {
+                if( w->listener )
+                    w->listener.close();
+                close_workers();
+                return false;
+            }
 
+            worker * W = w.get();
+            W->loop.add( W->listener.native_handle(), event_loop::readable, [this, W](std::uint32_t)
+            {
+                accept_all(*W);
+            });
+
+            m_workers.push_back( std::move(w) );
+        }
+
+        for(auto & w : m_workers)
+        {
+            worker * W = w.get();
+            W->thread = std::thread( [W]() { W->loop.run(); } );
+        }
+        return true;
     }
 
     /**
-     * @brief send
-     * @param data
-     * @param size
-     * @return returns 0 if the client disconnected, otherwise returns the
-     *         number of bytes sent
+     * @brief stop
      *
-     * Sends data to this socket.
+     * Stops all the event loops, joins the threads and closes the
+     * listening sockets.
      */
-    msg_size_t send( char const * data, size_t _size)
+    void stop()
     {
-        native_msg_size_return_t ret = ::send(m_fd, static_cast<const char*>(data), static_cast<native_msg_size_input_t>(_size), 0);
-        return msg_size_t(ret);
+        for(auto & w : m_workers)
+            w->loop.stop();
+
+        for(auto & w : m_workers)
+        {
+            if( w->thread.joinable() )
+                w->thread.join();
+        }
+        close_workers();
     }
 
     /**
-     * @brief recv
-     * @param data
-     * @param size
-     * @return  the number of bytes read, or zero if the client disconnected.
-     *          returns tcp_socket::error if an error occoured
+     * @brief size
+     * @return
      *
-     * Recieves data from the socket. This function blocks until the total
-     * number of bytes have been recieved.
+     * Returns the number of accepting threads.
      */
-    msg_size_t recv(char * data, size_t _size)
+    std::size_t size() const
     {
+        return m_workers.size();
+    }
 
+    /**
+     * @brief loop
+     * @param i
+     * @return
+     *
+     * Returns the event loop of the i'th thread.
+     */
+    event_loop & loop(std::size_t i)
+    {
+        return m_workers[i]->loop;
+    }
 
-        native_msg_size_return_t t = ::recv( m_fd, reinterpret_cast<char*>(data), static_cast<native_msg_size_input_t>(_size), 0 );
+protected:
+    struct worker
+    {
+        tcp_socket  listener;
+        event_loop  loop;
+        std::thread thread;
+    };
 
-        if( t == 0 && _size != 0 )
+    void accept_all(worker & W)
+    {
+        // the listener is non-blocking, so keep accepting until
+        // there are no more pending connections
+        for(;;)
         {
-            m_fd = invalid_socket;
+            tcp_socket client = W.listener.accept();
+            if( !client )
+                break;
+            m_on_accept( std::move(client), W.loop );
         }
-        return msg_size_t(t);
     }
 
+    void close_workers()
+    {
+        for(auto & w : m_workers)
+        {
+            if( w->listener )
+            {
+                w->loop.remove( w->listener.native_handle() );
+                w->listener.close();
+            }
+        }
+        m_workers.clear();
+    }
 
-
+    std::vector< std::unique_ptr<worker> > m_workers;
+    accept_callback_t                      m_on_accept;
 };
+
 #endif
 
 }
 
 #endif
-
-
@@ -0,0 +1,369 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org>
+ */
+
+#ifndef GNL_TASK_GRAPH_H
+#define GNL_TASK_GRAPH_H
+
+#include <gnl/gnl_threadpool.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#ifndef GNL_NAMESPACE
+    #define GNL_NAMESPACE gnl
+#endif
+namespace GNL_NAMESPACE
+{
+
+/**
+ * @brief The task_graph class
+ *
+ * A set of tasks with dependencies between them, run on a thread_pool.
+ * Instead of tasks blocking a worker in a future's get( ) until their
+ * inputs are ready, every node keeps an atomic count of the inputs it is
+ * still waiting for. The node which brings the count to zero queues it.
+ *
+ * The graph is built once and can then be run as many times as needed,
+ * eg: once per frame. The first run( ) compiles the graph into flat
+ * arrays, after that running it does not allocate.
+ *
+ * @code
+ *    gnl::task_graph G;
+ *    auto a = G.add( []{ load(); } );
+ *    auto b = G.add( []{ animate(); } );
+ *    auto c = G.add( []{ render(); } );
+ *    G.add_edge(a, c);
+ *    G.add_edge(b, c);
+ *
+ *    gnl::thread_pool P(4);
+ *    while( running )
+ *        G.run(P);
+ * @endcode
+ *
+ * A graph must not be run again while it is still running.
+ */
+class task_graph
+{
+public:
+    using node_id = std::size_t;
+
+    task_graph() = default;
+    task_graph(task_graph const &) = delete;
+    task_graph & operator=(task_graph const &) = delete;
+
+    /**
+     * @brief add
+     * @param fn a void() callable, it is called once on every run
+     * @return the id of the new node
+     */
+    template<typename F>
+    node_id add(F && fn)
+    {
+        m_nodes.emplace_back( unique_task( std::forward<F>(fn) ) );
+        m_compiled = false;
+        return m_nodes.size() - 1;
+    }
+
+    /**
+     * @brief add_edge
+     * @param from
+     * @param to
+     *
+     * Makes node to wait until node from has finished.
+     */
+    void add_edge(node_id from, node_id to)
+    {
+        if( from >= m_nodes.size() || to >= m_nodes.size() )
+            throw std::invalid_argument("task_graph: no such node");
+        if( from == to )
+            throw std::logic_error("task_graph: a node cannot depend on itself");
+
+        m_nodes[from].successors.push_back(to);
+        m_compiled = false;
+    }
+
+    /**
+     * @brief size
+     * @return the number of nodes in the graph
+     */
+    std::size_t size() const
+    {
+        return m_nodes.size();
+    }
+
+    /**
+     * @brief compile
+     *
+     * Flattens the edges and checks the graph. Throws std::logic_error if
+     * the edges form a cycle. run( ) calls this when the graph has
+     * changed, call it earlier to keep the cost out of the first run.
+     */
+    void compile();
+
+    /**
+     * @brief run
+     * @param pool
+     *
+     * Runs every node on the pool and returns when they have all
+     * finished. The calling thread runs nodes too, following a chain of
+     * nodes for as long as each one makes exactly the next one ready.
+     * If a node throws, the nodes that have not started yet are skipped
+     * and the first exception is rethrown. If the pool has no workers, or
+     * run( ) is called from a task on the pool itself, the graph is run on
+     * the calling thread: a worker blocked waiting for the graph could be
+     * the one its nodes need.
+     */
+    template<class QueuePolicy>
+    void run(basic_thread_pool<QueuePolicy> & pool);
+
+    /**
+     * @brief run
+     *
+     * Runs every node on the calling thread, in dependency order.
+     */
+    void run();
+
+protected:
+    static const std::size_t npos = static_cast<std::size_t>(-1);
+
+    struct node
+    {
+        explicit node(unique_task && f) : fn( std::move(f) )
+        {
+        }
+
+        unique_task         fn;
+        std::vector<node_id> successors;
+    };
+
+    template<class Pool>
+    static void post_node(void * pool, task_graph * graph, node_id i)
+    {
+        static_cast<Pool*>(pool)->post( [graph, i]{ graph->execute(i); } );
+    }
+
+    void start();
+    void execute(node_id i);
+    void finished();
+    void wait();
+
+    std::vector<node>              m_nodes;
+    bool                           m_compiled = false;
+
+    // the compiled graph, the successors of node i are
+    // m_successors[ m_offsets[i] ] to m_successors[ m_offsets[i+1] ]
+    std::vector<node_id>           m_successors;
+    std::vector<std::size_t>       m_offsets;
+    std::vector<std::uint32_t>     m_inputs;
+    std::vector<node_id>           m_roots;
+
+    // state of the current run
+    std::unique_ptr< std::atomic<std::uint32_t>[] > m_pending;
+    std::atomic<std::size_t>       m_remaining{0};
+    std::atomic<bool>              m_failed{false};
+    std::exception_ptr             m_error; // guarded by m_mutex
+    void *                         m_pool = nullptr;
+    void (*m_post)(void *, task_graph *, node_id) = nullptr;
+    std::vector<node_id>           m_ready; // nodes waiting to run, without a pool
+    std::mutex                     m_mutex;
+    std::condition_variable        m_cv;
+};
+
+inline void task_graph::compile()
+{
+    std::size_t n = m_nodes.size();
+
+    m_offsets.assign(n + 1, 0);
+    m_inputs.assign(n, 0);
+    m_successors.clear();
+    m_roots.clear();
+
+    for(std::size_t i=0; i < n; i++)
+    {
+        m_offsets[i] = m_successors.size();
+        for(node_id s : m_nodes[i].successors)
+        {
+            m_successors.push_back(s);
+            ++m_inputs[s];
+        }
+    }
+    m_offsets[n] = m_successors.size();
+
+    for(std::size_t i=0; i < n; i++)
+    {
+        if( m_inputs[i] == 0 )
+            m_roots.push_back(i);
+    }
+
+    // every node is reached from the roots unless there is a cycle
+    std::vector<std::uint32_t> inputs(m_inputs);
+    std::vector<node_id>       order(m_roots);
+    for(std::size_t k=0; k < order.size(); k++)
+    {
+        for(std::size_t j=m_offsets[ order[k] ]; j < m_offsets[ order[k] + 1 ]; j++)
+        {
+            if( --inputs[ m_successors[j] ] == 0 )
+                order.push_back( m_successors[j] );
+        }
+    }
+    if( order.size() != n )
+        throw std::logic_error("task_graph: the graph has a cycle");
+
+    m_pending.reset( new std::atomic<std::uint32_t>[n] );
+    m_ready.clear();
+    m_ready.reserve(n);
+    m_compiled = true;
+}
+
+inline void task_graph::start()
+{
+    if( !m_compiled )
+        compile();
+
+    for(std::size_t i=0; i < m_nodes.size(); i++)
+        m_pending[i].store( m_inputs[i], std::memory_order_relaxed );
+
+    m_remaining.store( m_nodes.size(), std::memory_order_relaxed );
+    m_failed.store( false, std::memory_order_relaxed );
+    m_error = nullptr;
+}
+
+inline void task_graph::run()
+{
+    start();
+
+    m_pool = nullptr;
+    m_ready.assign( m_roots.rbegin(), m_roots.rend() );
+    while( !m_ready.empty() )
+    {
+        node_id i = m_ready.back();
+        m_ready.pop_back();
+        execute(i);
+    }
+
+    if( m_error )
+        std::rethrow_exception(m_error);
+}
+
+template<class QueuePolicy>
+inline void task_graph::run(basic_thread_pool<QueuePolicy> & pool)
+{
+    if( pool.num_workers() == 0 || pool.is_worker() )
+    {
+        run();
+        return;
+    }
+
+    start();
+    if( m_nodes.empty() )
+        return;
+
+    m_pool = &pool;
+    m_post = &post_node< basic_thread_pool<QueuePolicy> >;
+    for(std::size_t k=1; k < m_roots.size(); k++)
+        m_post(m_pool, this, m_roots[k]);
+    execute( m_roots[0] );
+    wait();
+
+    if( m_error )
+        std::rethrow_exception(m_error);
+}
+
+inline void task_graph::wait()
+{
+    std::unique_lock<std::mutex> L(m_mutex);
+    m_cv.wait(L, [this]{ return m_remaining.load(std::memory_order_acquire) == 0; });
+}
+
+inline void task_graph::execute(node_id i)
+{
+    while( i != npos )
+    {
+        if( !m_failed.load(std::memory_order_relaxed) )
+        {
+            try
+            {
+                m_nodes[i].fn();
+            }
+            catch(...)
+            {
+                std::lock_guard<std::mutex> L(m_mutex);
+                if( !m_error )
+                    m_error = std::current_exception();
+                m_failed.store(true, std::memory_order_relaxed);
+            }
+        }
+
+        // queue the successors which are now ready, but keep one of them
+        // to run on this thread
+        node_id next = npos;
+        for(std::size_t j=m_offsets[i]; j < m_offsets[i+1]; j++)
+        {
+            node_id s = m_successors[j];
+            if( m_pending[s].fetch_sub(1, std::memory_order_acq_rel) != 1 )
+                continue;
+
+            if( !m_pool )
+                m_ready.push_back(s);
+            else if( next == npos )
+                next = s;
+            else
+                m_post(m_pool, this, s);
+        }
+
+        finished();
+        i = next;
+    }
+}
+
+inline void task_graph::finished()
+{
+    // once the count reaches zero, run( ) may return and the graph may be
+    // destroyed. So the last node only lowers it to zero with m_mutex held,
+    // wait( ) cannot see it until the mutex is released, and nothing is
+    // touched after that.
+    std::size_t r = m_remaining.load(std::memory_order_acquire);
+    while( r > 1 )
+    {
+        if( m_remaining.compare_exchange_weak(r, r - 1, std::memory_order_acq_rel, std::memory_order_acquire) )
+            return;
+    }
+
+    std::lock_guard<std::mutex> L(m_mutex);
+    m_remaining.store(0, std::memory_order_release);
+    m_cv.notify_all();
+}
+
+}
+
+#endif
@@ -6,11 +6,35 @@
 #include <memory>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
 #include <future>
 #include <functional>
 #include <stdexcept>
 #include <iostream>
+#include <cstdint>
+#include <algorithm>
+#include <cstddef>
+#include <type_traits>
+#include <exception>
+#include <iterator>
+#include <climits>
+#include <string>
+#include <fstream>
+#include <chrono>
+#include <cerrno>
+
+#if defined __x86_64__ || defined __i386__ || defined _M_X64 || defined _M_IX86
+    #include <immintrin.h>
+#endif
+
+#if defined __linux__
+    #include <pthread.h>
+    #include <sched.h>
+    #include <unistd.h>
+    #include <sys/syscall.h>
+    #include <linux/futex.h>
+#endif
 
 #ifndef GNL_NAMESPACE
     #define GNL_NAMESPACE gnl
@@ -18,202 +42,3398 @@
 namespace GNL_NAMESPACE
 {
 
-class thread_pool
+namespace detail
+{
+    /**
+     * @brief The object_pool class
+     *
+     * Recycles the memory of objects of type T, so that creating them does
+     * not go to the heap once the program has warmed up. Each thread keeps
+     * a small cache of free objects. Whole batches are moved to and from a
+     * shared depot when a cache becomes too full or runs out, so an object
+     * created on one thread and destroyed on another is still reused.
+     */
+    template<typename T>
+    class object_pool
+    {
+    public:
+        template<typename... A>
+        static T * create(A &&... args)
+        {
+            void * p = allocate();
+            try
+            {
+                return new (p) T( std::forward<A>(args)... );
+            }
+            catch(...)
+            {
+                deallocate(p);
+                throw;
+            }
+        }
+
+        static void destroy(T * p)
+        {
+            p->~T();
+            deallocate(p);
+        }
+
+    protected:
+        union slot
+        {
+            slot *                                                   next;
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+        };
+
+        static const std::size_t batch     = 32;
+        static const std::size_t max_depot = 64 * batch;
+
+        struct free_list
+        {
+            slot *      head  = nullptr;
+            std::size_t count = 0;
+
+            void push(slot * s)
+            {
+                s->next = head;
+                head    = s;
+                ++count;
+            }
+
+            slot * pop()
+            {
+                slot * s = head;
+                if( s )
+                {
+                    head = s->next;
+                    --count;
+                }
+                return s;
+            }
+
+            // moves up to n slots onto another list
+            void move_to(free_list & other, std::size_t n)
+            {
+                while( n-- && head )
+                    other.push( pop() );
+            }
+
+            void release_all()
+            {
+                while( slot * s = pop() )
+                    ::operator delete(s);
+            }
+        };
+
+        struct depot
+        {
+            std::mutex mutex;
+            free_list  list;
+
+            ~depot()
+            {
+                list.release_all();
+            }
+        };
+
+        struct cache
+        {
+            free_list list;
+
+            ~cache()
+            {
+                // the thread is exiting, let the others use the memory
+                depot & d = get_depot();
+                std::lock_guard<std::mutex> L(d.mutex);
+                list.move_to(d.list, max_depot - std::min(max_depot, d.list.count));
+                list.release_all();
+            }
+        };
+
+        static depot & get_depot()
+        {
+            static depot d;
+            return d;
+        }
+
+        static free_list & get_cache()
+        {
+            static thread_local cache c;
+            return c.list;
+        }
+
+        static void * allocate()
+        {
+            free_list & c = get_cache();
+            if( !c.head )
+            {
+                depot & d = get_depot();
+                {
+                    std::lock_guard<std::mutex> L(d.mutex);
+                    d.list.move_to(c, batch);
+                }
+
+                // grow by a whole batch so the pool quickly reaches the
+                // size the threads need and stops allocating
+                if( !c.head )
+                {
+                    for(std::size_t i=1; i < batch; i++)
+                        c.push( static_cast<slot*>( ::operator new( sizeof(slot) ) ) );
+                    return ::operator new( sizeof(slot) );
+                }
+            }
+            return c.pop();
+        }
+
+        static void deallocate(void * p)
+        {
+            free_list & c = get_cache();
+            c.push( static_cast<slot*>(p) );
+
+            if( c.count > 2 * batch )
+            {
+                depot & d = get_depot();
+                std::lock_guard<std::mutex> L(d.mutex);
+                c.move_to(d.list, std::min(batch, max_depot - std::min(max_depot, d.list.count)) );
+                while( c.count > 2 * batch ) // the depot is full
+                    ::operator delete( c.pop() );
+            }
+        }
+    };
+
+    template<typename T>
+    const std::size_t object_pool<T>::batch;
+
+    template<typename T>
+    const std::size_t object_pool<T>::max_depot;
+}
+
+/**
+ * @brief The unique_task class
+ *
+ * A move-only void() callable. Unlike std::function it can hold move-only
+ * objects (eg: a std::packaged_task or a std::promise), and callables of
+ * up to inline_size bytes are stored inside the object instead of being
+ * allocated on the heap.
+ */
+class unique_task
+{
+public:
+    static const std::size_t inline_size = 6 * sizeof(void*);
+
+    unique_task() : m_ops(nullptr)
+    {
+    }
+
+    template<typename F,
+             typename = typename std::enable_if< !std::is_same<typename std::decay<F>::type, unique_task>::value >::type >
+    unique_task(F && f) : m_ops(nullptr)
+    {
+        using callable = typename std::decay<F>::type;
+        using ops      = typename std::conditional< fits_inline<callable>(), inline_ops<callable>, heap_ops<callable> >::type;
+
+        ops::create( &m_storage, std::forward<F>(f) );
+        m_ops = ops::get();
+    }
+
+    unique_task(unique_task && other) : m_ops(other.m_ops)
+    {
+        if( m_ops )
+        {
+            m_ops->move(&other.m_storage, &m_storage);
+            other.m_ops = nullptr;
+        }
+    }
+
+    unique_task & operator=(unique_task && other)
+    {
+        if( this != &other )
+        {
+            reset();
+            if( other.m_ops )
+            {
+                other.m_ops->move(&other.m_storage, &m_storage);
+                m_ops       = other.m_ops;
+                other.m_ops = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    unique_task(unique_task const &) = delete;
+    unique_task & operator=(unique_task const &) = delete;
+
+    ~unique_task()
+    {
+        reset();
+    }
+
+    void operator()()
+    {
+        m_ops->invoke(&m_storage);
+    }
+
+    explicit operator bool() const
+    {
+        return m_ops != nullptr;
+    }
+
+    /**
+     * @brief reset
+     *
+     * Destroys the stored callable.
+     */
+    void reset()
+    {
+        if( m_ops )
+        {
+            m_ops->destroy(&m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+    /**
+     * @brief fits_inline
+     * @return true if a callable of type F is stored without allocating
+     */
+    template<typename F>
+    static constexpr bool fits_inline()
+    {
+        return sizeof(F) <= inline_size &&
+               alignof(F) <= alignof(std::max_align_t) &&
+               std::is_nothrow_move_constructible<F>::value;
+    }
+
+protected:
+    using storage_t = typename std::aligned_storage<inline_size, alignof(std::max_align_t)>::type;
+
+    struct operations
+    {
+        void (*invoke)(void * storage);
+        void (*move)(void * from, void * to);
+        void (*destroy)(void * storage);
+    };
+
+    template<typename F>
+    struct inline_ops
+    {
+        template<typename G>
+        static void create(void * storage, G && g)
+        {
+            new (storage) F( std::forward<G>(g) );
+        }
+
+        static void invoke(void * storage)
+        {
+            (*static_cast<F*>(storage))();
+        }
+
+        static void move(void * from, void * to)
+        {
+            new (to) F( std::move( *static_cast<F*>(from) ) );
+            static_cast<F*>(from)->~F();
+        }
+
+        static void destroy(void * storage)
+        {
+            static_cast<F*>(storage)->~F();
+        }
+
+        static operations const * get()
+        {
+            static const operations o = { &invoke, &move, &destroy };
+            return &o;
+        }
+    };
+
+    template<typename F>
+    struct heap_ops
+    {
+        template<typename G>
+        static void create(void * storage, G && g)
+        {
+            *static_cast<F**>(storage) = new F( std::forward<G>(g) );
+        }
+
+        static void invoke(void * storage)
+        {
+            (**static_cast<F**>(storage))();
+        }
+
+        static void move(void * from, void * to)
+        {
+            *static_cast<F**>(to) = *static_cast<F**>(from);
+        }
+
+        static void destroy(void * storage)
+        {
+            delete *static_cast<F**>(storage);
+        }
+
+        static operations const * get()
+        {
+            static const operations o = { &invoke, &move, &destroy };
+            return &o;
+        }
+    };
+
+    storage_t          m_storage;
+    operations const * m_ops;
+};
+
+template<typename T>
+class task_future;
+
+template<typename T>
+class task_promise;
+
+template<class QueuePolicy>
+class basic_thread_pool;
+
+namespace detail
+{
+    struct future_access;
+
+    /**
+     * @brief The executor struct
+     *
+     * Where a future's continuations are run: posted to a thread pool, or
+     * called straight away by the thread which made the future ready if
+     * there is no pool.
+     */
+    struct executor
+    {
+        void * pool                                   = nullptr;
+        void (*schedule)(void * pool, unique_task && t) = nullptr;
+
+        void run(unique_task && t) const
+        {
+            if( schedule )
+                schedule(pool, std::move(t));
+            else
+                t();
+        }
+    };
+
+    template<typename T>
+    struct future_storage
+    {
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type data;
+        bool                                                       has_value = false;
+
+        template<typename U>
+        void set(U && u)
+        {
+            new (&data) T( std::forward<U>(u) );
+            has_value = true;
+        }
+
+        T take()
+        {
+            return std::move( *reinterpret_cast<T*>(&data) );
+        }
+
+        ~future_storage()
+        {
+            if( has_value )
+                reinterpret_cast<T*>(&data)->~T();
+        }
+    };
+
+    template<>
+    struct future_storage<void>
+    {
+        void set()  {}
+        void take() {}
+    };
+
+    /**
+     * @brief The future_state class
+     *
+     * The state shared by a task_promise and its task_future. They are
+     * recycled with object_pool, so a submit( ) does not allocate.
+     */
+    template<typename T>
+    class future_state
+    {
+    public:
+        static future_state * create()
+        {
+            return object_pool<future_state>::create();
+        }
+
+        void add_ref()
+        {
+            m_refs.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void release()
+        {
+            if( m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1 )
+                object_pool<future_state>::destroy(this);
+        }
+
+        template<typename... U>
+        void set_value(U &&... u)
+        {
+            if( m_ready.load(std::memory_order_relaxed) )
+                throw std::future_error(std::future_errc::promise_already_satisfied);
+            m_value.set( std::forward<U>(u)... );
+            finish();
+        }
+
+        void set_exception(std::exception_ptr e)
+        {
+            if( m_ready.load(std::memory_order_relaxed) )
+                throw std::future_error(std::future_errc::promise_already_satisfied);
+            m_exception = e;
+            finish();
+        }
+
+        bool ready() const
+        {
+            return m_ready.load(std::memory_order_acquire);
+        }
+
+        executor const & get_executor() const
+        {
+            return m_executor;
+        }
+
+        void set_executor(executor const & e)
+        {
+            m_executor = e;
+        }
+
+        /**
+         * @brief on_ready
+         * @param c called once the state is ready, straight away if it
+         *          already is. Only one can be set.
+         */
+        void on_ready(unique_task && c)
+        {
+            {
+                std::lock_guard<std::mutex> L(m_mutex);
+                m_waiting.store(true, std::memory_order_seq_cst);
+                if( !m_ready.load(std::memory_order_seq_cst) )
+                {
+                    m_continuation = std::move(c);
+                    return;
+                }
+            }
+            c();
+        }
+
+        void wait()
+        {
+            if( ready() )
+                return;
+
+            std::unique_lock<std::mutex> L(m_mutex);
+            m_waiting.store(true, std::memory_order_seq_cst);
+            while( !m_ready.load(std::memory_order_seq_cst) )
+                m_cv.wait(L);
+        }
+
+        T get()
+        {
+            wait();
+            if( m_exception )
+                std::rethrow_exception(m_exception);
+            return m_value.take();
+        }
+
+    protected:
+        void finish()
+        {
+            // the waiter sets m_waiting before checking m_ready, so one of
+            // us is guaranteed to see the other
+            m_ready.store(true, std::memory_order_seq_cst);
+            if( m_waiting.load(std::memory_order_seq_cst) )
+            {
+                unique_task c;
+                {
+                    std::lock_guard<std::mutex> L(m_mutex);
+                    c = std::move(m_continuation);
+                    m_cv.notify_all();
+                }
+                if( c )
+                    c();
+            }
+        }
+
+        std::atomic<int>        m_refs{1};
+        std::atomic<bool>       m_ready{false};
+        std::atomic<bool>       m_waiting{false};
+        std::mutex              m_mutex;
+        std::condition_variable m_cv;
+        std::exception_ptr      m_exception;
+        future_storage<T>       m_value;
+        executor                m_executor;
+        unique_task             m_continuation; // guarded by m_mutex
+    };
+
+    // the result of a continuation taking a task_future<T>
+    template<typename F, typename T>
+    using continuation_result = typename std::result_of<typename std::decay<F>::type(task_future<T>)>::type;
+}
+
+/**
+ * @brief The task_future class
+ *
+ * The result of thread_pool::submit( ). Works like a std::future, but its
+ * shared state is recycled instead of being allocated for every task.
+ *
+ * Instead of blocking on get( ), then( ) can be given the work which needs
+ * the result. It is queued on the pool when the result is ready, so a chain
+ * of tasks never keeps a worker waiting. The pool must outlive the futures
+ * which may still post continuations to it.
+ */
+template<typename T>
+class task_future
+{
+public:
+    task_future() : m_state(nullptr)
+    {
+    }
+
+    task_future(task_future && other) : m_state(other.m_state)
+    {
+        other.m_state = nullptr;
+    }
+
+    task_future & operator=(task_future && other)
+    {
+        if( this != &other )
+        {
+            if( m_state )
+                m_state->release();
+            m_state       = other.m_state;
+            other.m_state = nullptr;
+        }
+        return *this;
+    }
+
+    task_future(task_future const &) = delete;
+    task_future & operator=(task_future const &) = delete;
+
+    ~task_future()
+    {
+        if( m_state )
+            m_state->release();
+    }
+
+    /**
+     * @brief valid
+     * @return true until get( ) has been called
+     */
+    bool valid() const
+    {
+        return m_state != nullptr;
+    }
+
+    /**
+     * @brief ready
+     * @return true if the result is available, get( ) will not block
+     */
+    bool ready() const
+    {
+        return m_state->ready();
+    }
+
+    /**
+     * @brief wait
+     *
+     * Blocks until the result is available.
+     */
+    void wait() const
+    {
+        m_state->wait();
+    }
+
+    /**
+     * @brief get
+     * @return the result
+     *
+     * Blocks until the result is available, and rethrows the exception if
+     * the task threw one. Can only be called once.
+     */
+    T get()
+    {
+        if( !m_state )
+            throw std::future_error(std::future_errc::no_state);
+
+        detail::future_state<T> * s = m_state;
+        m_state = nullptr;
+
+        struct releaser
+        {
+            detail::future_state<T> * s;
+            ~releaser() { s->release(); }
+        } r = {s};
+
+        return s->get();
+    }
+
+    /**
+     * @brief then
+     * @param f called with this future once it is ready, eg:
+     *          [](gnl::task_future<int> r){ return r.get() * 2; }
+     * @return a future for the result of f
+     *
+     * If this future came from a thread pool, f is posted to that pool when
+     * the result is ready, otherwise it is called by the thread which makes
+     * the result ready. If f is attached after that it is scheduled right
+     * away. This future is no longer valid afterwards.
+     */
+    template<typename F>
+    task_future< detail::continuation_result<F,T> > then(F && f);
+
+    /**
+     * @brief then
+     * @param pool the pool to post f to
+     * @param f called with this future once it is ready
+     * @return a future for the result of f. Its own continuations are also
+     *         posted to pool.
+     */
+    template<class QueuePolicy, typename F>
+    task_future< detail::continuation_result<F,T> > then(basic_thread_pool<QueuePolicy> & pool, F && f);
+
+protected:
+    explicit task_future(detail::future_state<T> * s) : m_state(s)
+    {
+    }
+
+    template<typename F>
+    task_future< detail::continuation_result<F,T> > then(detail::executor const & e, F && f);
+
+    detail::future_state<T> * m_state;
+
+    friend class task_promise<T>;
+    friend struct detail::future_access;
+};
+
+/**
+ * @brief The task_promise class
+ *
+ * The writing end of a task_future. If it is destroyed without a value
+ * being set, the future throws a broken_promise future_error.
+ */
+template<typename T>
+class task_promise
+{
+public:
+    task_promise() : m_state( detail::future_state<T>::create() )
+    {
+    }
+
+    task_promise(task_promise && other) noexcept : m_state(other.m_state), m_retrieved(other.m_retrieved)
+    {
+        other.m_state = nullptr;
+    }
+
+    task_promise & operator=(task_promise && other) noexcept
+    {
+        if( this != &other )
+        {
+            abandon();
+            m_state       = other.m_state;
+            m_retrieved   = other.m_retrieved;
+            other.m_state = nullptr;
+        }
+        return *this;
+    }
+
+    task_promise(task_promise const &) = delete;
+    task_promise & operator=(task_promise const &) = delete;
+
+    ~task_promise()
+    {
+        abandon();
+    }
+
+    /**
+     * @brief get_future
+     * @return the future which recieves the value. Can only be called once.
+     */
+    task_future<T> get_future()
+    {
+        if( !m_state )
+            throw std::future_error(std::future_errc::no_state);
+        if( m_retrieved )
+            throw std::future_error(std::future_errc::future_already_retrieved);
+
+        m_retrieved = true;
+        m_state->add_ref();
+        return task_future<T>(m_state);
+    }
+
+    template<typename... U>
+    void set_value(U &&... u)
+    {
+        if( !m_state )
+            throw std::future_error(std::future_errc::no_state);
+        m_state->set_value( std::forward<U>(u)... );
+    }
+
+    void set_exception(std::exception_ptr e)
+    {
+        if( !m_state )
+            throw std::future_error(std::future_errc::no_state);
+        m_state->set_exception(e);
+    }
+
+protected:
+    void abandon() noexcept
+    {
+        if( !m_state )
+            return;
+
+        if( !m_state->ready() )
+            m_state->set_exception( std::make_exception_ptr( std::future_error(std::future_errc::broken_promise) ) );
+        m_state->release();
+        m_state = nullptr;
+    }
+
+    detail::future_state<T> * m_state;
+    bool                      m_retrieved = false;
+};
+
+namespace detail
+{
+    // stores a callable and its arguments, without std::bind when there
+    // are no arguments
+    template<typename F>
+    typename std::decay<F>::type bind_task(F && f)
+    {
+        return std::forward<F>(f);
+    }
+
+    template<typename F, typename A0, typename... A>
+    auto bind_task(F && f, A0 && a0, A &&... a)
+        -> decltype( std::bind(std::forward<F>(f), std::forward<A0>(a0), std::forward<A>(a)...) )
+    {
+        return std::bind(std::forward<F>(f), std::forward<A0>(a0), std::forward<A>(a)...);
+    }
+
+    template<typename R>
+    struct fulfil
+    {
+        template<typename F>
+        static void run(task_promise<R> & p, F & f)
+        {
+            p.set_value( f() );
+        }
+    };
+
+    template<>
+    struct fulfil<void>
+    {
+        template<typename F>
+        static void run(task_promise<void> & p, F & f)
+        {
+            f();
+            p.set_value();
+        }
+    };
+
+    // runs a callable and stores its result in a task_promise
+    template<typename R, typename F>
+    struct promise_task
+    {
+        task_promise<R> promise;
+        F               fn;
+
+        promise_task(task_promise<R> && p, F && f) : promise( std::move(p) ), fn( std::move(f) )
+        {
+        }
+
+        void operator()()
+        {
+            try
+            {
+                fulfil<R>::run(promise, fn);
+            }
+            catch(...)
+            {
+                promise.set_exception( std::current_exception() );
+            }
+        }
+    };
+
+    struct future_access
+    {
+        template<typename T>
+        static future_state<T> * state(task_future<T> const & f)
+        {
+            return f.m_state;
+        }
+
+        template<class Pool>
+        static void schedule(void * pool, unique_task && t)
+        {
+            Pool * p = static_cast<Pool*>(pool);
+
+            // tasks dropped by a pool which is being destroyed still run
+            // their continuations, but there is nowhere to post them
+            if( p->m_stopping.load() )
+                t();
+            else
+                p->post( std::move(t) );
+        }
+
+        template<class Pool>
+        static executor executor_of(Pool & pool)
+        {
+            executor e;
+            e.pool     = &pool;
+            e.schedule = &schedule<Pool>;
+            return e;
+        }
+    };
+
+    // calls a continuation with the future it was attached to
+    template<typename T, typename F>
+    struct then_call
+    {
+        F              fn;
+        task_future<T> antecedent;
+
+        continuation_result<F,T> operator()()
+        {
+            return fn( std::move(antecedent) );
+        }
+    };
+
+    // hands a continuation to its executor once the antecedent is ready
+    template<typename R, typename Call>
+    struct then_schedule
+    {
+        executor              exec;
+        promise_task<R, Call> task;
+
+        void operator()()
+        {
+            exec.run( unique_task( std::move(task) ) );
+        }
+    };
+
+    // the state shared by the continuations when_all( ) and when_any( )
+    // attach to their futures
+    template<typename T, typename Result>
+    struct future_join
+    {
+        std::vector< task_future<T> > futures;
+        task_promise<Result>          promise;
+        std::atomic<std::size_t>      remaining;
+        std::atomic<bool>             fired{false};
+        std::size_t                   index = static_cast<std::size_t>(-1);
+    };
+
+    template<typename T>
+    void complete_join(future_join<T, std::vector< task_future<T> > > & j)
+    {
+        j.promise.set_value( std::move(j.futures) );
+    }
+
+    template<typename T, typename Result>
+    void complete_join(future_join<T, Result> & j)
+    {
+        Result r;
+        r.index   = j.index;
+        r.futures = std::move(j.futures);
+        j.promise.set_value( std::move(r) );
+    }
+
+    template<typename T, typename Result>
+    struct join_arrival
+    {
+        std::shared_ptr< future_join<T, Result> > join;
+        std::size_t                               index;
+        bool                                      any;
+
+        void operator()()
+        {
+            if( any )
+            {
+                if( join->fired.exchange(true) )
+                    return;
+                join->index = index;
+            }
+            if( join->remaining.fetch_sub(1) == 1 )
+                complete_join( *join );
+        }
+    };
+
+    template<typename T, typename Result>
+    task_future<Result> join_futures(std::vector< task_future<T> > futures, bool any)
+    {
+        executor exec;
+        for(task_future<T> const & f : futures)
+        {
+            future_state<T> * s = future_access::state(f);
+            if( !s )
+                throw std::future_error(std::future_errc::no_state);
+            if( !exec.schedule )
+                exec = s->get_executor();
+        }
+
+        std::shared_ptr< future_join<T, Result> > join = std::make_shared< future_join<T, Result> >();
+        task_future<Result> res = join->promise.get_future();
+        future_access::state(res)->set_executor(exec);
+
+        // the join is completed by whoever arrives last: every future and
+        // this thread, or the first future and this thread for when_any.
+        // So the futures are not moved into the result while we are still
+        // attaching to them.
+        std::size_t n = futures.size();
+        join->remaining = ( any && n > 0 ) ? 2 : n + 1;
+        join->futures   = std::move(futures);
+        for(std::size_t i=0; i < n; i++)
+        {
+            join_arrival<T, Result> a = {join, i, any};
+            future_access::state( join->futures[i] )->on_ready( unique_task( std::move(a) ) );
+        }
+
+        join_arrival<T, Result> self = {join, n, false};
+        self();
+        return res;
+    }
+}
+
+template<typename T>
+template<typename F>
+task_future< detail::continuation_result<F,T> > task_future<T>::then(detail::executor const & e, F && f)
+{
+    using result_type = detail::continuation_result<F,T>;
+    using call_type   = detail::then_call<T, typename std::decay<F>::type>;
+
+    if( !m_state )
+        throw std::future_error(std::future_errc::no_state);
+
+    task_promise<result_type> promise;
+    task_future<result_type>  res = promise.get_future();
+    detail::future_access::state(res)->set_executor(e);
+
+    detail::future_state<T> * s = m_state;
+    call_type call = { std::forward<F>(f), std::move(*this) };
+
+    s->on_ready( unique_task( detail::then_schedule<result_type, call_type>{
+                                  e, detail::promise_task<result_type, call_type>( std::move(promise), std::move(call) ) } ) );
+    return res;
+}
+
+template<typename T>
+template<typename F>
+task_future< detail::continuation_result<F,T> > task_future<T>::then(F && f)
+{
+    if( !m_state )
+        throw std::future_error(std::future_errc::no_state);
+    detail::executor e = m_state->get_executor();
+    return then( e, std::forward<F>(f) );
+}
+
+template<typename T>
+template<class QueuePolicy, typename F>
+task_future< detail::continuation_result<F,T> > task_future<T>::then(basic_thread_pool<QueuePolicy> & pool, F && f)
+{
+    return then( detail::future_access::executor_of(pool), std::forward<F>(f) );
+}
+
+/**
+ * @brief when_all
+ * @param futures the futures to wait for
+ * @return a future which becomes ready, holding the same futures, once
+ *         every one of them is ready. Its continuations go to the pool of
+ *         the first future which came from one.
+ */
+template<typename T>
+task_future< std::vector< task_future<T> > > when_all(std::vector< task_future<T> > futures)
+{
+    return detail::join_futures<T, std::vector< task_future<T> > >( std::move(futures), false );
+}
+
+/**
+ * @brief The when_any_result struct
+ *
+ * What the future returned by when_any( ) holds: the futures, and the
+ * position of the first one which became ready.
+ */
+template<typename T>
+struct when_any_result
+{
+    std::size_t                   index = static_cast<std::size_t>(-1);
+    std::vector< task_future<T> > futures;
+};
+
+/**
+ * @brief when_any
+ * @param futures the futures to wait for
+ * @return a future which becomes ready as soon as one of them is. If
+ *         futures is empty it is ready straight away, with an index of -1.
+ */
+template<typename T>
+task_future< when_any_result<T> > when_any(std::vector< task_future<T> > futures)
+{
+    return detail::join_futures<T, when_any_result<T> >( std::move(futures), true );
+}
+
+namespace detail
+{
+    /**
+     * @brief The task_node struct
+     *
+     * A task waiting in one of the pool's queues. The queues link the
+     * nodes together, so adding a task to a queue does not allocate.
+     */
+    struct task_node
+    {
+        template<typename F>
+        explicit task_node(F && f) : fn( std::forward<F>(f) )
+        {
+        }
+
+        unique_task   fn;
+        task_node *   next     = nullptr;
+        std::uint64_t enqueued = 0; // steady clock ns, only set when timing tasks
+    };
+
+    using task_node_pool = object_pool<task_node>;
+
+    /**
+     * @brief The task_list class
+     *
+     * An intrusive FIFO of task_nodes. Not thread safe.
+     */
+    class task_list
+    {
+    public:
+        task_list() = default;
+        task_list(task_list const &) = delete;
+        task_list & operator=(task_list const &) = delete;
+
+        ~task_list()
+        {
+            clear();
+        }
+
+        void push_back(task_node * n)
+        {
+            n->next = nullptr;
+            if( m_tail )
+                m_tail->next = n;
+            else
+                m_head = n;
+            m_tail = n;
+            ++m_size;
+        }
+
+        task_node * pop_front()
+        {
+            task_node * n = m_head;
+            if( n )
+            {
+                m_head = n->next;
+                if( !m_head )
+                    m_tail = nullptr;
+                --m_size;
+            }
+            return n;
+        }
+
+        bool empty() const
+        {
+            return m_head == nullptr;
+        }
+
+        std::size_t size() const
+        {
+            return m_size;
+        }
+
+        // moves all of other's tasks onto the end of this list
+        void splice_back(task_list & other)
+        {
+            if( !other.m_head )
+                return;
+            if( m_tail )
+                m_tail->next = other.m_head;
+            else
+                m_head = other.m_head;
+            m_tail  = other.m_tail;
+            m_size += other.m_size;
+
+            other.m_head = nullptr;
+            other.m_tail = nullptr;
+            other.m_size = 0;
+        }
+
+        // deletes all the tasks
+        void clear()
+        {
+            while( task_node * n = pop_front() )
+                task_node_pool::destroy(n);
+        }
+
+    protected:
+        task_node * m_head = nullptr;
+        task_node * m_tail = nullptr;
+        std::size_t m_size = 0;
+    };
+
+    /**
+     * @brief The chase_lev_deque class
+     *
+     * The work stealing deque from "Dynamic Circular Work-Stealing Deque"
+     * (Chase and Lev, 2005), using the memory orderings from "Correct and
+     * Efficient Work-Stealing for Weak Memory Models" (Le et al, 2013).
+     *
+     * The owning thread pushes and pops at the bottom without taking any
+     * locks, other threads steal from the top. The buffer grows when it is
+     * full. Old buffers are kept until the deque is destroyed because a
+     * thief may still be reading from them.
+     */
+    template<typename T>
+    class chase_lev_deque
+    {
+    public:
+        explicit chase_lev_deque(std::size_t capacity = 256)
+        {
+            std::size_t c = 1;
+            while( c < capacity )
+                c <<= 1;
+            m_buffers.emplace_back( new buffer(c) );
+            m_buffer.store( m_buffers.back().get(), std::memory_order_relaxed );
+        }
+
+        chase_lev_deque(chase_lev_deque const &) = delete;
+        chase_lev_deque & operator=(chase_lev_deque const &) = delete;
+
+        /**
+         * @brief push
+         * @param x
+         *
+         * Adds an item to the bottom. Only the owner may call this.
+         */
+        void push(T * x)
+        {
+            std::uint64_t b = m_bottom.load(std::memory_order_relaxed);
+            std::uint64_t t = m_top.load(std::memory_order_acquire);
+            buffer *     a = m_buffer.load(std::memory_order_relaxed);
+
+            if( b - t > a->mask )
+                a = grow(a, b, t);
+
+            a->put(b, x);
+            std::atomic_thread_fence(std::memory_order_release);
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief pop
+         * @return the most recently pushed item, or nullptr
+         *
+         * Only the owner may call this.
+         */
+        T * pop()
+        {
+            std::uint64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+            buffer *     a = m_buffer.load(std::memory_order_relaxed);
+            m_bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            std::uint64_t t = m_top.load(std::memory_order_relaxed);
+
+            T * x = nullptr;
+            if( t <= b )
+            {
+                x = a->get(b);
+                if( t == b )
+                {
+                    // the last item, race the thieves for it
+                    if( !m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed) )
+                        x = nullptr;
+                    m_bottom.store(b + 1, std::memory_order_relaxed);
+                }
+            }
+            else
+            {
+                m_bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return x;
+        }
+
+        /**
+         * @brief steal
+         * @return the oldest item, or nullptr if the deque was empty or
+         *         another thread got to it first
+         *
+         * Can be called from any thread.
+         */
+        T * steal()
+        {
+            std::uint64_t t = m_top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            std::uint64_t b = m_bottom.load(std::memory_order_acquire);
+
+            if( t < b )
+            {
+                buffer * a = m_buffer.load(std::memory_order_acquire);
+                T *      x = a->get(t);
+                if( !m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed) )
+                    return nullptr;
+                return x;
+            }
+            return nullptr;
+        }
+
+        /**
+         * @brief size
+         * @return the number of items. Only a hint if other threads are
+         *         using the deque.
+         */
+        std::size_t size() const
+        {
+            std::uint64_t b = m_bottom.load(std::memory_order_relaxed);
+            std::uint64_t t = m_top.load(std::memory_order_relaxed);
+            return b > t ? static_cast<std::size_t>(b - t) : 0;
+        }
+
+        bool empty() const
+        {
+            return size() == 0;
+        }
+
+    protected:
+        struct buffer
+        {
+            explicit buffer(std::size_t capacity)
+                : mask( static_cast<std::uint64_t>(capacity) - 1 ),
+                  slots( new std::atomic<T*>[capacity] )
+            {
+            }
+
+            T * get(std::uint64_t i) const
+            {
+                return slots[ static_cast<std::size_t>(i & mask) ].load(std::memory_order_relaxed);
+            }
+
+            void put(std::uint64_t i, T * x)
+            {
+                slots[ static_cast<std::size_t>(i & mask) ].store(x, std::memory_order_relaxed);
+            }
+
+            std::uint64_t                     mask;
+            std::unique_ptr<std::atomic<T*>[]> slots;
+        };
+
+        buffer * grow(buffer * a, std::uint64_t b, std::uint64_t t)
+        {
+            buffer * n = new buffer( static_cast<std::size_t>(a->mask + 1) * 2 );
+            for(std::uint64_t i=t; i < b; i++)
+                n->put(i, a->get(i));
+
+            m_buffers.emplace_back(n);
+            m_buffer.store(n, std::memory_order_release);
+            return n;
+        }
+
+        // top and bottom on separate cache lines, thieves only write top.
+        // They start at 1 so that pop( ) can step bottom back below top
+        // without the unsigned index wrapping around.
+        std::atomic<std::uint64_t>            m_top{1};
+        char                                  m_pad[64];
+        std::atomic<std::uint64_t>            m_bottom{1};
+        std::atomic<buffer*>                  m_buffer{nullptr};
+        std::vector< std::unique_ptr<buffer> > m_buffers; // only touched by the owner
+    };
+
+    /**
+     * @brief The parallel_state struct
+     *
+     * Shared by the threads working on one parallel_for. The range is
+     * handed out in chunks from an atomic counter. The chunks start at
+     * 1/(2*participants) of what is left and shrink down to the grain
+     * size, so early chunks are cheap to hand out and the last ones
+     * balance the load. It is held in a shared_ptr because helper tasks
+     * may only get to run after the caller has finished everything.
+     */
+    template<typename Body>
+    struct parallel_state
+    {
+        parallel_state(Body & b, std::size_t n, std::size_t g, std::size_t p)
+            : body(b), size(n), grain(g), participants(p)
+        {
+        }
+
+        bool claim(std::size_t & lo, std::size_t & hi)
+        {
+            std::size_t n = next.load(std::memory_order_relaxed);
+            for(;;)
+            {
+                if( n >= size )
+                    return false;
+
+                std::size_t chunk = std::max( grain, (size - n) / (2 * participants) );
+                std::size_t h     = n + std::min(chunk, size - n);
+                if( next.compare_exchange_weak(n, h, std::memory_order_relaxed) )
+                {
+                    lo = n;
+                    hi = h;
+                    return true;
+                }
+            }
+        }
+
+        void finished(std::size_t count)
+        {
+            if( done.fetch_add(count, std::memory_order_acq_rel) + count == size )
+            {
+                std::lock_guard<std::mutex> L(mutex);
+                cv.notify_all();
+            }
+        }
+
+        // processes chunks until there are none left
+        void run()
+        {
+            std::size_t lo, hi;
+            while( claim(lo, hi) )
+            {
+                try
+                {
+                    body(lo, hi);
+                }
+                catch(...)
+                {
+                    {
+                        std::lock_guard<std::mutex> L(mutex);
+                        if( !error )
+                            error = std::current_exception();
+                    }
+                    // skip everything that has not been handed out yet
+                    std::size_t skipped = size - next.exchange(size);
+                    finished( hi - lo + skipped );
+                    return;
+                }
+                finished( hi - lo );
+            }
+        }
+
+        void wait()
+        {
+            std::unique_lock<std::mutex> L(mutex);
+            cv.wait(L, [this]{ return done.load(std::memory_order_acquire) == size; });
+        }
+
+        Body &                   body;
+        std::size_t const        size;
+        std::size_t const        grain;
+        std::size_t const        participants;
+        std::atomic<std::size_t> next{0};
+        std::atomic<std::size_t> done{0};
+        std::mutex               mutex;
+        std::condition_variable  cv;
+        std::exception_ptr       error; // guarded by mutex
+    };
+
+    /**
+     * @brief The event_count class
+     *
+     * Lets threads sleep until there is work without them having to share
+     * a lock with the threads producing it. A waiter calls prepare_wait( ),
+     * checks its condition again and then calls wait( ) with the key it was
+     * given. If notify( ) was called in between, wait( ) returns straight
+     * away. notify( ) is only a fence and a load when nobody is waiting.
+     *
+     * On Linux this is a futex, elsewhere a mutex and condition variable.
+     */
+    class event_count
+    {
+    public:
+        std::uint32_t prepare_wait()
+        {
+            m_waiters.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return m_epoch.load(std::memory_order_acquire);
+        }
+
+        void cancel_wait()
+        {
+            m_waiters.fetch_sub(1);
+        }
+
+        /**
+         * @brief wait
+         * @param key the value prepare_wait( ) returned
+         * @param timeout how long to wait at most, zero waits until notified
+         * @return false if the timeout ran out
+         */
+        bool wait(std::uint32_t key, std::chrono::nanoseconds timeout = std::chrono::nanoseconds::zero())
+        {
+            bool woken = true;
+#if defined __linux__
+            if( m_epoch.load(std::memory_order_acquire) == key )
+            {
+                if( timeout.count() > 0 )
+                {
+                    timespec ts;
+                    ts.tv_sec  = static_cast<time_t>( timeout.count() / 1000000000 );
+                    ts.tv_nsec = static_cast<long>( timeout.count() % 1000000000 );
+                    if( ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&m_epoch), FUTEX_WAIT_PRIVATE, key, &ts, nullptr, 0) != 0 && errno == ETIMEDOUT )
+                        woken = false;
+                }
+                else
+                {
+                    ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&m_epoch), FUTEX_WAIT_PRIVATE, key, nullptr, nullptr, 0);
+                }
+            }
+#else
+            std::unique_lock<std::mutex> L(m_mutex);
+            if( timeout.count() > 0 )
+                woken = m_cv.wait_for(L, timeout, [this, key]{ return m_epoch.load() != key; });
+            else
+                m_cv.wait(L, [this, key]{ return m_epoch.load() != key; });
+#endif
+            m_waiters.fetch_sub(1);
+            return woken;
+        }
+
+        /**
+         * @brief notify
+         * @param count the number of waiters to wake
+         */
+        void notify(std::size_t count)
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if( m_waiters.load(std::memory_order_relaxed) == 0 )
+                return;
+
+            m_epoch.fetch_add(1, std::memory_order_release);
+#if defined __linux__
+            int n = count > static_cast<std::size_t>(INT_MAX) ? INT_MAX : static_cast<int>(count);
+            ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&m_epoch), FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+#else
+            {
+                std::lock_guard<std::mutex> L(m_mutex);
+            }
+            if( count > 1 )
+                m_cv.notify_all();
+            else
+                m_cv.notify_one();
+#endif
+        }
+
+    protected:
+        std::atomic<std::uint32_t> m_epoch{0};
+        std::atomic<std::uint32_t> m_waiters{0};
+#if !defined __linux__
+        std::mutex                 m_mutex;
+        std::condition_variable    m_cv;
+#endif
+    };
+}
+
+/**
+ * @brief The locked_queue class
+ *
+ * The default queue policy for basic_thread_pool: a list of tasks guarded
+ * by a mutex. Idle workers wait on a condition variable.
+ *
+ * A queue policy provides push( ), push_bulk( ) and pop( ), which never
+ * block, wait( ), which puts an idle worker to sleep until there is a task
+ * or ready( ) returns true, or the optional timeout runs out, in which
+ * case it returns false, notify( ) and notify_all( ) to wake workers for
+ * work which did not go through the queue, and size( ) and clear( ).
+ */
+class locked_queue
+{
+public:
+    void push(detail::task_node * n)
+    {
+        {
+            std::lock_guard<std::mutex> L(m_mutex);
+            m_tasks.push_back(n);
+        }
+        if( m_sleepers.load() )
+            m_cv.notify_one();
+    }
+
+    void push_bulk(detail::task_list & tasks)
+    {
+        std::size_t count = tasks.size();
+        {
+            std::lock_guard<std::mutex> L(m_mutex);
+            m_tasks.splice_back(tasks);
+        }
+        if( m_sleepers.load() )
+        {
+            if( count > 1 )
+                m_cv.notify_all();
+            else
+                m_cv.notify_one();
+        }
+    }
+
+    detail::task_node * pop()
+    {
+        std::lock_guard<std::mutex> L(m_mutex);
+        return m_tasks.pop_front();
+    }
+
+    template<typename Ready>
+    bool wait(Ready ready, std::chrono::nanoseconds timeout = std::chrono::nanoseconds::zero())
+    {
+        std::unique_lock<std::mutex> L(m_mutex);
+
+        // tell the pushers that we are about to sleep, then look again
+        // so that a task pushed in between is not missed
+        bool woken = true;
+        ++m_sleepers;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if( m_tasks.empty() && !ready() )
+        {
+            if( timeout.count() > 0 )
+                woken = m_cv.wait_for(L, timeout) == std::cv_status::no_timeout;
+            else
+                m_cv.wait(L);
+        }
+        --m_sleepers;
+        return woken;
+    }
+
+    void notify(std::size_t tasks)
+    {
+        // the sleeper increments m_sleepers and checks for work while
+        // holding the lock, so taking it here means it is either still
+        // going to see the new task, or is already waiting.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if( m_sleepers.load(std::memory_order_relaxed) )
+        {
+            std::lock_guard<std::mutex> L(m_mutex);
+            if( tasks > 1 )
+                m_cv.notify_all();
+            else
+                m_cv.notify_one();
+        }
+    }
+
+    void notify_all()
+    {
+        std::lock_guard<std::mutex> L(m_mutex);
+        m_cv.notify_all();
+    }
+
+    std::size_t size()
+    {
+        std::lock_guard<std::mutex> L(m_mutex);
+        return m_tasks.size();
+    }
+
+    void clear()
+    {
+        // destroyed outside the lock, a dropped task's continuation may
+        // push another one
+        detail::task_list tasks;
+        {
+            std::lock_guard<std::mutex> L(m_mutex);
+            tasks.splice_back(m_tasks);
+        }
+        tasks.clear();
+    }
+
+protected:
+    detail::task_list       m_tasks;
+    std::mutex              m_mutex;
+    std::condition_variable m_cv;
+    std::atomic<uint32_t>   m_sleepers{0}; // workers waiting on m_cv
+};
+
+/**
+ * @brief The lockfree_queue class
+ *
+ * A queue policy for basic_thread_pool built on the bounded multi-producer
+ * multi-consumer ring buffer by Dmitry Vyukov. Pushing or popping a task
+ * is a compare-and-swap on the ring's position and a store to the cell's
+ * sequence number, so workers do not queue up on a mutex.
+ *
+ * When the ring is full the tasks go onto a locked overflow list, which
+ * is only looked at once the ring is empty, so tasks are no longer run in
+ * order at that point. Idle workers sleep on a futex, and pushing a task
+ * only makes a system call when a worker is asleep.
+ */
+class lockfree_queue
+{
+public:
+    static const std::size_t capacity = 4096;
+
+    lockfree_queue() : m_cells( new cell[capacity] )
+    {
+        for(std::size_t i=0; i < capacity; i++)
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    lockfree_queue(lockfree_queue const &) = delete;
+    lockfree_queue & operator=(lockfree_queue const &) = delete;
+
+    ~lockfree_queue()
+    {
+        clear();
+    }
+
+    void push(detail::task_node * n)
+    {
+        enqueue(n);
+        m_event.notify(1);
+    }
+
+    void push_bulk(detail::task_list & tasks)
+    {
+        std::size_t count = tasks.size();
+        while( detail::task_node * n = tasks.pop_front() )
+            enqueue(n);
+        m_event.notify(count);
+    }
+
+    detail::task_node * pop()
+    {
+        if( detail::task_node * n = dequeue() )
+            return n;
+
+        if( m_overflow_size.load(std::memory_order_acquire) == 0 )
+            return nullptr;
+
+        std::lock_guard<std::mutex> L(m_overflow_mutex);
+        detail::task_node * n = m_overflow.pop_front();
+        if( n )
+            m_overflow_size.fetch_sub(1, std::memory_order_relaxed);
+        return n;
+    }
+
+    template<typename Ready>
+    bool wait(Ready ready, std::chrono::nanoseconds timeout = std::chrono::nanoseconds::zero())
+    {
+        std::uint32_t key = m_event.prepare_wait();
+        if( size() != 0 || ready() )
+        {
+            m_event.cancel_wait();
+            return true;
+        }
+        return m_event.wait(key, timeout);
+    }
+
+    void notify(std::size_t tasks)
+    {
+        m_event.notify(tasks);
+    }
+
+    void notify_all()
+    {
+        m_event.notify( static_cast<std::size_t>(-1) );
+    }
+
+    std::size_t size()
+    {
+        // a task is counted as soon as its cell is claimed
+        std::size_t d = m_dequeue_pos.load(std::memory_order_acquire);
+        std::size_t e = m_enqueue_pos.load(std::memory_order_acquire);
+        return e - d + m_overflow_size.load(std::memory_order_acquire);
+    }
+
+    void clear()
+    {
+        while( detail::task_node * n = pop() )
+            detail::task_node_pool::destroy(n);
+    }
+
+protected:
+    struct cell
+    {
+        std::atomic<std::size_t> sequence;
+        detail::task_node *      data;
+    };
+
+    void enqueue(detail::task_node * n)
+    {
+        cell *      c;
+        std::size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        for(;;)
+        {
+            c = &m_cells[pos & (capacity - 1)];
+            std::size_t    seq = c->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t dif = static_cast<std::ptrdiff_t>(seq - pos);
+            if( dif == 0 )
+            {
+                if( m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) )
+                    break;
+            }
+            else if( dif < 0 )
+            {
+                // the ring is full
+                std::lock_guard<std::mutex> L(m_overflow_mutex);
+                m_overflow.push_back(n);
+                m_overflow_size.fetch_add(1, std::memory_order_release);
+                return;
+            }
+            else
+            {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        c->data = n;
+        c->sequence.store(pos + 1, std::memory_order_release);
+    }
+
+    detail::task_node * dequeue()
+    {
+        cell *      c;
+        std::size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        for(;;)
+        {
+            c = &m_cells[pos & (capacity - 1)];
+            std::size_t    seq = c->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t dif = static_cast<std::ptrdiff_t>(seq - (pos + 1));
+            if( dif == 0 )
+            {
+                if( m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) )
+                    break;
+            }
+            else if( dif < 0 )
+            {
+                return nullptr; // empty
+            }
+            else
+            {
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        detail::task_node * n = c->data;
+        c->sequence.store(pos + capacity, std::memory_order_release);
+        return n;
+    }
+
+    std::unique_ptr<cell[]>  m_cells;
+
+    // the two positions on separate cache lines, producers only write
+    // one and consumers the other
+    char                     m_pad0[64];
+    std::atomic<std::size_t> m_enqueue_pos{0};
+    char                     m_pad1[64];
+    std::atomic<std::size_t> m_dequeue_pos{0};
+    char                     m_pad2[64];
+
+    std::atomic<std::size_t> m_overflow_size{0};
+    std::mutex               m_overflow_mutex;
+    detail::task_list        m_overflow;
+
+    detail::event_count      m_event;
+};
+
+/**
+ * @brief The numa_node struct
+ *
+ * A NUMA node and the CPUs which belong to it.
+ */
+struct numa_node
+{
+    int              id;
+    std::vector<int> cpus;
+};
+
+namespace detail
+{
+    /**
+     * @brief parse_cpu_list
+     * @param list a list in the kernel's format, eg: "0-3,8,10-11"
+     * @return the numbers in the list
+     */
+    inline std::vector<int> parse_cpu_list(std::string const & list)
+    {
+        std::vector<int> cpus;
+        std::size_t      i = 0;
+
+        auto number = [&](int & x)
+        {
+            std::size_t start = i;
+            x = 0;
+            while( i < list.size() && list[i] >= '0' && list[i] <= '9' )
+                x = x * 10 + (list[i++] - '0');
+            return i != start;
+        };
+
+        while( i < list.size() )
+        {
+            int first, last;
+            if( !number(first) )
+                break;
+            last = first;
+            if( i < list.size() && list[i] == '-' )
+            {
+                ++i;
+                if( !number(last) )
+                    break;
+            }
+            for(int c=first; c <= last; c++)
+                cpus.push_back(c);
+
+            if( i < list.size() && list[i] != ',' )
+                break;
+            ++i;
+        }
+        return cpus;
+    }
+
+    inline std::string read_line(std::string const & path)
+    {
+        std::ifstream in(path);
+        std::string   line;
+        std::getline(in, line);
+        return line;
+    }
+
+    // pins the calling thread to the given CPUs
+    inline bool set_thread_affinity(std::vector<int> const & cpus)
+    {
+#if defined __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for(int c : cpus)
+        {
+            if( c >= 0 && c < CPU_SETSIZE )
+                CPU_SET(c, &set);
+        }
+        return ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) == 0;
+#else
+        (void)cpus;
+        return false;
+#endif
+    }
+
+    // tells the CPU we are in a spin loop
+    inline void cpu_relax()
+    {
+#if defined __x86_64__ || defined __i386__ || defined _M_X64 || defined _M_IX86
+        _mm_pause();
+#elif defined __aarch64__
+        __asm__ __volatile__("yield");
+#endif
+    }
+
+    // names the calling thread, Linux keeps the first 15 characters
+    inline void set_thread_name(std::string const & name)
+    {
+#if defined __linux__
+        ::pthread_setname_np( ::pthread_self(), name.substr(0, 15).c_str() );
+#else
+        (void)name;
+#endif
+    }
+}
+
+/**
+ * @brief numa_topology
+ * @return the NUMA nodes which have CPUs
+ *
+ * Read from /sys/devices/system/node on Linux. Elsewhere, or when that
+ * can not be read, all the CPUs are reported as a single node.
+ */
+inline std::vector<numa_node> numa_topology()
+{
+    std::vector<numa_node> nodes;
+
+#if defined __linux__
+    for(int id : detail::parse_cpu_list( detail::read_line("/sys/devices/system/node/online") ))
+    {
+        numa_node n;
+        n.id   = id;
+        n.cpus = detail::parse_cpu_list( detail::read_line("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist") );
+        if( !n.cpus.empty() )
+            nodes.push_back(n);
+    }
+#endif
+
+    if( nodes.empty() )
+    {
+        numa_node n;
+        n.id = 0;
+        for(unsigned c=0; c < std::max(1u, std::thread::hardware_concurrency()); c++)
+            n.cpus.push_back( static_cast<int>(c) );
+        nodes.push_back(n);
+    }
+    return nodes;
+}
+
+/**
+ * @brief The thread_affinity enum
+ *
+ * How the workers of a thread_pool are pinned to CPUs.
+ */
+enum class thread_affinity
+{
+    none,      // the OS decides
+    cpu,       // every worker gets a CPU of its own, spread across the nodes
+    numa_node  // every worker may use any CPU of its NUMA node
+};
+
+/**
+ * @brief The task_priority enum
+ *
+ * Which queue a task waits in. Normal tasks use the pool's queue policy,
+ * high and low priority tasks go into their own lists.
+ */
+enum class task_priority
+{
+    high,
+    normal,
+    low
+};
+
+/**
+ * @brief The duration_histogram struct
+ *
+ * Counts durations in power of two buckets: bucket i holds the durations
+ * from 2^i up to 2^(i+1) nanoseconds, bucket 0 also holds zero.
+ */
+struct duration_histogram
+{
+    static const std::size_t bucket_count = 40;
+
+    duration_histogram()
+    {
+        for(std::size_t i=0; i < bucket_count; i++)
+            buckets[i] = 0;
+    }
+
+    static std::size_t bucket_of(std::uint64_t ns)
+    {
+        std::size_t b = 0;
+        while( ns > 1 && b < bucket_count - 1 )
+        {
+            ns >>= 1;
+            ++b;
+        }
+        return b;
+    }
+
+    /**
+     * @brief count
+     * @return the number of durations recorded
+     */
+    std::uint64_t count() const
+    {
+        std::uint64_t c = 0;
+        for(std::size_t i=0; i < bucket_count; i++)
+            c += buckets[i];
+        return c;
+    }
+
+    /**
+     * @brief percentile
+     * @param p between 0 and 100
+     * @return the upper end, in nanoseconds, of the bucket the p'th
+     *         percentile falls in. 0 if nothing was recorded.
+     */
+    std::uint64_t percentile(double p) const
+    {
+        std::uint64_t total = count();
+        if( total == 0 )
+            return 0;
+
+        std::uint64_t rank = static_cast<std::uint64_t>( p / 100.0 * static_cast<double>(total) + 0.5 );
+        std::uint64_t seen = 0;
+        for(std::size_t i=0; i < bucket_count; i++)
+        {
+            seen += buckets[i];
+            if( seen >= rank && seen > 0 )
+                return std::uint64_t(2) << i;
+        }
+        return std::uint64_t(2) << (bucket_count - 1);
+    }
+
+    std::uint64_t buckets[bucket_count];
+};
+
+/**
+ * @brief The task_trace struct
+ *
+ * What the trace hook is told about every task a worker runs.
+ */
+struct task_trace
+{
+    std::size_t   worker;        // the worker's number, as in its thread name
+    std::uint64_t queue_wait_ns; // time between queueing the task and a worker taking it
+    std::uint64_t execution_ns;  // time the task ran for
+};
+
+/**
+ * @brief The thread_pool_metrics struct
+ *
+ * A snapshot of a pool's counters, see thread_pool::metrics( ). Workers
+ * which have exited are still included.
+ */
+struct thread_pool_metrics
+{
+    std::uint64_t      tasks_submitted  = 0;
+    std::uint64_t      tasks_completed  = 0;
+    std::uint64_t      steals           = 0; // tasks taken from another worker's deque
+    std::uint64_t      peak_queue_depth = 0; // most tasks waiting at once
+    std::uint64_t      busy_ns          = 0; // time the workers spent running tasks
+    std::uint64_t      idle_ns          = 0; // time the workers spent looking for or waiting for tasks
+    std::size_t        workers          = 0;
+    std::size_t        queued           = 0;
+    duration_histogram queue_wait;
+    duration_histogram execution;
+};
+
+/**
+ * @brief The thread_pool_options struct
+ *
+ * Settings which are fixed when the thread_pool is created.
+ */
+struct thread_pool_options
+{
+    /**
+     * Give each worker its own deque. Tasks pushed from inside a task go
+     * onto the worker's own deque without taking a lock, and idle workers
+     * steal from the others. Tasks pushed from other threads go through the
+     * shared queue.
+     */
+    bool        work_stealing = false;
+
+    /**
+     * The number of workers which get a deque, 0 picks a default. Workers
+     * added beyond this only use the shared queue.
+     */
+    std::size_t max_workers = 0;
+
+    /**
+     * How the workers are pinned to CPUs. Only supported on Linux.
+     */
+    thread_affinity  affinity = thread_affinity::none;
+
+    /**
+     * The CPUs the workers may be pinned to, empty means all of them.
+     */
+    std::vector<int> cpus;
+
+    /**
+     * Give every NUMA node its own queue, see post_to_node( ). Workers
+     * take tasks from their own node's queue before anything else and
+     * from the other nodes' queues only when they have nothing else to do.
+     */
+    bool             numa_aware = false;
+
+    /**
+     * Workers are named "<thread_name>-<n>" so they can be told apart in
+     * top, perf or a debugger. Empty leaves the names alone.
+     */
+    std::string      thread_name;
+
+    /**
+     * An idle worker polls for work this many times, with a pause
+     * instruction in between, before it goes to sleep. A task which
+     * arrives in that time is picked up without a wake up system call,
+     * at the cost of some CPU time after every burst of tasks.
+     */
+    std::size_t      spin_count = 0;
+
+    /**
+     * Then it polls this many more times, yielding the CPU in between.
+     */
+    std::size_t      yield_count = 0;
+
+    /**
+     * Start and stop workers automatically. When a task is queued while
+     * every worker is busy and there are more tasks waiting than workers,
+     * a worker is added, up to max_threads. A worker which found nothing
+     * to do for idle_timeout exits, down to min_threads.
+     */
+    bool             auto_scale = false;
+    std::size_t      min_threads = 1;
+    std::size_t      max_threads = 0; // 0 picks the number of CPUs
+    std::chrono::milliseconds idle_timeout{1000};
+
+    /**
+     * Count and time every task so metrics( ) has something to report.
+     * This costs a few clock reads and relaxed atomic updates per task.
+     */
+    bool             collect_metrics = false;
+
+    /**
+     * Called by the worker after every task, eg: to log the ones which
+     * waited or ran for too long. It must not throw. Setting it times
+     * every task, like collect_metrics.
+     */
+    std::function<void(task_trace const &)> trace_hook;
+};
+
+/**
+ * @brief The basic_thread_pool class
+ *
+ * A pool of worker threads which run the tasks given to it. QueuePolicy is
+ * the shared queue the tasks wait in, either locked_queue or
+ * lockfree_queue. Most code should use the thread_pool typedef.
+ */
+template<class QueuePolicy>
+class basic_thread_pool
+{
+
+    public:
+        using queue_type = QueuePolicy;
+
+        basic_thread_pool(size_t num_threads);
+        basic_thread_pool(size_t num_threads, thread_pool_options const & options);
+        basic_thread_pool();
+
+        basic_thread_pool(basic_thread_pool const &) = delete;
+        basic_thread_pool & operator=(basic_thread_pool const &) = delete;
+
+
+        template<class F, class... Args>
+        std::future<typename std::result_of<F(Args...)>::type> push( F && f, Args &&... args);
+
+        /**
+         * @brief post
+         * @param f
+         * @param args
+         *
+         * Queues a task without returning a future. Small callables are
+         * stored in the task itself and task memory is recycled, so this
+         * does not allocate. If the task throws, std::terminate is called.
+         */
+        template<class F, class... Args>
+        void post( F && f, Args &&... args);
+
+        /**
+         * @brief submit
+         * @param f
+         * @param args
+         * @return a task_future for the result
+         *
+         * Like push( ), but the future's state is recycled as well, so
+         * submitting a small callable does not allocate.
+         */
+        template<class F, class... Args>
+        task_future<typename std::result_of<F(Args...)>::type> submit( F && f, Args &&... args);
+
+        /**
+         * @brief post
+         * @param priority
+         * @param f
+         * @param args
+         *
+         * Queues a task with the given priority. Workers take a high
+         * priority task before anything else, but out of every 16 tasks
+         * they pick, 3 come from the normal queue and 1 from the low one
+         * when those have tasks waiting, so a steady stream of high
+         * priority work cannot starve them. While no high or low priority
+         * tasks are queued the workers only check a single counter.
+         */
+        template<class F, class... Args>
+        void post( task_priority priority, F && f, Args &&... args);
+
+        /**
+         * @brief submit
+         * @param priority
+         * @param f
+         * @param args
+         * @return a task_future for the result
+         *
+         * submit( ) with a priority, see post( ).
+         */
+        template<class F, class... Args>
+        task_future<typename std::result_of<F(Args...)>::type> submit( task_priority priority, F && f, Args &&... args);
+
+        /**
+         * @brief push_bulk
+         * @param first
+         * @param last
+         *
+         * Queues every callable in [first, last) like post( ). All the
+         * tasks are added under a single lock and the sleeping workers are
+         * woken with one notification, instead of once per task.
+         */
+        template<class InputIt>
+        void push_bulk(InputIt first, InputIt last);
+
+        /**
+         * @brief parallel_for
+         * @param begin
+         * @param end
+         * @param grain the smallest number of indices handed out at once, 0 picks one
+         * @param fn called as fn(i) for every i in [begin, end)
+         *
+         * Splits the range into chunks which are shared between the
+         * workers and the calling thread. The caller works on the range
+         * too instead of blocking, so this can also be called from inside
+         * a task. Returns once every index has been processed. If fn
+         * throws, the indices not yet started are skipped and the first
+         * exception is rethrown.
+         */
+        template<class Index, class F>
+        void parallel_for(Index begin, Index end, std::size_t grain, F && fn);
+
+        /**
+         * @brief parallel_reduce
+         * @param begin
+         * @param end
+         * @param grain the smallest number of indices handed out at once, 0 picks one
+         * @param identity the starting value of every partial result
+         * @param fn called as fn(i) for every i in [begin, end)
+         * @param reduce combines two values, reduce(a, b)
+         * @return the reduction of identity and all the fn(i)
+         *
+         * The partial results are combined in whatever order the chunks
+         * finish, so reduce must be associative and commutative.
+         */
+        template<class Index, class T, class F, class R>
+        T parallel_reduce(Index begin, Index end, std::size_t grain, T identity, F && fn, R && reduce);
+
+        /**
+         * @brief parallel_transform
+         * @param first
+         * @param last
+         * @param d_first
+         * @param grain the smallest number of elements handed out at once, 0 picks one
+         * @param fn
+         * @return an iterator past the last element written
+         *
+         * The parallel version of std::transform. Both iterators must be
+         * random access.
+         */
+        template<class InputIt, class OutputIt, class F>
+        OutputIt parallel_transform(InputIt first, InputIt last, OutputIt d_first, std::size_t grain, F && fn);
+
+        /**
+         * @brief create_workers
+         * @param num
+         * Creates a new worker to work the threadpool
+         */
+        void create_workers(std::size_t num);
+        /**
+         * @brief remove_thread
+         * Remove a worker from the thread pool
+         */
+        void remove_worker();
+        /**
+         * @brief clear_tasks
+         *
+         * Clears all the current tasks in the queue
+         */
+        void clear_tasks();
+
+        /**
+         * @brief num_tasks
+         * @return
+         *
+         * Returns the number of tasks still in the queue
+         */
+        std::size_t num_tasks();
+
+        /**
+         * @brief num_workers
+         * @return
+         *
+         * Returns the number of workers in this thread pool
+         */
+        std::size_t num_workers() { return m_worker_count; }
+
+        /**
+         * @brief is_worker
+         * @return true if the calling thread is one of this pool's workers
+         */
+        bool is_worker() const { return current_worker().pool == this; }
+
+        /**
+         * @brief work_stealing
+         * @return true if the workers have their own deques
+         */
+        bool work_stealing() const { return m_options.work_stealing; }
+
+        /**
+         * @brief metrics
+         * @return a snapshot of the pool's counters
+         *
+         * Only the worker and queued task counts are filled in unless the
+         * pool was created with collect_metrics or a trace_hook. The
+         * counters are read without stopping the workers, so they may be
+         * a task or two apart from each other.
+         */
+        thread_pool_metrics metrics();
+
+        /**
+         * @brief numa_nodes
+         * @return the number of NUMA nodes tasks can be posted to
+         *
+         * 1 unless the pool was created with numa_aware set.
+         */
+        std::size_t numa_nodes() const { return m_node_count; }
+
+        /**
+         * @brief post_to_node
+         * @param node an index below numa_nodes( ), not the kernel's node id
+         * @param f
+         * @param args
+         *
+         * Queues a task for the workers on a NUMA node, so it runs close
+         * to memory that node allocated. Throws std::out_of_range for an
+         * unknown node.
+         */
+        template<class F, class... Args>
+        void post_to_node(std::size_t node, F && f, Args &&... args);
+
+
+
+
+        ~basic_thread_pool();
+
+    protected:
+        friend struct detail::future_access;
+
+        struct worker_slot
+        {
+            detail::chase_lev_deque<detail::task_node> deque;
+            bool                                       used = false; // guarded by m_mutex
+        };
+
+        // which pool and slot the current thread is a worker of
+        struct worker_context
+        {
+            basic_thread_pool const * pool;
+            std::size_t               slot;
+        };
+
+        struct node_queue
+        {
+            std::mutex        mutex;
+            detail::task_list tasks;
+        };
+
+        // counters only written by their worker, so they are updated with
+        // a load and a store rather than a locked instruction
+        struct worker_metrics
+        {
+            worker_metrics()
+            {
+                for(std::size_t i=0; i < duration_histogram::bucket_count; i++)
+                {
+                    queue_wait[i].store(0, std::memory_order_relaxed);
+                    execution[i].store(0, std::memory_order_relaxed);
+                }
+            }
+
+            static void add(std::atomic<std::uint64_t> & c, std::uint64_t x)
+            {
+                c.store( c.load(std::memory_order_relaxed) + x, std::memory_order_relaxed );
+            }
+
+            void add_to(thread_pool_metrics & m) const
+            {
+                m.tasks_completed += completed.load(std::memory_order_relaxed);
+                m.steals          += steals.load(std::memory_order_relaxed);
+                m.busy_ns         += busy_ns.load(std::memory_order_relaxed);
+                m.idle_ns         += idle_ns.load(std::memory_order_relaxed);
+                for(std::size_t i=0; i < duration_histogram::bucket_count; i++)
+                {
+                    m.queue_wait.buckets[i] += queue_wait[i].load(std::memory_order_relaxed);
+                    m.execution.buckets[i]  += execution[i].load(std::memory_order_relaxed);
+                }
+            }
+
+            std::atomic<std::uint64_t> completed{0};
+            std::atomic<std::uint64_t> steals{0};
+            std::atomic<std::uint64_t> busy_ns{0};
+            std::atomic<std::uint64_t> idle_ns{0};
+            std::atomic<std::uint64_t> queue_wait[duration_histogram::bucket_count];
+            std::atomic<std::uint64_t> execution[duration_histogram::bucket_count];
+        };
+
+        static std::uint64_t now_ns()
+        {
+            return static_cast<std::uint64_t>( std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                   std::chrono::steady_clock::now().time_since_epoch() ).count() );
+        }
+
+        // a worker thread's own state
+        struct worker_state
+        {
+            std::size_t      slot;
+            std::size_t      node;
+            std::uint32_t    seed;
+            std::uint32_t    tick;
+            std::size_t      polls;   // times it looked for work and found none
+            bool             idle;    // counted in m_idle
+            worker_metrics * metrics; // nullptr unless timing tasks
+        };
+
+        static worker_context & current_worker()
+        {
+            static thread_local worker_context c = {nullptr, 0};
+            return c;
+        }
+
+        /**
+         * @brief add_thread
+         * Add a new worker to the thread pool
+         */
+        bool add_thread(std::size_t limit = static_cast<std::size_t>(-1));
+        void grow_if_busy();
+        bool retire();
+        void set_idle(worker_state & w, bool idle);
+        void stamp(detail::task_node * n);
+
+        void        enqueue(detail::task_node * n);
+        void        enqueue_bulk(detail::task_list & tasks);
+        template<class Body>
+        void        parallel_chunks(std::size_t size, std::size_t grain, Body & body);
+        void        worker_loop(std::size_t slot, std::size_t index);
+        detail::task_node * next_task(worker_state & w);
+        detail::task_node * pop_node(std::size_t node);
+        detail::task_node * pop_other_node(std::size_t node);
+        std::vector<int>    worker_cpus(std::size_t index, std::size_t & node) const;
+        void        enqueue(task_priority priority, detail::task_node * n);
+        detail::task_node * pop_priority(task_priority level);
+        detail::task_node * pop_weighted(worker_state & w);
+        detail::task_node * pop_normal(worker_state & w);
+        bool        should_exit();
+        detail::task_node * steal(std::size_t slot, std::uint32_t & seed);
+        bool        deques_empty() const;
+
+
+        // need to keep track of threads so we can join them, guarded by m_mutex
+        std::vector< std::thread >     workers;
+        std::vector< std::thread::id > m_exited;   // workers which finished but were not joined yet
+        std::atomic<bool>              m_stopping{false};
+
+        // the shared task queue
+        QueuePolicy m_queue;
+
+        // per worker deques, only used with work stealing
+        std::unique_ptr<worker_slot[]> m_slots;
+        std::size_t                    m_slot_count = 0;
+
+        // high and low priority tasks, guarded by m_priority_mutex
+        detail::task_list              m_high_tasks;
+        detail::task_list              m_low_tasks;
+        std::mutex                     m_priority_mutex;
+        std::atomic<std::size_t>       m_priority_count{0}; // tasks in both lists
+
+        // NUMA nodes and their queues, m_node_count is 1 when not numa_aware
+        std::vector<numa_node>         m_topology;
+        std::unique_ptr<node_queue[]>  m_node_queues;
+        std::size_t                    m_node_count = 1;
+        std::atomic<std::size_t>       m_node_task_count{0}; // tasks in all the node queues
+        std::size_t                    m_next_index = 0;     // guarded by m_mutex
+
+        thread_pool_options     m_options;
+
+        // synchronization, m_mutex guards the worker bookkeeping
+        std::mutex              m_mutex;
+        std::atomic<uint32_t>   m_worker_count{0}; // number of currently active workers
+        std::atomic<uint32_t>   m_thread_count{0};
+        std::atomic<uint32_t>   m_idle{0};         // workers looking for work
+
+        // metrics, only used when m_timing is set
+        bool                          m_timing = false;
+        std::atomic<std::uint64_t>    m_submitted{0};
+        std::atomic<std::uint64_t>    m_started{0};
+        std::atomic<std::uint64_t>    m_peak_depth{0};
+        std::vector<worker_metrics *> m_worker_metrics; // guarded by m_mutex
+        thread_pool_metrics           m_retired;        // workers which have exited, guarded by m_mutex
+       // bool stop;
+
+};
+
+/**
+ * @brief thread_pool
+ *
+ * The thread pool with the default, mutex based, queue.
+ */
+using thread_pool = basic_thread_pool<locked_queue>;
+
+
+template<class QueuePolicy>
+inline void basic_thread_pool<QueuePolicy>::remove_worker()
+{
+    --m_thread_count;
+    m_queue.notify_all();
+}
+
+template<class QueuePolicy>
+inline void basic_thread_pool<QueuePolicy>::create_workers(std::size_t num)
+{
+    for(size_t i=0;i<num;++i)
+    {
+        add_thread();
+    }
+    if( m_queue.size() )
+        m_queue.notify_all();
+}
+
+template<class QueuePolicy>
+inline bool basic_thread_pool<QueuePolicy>::add_thread(std::size_t limit)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if( m_stopping || m_thread_count >= limit )
+        return false;
+
+    // join the workers which have exited since last time
+    for(std::thread::id id : m_exited)
+    {
+        for(std::size_t i=0; i < workers.size(); i++)
+        {
+            if( workers[i].get_id() == id )
+            {
+                workers[i].join();
+                workers.erase( workers.begin() + static_cast<std::ptrdiff_t>(i) );
+                break;
+            }
+        }
+    }
+    m_exited.clear();
+
+    std::size_t slot  = m_slot_count; // no deque
+    std::size_t index = m_next_index++;
+    for(std::size_t i=0; i < m_slot_count; i++)
+    {
+        if( !m_slots[i].used )
+        {
+            m_slots[i].used = true;
+            slot = i;
+            break;
+        }
+    }
+
+    ++m_thread_count;
+    ++m_worker_count;
+
+    workers.emplace_back( [this, slot, index]{ worker_loop(slot, index); } );
+    return true;
+}
+
+template<class QueuePolicy>
+inline void basic_thread_pool<QueuePolicy>::grow_if_busy()
+{
+    if( !m_options.auto_scale || m_idle.load(std::memory_order_relaxed) != 0 )
+        return;
+    if( m_thread_count.load(std::memory_order_relaxed) >= m_options.max_threads )
+        return;
+    if( num_tasks() > m_thread_count.load(std::memory_order_relaxed) )
+        add_thread(m_options.max_threads);
+}
+
+template<class QueuePolicy>
+inline bool basic_thread_pool<QueuePolicy>::retire()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if( m_stopping || m_thread_count <= m_options.min_threads || m_thread_count < m_worker_count )
+        return false;
+
+    --m_thread_count;
+    --m_worker_count;
+    return true;
+}
+
+template<class QueuePolicy>
+inline void basic_thread_pool<QueuePolicy>::stamp(detail::task_node * n)
+{
+    if( !m_timing )
+        return;
+
+    n->enqueued = now_ns();
+
+    // the depth is only as exact as the two counters are in step
+    std::uint64_t submitted = m_submitted.fetch_add(1, std::memory_order_relaxed) + 1;
+    std::uint64_t started   = m_started.load(std::memory_order_relaxed);
+    std::uint64_t depth     = submitted > started ? submitted - started : 0;
+    std::uint64_t peak      = m_peak_depth.load(std::memory_order_relaxed);
+    while( depth > peak && !m_peak_depth.compare_exchange_weak(peak, depth, std::memory_order_relaxed) )
+    {
+    }
+}
+
+template<class QueuePolicy>
+inline thread_pool_metrics basic_thread_pool<QueuePolicy>::metrics()
+{
+    thread_pool_metrics m;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m = m_retired;
+        for(worker_metrics const * w : m_worker_metrics)
+            w->add_to(m);
+    }
+    m.tasks_submitted  = m_submitted.load(std::memory_order_relaxed);
+    m.peak_queue_depth = m_peak_depth.load(std::memory_order_relaxed);
+    m.workers          = m_worker_count.load();
+    m.queued           = num_tasks();
+    return m;
+}
+
+template<class QueuePolicy>
+inline void basic_thread_pool<QueuePolicy>::set_idle(worker_state & w, bool idle)
+{
+    if( w.idle == idle )
+        return;
+    w.idle  = idle;
+    w.polls = 0;
+    if( idle )
+        ++m_idle;
+    else
+        --m_idle;
+}
+
+template<class QueuePolicy>
+inline bool basic_thread_pool<QueuePolicy>::should_exit()
+{
+    // called with m_mutex locked
+    if( m_thread_count < m_worker_count )
+    {
+        // We do not need this thread anymore, so we can exit.
+        --m_worker_count;
+        return true;
+    }
+    return false;
+}
+
+template<class QueuePolicy>
+inline bool basic_thread_pool<QueuePolicy>::deques_empty() const
+{
+    for(std::size_t i=0; i < m_slot_count; i++)
+    {
+        if( !m_slots[i].deque.empty() )
+            return false;
+    }
+    return true;
+}
+
+template<class QueuePolicy>
+inline detail::task_node * basic_thread_pool<QueuePolicy>::steal(std::size_t slot, std::uint32_t & seed)
+{
+    if( m_slot_count == 0 )
+        return nullptr;
+
+    // start at a random victim so the thieves spread out
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    std::size_t start = seed % m_slot_count;
+    for(std::size_t i=0; i < m_slot_count; i++)
+    {
+        std::size_t victim = (start + i) % m_slot_count;
+        if( victim == slot )
+            continue;
+        if( detail::task_node * n = m_slots[victim].deque.steal() )
+            return n;
+    }
+    return nullptr;
+}
+
+template<class QueuePolicy>
+inline detail::task_node * basic_thread_pool<QueuePolicy>::next_task(worker_state & w)
+{
+    if( m_priority_count.load(std::memory_order_relaxed) != 0 )
+    {
+        if( detail::task_node * n = pop_weighted(w) )
+            return n;
+    }
+
+    if( m_node_task_count.load(std::memory_order_relaxed) != 0 )
+    {
+        if( detail::task_node * n = pop_node(w.node) )
+            return n;
+    }
+
+    if( w.slot < m_slot_count )
+    {
+        if( detail::task_node * n = m_slots[w.slot].deque.pop() )
+            return n;
+    }
+
+    // Wait for a task to be queued.
+    // But do not wait if there is something to do
+    for(;;)
+    {
+        if( m_thread_count < m_worker_count )
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if( should_exit() )
+            {
+                set_idle(w, false);
+                return nullptr;
+            }
+        }
+
+        detail::task_node * n = nullptr;
+        if( m_priority_count.load(std::memory_order_relaxed) != 0 )
+            n = pop_weighted(w);
+        else
+            n = m_queue.pop();
+
+        if( !n )
+        {
+            n = steal(w.slot, w.seed);
+            if( n && w.metrics )
+                worker_metrics::add(w.metrics->steals, 1);
+        }
+
+        if( !n && m_node_task_count.load(std::memory_order_relaxed) != 0 )
+            n = pop_other_node(w.node);
+
+        if( n )
+        {
+            set_idle(w, false);
+            return n;
+        }
+
+        // spin, then yield, then sleep
+        set_idle(w, true);
+        if( w.polls < m_options.spin_count + m_options.yield_count )
+        {
+            if( w.polls < m_options.spin_count )
+                detail::cpu_relax();
+            else
+                std::this_thread::yield();
+            ++w.polls;
+            continue;
+        }
+
+        bool shrink = m_options.auto_scale && m_thread_count > m_options.min_threads;
+        bool woken  = m_queue.wait( [this]
+        {
+            return m_thread_count < m_worker_count ||
+                   m_priority_count.load() != 0 ||
+                   m_node_task_count.load() != 0 ||
+                   !deques_empty();
+        }, shrink ? std::chrono::nanoseconds(m_options.idle_timeout) : std::chrono::nanoseconds::zero() );
+
+        if( !woken && retire() )
+        {
+            set_idle(w, false);
+            return nullptr;
+        }
+        w.polls = 0;
+    }
+}
+
+template<class QueuePolicy>
+inline void basic_thread_pool<QueuePolicy>::worker_loop(std::size_t slot, std::size_t index)
 {
+    current_worker().pool = this;
+    current_worker().slot = slot;
 
-    public:
-        thread_pool(size_t num_threads);
-        thread_pool();
+    worker_state w;
+    w.slot  = slot;
+    w.seed  = static_cast<std::uint32_t>(index * 2654435761u) | 1u;
+    w.tick  = 0;
+    w.polls = 0;
+    w.idle  = false;
 
+    std::unique_ptr<worker_metrics> metrics;
+    if( m_timing )
+    {
+        metrics.reset( new worker_metrics );
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_worker_metrics.push_back( metrics.get() );
+    }
+    w.metrics = metrics.get();
 
-        template<class F, class... Args>
-        std::future<typename std::result_of<F(Args...)>::type> push( F && f, Args &&... args);
+    std::vector<int> cpus = worker_cpus(index, w.node);
+    if( !cpus.empty() )
+        detail::set_thread_affinity(cpus);
+    if( !m_options.thread_name.empty() )
+        detail::set_thread_name( m_options.thread_name + "-" + std::to_string(index) );
 
-        /**
-         * @brief create_workers
-         * @param num
-         * Creates a new worker to work the threadpool
-         */
-        void create_workers(std::size_t num);
-        /**
-         * @brief remove_thread
-         * Remove a worker from the thread pool
-         */
-        void remove_worker();
-        /**
-         * @brief clear_tasks
-         *
-         * Clears all the current tasks in the queue
-         */
-        void clear_tasks();
+    for(;;)
+    {
+        if( m_thread_count < m_worker_count )
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if( should_exit() )
+                break;
+        }
 
-        /**
-         * @brief num_tasks
-         * @return
-         *
-         * Returns the number of tasks still in the queue
-         */
-        std::size_t num_tasks() { return m_tasks.size(); }
+        if( !metrics )
+        {
+            detail::task_node * task = next_task(w);
+            if( !task )
+                break;
 
-        /**
-         * @brief num_workers
-         * @return
-         *
-         * Returns the number of workers in this thread pool
-         */
-        std::size_t num_workers() { return m_worker_count; }
+            task->fn();
+            detail::task_node_pool::destroy(task);
+            continue;
+        }
 
+        std::uint64_t t0   = now_ns();
+        detail::task_node * task = next_task(w);
+        std::uint64_t t1   = now_ns();
+        worker_metrics::add(metrics->idle_ns, t1 - t0);
+        if( !task )
+            break;
 
+        m_started.fetch_add(1, std::memory_order_relaxed);
+        std::uint64_t wait = task->enqueued && t1 > task->enqueued ? t1 - task->enqueued : 0;
 
+        task->fn();
+        detail::task_node_pool::destroy(task);
 
-        ~thread_pool();
+        std::uint64_t t2 = now_ns();
+        worker_metrics::add(metrics->busy_ns, t2 - t1);
+        worker_metrics::add(metrics->completed, 1);
+        worker_metrics::add(metrics->queue_wait[ duration_histogram::bucket_of(wait) ], 1);
+        worker_metrics::add(metrics->execution[ duration_histogram::bucket_of(t2 - t1) ], 1);
 
-    protected:
-        /**
-         * @brief add_thread
-         * Add a new worker to the thread pool
-         */
-        void add_thread();
+        if( m_options.trace_hook )
+        {
+            task_trace t;
+            t.worker        = index;
+            t.queue_wait_ns = wait;
+            t.execution_ns  = t2 - t1;
+            m_options.trace_hook(t);
+        }
+    }
+
+    // hand back anything left in the deque
+    if( slot < m_slot_count )
+    {
+        detail::task_list left;
+        while( detail::task_node * n = m_slots[slot].deque.pop() )
+            left.push_back(n);
+        m_queue.push_bulk(left);
 
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_slots[slot].used = false;
+    }
 
-        // need to keep track of threads so we can join them
-        std::vector< std::thread > workers;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exited.push_back( std::this_thread::get_id() );
+        if( metrics )
+        {
+            metrics->add_to(m_retired);
+            m_worker_metrics.erase( std::find(m_worker_metrics.begin(), m_worker_metrics.end(), metrics.get()) );
+        }
+    }
+    current_worker().pool = nullptr;
+}
 
-        // the task queue
-        std::queue< std::function<void()> > m_tasks;
+template<class QueuePolicy>
+inline void basic_thread_pool<QueuePolicy>::enqueue(detail::task_node * n)
+{
+    stamp(n);
 
-        // synchronization
-        std::mutex              m_mutex;
-        std::condition_variable m_cv;
-        uint32_t                m_worker_count=0; // number of currently active workers
-        uint32_t                m_thread_count=0;
-       // bool stop;
+    worker_context & w = current_worker();
+    if( w.pool == this && w.slot < m_slot_count )
+    {
+        // pushed from one of our own workers, no locks needed
+        m_slots[w.slot].deque.push(n);
+        m_queue.notify(1);
+    }
+    else
+    {
+        m_queue.push(n);
+    }
+    grow_if_busy();
+}
 
-};
+template<class QueuePolicy>
+inline void basic_thread_pool<QueuePolicy>::enqueue(task_priority priority, detail::task_node * n)
+{
+    if( priority == task_priority::normal )
+    {
+        enqueue(n);
+        return;
+    }
 
+    stamp(n);
+    {
+        std::lock_guard<std::mutex> lock(m_priority_mutex);
+        if( priority == task_priority::high )
+            m_high_tasks.push_back(n);
+        else
+            m_low_tasks.push_back(n);
+        m_priority_count.fetch_add(1);
+    }
+    m_queue.notify(1);
+    grow_if_busy();
+}
 
-inline void thread_pool::remove_worker()
+template<class QueuePolicy>
+inline detail::task_node * basic_thread_pool<QueuePolicy>::pop_priority(task_priority level)
 {
-    --m_thread_count;
+    if( level == task_priority::normal )
+        return m_queue.pop();
+
+    std::lock_guard<std::mutex> lock(m_priority_mutex);
+    detail::task_node * n = level == task_priority::high ? m_high_tasks.pop_front() : m_low_tasks.pop_front();
+    if( n )
+        m_priority_count.fetch_sub(1, std::memory_order_relaxed);
+    return n;
 }
 
-inline void thread_pool::create_workers(std::size_t num)
+template<class QueuePolicy>
+inline detail::task_node * basic_thread_pool<QueuePolicy>::pop_normal(worker_state & w)
 {
-    for(size_t i=0;i<num;++i)
+    // normal tasks may also be in the worker's node queue or its own deque
+    if( m_node_task_count.load(std::memory_order_relaxed) != 0 )
     {
-        add_thread();
+        if( detail::task_node * n = pop_node(w.node) )
+            return n;
     }
-    if( m_tasks.size())
-        m_cv.notify_all();
+
+    if( w.slot < m_slot_count )
+    {
+        if( detail::task_node * n = m_slots[w.slot].deque.pop() )
+            return n;
+    }
+
+    return m_queue.pop();
 }
 
-inline void thread_pool::add_thread()
+template<class QueuePolicy>
+inline detail::task_node * basic_thread_pool<QueuePolicy>::pop_weighted(worker_state & w)
 {
-    ++m_thread_count;
-    ++m_worker_count;
+    static const task_priority orders[3][3] =
+    {
+        { task_priority::high,   task_priority::normal, task_priority::low    },
+        { task_priority::normal, task_priority::high,   task_priority::low    },
+        { task_priority::low,    task_priority::high,   task_priority::normal }
+    };
 
-    workers.emplace_back(
-        [this]
-        {
-            for(;;)
-            {
-                std::function<void()> task;
+    // out of every 16 picks, the low queue goes first once and the normal
+    // tasks three times
+    ++w.tick;
+    std::size_t which = (w.tick % 16 == 0) ? 2 : (w.tick % 4 == 0) ? 1 : 0;
 
-                {
-                    std::unique_lock<std::mutex> lock(this->m_mutex);
+    for(task_priority level : orders[which])
+    {
+        detail::task_node * n = level == task_priority::normal ? pop_normal(w) : pop_priority(level);
+        if( n )
+            return n;
+    }
+    return nullptr;
+}
 
-                    // Wait for someone to trigger the condition variable.
-                    // But do not wait if the task list is empty
-                    //this->m_cv.wait(lock, [this]{ return this->stop || !this->m_tasks.empty(); });
-                    this->m_cv.wait(lock, [this]{ return (m_thread_count < m_worker_count) || !this->m_tasks.empty(); });
+template<class QueuePolicy>
+inline detail::task_node * basic_thread_pool<QueuePolicy>::pop_node(std::size_t node)
+{
+    if( node >= m_node_count || !m_node_queues )
+        return nullptr;
 
-                    //  ========== Start Safe Zone =========================
-                    //if( (this->stop && this->m_tasks.empty()) || (m_thread_count < m_worker_count) )
-                    if( m_thread_count < m_worker_count )
-                    {
-                        // We do not need this thread anymore, so we can exit.
-                        --m_worker_count;
-                       // std::cout << std::this_thread::get_id() << " shutting down" << std::endl;
-                        return;
-                    }
+    node_queue & q = m_node_queues[node];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    detail::task_node * n = q.tasks.pop_front();
+    if( n )
+        m_node_task_count.fetch_sub(1, std::memory_order_relaxed);
+    return n;
+}
 
-                    task = std::move(this->m_tasks.front());
-                    this->m_tasks.pop();
-                    //std::cout << std::this_thread::get_id() << " Starting Task! " << m_tasks.size() << " tasks left" << std::endl;
-                    //  ========== End Safe Zone =========================
-                }
-                task();
-            }
+template<class QueuePolicy>
+inline detail::task_node * basic_thread_pool<QueuePolicy>::pop_other_node(std::size_t node)
+{
+    for(std::size_t i=1; i <= m_node_count; i++)
+    {
+        if( detail::task_node * n = pop_node( (node + i) % m_node_count ) )
+            return n;
+    }
+    return nullptr;
+}
+
+template<class QueuePolicy>
+inline std::vector<int> basic_thread_pool<QueuePolicy>::worker_cpus(std::size_t index, std::size_t & node) const
+{
+    // workers are dealt out to the nodes in turn
+    node = index % m_topology.size();
+    if( m_options.affinity == thread_affinity::none )
+        return std::vector<int>();
+
+    std::vector<int> const & cpus = m_topology[node].cpus;
+    if( m_options.affinity == thread_affinity::numa_node )
+        return cpus;
+
+    std::size_t k = (index / m_topology.size()) % cpus.size();
+    return std::vector<int>( 1, cpus[k] );
+}
+
+template<class QueuePolicy>
+inline void basic_thread_pool<QueuePolicy>::enqueue_bulk(detail::task_list & tasks)
+{
+    std::size_t count = tasks.size();
+    if( count == 0 )
+        return;
+
+    if( m_timing )
+    {
+        detail::task_list stamped;
+        while( detail::task_node * n = tasks.pop_front() )
+        {
+            stamp(n);
+            stamped.push_back(n);
         }
-    );
+        tasks.splice_back(stamped);
+    }
+
+    worker_context & w = current_worker();
+    if( w.pool == this && w.slot < m_slot_count )
+    {
+        while( detail::task_node * n = tasks.pop_front() )
+            m_slots[w.slot].deque.push(n);
+        m_queue.notify(count);
+    }
+    else
+    {
+        m_queue.push_bulk(tasks);
+    }
+    grow_if_busy();
 }
 
 // The constructor just launches some amount of workers
-inline thread_pool::thread_pool(size_t threads)
-    : m_worker_count(0), m_thread_count(0)
+template<class QueuePolicy>
+inline basic_thread_pool<QueuePolicy>::basic_thread_pool(size_t threads)
+    : basic_thread_pool(threads, thread_pool_options())
+{
+}
+
+template<class QueuePolicy>
+inline basic_thread_pool<QueuePolicy>::basic_thread_pool(size_t threads, thread_pool_options const & options)
+    : m_options(options)
 //    :   stop(false)
 {
+    if( m_options.work_stealing )
+    {
+        m_slot_count = m_options.max_workers;
+        if( m_slot_count == 0 )
+            m_slot_count = std::max<std::size_t>( 64, 2 * std::thread::hardware_concurrency() );
+        m_slots.reset( new worker_slot[m_slot_count] );
+    }
+
+    if( m_options.numa_aware || m_options.affinity != thread_affinity::none )
+    {
+        m_topology = numa_topology();
+
+        // only keep the CPUs we were given
+        if( !m_options.cpus.empty() )
+        {
+            std::vector<numa_node> allowed;
+            for(numa_node n : m_topology)
+            {
+                std::vector<int> cpus;
+                for(int c : n.cpus)
+                {
+                    if( std::find(m_options.cpus.begin(), m_options.cpus.end(), c) != m_options.cpus.end() )
+                        cpus.push_back(c);
+                }
+                if( !cpus.empty() )
+                {
+                    n.cpus = cpus;
+                    allowed.push_back(n);
+                }
+            }
+            m_topology = allowed;
+        }
+    }
+    if( m_topology.empty() )
+    {
+        // one node, used when pinning to the given cpus
+        numa_node n;
+        n.id   = 0;
+        n.cpus = m_options.cpus;
+        m_topology.push_back(n);
+    }
+
+    if( m_options.numa_aware && m_topology.size() > 1 )
+    {
+        m_node_count = m_topology.size();
+        m_node_queues.reset( new node_queue[m_node_count] );
+    }
+
+    m_timing = m_options.collect_metrics || static_cast<bool>(m_options.trace_hook);
+
+    if( m_options.auto_scale )
+    {
+        if( m_options.max_threads == 0 )
+            m_options.max_threads = std::max(1u, std::thread::hardware_concurrency());
+        m_options.max_threads = std::max(m_options.max_threads, m_options.min_threads);
+        threads = std::min( std::max(threads, m_options.min_threads), m_options.max_threads );
+    }
+
     for(size_t i = 0;i<threads;++i)
     {
         add_thread();
     }
 }
 
-inline thread_pool::thread_pool()  : m_worker_count(0), m_thread_count(0)
+template<class QueuePolicy>
+inline basic_thread_pool<QueuePolicy>::basic_thread_pool()  : basic_thread_pool(0)
 {
 
 }
 
-inline void thread_pool::clear_tasks()
+template<class QueuePolicy>
+inline std::size_t basic_thread_pool<QueuePolicy>::num_tasks()
+{
+    std::size_t count = m_queue.size() + m_priority_count.load() + m_node_task_count.load();
+    for(std::size_t i=0; i < m_slot_count; i++)
+        count += m_slots[i].deque.size();
+    return count;
+}
+
+template<class QueuePolicy>
+inline void basic_thread_pool<QueuePolicy>::clear_tasks()
 {
-    std::unique_lock<std::mutex> lock(m_mutex);
-    while(m_tasks.size()) m_tasks.pop();
+    // the tasks are destroyed outside the locks, a dropped task's
+    // continuation may post another one
+    m_queue.clear();
+    {
+        detail::task_list tasks;
+        {
+            std::lock_guard<std::mutex> lock(m_priority_mutex);
+            tasks.splice_back(m_high_tasks);
+            tasks.splice_back(m_low_tasks);
+            m_priority_count = 0;
+        }
+        tasks.clear();
+    }
+    for(std::size_t i=0; m_node_queues && i < m_node_count; i++)
+    {
+        detail::task_list tasks;
+        {
+            std::lock_guard<std::mutex> lock(m_node_queues[i].mutex);
+            m_node_task_count.fetch_sub( m_node_queues[i].tasks.size() );
+            tasks.splice_back(m_node_queues[i].tasks);
+        }
+        tasks.clear();
+    }
+
+    // any thread is allowed to steal
+    for(std::size_t i=0; i < m_slot_count; i++)
+    {
+        while( !m_slots[i].deque.empty() )
+        {
+            if( detail::task_node * n = m_slots[i].deque.steal() )
+                detail::task_node_pool::destroy(n);
+        }
+    }
 }
 
 // add new work item to the pool
+template<class QueuePolicy>
 template<class F, class... Args>
 #define RETURN_TYPE typename std::result_of<F(Args...)>::type
-std::future< RETURN_TYPE > thread_pool::push(F&& f, Args&&... args)
+std::future< RETURN_TYPE > basic_thread_pool<QueuePolicy>::push(F&& f, Args&&... args)
 {
 #undef RETURN_TYPE
     using return_type = typename std::result_of<F(Args...)>::type;
 
-    auto task = std::make_shared< std::packaged_task<return_type()> >
-                (
-                    std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-                );
+    // unique_task can hold the packaged_task directly, so the only
+    // allocation is the std::future's shared state
+    std::packaged_task<return_type()> task( detail::bind_task( std::forward<F>(f), std::forward<Args>(args)... ) );
 
-    std::future<return_type> res = task->get_future();
-    {
-        std::unique_lock<std::mutex> lock(m_mutex);
+    std::future<return_type> res = task.get_future();
+    enqueue( detail::task_node_pool::create( std::move(task) ) );
+    return res;
+}
+
+template<class QueuePolicy>
+template<class F, class... Args>
+void basic_thread_pool<QueuePolicy>::post(F && f, Args &&... args)
+{
+    enqueue( detail::task_node_pool::create( detail::bind_task( std::forward<F>(f), std::forward<Args>(args)... ) ) );
+}
+
+template<class QueuePolicy>
+template<class F, class... Args>
+#define RETURN_TYPE typename std::result_of<F(Args...)>::type
+task_future< RETURN_TYPE > basic_thread_pool<QueuePolicy>::submit(F && f, Args &&... args)
+{
+#undef RETURN_TYPE
+    using return_type = typename std::result_of<F(Args...)>::type;
+    using bound_type  = decltype( detail::bind_task( std::forward<F>(f), std::forward<Args>(args)... ) );
+
+    task_promise<return_type> promise;
+    task_future<return_type>  res = promise.get_future();
+    detail::future_access::state(res)->set_executor( detail::future_access::executor_of(*this) );
+
+    enqueue( detail::task_node_pool::create(
+                 detail::promise_task<return_type, bound_type>( std::move(promise),
+                                                               detail::bind_task( std::forward<F>(f), std::forward<Args>(args)... ) ) ) );
+    return res;
+}
+
+template<class QueuePolicy>
+template<class InputIt>
+void basic_thread_pool<QueuePolicy>::push_bulk(InputIt first, InputIt last)
+{
+    // if creating a task throws, the list deletes the ones already made
+    detail::task_list tasks;
+    for( ; first != last; ++first)
+        tasks.push_back( detail::task_node_pool::create( *first ) );
+    enqueue_bulk(tasks);
+}
+
+template<class QueuePolicy>
+template<class Body>
+void basic_thread_pool<QueuePolicy>::parallel_chunks(std::size_t size, std::size_t grain, Body & body)
+{
+    if( size == 0 )
+        return;
 
-        // don't allow enqueueing after stopping the pool
-        //if(stop)
-        //    throw std::runtime_error("enqueue on stopped ThreadPool");
+    std::size_t threads = m_worker_count.load();
+    if( grain == 0 )
+        grain = std::max<std::size_t>( 1, size / (32 * (threads + 1)) );
 
-        m_tasks.emplace([task](){ (*task)(); });
+    std::size_t chunks  = (size + grain - 1) / grain;
+    std::size_t helpers = std::min(threads, chunks - 1);
+    if( helpers == 0 )
+    {
+        body(std::size_t(0), size);
+        return;
     }
-    m_cv.notify_one();
+
+    auto state = std::make_shared< detail::parallel_state<Body> >(body, size, grain, helpers + 1);
+
+    detail::task_list tasks;
+    for(std::size_t i=0; i < helpers; i++)
+        tasks.push_back( detail::task_node_pool::create( [state]{ state->run(); } ) );
+    enqueue_bulk(tasks);
+
+    state->run();
+    state->wait();
+
+    if( state->error )
+        std::rethrow_exception(state->error);
+}
+
+template<class QueuePolicy>
+template<class Index, class F>
+void basic_thread_pool<QueuePolicy>::parallel_for(Index begin, Index end, std::size_t grain, F && fn)
+{
+    std::size_t size = end > begin ? static_cast<std::size_t>(end - begin) : 0;
+
+    auto body = [&](std::size_t lo, std::size_t hi)
+    {
+        for(std::size_t i=lo; i < hi; i++)
+            fn( static_cast<Index>( begin + static_cast<Index>(i) ) );
+    };
+    parallel_chunks(size, grain, body);
+}
+
+template<class QueuePolicy>
+template<class Index, class T, class F, class R>
+T basic_thread_pool<QueuePolicy>::parallel_reduce(Index begin, Index end, std::size_t grain, T identity, F && fn, R && reduce)
+{
+    std::size_t size = end > begin ? static_cast<std::size_t>(end - begin) : 0;
+
+    T          result = identity;
+    std::mutex result_mutex;
+
+    auto body = [&](std::size_t lo, std::size_t hi)
+    {
+        T partial = identity;
+        for(std::size_t i=lo; i < hi; i++)
+            partial = reduce( std::move(partial), fn( static_cast<Index>( begin + static_cast<Index>(i) ) ) );
+
+        std::lock_guard<std::mutex> L(result_mutex);
+        result = reduce( std::move(result), std::move(partial) );
+    };
+    parallel_chunks(size, grain, body);
+    return result;
+}
+
+template<class QueuePolicy>
+template<class InputIt, class OutputIt, class F>
+OutputIt basic_thread_pool<QueuePolicy>::parallel_transform(InputIt first, InputIt last, OutputIt d_first, std::size_t grain, F && fn)
+{
+    using in_diff  = typename std::iterator_traits<InputIt>::difference_type;
+    using out_diff = typename std::iterator_traits<OutputIt>::difference_type;
+
+    std::size_t size = static_cast<std::size_t>( std::distance(first, last) );
+
+    auto body = [&](std::size_t lo, std::size_t hi)
+    {
+        InputIt  in  = first   + static_cast<in_diff>(lo);
+        OutputIt out = d_first + static_cast<out_diff>(lo);
+        for(std::size_t i=lo; i < hi; i++)
+            *out++ = fn( *in++ );
+    };
+    parallel_chunks(size, grain, body);
+    return d_first + static_cast<out_diff>(size);
+}
+
+template<class QueuePolicy>
+template<class F, class... Args>
+void basic_thread_pool<QueuePolicy>::post(task_priority priority, F && f, Args &&... args)
+{
+    enqueue( priority, detail::task_node_pool::create( detail::bind_task( std::forward<F>(f), std::forward<Args>(args)... ) ) );
+}
+
+template<class QueuePolicy>
+template<class F, class... Args>
+#define RETURN_TYPE typename std::result_of<F(Args...)>::type
+task_future< RETURN_TYPE > basic_thread_pool<QueuePolicy>::submit(task_priority priority, F && f, Args &&... args)
+{
+#undef RETURN_TYPE
+    using return_type = typename std::result_of<F(Args...)>::type;
+    using bound_type  = decltype( detail::bind_task( std::forward<F>(f), std::forward<Args>(args)... ) );
+
+    task_promise<return_type> promise;
+    task_future<return_type>  res = promise.get_future();
+    detail::future_access::state(res)->set_executor( detail::future_access::executor_of(*this) );
+
+    enqueue( priority,
+             detail::task_node_pool::create(
+                 detail::promise_task<return_type, bound_type>( std::move(promise),
+                                                               detail::bind_task( std::forward<F>(f), std::forward<Args>(args)... ) ) ) );
     return res;
 }
 
+template<class QueuePolicy>
+template<class F, class... Args>
+void basic_thread_pool<QueuePolicy>::post_to_node(std::size_t node, F && f, Args &&... args)
+{
+    if( node >= m_node_count )
+        throw std::out_of_range("thread_pool: no such NUMA node");
+
+    detail::task_node * n = detail::task_node_pool::create( detail::bind_task( std::forward<F>(f), std::forward<Args>(args)... ) );
+    if( !m_node_queues )
+    {
+        enqueue(n);
+        return;
+    }
+    stamp(n);
+
+    {
+        std::lock_guard<std::mutex> lock(m_node_queues[node].mutex);
+        m_node_queues[node].tasks.push_back(n);
+        m_node_task_count.fetch_add(1);
+    }
+    // wake as many workers as there are nodes, so one is likely local
+    m_queue.notify(m_node_count);
+    grow_if_busy();
+}
+
 // the destructor joins all threads
-inline thread_pool::~thread_pool()
+template<class QueuePolicy>
+inline basic_thread_pool<QueuePolicy>::~basic_thread_pool()
 {
+    std::vector<std::thread> threads;
     {
         std::unique_lock<std::mutex> lock(m_mutex);
         m_thread_count = 0;
+        m_stopping     = true;
+        threads.swap(workers);
     }
 
-    m_cv.notify_all();
+    m_queue.notify_all();
 
-    for(std::thread &worker: workers)
+    for(std::thread &worker: threads)
     {
         if( worker.joinable())
             worker.join();
     }
+
+    // tasks which were never run
+    clear_tasks();
 }
 
 }
 #endif
-
@@ -0,0 +1,179 @@
+#include <gnl/gnl_async_socket.h>
+
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main() - only do this in one cpp file
+#include "catch.hpp"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#if defined GNL_HAS_COROUTINES
+
+#if defined __GNUC__ && !defined __clang__
+    #pragma GCC diagnostic ignored "-Wswitch-default"
+#endif
+
+namespace
+{
+    gnl::task<int> add(int a, int b)
+    {
+        co_return a + b;
+    }
+
+    gnl::task<int> sum_of_three(int a, int b, int c)
+    {
+        int x = co_await add(a, b);
+        co_return co_await add(x, c);
+    }
+
+    gnl::task<> throws()
+    {
+        throw std::runtime_error("error");
+        co_return;
+    }
+
+    gnl::task<> echo(gnl::event_loop & loop, gnl::tcp_socket client)
+    {
+        char buf[256];
+        for(;;)
+        {
+            auto r = co_await gnl::async_recv_some(loop, client, buf, sizeof(buf));
+            if( !r )
+                break;
+            co_await gnl::async_send(loop, client, buf, r.bytes);
+        }
+        client.close();
+    }
+
+    gnl::task<> server(gnl::event_loop & loop, gnl::tcp_socket & listener, int clients)
+    {
+        for(int i=0; i < clients; i++)
+        {
+            auto c = co_await gnl::async_accept(loop, listener);
+            if( c )
+                gnl::spawn( echo(loop, std::move(c.socket)) );
+        }
+    }
+
+    gnl::task<> client(gnl::event_loop & loop, std::uint16_t port, std::string msg, std::vector<std::string> & replies, int & finished)
+    {
+        auto c = co_await gnl::async_connect(loop, "127.0.0.1", port, std::chrono::milliseconds(2000));
+        if( c )
+        {
+            for(int i=0; i < 10; i++)
+            {
+                co_await gnl::async_send(loop, c.socket, msg.data(), msg.size());
+
+                std::string reply(msg.size(), ' ');
+                auto r = co_await gnl::async_recv(loop, c.socket, &reply[0], reply.size(), std::chrono::milliseconds(2000));
+                if( r.bytes == static_cast<int>(reply.size()) )
+                    replies.push_back(reply);
+            }
+            c.socket.close();
+        }
+        if( ++finished == 3 )
+            loop.stop();
+    }
+}
+
+TEST_CASE( "Coroutine tasks" )
+{
+    int result = 0;
+    bool caught = false;
+
+    auto outer = [&]() -> gnl::task<>
+    {
+        result = co_await sum_of_three(1, 2, 3);
+        try
+        {
+            co_await throws();
+        }
+        catch(std::runtime_error &)
+        {
+            caught = true;
+        }
+    };
+
+    gnl::spawn( outer() );
+
+    REQUIRE( result == 6 );
+    REQUIRE( caught );
+}
+
+TEST_CASE( "Coroutine echo server" )
+{
+    gnl::event_loop loop;
+
+    gnl::tcp_socket listener;
+    REQUIRE( listener.create() );
+    REQUIRE( listener.set_option( gnl::socket_options::reuse_address(true) ) );
+    REQUIRE( listener.bind(30210) );
+    REQUIRE( listener.listen(10) );
+
+    std::vector<std::string> replies;
+    int finished = 0;
+
+    gnl::spawn( loop, server(loop, listener, 3) );
+    gnl::spawn( loop, client(loop, 30210, "first",  replies, finished) );
+    gnl::spawn( loop, client(loop, 30210, "second", replies, finished) );
+    gnl::spawn( loop, client(loop, 30210, "third",  replies, finished) );
+
+    loop.add_timer( std::chrono::milliseconds(5000), [&](){ loop.stop(); } );
+    loop.run();
+
+    // let the echo handlers see the clients close
+    for(int i=0; i < 100 && loop.size() > 0; i++)
+        loop.run_once(10);
+
+    REQUIRE( loop.size() == 0 );
+    REQUIRE( finished == 3 );
+    REQUIRE( replies.size() == 30 );
+    REQUIRE( std::count(replies.begin(), replies.end(), "second") == 10 );
+
+    listener.close();
+}
+
+TEST_CASE( "Coroutine timeouts" )
+{
+    gnl::event_loop loop;
+
+    gnl::tcp_socket listener;
+    REQUIRE( listener.create() );
+    REQUIRE( listener.set_option( gnl::socket_options::reuse_address(true) ) );
+    REQUIRE( listener.bind(30211) );
+    REQUIRE( listener.listen(10) );
+
+    int  accept_error = 0;
+    int  recv_error   = 0;
+    bool slept        = false;
+
+    auto run = [&]() -> gnl::task<>
+    {
+        auto a = co_await gnl::async_accept(loop, listener, std::chrono::milliseconds(20));
+        accept_error = a.error;
+
+        // nothing is ever sent, so the recv times out
+        auto c = co_await gnl::async_connect(loop, gnl::socket_address("127.0.0.1", 30211));
+        char buf[4];
+        auto r = co_await gnl::async_recv(loop, c.socket, buf, sizeof(buf), std::chrono::milliseconds(20));
+        recv_error = r.error;
+
+        co_await gnl::async_sleep(loop, std::chrono::milliseconds(10));
+        slept = true;
+
+        c.socket.close();
+        loop.stop();
+    };
+
+    gnl::spawn( loop, run() );
+    loop.add_timer( std::chrono::milliseconds(5000), [&](){ loop.stop(); } );
+    loop.run();
+
+    REQUIRE( accept_error == ETIMEDOUT );
+    REQUIRE( recv_error == ETIMEDOUT );
+    REQUIRE( slept );
+    REQUIRE( loop.size() == 0 );
+
+    listener.close();
+}
+
+#endif
@@ -221,3 +221,20 @@ TEST_CASE( "Move Operator" )
     REQUIRE( (json2["bool"]   == false ));
     REQUIRE( json.type() == gnl::json::BOOL );
 }
+
+
+TEST_CASE( "Empty containers and malformed input" )
+{
+    gnl::json J;
+
+    J.parse( "{ \"a\" : [], \"b\" : {} }" );
+    REQUIRE( J["a"].type() == gnl::json::ARRAY );
+    REQUIRE( J["a"].size() == 0 );
+    REQUIRE( J["b"].type() == gnl::json::OBJECT );
+    REQUIRE( J["b"].size() == 0 );
+
+    // truncated input throws instead of reading forever
+    REQUIRE_THROWS( J.parse( "{ \"a\" : [1, 2" ) );
+    REQUIRE_THROWS( J.parse( "{ \"a\" : \"unterminated" ) );
+    REQUIRE_THROWS( J.parse( "{ \"a\" : 1" ) );
+}
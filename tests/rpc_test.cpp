@@ -0,0 +1,288 @@
+#include <gnl/gnl_rpc.h>
+
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main() - only do this in one cpp file
+#include "catch.hpp"
+#include <chrono>
+#include <csignal>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    gnl::json args(std::string const & name, float value)
+    {
+        gnl::json j;
+        j[name] = value;
+        return j;
+    }
+
+    gnl::json args(float a, float b)
+    {
+        gnl::json j;
+        j["a"] = a;
+        j["b"] = b;
+        return j;
+    }
+
+    void add_methods(gnl::rpc_server & server)
+    {
+        server.bind("add", [](gnl::json const & params)
+        {
+            return gnl::json( params.get("a", 0.0f) + params.get("b", 0.0f) );
+        });
+
+        server.bind("echo", [](gnl::json const & params)
+        {
+            return params;
+        });
+
+        server.bind("sleep", [](gnl::json const & params)
+        {
+            std::this_thread::sleep_for( std::chrono::milliseconds( static_cast<int>(params.get("ms", 0.0f)) ) );
+            return params;
+        });
+
+        server.bind("fail", [](gnl::json const &) -> gnl::json
+        {
+            throw std::runtime_error("it failed");
+        });
+
+        server.bind_binary("reverse", [](char const * data, std::size_t size)
+        {
+            return std::string( std::reverse_iterator<char const*>(data + size), std::reverse_iterator<char const*>(data) );
+        });
+    }
+}
+
+TEST_CASE( "RPC calls" )
+{
+    gnl::tcp_socket listener;
+    REQUIRE( listener.create() );
+    REQUIRE( listener.set_option( gnl::socket_options::reuse_address(true) ) );
+    REQUIRE( listener.bind(30212) );
+    REQUIRE( listener.listen(5) );
+
+    gnl::rpc_server server;
+    add_methods(server);
+
+    std::thread T( [&]{ server.serve( listener.accept() ); } );
+
+    {
+        gnl::rpc_client client;
+        REQUIRE( client.connect("127.0.0.1", 30212) );
+
+        // many calls in flight at once
+        std::vector< std::future<gnl::json> > results;
+        for(int i=0; i < 100; i++)
+            results.push_back( client.call("add", args(i, 1000) ) );
+
+        for(int i=0; i < 100; i++)
+            REQUIRE( (results[i].get() == float(i + 1000)) );
+
+        gnl::json msg;
+        msg["text"]   = "quote \" backslash \\ newline \n end";
+        msg["number"] = 16777215;
+        msg["list"]   = {1, 2, 3};
+        msg["empty"]  = gnl::json(gnl::json::OBJECT);
+
+        gnl::json reply = client.call("echo", msg).get();
+        REQUIRE( reply.get("text", std::string()) == msg.get("text", std::string()) );
+        REQUIRE( (reply["number"] == 16777215.f) );
+        REQUIRE( reply["list"].size() == 3 );
+        REQUIRE( reply["empty"].size() == 0 );
+
+        REQUIRE( client.call_binary("reverse", std::string("abc\0def", 7)).get() == std::string("fed\0cba", 7) );
+
+        REQUIRE_THROWS_AS( client.call("fail",    gnl::json()).get(), gnl::rpc_error & );
+        REQUIRE_THROWS_AS( client.call("missing", gnl::json()).get(), gnl::rpc_error & );
+
+        REQUIRE( client.notify("echo", gnl::json()) );
+        REQUIRE( (client.call("add", args(1, 2)).get() == 3.f) );
+        REQUIRE( client.pending() == 0 );
+    }
+
+    T.join();
+    listener.close();
+}
+
+TEST_CASE( "RPC out of order responses" )
+{
+    gnl::tcp_socket listener;
+    REQUIRE( listener.create() );
+    REQUIRE( listener.set_option( gnl::socket_options::reuse_address(true) ) );
+    REQUIRE( listener.bind(30213) );
+    REQUIRE( listener.listen(5) );
+
+    gnl::rpc_server server;
+    add_methods(server);
+
+    // one thread per request
+    std::vector<std::thread> workers;
+    std::mutex               workers_mutex;
+    auto executor = [&](std::function<void()> f)
+    {
+        std::lock_guard<std::mutex> L(workers_mutex);
+        workers.emplace_back( std::move(f) );
+    };
+
+    std::thread T( [&]{ server.serve( listener.accept(), executor ); } );
+
+    std::vector<int> order;
+    std::mutex       order_mutex;
+
+    {
+        gnl::rpc_client client;
+        REQUIRE( client.connect("127.0.0.1", 30213) );
+
+        std::promise<void> all_done;
+        int remaining = 2;
+        auto record = [&](gnl::json const & result, std::string const & error)
+        {
+            std::lock_guard<std::mutex> L(order_mutex);
+            order.push_back( static_cast<int>(result.get("ms", 0.0f)) );
+            if( --remaining == 0 )
+                all_done.set_value();
+        };
+
+        client.call("sleep", args("ms", 200), record);
+        client.call("sleep", args("ms", 1), record);
+
+        all_done.get_future().wait();
+    }
+
+    T.join();
+    for(auto & w : workers)
+        w.join();
+
+    // the fast call was answered first
+    REQUIRE( order.size() == 2 );
+    REQUIRE( order[0] == 1 );
+    REQUIRE( order[1] == 200 );
+
+    listener.close();
+}
+
+TEST_CASE( "RPC connection lost" )
+{
+    gnl::tcp_socket listener;
+    REQUIRE( listener.create() );
+    REQUIRE( listener.set_option( gnl::socket_options::reuse_address(true) ) );
+    REQUIRE( listener.bind(30214) );
+    REQUIRE( listener.listen(5) );
+
+    // accepts and closes without answering
+    std::thread T( [&]
+    {
+        gnl::tcp_socket c = listener.accept();
+        std::this_thread::sleep_for( std::chrono::milliseconds(50) );
+        c.close();
+    });
+
+    gnl::rpc_client client;
+    REQUIRE( client.connect("127.0.0.1", 30214) );
+
+    auto f = client.call("add", args(1, 2));
+    REQUIRE_THROWS_AS( f.get(), gnl::rpc_error & );
+    REQUIRE( !client.connected() );
+    REQUIRE_THROWS_AS( client.call("add", gnl::json()).get(), gnl::rpc_error & );
+
+    T.join();
+    listener.close();
+}
+
+TEST_CASE( "RPC server oversized frame" )
+{
+    gnl::tcp_socket listener;
+    REQUIRE( listener.create() );
+    REQUIRE( listener.set_option( gnl::socket_options::reuse_address(true) ) );
+    REQUIRE( listener.bind(30217) );
+    REQUIRE( listener.listen(5) );
+
+    gnl::rpc_server server;
+    add_methods(server);
+
+    std::vector<std::thread> workers;
+    std::mutex               workers_mutex;
+    auto executor = [&](std::function<void()> f)
+    {
+        std::lock_guard<std::mutex> L(workers_mutex);
+        workers.emplace_back( std::move(f) );
+    };
+
+    std::thread T( [&]{ server.serve( listener.accept(), executor ); } );
+
+    gnl::tcp_socket C;
+    REQUIRE( C.create() );
+    REQUIRE( C.connect("127.0.0.1", 30217) );
+    gnl::framed_connection F( std::move(C) );
+
+    // a slow request, followed by a frame which is over the server's limit
+    std::string text    = gnl::detail::rpc_to_text( args("ms", 50) );
+    std::string request = gnl::rpc_message::encode(gnl::rpc_message::request, gnl::rpc_encoding::json, 7, "sleep", text.data(), text.size());
+    REQUIRE( F.send(request.data(), request.size()) );
+
+    std::uint32_t huge = htonl(32u*1024*1024);
+    REQUIRE( F.socket().send(&huge, sizeof(huge)) == static_cast<gnl::tcp_socket::msg_size_t>(sizeof(huge)) );
+
+    // the request is still answered before the server closes the connection
+    gnl::frame_view   frame;
+    gnl::rpc_message  msg;
+    REQUIRE( F.recv(frame) );
+    REQUIRE( gnl::rpc_message::decode(frame, msg) );
+    REQUIRE( (msg.id == 7) );
+    REQUIRE( (msg.type == gnl::rpc_message::response) );
+
+    REQUIRE( !F.recv(frame) );
+    REQUIRE( !F );
+
+    T.join();
+    for(auto & w : workers)
+        w.join();
+    listener.close();
+}
+
+TEST_CASE( "RPC client oversized response" )
+{
+    gnl::tcp_socket listener;
+    REQUIRE( listener.create() );
+    REQUIRE( listener.set_option( gnl::socket_options::reuse_address(true) ) );
+    REQUIRE( listener.bind(30219) );
+    REQUIRE( listener.listen(5) );
+
+#if defined SIGPIPE
+    // the server is still writing the response when the client drops the
+    // connection
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+
+    gnl::rpc_server server;
+    server.bind_binary("huge", [](char const *, std::size_t)
+    {
+        return std::string(17*1024*1024, 'x');
+    });
+
+    std::thread T( [&]{ server.serve( listener.accept() ); } );
+
+    {
+        gnl::rpc_client client;
+        REQUIRE( client.connect("127.0.0.1", 30219) );
+
+        // the response is over the client's frame size limit, so the call
+        // fails and the connection is dropped
+        REQUIRE_THROWS_AS( client.call_binary("huge", std::string()).get(), gnl::rpc_error & );
+        REQUIRE( !client.connected() );
+
+        // handlers of calls which fail straight away can use the client
+        std::size_t pending = 1;
+        client.call_binary("huge", "", 0, [&](std::string const &, std::string const & error)
+        {
+            REQUIRE( !error.empty() );
+            pending = client.pending();
+        });
+        REQUIRE( pending == 0 );
+    }
+
+    T.join();
+    listener.close();
+}
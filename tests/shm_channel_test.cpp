@@ -0,0 +1,151 @@
+#include <gnl/gnl_shm_channel.h>
+
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main() - only do this in one cpp file
+#include "catch.hpp"
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined __linux__ && defined SYS_memfd_create
+
+TEST_CASE( "Shared memory channel handshake and messages" )
+{
+    gnl::domain_stream_socket a;
+    gnl::domain_stream_socket b;
+    REQUIRE( gnl::domain_stream_socket::pair(a, b) );
+
+    gnl::shm_channel writer;
+    gnl::shm_channel reader;
+
+    REQUIRE( writer.create(a, 4096) );
+    REQUIRE( reader.open(b) );
+    REQUIRE( reader.capacity() == writer.capacity() );
+
+    char buf[64] = {0};
+
+    REQUIRE( reader.try_recv(buf, sizeof(buf)) == 0 );
+
+    REQUIRE( writer.send("hello", 5) == 5 );
+    REQUIRE( writer.send("world!", 6) == 6 );
+
+    REQUIRE( reader.recv(buf, sizeof(buf)) == 5 );
+    REQUIRE( std::string(buf, 5) == "hello" );
+    REQUIRE( reader.recv(buf, sizeof(buf)) == 6 );
+    REQUIRE( std::string(buf, 6) == "world!" );
+
+    REQUIRE( (writer.send(buf, writer.max_message_size() + 1) == gnl::shm_channel::error) );
+
+    // push many messages through a small ring so it wraps and both sides
+    // have to sleep
+    std::size_t const count = 20000;
+    std::thread T( [&]()
+    {
+        for(std::uint32_t i=0; i < count; i++)
+        {
+            char msg[40];
+            std::memcpy(msg, &i, sizeof(i));
+            writer.send(msg, 4 + i % 36);
+        }
+        writer.close();
+    });
+
+    std::uint32_t expected = 0;
+    bool          ok       = true;
+    for(;;)
+    {
+        gnl::shm_channel::msg_size_t n = reader.recv(buf, sizeof(buf));
+        if( n == 0 )
+            break;
+
+        std::uint32_t i;
+        std::memcpy(&i, buf, sizeof(i));
+        ok = ok && i == expected && n == static_cast<gnl::shm_channel::msg_size_t>(4 + i % 36);
+        expected++;
+    }
+    T.join();
+
+    REQUIRE( ok );
+    REQUIRE( expected == count );
+    REQUIRE( reader.closed() );
+}
+
+TEST_CASE( "Shared memory channel with multiple producers" )
+{
+    gnl::shm_channel writer;
+    REQUIRE( writer.create(8192, true) );
+
+    gnl::shm_channel reader;
+    REQUIRE( reader.open( ::dup(writer.native_handle()) ) );
+
+    std::size_t const per_thread = 5000;
+    std::vector<std::thread> producers;
+    for(std::uint32_t t=0; t < 4; t++)
+    {
+        producers.emplace_back( [&writer, t, per_thread]()
+        {
+            for(std::uint32_t i=0; i < per_thread; i++)
+            {
+                std::uint32_t msg[2] = {t, i};
+                writer.send(msg, sizeof(msg));
+            }
+        });
+    }
+
+    std::uint32_t next[4] = {0,0,0,0};
+    bool          ok      = true;
+    for(std::size_t i=0; i < 4*per_thread; i++)
+    {
+        std::uint32_t msg[2];
+        ok = ok && reader.recv(msg, sizeof(msg)) == sizeof(msg);
+        ok = ok && msg[0] < 4 && msg[1] == next[msg[0]]++;
+    }
+
+    for(auto & p : producers)
+        p.join();
+
+    REQUIRE( ok );
+}
+
+TEST_CASE( "Shared memory channel which is not open or is corrupted" )
+{
+    char buf[64] = {0};
+
+    gnl::shm_channel none;
+    REQUIRE( !none.closed() );
+    REQUIRE( (none.try_send("x", 1) == gnl::shm_channel::error) );
+    REQUIRE( (none.send("x", 1) == gnl::shm_channel::error) );
+    REQUIRE( (none.try_recv(buf, sizeof(buf)) == gnl::shm_channel::error) );
+    REQUIRE( (none.recv(buf, sizeof(buf)) == gnl::shm_channel::error) );
+
+    gnl::shm_channel writer;
+    REQUIRE( writer.create(4096) );
+
+    gnl::shm_channel moved( std::move(writer) );
+    REQUIRE( (writer.send("x", 1) == gnl::shm_channel::error) );
+
+    gnl::shm_channel reader;
+    REQUIRE( reader.open( ::dup(moved.native_handle()) ) );
+
+    // overwrite the length of the first record, as a misbehaving peer could.
+    // The ring starts on the page after the control block.
+    REQUIRE( moved.send("hello", 5) == 5 );
+    std::size_t page = static_cast<std::size_t>( ::sysconf(_SC_PAGESIZE) );
+    std::size_t size = page + moved.capacity();
+    void * m = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, moved.native_handle(), 0);
+    REQUIRE( m != MAP_FAILED );
+    std::uint32_t length = 0xFFFFFFFF;
+    std::memcpy( static_cast<char*>(m) + page, &length, sizeof(length) );
+    ::munmap(m, size);
+
+    REQUIRE( (reader.try_recv(buf, sizeof(buf)) == gnl::shm_channel::error) );
+    REQUIRE( (reader.recv(buf, sizeof(buf)) == gnl::shm_channel::error) );
+    REQUIRE( reader.closed() );
+    REQUIRE( moved.closed() );
+    REQUIRE( (moved.send("x", 1) == gnl::shm_channel::error) );
+
+    moved.close();
+    REQUIRE( !moved.closed() );
+    REQUIRE( (moved.send("x", 1) == gnl::shm_channel::error) );
+}
+
+#endif
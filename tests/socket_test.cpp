@@ -0,0 +1,902 @@
+#include <gnl/gnl_socket.h>
+
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main() - only do this in one cpp file
+#include "catch.hpp"
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST_CASE( "Scatter/gather send and recv over tcp" )
+{
+    gnl::tcp_socket server;
+    REQUIRE( server.create() );
+    REQUIRE( server.set_option( gnl::socket_options::reuse_address(true) ) );
+    REQUIRE( server.bind(30200) );
+    REQUIRE( server.listen(1) );
+
+    std::uint32_t header   = 0;
+    char          payload[12] = {0};
+
+    std::thread T( [&]()
+    {
+        auto client = server.accept();
+
+        gnl::io_buffer in[] = { gnl::io_buffer(&header, sizeof(header)),
+                                gnl::io_buffer(payload, sizeof(payload)) };
+        client.recv(in);
+        client.close();
+    });
+
+    gnl::tcp_socket C;
+    REQUIRE( C.create() );
+    REQUIRE( C.connect("127.0.0.1", 30200) );
+
+    std::uint32_t h = 12;
+    char const    p[12] = "hello world";
+
+    REQUIRE( C.send( { gnl::io_buffer(&h, sizeof(h)), gnl::io_buffer(p, sizeof(p)) } ) == 16 );
+
+    T.join();
+    C.close();
+    server.close();
+
+    REQUIRE( header == 12 );
+    REQUIRE( std::string(payload) == "hello world" );
+}
+
+TEST_CASE( "Framed connection" )
+{
+    gnl::tcp_socket server;
+    REQUIRE( server.create() );
+    REQUIRE( server.set_option( gnl::socket_options::reuse_address(true) ) );
+    REQUIRE( server.bind(30201) );
+    REQUIRE( server.listen(1) );
+
+    std::vector<std::string> recieved;
+
+    std::thread T( [&]()
+    {
+        // use a tiny buffer so that frames have to be split over several reads
+        gnl::framed_connection F( server.accept(), 8 );
+
+        gnl::frame_view msg;
+        while( F.recv(msg) )
+            recieved.push_back( std::string(msg.data, msg.size) );
+    });
+
+    gnl::tcp_socket C;
+    REQUIRE( C.create() );
+    REQUIRE( C.connect("127.0.0.1", 30201) );
+
+    gnl::framed_connection F( std::move(C) );
+
+    F.queue("one", 3);
+    F.queue("", 0);
+    F.queue("three", 5);
+    REQUIRE( F.pending() == 3*4 + 8 );
+    REQUIRE( F.flush() );
+    REQUIRE( F.pending() == 0 );
+
+    std::string big(1000, 'x');
+    REQUIRE( F.send(big.data(), big.size()) );
+    F.close();
+
+    T.join();
+    server.close();
+
+    REQUIRE( recieved.size() == 4 );
+    REQUIRE( recieved[0] == "one" );
+    REQUIRE( recieved[1] == "" );
+    REQUIRE( recieved[2] == "three" );
+    REQUIRE( recieved[3] == big );
+}
+
+TEST_CASE( "Framed connection edge cases" )
+{
+    gnl::tcp_socket server;
+    REQUIRE( server.create() );
+    REQUIRE( server.set_option( gnl::socket_options::reuse_address(true) ) );
+    REQUIRE( server.bind(30218) );
+    REQUIRE( server.listen(1) );
+
+    gnl::tcp_socket C;
+    REQUIRE( C.create() );
+    REQUIRE( C.connect("127.0.0.1", 30218) );
+    gnl::framed_connection F( std::move(C) );
+
+    // a buffer which only holds a header, so the empty frame ends exactly
+    // at the end of it
+    gnl::framed_connection S( server.accept(), 4 );
+
+    REQUIRE( F.send("", 0) );
+    gnl::frame_view msg;
+    REQUIRE( S.recv(msg) );
+    REQUIRE( msg.size == 0 );
+
+    // sizes which do not fit in the header are refused before the data
+    // is touched
+    if( sizeof(std::size_t) > 4 )
+    {
+        std::size_t huge = static_cast<std::size_t>( std::numeric_limits<std::uint32_t>::max() ) + 1;
+        REQUIRE( !F.queue("", huge) );
+        REQUIRE( F.pending() == 0 );
+        REQUIRE( !F.send("", huge) );
+    }
+
+    REQUIRE( F.send("ok", 2) );
+    REQUIRE( S.recv(msg) );
+    REQUIRE( std::string(msg.data, msg.size) == "ok" );
+
+    server.close();
+}
+
+TEST_CASE( "Ring buffer regions" )
+{
+    gnl::ring_buffer R(4096);
+
+    REQUIRE( R.capacity() >= 4096 );
+    REQUIRE( R.empty() );
+
+    // move the read/write position close to the end of the buffer
+    R.commit( R.capacity() - 10 );
+    R.consume( R.capacity() - 20 );
+    REQUIRE( R.size() == 10 );
+
+    gnl::io_buffer regions[2];
+    REQUIRE( R.write_regions(regions) >= 1 );
+    REQUIRE( regions[0].size() + regions[1].size() == R.capacity() - 10 );
+
+    if( R.is_mirrored() )
+    {
+        // the free space wraps, but is still contiguous
+        REQUIRE( R.write_region().size() == R.capacity() - 10 );
+
+        char * w = static_cast<char*>( R.write_region().data() );
+        for(int i=0;i<100;i++) w[i] = char(i);
+        R.commit(100);
+
+        char const * r = static_cast<char const*>( R.read_region().data() );
+        REQUIRE( R.read_region().size() == 110 );
+        REQUIRE( r[10+99] == char(99) );
+    }
+}
+
+TEST_CASE( "Recv into ring buffer" )
+{
+    gnl::tcp_socket server;
+    REQUIRE( server.create() );
+    REQUIRE( server.set_option( gnl::socket_options::reuse_address(true) ) );
+    REQUIRE( server.bind(30202) );
+    REQUIRE( server.listen(1) );
+
+    std::string recieved;
+
+    std::thread T( [&]()
+    {
+        auto client = server.accept();
+        gnl::ring_buffer R(4096);
+
+        while( client.recv(R) > 0 )
+        {
+            gnl::io_buffer regions[2];
+            auto n = R.read_regions(regions);
+            for(std::size_t i=0;i<n;i++)
+                recieved.append( static_cast<char const*>(regions[i].data()), regions[i].size() );
+            R.consume( R.size() );
+        }
+    });
+
+    gnl::tcp_socket C;
+    REQUIRE( C.create() );
+    REQUIRE( C.connect("127.0.0.1", 30202) );
+
+    gnl::ring_buffer W(4096);
+    std::string message(10000, 'a');
+    for(std::size_t i=0;i<message.size();i++)
+        message[i] = char('a' + i%26);
+
+    std::size_t offset = 0;
+    while( offset < message.size() )
+    {
+        auto w = W.write_region();
+        auto n = std::min( w.size(), message.size() - offset );
+        memcpy( w.data(), &message[offset], n );
+        W.commit(n);
+        offset += n;
+
+        while( !W.empty() )
+            REQUIRE( C.send(W) > 0 );
+    }
+    C.close();
+
+    T.join();
+    server.close();
+
+    REQUIRE( recieved == message );
+}
+
+#if defined __linux__
+TEST_CASE( "Listener group accepts on all threads" )
+{
+    gnl::listener_group G;
+
+    std::atomic<int> accepted(0);
+    std::mutex       m;
+    std::vector<gnl::tcp_socket> clients;
+
+    REQUIRE( G.start(30203, 2, [&](gnl::tcp_socket && client, gnl::event_loop &)
+    {
+        std::lock_guard<std::mutex> L(m);
+        clients.push_back( std::move(client) );
+        ++accepted;
+    }) );
+    REQUIRE( G.size() == 2 );
+
+    std::vector<gnl::tcp_socket> C(8);
+    for(auto & c : C)
+    {
+        REQUIRE( c.create() );
+        REQUIRE( c.connect("127.0.0.1", 30203) );
+    }
+
+    for(int i=0; i < 200 && accepted != 8; i++)
+        std::this_thread::sleep_for( std::chrono::milliseconds(5) );
+
+    G.stop();
+
+    REQUIRE( accepted == 8 );
+
+    for(auto & c : C)       c.close();
+    for(auto & c : clients) c.close();
+}
+#endif
+
+TEST_CASE( "Typed socket options" )
+{
+    gnl::tcp_socket S;
+    REQUIRE( S.create() );
+
+    gnl::socket_options::tcp_nodelay nodelay;
+    REQUIRE( S.get_option(nodelay) );
+    REQUIRE( nodelay.value() == false );
+
+    REQUIRE( S.set_option( gnl::socket_options::tcp_nodelay(true) ) );
+    REQUIRE( S.get_option(nodelay) );
+    REQUIRE( nodelay.value() == true );
+
+    REQUIRE( S.set_option( gnl::socket_options::send_buffer_size(64*1024) ) );
+    gnl::socket_options::send_buffer_size sndbuf;
+    REQUIRE( S.get_option(sndbuf) );
+    REQUIRE( sndbuf.value() >= 64*1024 );
+
+    S.close();
+
+    gnl::udp_socket U;
+    REQUIRE( U.create() );
+    REQUIRE( U.set_option( gnl::socket_options::reuse_address(true) ) );
+    // tcp only options are rejected by udp sockets
+    REQUIRE( !U.set_option( gnl::socket_options::tcp_nodelay(true) ) );
+    U.close();
+}
+
+TEST_CASE( "Connection pool reuses connections" )
+{
+    gnl::tcp_socket server;
+    REQUIRE( server.create() );
+    REQUIRE( server.set_option( gnl::socket_options::reuse_address(true) ) );
+    REQUIRE( server.bind(30204) );
+    REQUIRE( server.listen(8) );
+
+    std::atomic<int> accepted(0);
+    std::vector<gnl::tcp_socket> clients(8);
+
+    std::thread T( [&]()
+    {
+        for(;;)
+        {
+            auto c = server.accept();
+            if( !c )
+                break;
+            clients[ static_cast<std::size_t>(accepted) ] = std::move(c);
+            ++accepted;
+        }
+    });
+
+    gnl::connection_pool P(4);
+
+    for(int i=0; i < 10; i++)
+    {
+        auto C = P.acquire("127.0.0.1", 30204);
+        REQUIRE( C );
+    }
+    REQUIRE( P.idle() == 1 );
+
+    {
+        // two at once need two connections
+        auto A = P.acquire("127.0.0.1", 30204);
+        auto B = P.acquire("127.0.0.1", 30204);
+        REQUIRE( A );
+        REQUIRE( B );
+        B.discard();
+    }
+    REQUIRE( P.idle() == 1 );
+
+    while( accepted != 2 )
+        std::this_thread::yield();
+
+    // the idle connection is the first one that was made. Once the server
+    // sends unexpected data on it, it is no longer healthy
+    clients[0].send("x", 1);
+    std::this_thread::sleep_for( std::chrono::milliseconds(20) );
+    {
+        auto C = P.acquire("127.0.0.1", 30204);
+        REQUIRE( C );
+        REQUIRE( gnl::connection_pool::is_alive( C.socket() ) );
+    }
+
+    P.clear();
+    REQUIRE( P.idle() == 0 );
+
+    ::shutdown( server.native_handle(), SHUT_RDWR );
+    T.join();
+    server.close();
+    for(int i=0; i < accepted; i++)
+        clients[ static_cast<std::size_t>(i) ].close();
+
+    REQUIRE( accepted == 3 );
+}
+
+TEST_CASE( "Connection pool limits idle connections per host" )
+{
+    gnl::tcp_socket server;
+    REQUIRE( server.create() );
+    REQUIRE( server.set_option( gnl::socket_options::reuse_address(true) ) );
+    REQUIRE( server.bind(30216) );
+    REQUIRE( server.listen(16) );
+
+    std::atomic<int> accepted(0);
+    std::vector<gnl::tcp_socket> clients(16);
+
+    std::thread T( [&]()
+    {
+        for(;;)
+        {
+            auto c = server.accept();
+            if( !c )
+                break;
+            clients[ static_cast<std::size_t>(accepted) ] = std::move(c);
+            ++accepted;
+        }
+    });
+
+    {
+        // more shards than idle connections allowed
+        gnl::connection_pool P(2, std::chrono::seconds(30), 8);
+
+        std::vector<gnl::connection_pool::connection> C;
+        for(int i=0; i < 5; i++)
+        {
+            C.push_back( P.acquire("127.0.0.1", 30216) );
+            REQUIRE( C.back() );
+        }
+
+        // release them from different threads, so different home shards
+        std::vector<std::thread> R;
+        for(auto & c : C)
+            R.push_back( std::thread( [&c]{ c.release(); } ) );
+        for(auto & r : R)
+            r.join();
+        REQUIRE( P.idle() == 2 );
+
+        // taking one out makes room for one more
+        {
+            auto A = P.acquire("127.0.0.1", 30216);
+            auto B = P.acquire("127.0.0.1", 30216);
+            auto D = P.acquire("127.0.0.1", 30216);
+            REQUIRE( P.idle() == 0 );
+        }
+        REQUIRE( P.idle() == 2 );
+    }
+
+    {
+        // 0 does not pool at all
+        gnl::connection_pool P(0, std::chrono::seconds(30), 4);
+        {
+            auto C = P.acquire("127.0.0.1", 30216);
+            REQUIRE( C );
+        }
+        REQUIRE( P.idle() == 0 );
+    }
+
+    ::shutdown( server.native_handle(), SHUT_RDWR );
+    T.join();
+    server.close();
+    for(int i=0; i < accepted; i++)
+        clients[ static_cast<std::size_t>(i) ].close();
+
+    REQUIRE( accepted == 7 );
+}
+
+TEST_CASE( "Timed accept from two threads" )
+{
+    gnl::tcp_socket server;
+    REQUIRE( server.create() );
+    REQUIRE( server.set_option( gnl::socket_options::reuse_address(true) ) );
+    REQUIRE( server.bind(30220) );
+    REQUIRE( server.listen(1) );
+
+    // both threads see the one client arrive, the one which does not get
+    // it has to give up at its deadline instead of blocking in accept
+    gnl::tcp_socket accepted[2];
+    std::thread     T[2];
+    for(int i=0; i < 2; i++)
+        T[i] = std::thread( [&server, &accepted, i]{ accepted[i] = server.accept( std::chrono::milliseconds(300) ); } );
+
+    gnl::tcp_socket C;
+    REQUIRE( C.create() );
+    REQUIRE( C.connect("127.0.0.1", 30220) );
+
+    T[0].join();
+    T[1].join();
+    REQUIRE( (accepted[0].native_handle() == -1) != (accepted[1].native_handle() == -1) );
+
+#if !defined _MSC_VER
+    // the listening socket is left in blocking mode
+    REQUIRE( (::fcntl(server.native_handle(), F_GETFL, 0) & O_NONBLOCK) == 0 );
+#endif
+    server.close();
+}
+
+TEST_CASE( "Timeouts on blocking calls" )
+{
+    gnl::tcp_socket server;
+    REQUIRE( server.create() );
+    REQUIRE( server.set_option( gnl::socket_options::reuse_address(true) ) );
+    REQUIRE( server.bind(30205) );
+    REQUIRE( server.listen(1) );
+
+    // nobody is connecting
+    auto none = server.accept( std::chrono::milliseconds(20) );
+    REQUIRE( !none );
+
+    gnl::tcp_socket C;
+    REQUIRE( C.create() );
+    REQUIRE( C.connect("127.0.0.1", 30205, std::chrono::milliseconds(1000)) );
+
+    auto client = server.accept( std::chrono::milliseconds(1000) );
+    REQUIRE( static_cast<bool>(client) );
+
+    // the peer never sends anything
+    char buf[4];
+    auto t0 = std::chrono::steady_clock::now();
+    REQUIRE( (C.recv(buf, sizeof(buf), std::chrono::milliseconds(50)) == gnl::tcp_socket::error) );
+    REQUIRE( errno == ETIMEDOUT );
+    REQUIRE( std::chrono::steady_clock::now() - t0 >= std::chrono::milliseconds(50) );
+
+    REQUIRE( client.send("abcd", 4, std::chrono::milliseconds(1000)) == 4 );
+    REQUIRE( C.recv(buf, sizeof(buf), std::chrono::milliseconds(1000)) == 4 );
+    REQUIRE( std::string(buf, 4) == "abcd" );
+
+    // milliseconds::max( ) waits as long as it takes
+    auto forever = std::chrono::milliseconds::max();
+    std::thread T( [&]()
+    {
+        std::this_thread::sleep_for( std::chrono::milliseconds(50) );
+        client.send("efgh", 4, forever);
+    });
+    REQUIRE( C.recv(buf, sizeof(buf), forever) == 4 );
+    REQUIRE( std::string(buf, 4) == "efgh" );
+    T.join();
+    REQUIRE( C.send("ijkl", 4, forever) == 4 );
+    REQUIRE( client.recv(buf, sizeof(buf), forever) == 4 );
+
+    C.close();
+    client.close();
+    server.close();
+}
+
+#if defined __linux__
+TEST_CASE( "Asynchronous connect, accept, send and recv" )
+{
+    gnl::event_loop L;
+
+    gnl::tcp_socket server;
+    REQUIRE( server.create() );
+    REQUIRE( server.set_option( gnl::socket_options::reuse_address(true) ) );
+    REQUIRE( server.bind(30206) );
+    REQUIRE( server.listen(1) );
+
+    gnl::tcp_socket client;
+    gnl::tcp_socket accepted;
+    int connect_error = -1;
+    int accept_error  = -1;
+    int recv_error    = -1;
+    int timeout_error = -1;
+    char buf[5] = {0};
+
+    gnl::async_accept(L, server, std::chrono::milliseconds(1000), [&](gnl::tcp_socket && c, int err)
+    {
+        accept_error = err;
+        accepted = std::move(c);
+
+        // the client never sends anything, so this times out
+        gnl::async_recv(L, accepted, buf, 4, std::chrono::milliseconds(30), [&](gnl::tcp_socket::msg_size_t, int e)
+        {
+            timeout_error = e;
+
+            gnl::async_recv(L, accepted, buf, 4, std::chrono::milliseconds(1000), [&](gnl::tcp_socket::msg_size_t n, int e2)
+            {
+                recv_error = e2;
+                REQUIRE( n == 4 );
+                L.stop();
+            });
+
+            gnl::async_send(L, client, "ping", 4, std::chrono::milliseconds(1000), [&](gnl::tcp_socket::msg_size_t n, int)
+            {
+                REQUIRE( n == 4 );
+            });
+        });
+    });
+
+    gnl::async_connect(L, "127.0.0.1", 30206, std::chrono::milliseconds(1000), [&](gnl::tcp_socket && c, int err)
+    {
+        connect_error = err;
+        client = std::move(c);
+    });
+
+    L.run();
+
+    REQUIRE( connect_error == 0 );
+    REQUIRE( accept_error  == 0 );
+    REQUIRE( timeout_error == ETIMEDOUT );
+    REQUIRE( recv_error    == 0 );
+    REQUIRE( std::string(buf) == "ping" );
+
+    client.close();
+    accepted.close();
+    server.close();
+}
+#endif
+
+#if defined __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+TEST_CASE("Unix domain seqpacket, datagram and descriptor passing")
+{
+    gnl::domain_seqpacket_socket a;
+    gnl::domain_seqpacket_socket b;
+    REQUIRE( gnl::domain_seqpacket_socket::pair(a, b) );
+
+    // message boundaries are kept
+    REQUIRE( a.send("abc", 3) == 3 );
+    REQUIRE( a.send("defgh", 5) == 5 );
+
+    char buf[64] = {0};
+    REQUIRE( b.recv(buf, sizeof(buf)) == 3 );
+    REQUIRE( b.recv(buf, sizeof(buf)) == 5 );
+
+    // pass a memfd and read what the sender wrote into it
+    int mem = static_cast<int>( syscall(SYS_memfd_create, "gnl_test", 0) );
+    REQUIRE( mem != -1 );
+    REQUIRE( ftruncate(mem, 4096) == 0 );
+    char * p = static_cast<char*>( mmap(nullptr, 4096, PROT_READ|PROT_WRITE, MAP_SHARED, mem, 0) );
+    strcpy(p, "shared");
+
+    REQUIRE( a.send_fds("m", 1, &mem, 1) == 1 );
+    ::close(mem);
+
+    int         fds[4];
+    std::size_t count = 0;
+    REQUIRE( b.recv_fds(buf, sizeof(buf), fds, 4, count) == 1 );
+    REQUIRE( count == 1 );
+
+    char * q = static_cast<char*>( mmap(nullptr, 4096, PROT_READ|PROT_WRITE, MAP_SHARED, fds[0], 0) );
+    REQUIRE( std::string(q) == "shared" );
+    strcpy(q, "changed");
+    REQUIRE( std::string(p) == "changed" );
+
+    munmap(p, 4096);
+    munmap(q, 4096);
+    ::close(fds[0]);
+
+    // no descriptors at all
+    REQUIRE( a.send_fds("n", 1, nullptr, 0) == 1 );
+    REQUIRE( b.recv_fds(buf, sizeof(buf), fds, 4, count) == 1 );
+    REQUIRE( count == 0 );
+
+    a.close();
+    b.close();
+
+    // datagrams between two bound paths
+    const char * server_path = "/tmp/gnl_test_dgram_server.socket";
+    const char * client_path = "/tmp/gnl_test_dgram_client.socket";
+    ::unlink(server_path);
+    ::unlink(client_path);
+
+    gnl::domain_datagram_socket server;
+    gnl::domain_datagram_socket client;
+    REQUIRE( server.bind(server_path) );
+    REQUIRE( client.bind(client_path) );
+
+    REQUIRE( client.send_to("hello", 5, server_path) == 5 );
+
+    std::string from;
+    REQUIRE( server.recv_from(buf, sizeof(buf), &from) == 5 );
+    REQUIRE( from == client_path );
+
+    // an empty datagram does not close the socket
+    REQUIRE( client.send_to("", 0, server_path) == 0 );
+    REQUIRE( server.recv(buf, sizeof(buf)) == 0 );
+    REQUIRE( (server.native_handle() != -1) );
+    REQUIRE( client.send_to("again", 5, server_path) == 5 );
+    REQUIRE( server.recv(buf, sizeof(buf)) == 5 );
+
+    // paths which do not fit are refused rather than cut short
+    std::string long_path = "/tmp/" + std::string(200, 'x');
+    gnl::domain_datagram_socket other;
+    REQUIRE( !other.bind(long_path.c_str()) );
+    REQUIRE( errno == ENAMETOOLONG );
+    REQUIRE( (client.send_to("x", 1, long_path.c_str()) == gnl::domain_datagram_socket::error) );
+    REQUIRE( errno == ENAMETOOLONG );
+    REQUIRE( !gnl::socket_address::unix_path(long_path.c_str()) );
+    other.close();
+
+    server.close();
+    client.close();
+    server.unlink(server_path);
+    client.unlink(client_path);
+}
+#endif
+
+#if !defined _MSC_VER
+#include <gnl/gnl_path.h>
+
+TEST_CASE("Send a file over tcp")
+{
+    std::string contents;
+    for(int i=0; i < 300000; i++)
+        contents += static_cast<char>('a' + i % 26);
+
+    const char * file_name = "/tmp/gnl_test_send_file.txt";
+    {
+        FILE * f = std::fopen(file_name, "wb");
+        REQUIRE( f != nullptr );
+        REQUIRE( std::fwrite(contents.data(), 1, contents.size(), f) == contents.size() );
+        std::fclose(f);
+    }
+
+    gnl::tcp_socket server;
+    REQUIRE( server.create() );
+    REQUIRE( server.set_option( gnl::socket_options::reuse_address(true) ) );
+    REQUIRE( server.bind(30207) );
+    REQUIRE( server.listen(1) );
+
+    std::thread T( [&]()
+    {
+        gnl::tcp_socket client = server.accept();
+
+        client.send_file( gnl::path(file_name) );
+        client.send_file( file_name, 1000, 5000 );
+
+        // past the end of the file
+        client.send_file( file_name, contents.size() + 10 );
+        client.close();
+    });
+
+    gnl::tcp_socket S;
+    REQUIRE( S.create() );
+    REQUIRE( S.connect("127.0.0.1", 30207) );
+
+    std::string recieved( contents.size() + 5000, 0 );
+    REQUIRE( S.recv(&recieved[0], recieved.size()) == static_cast<gnl::tcp_socket::msg_size_t>(recieved.size()) );
+
+    T.join();
+
+    REQUIRE( recieved.substr(0, contents.size()) == contents );
+    REQUIRE( recieved.substr(contents.size()) == contents.substr(1000, 5000) );
+
+    S.close();
+    server.close();
+    std::remove(file_name);
+}
+
+#if defined __linux__
+TEST_CASE("Send a file larger than 2GB over tcp")
+{
+    // a sparse file, so nothing is written to disk
+    const char * file_name = "/tmp/gnl_test_send_large_file.bin";
+    const std::int64_t size = (std::int64_t(1) << 31) + 4096;
+    {
+        FILE * f = std::fopen(file_name, "wb");
+        REQUIRE( f != nullptr );
+        std::fclose(f);
+        REQUIRE( ::truncate(file_name, static_cast<off_t>(size)) == 0 );
+    }
+
+    gnl::tcp_socket server;
+    REQUIRE( server.create() );
+    REQUIRE( server.set_option( gnl::socket_options::reuse_address(true) ) );
+    REQUIRE( server.bind(30215) );
+    REQUIRE( server.listen(1) );
+
+    std::int64_t sent = 0;
+    std::thread T( [&]()
+    {
+        gnl::tcp_socket client = server.accept();
+        sent = client.send_file(file_name);
+        client.close();
+    });
+
+    gnl::tcp_socket S;
+    REQUIRE( S.create() );
+    REQUIRE( S.connect("127.0.0.1", 30215) );
+
+    std::vector<char> buffer(1 << 20);
+    std::int64_t recieved = 0;
+    for(;;)
+    {
+        auto n = S.recv_some(buffer.data(), buffer.size());
+        if( n <= 0 )
+            break;
+        recieved += n;
+    }
+
+    T.join();
+
+    REQUIRE( sent == size );
+    REQUIRE( recieved == size );
+
+    S.close();
+    server.close();
+    std::remove(file_name);
+}
+#endif
+#endif
+
+TEST_CASE("Per socket and global I/O statistics")
+{
+    gnl::tcp_socket server;
+    REQUIRE( server.create() );
+    REQUIRE( server.set_option( gnl::socket_options::reuse_address(true) ) );
+    REQUIRE( server.bind(30208) );
+    REQUIRE( server.listen(1) );
+
+    gnl::io_statistics global_before = gnl::socket_base::global_stats();
+
+    std::thread T( [&]()
+    {
+        gnl::tcp_socket client = server.accept();
+        char buf[100];
+        client.recv(buf, 100);
+        client.send(buf, 10);
+        client.close();
+    });
+
+    gnl::tcp_socket C;
+    REQUIRE( C.create() );
+    C.enable_stats();
+    REQUIRE( C.connect("127.0.0.1", 30208) );
+
+    char buf[100] = {0};
+    REQUIRE( C.send(buf, 60) == 60 );
+    REQUIRE( C.send(buf, 40) == 40 );
+    REQUIRE( C.recv_some(buf, 100) == 10 );
+
+    T.join();
+
+    C.set_blocking(false);
+    REQUIRE( C.recv_some(buf, 100) <= 0 );
+
+    gnl::io_statistics s = C.stats();
+    REQUIRE( s.bytes_sent        == 100 );
+    REQUIRE( s.messages_sent     == 2 );
+    REQUIRE( s.bytes_recieved    == 10 );
+    REQUIRE( s.short_reads       >= 1 );
+    REQUIRE( s.syscalls          == 4 );
+    REQUIRE( s.send_latency.count() == 2 );
+    REQUIRE( s.send_latency.percentile(50) > 0 );
+
+    // both ends of the connection count towards the global totals
+    gnl::io_statistics g = gnl::socket_base::global_stats() - global_before;
+    REQUIRE( g.bytes_sent     >= 110 );
+    REQUIRE( g.bytes_recieved >= 110 );
+
+    C.close();
+    server.close();
+}
+
+TEST_CASE("IPv4, IPv6 and unix socket addresses")
+{
+    gnl::socket_address v4("127.0.0.1", 80);
+    REQUIRE( static_cast<bool>(v4) );
+    REQUIRE( v4.family() == AF_INET );
+    REQUIRE( v4.port() == 80 );
+    REQUIRE( std::string(v4.ip()) == "127.0.0.1" );
+    REQUIRE( v4.size() == sizeof(struct sockaddr_in) );
+
+    gnl::socket_address v6("::1", 8080);
+    REQUIRE( v6.family() == AF_INET6 );
+    REQUIRE( v6.port() == 8080 );
+    REQUIRE( std::string(v6.ip()) == "::1" );
+    REQUIRE( v6.size() == sizeof(struct sockaddr_in6) );
+
+    gnl::socket_address bad("not an address", 80);
+    REQUIRE( !bad );
+
+#if !defined _MSC_VER
+    gnl::socket_address u = gnl::socket_address::unix_path("/tmp/gnl.socket");
+    REQUIRE( u.family() == AF_UNIX );
+    REQUIRE( std::string(u.ip()) == "/tmp/gnl.socket" );
+#endif
+}
+
+TEST_CASE("Dual stack server and cached resolver")
+{
+    gnl::tcp_socket server;
+    if( !server.create(AF_INET6) )
+    {
+        WARN("IPv6 is not available");
+        return;
+    }
+    REQUIRE( server.set_option( gnl::socket_options::reuse_address(true) ) );
+    REQUIRE( server.bind(30209) );
+    REQUIRE( server.listen(2) );
+
+    gnl::socket_options::ipv6_only v6only(true);
+    REQUIRE( server.get_option(v6only) );
+    REQUIRE( !v6only.value() );
+
+    std::thread T( [&]()
+    {
+        for(int i=0; i < 2; i++)
+        {
+            gnl::tcp_socket client = server.accept();
+            char c = 0;
+            client.recv(&c, 1);
+            client.send(&c, 1);
+            client.close();
+        }
+    });
+
+    // an IPv6 client, and an IPv4 client on the same listening socket
+    const char * hosts[] = {"::1", "127.0.0.1"};
+    for(auto h : hosts)
+    {
+        gnl::tcp_socket C;
+        REQUIRE( C.create() );
+        REQUIRE( C.set_option( gnl::socket_options::tcp_nodelay(true) ) );
+        REQUIRE( C.connect(h, 30209) );
+
+        // the IPv4 socket is replaced by an IPv6 one for ::1, with the
+        // same options
+        gnl::socket_options::tcp_nodelay nodelay;
+        REQUIRE( C.get_option(nodelay) );
+        REQUIRE( nodelay.value() );
+        REQUIRE( C.family() == gnl::socket_address(h, 0).family() );
+
+        char c = 'x';
+        REQUIRE( C.send(&c, 1) == 1 );
+        REQUIRE( C.recv(&c, 1) == 1 );
+        REQUIRE( C.get_address().port() == 30209 );
+        C.close();
+    }
+    T.join();
+    server.close();
+
+    gnl::resolver R;
+    gnl::resolver::addresses_t a;
+
+    REQUIRE( R.try_resolve("127.0.0.1", 5, a) );
+    REQUIRE( a.size() == 1 );
+
+    auto r = R.resolve("localhost", 7);
+    REQUIRE( !r.empty() );
+    REQUIRE( r.front().port() == 7 );
+
+    // now cached, so this does not block
+    REQUIRE( R.try_resolve("localhost", 9, a) );
+    REQUIRE( a.front().port() == 9 );
+}
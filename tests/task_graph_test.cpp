@@ -0,0 +1,205 @@
+#include <gnl/gnl_task_graph.h>
+
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main() - only do this in one cpp file
+#include "catch.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// counts every allocation made by the program. These are kept out of line
+// so the compiler does not match the malloc/free inside against new/delete
+static std::atomic<std::size_t> g_allocations(0);
+
+#if defined __GNUC__
+    #define TEST_NOINLINE __attribute__((noinline))
+#else
+    #define TEST_NOINLINE
+#endif
+
+TEST_NOINLINE void * operator new(std::size_t size)
+{
+    ++g_allocations;
+    if( void * p = std::malloc(size ? size : 1) )
+        return p;
+    throw std::bad_alloc();
+}
+
+TEST_NOINLINE void operator delete(void * p) noexcept
+{
+    std::free(p);
+}
+
+TEST_NOINLINE void operator delete(void * p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace
+{
+    // a random layered graph, where every node records when it ran
+    struct test_graph
+    {
+        explicit test_graph(std::size_t n) : order(n)
+        {
+            for(std::size_t i=0; i < n; i++)
+                G.add( [this, i]{ order[i] = ++counter; } );
+
+            std::srand(1);
+            for(std::size_t i=1; i < n; i++)
+            {
+                for(int k=0; k < 3; k++)
+                {
+                    std::size_t from = static_cast<std::size_t>( std::rand() ) % i;
+                    G.add_edge(from, i);
+                    edges.push_back( std::make_pair(from, i) );
+                }
+            }
+        }
+
+        // true if every node ran after its inputs
+        bool check() const
+        {
+            for(auto & e : edges)
+            {
+                if( order[e.first] == 0 || order[e.first] >= order[e.second] )
+                    return false;
+            }
+            return true;
+        }
+
+        void reset()
+        {
+            counter = 0;
+            for(auto & o : order)
+                o = 0;
+        }
+
+        gnl::task_graph                                 G;
+        std::atomic<int>                                counter{0};
+        std::vector<int>                                order;
+        std::vector< std::pair<std::size_t, std::size_t> > edges;
+    };
+}
+
+TEST_CASE( "Task graph order" )
+{
+    gnl::thread_pool P(3);
+    test_graph T(200);
+
+    for(int run=0; run < 50; run++)
+    {
+        T.reset();
+        T.G.run(P);
+        REQUIRE( T.counter == 200 );
+        REQUIRE( T.check() );
+    }
+
+    // on the calling thread
+    T.reset();
+    T.G.run();
+    REQUIRE( T.counter == 200 );
+    REQUIRE( T.check() );
+
+    // a pool without workers
+    gnl::thread_pool E;
+    T.reset();
+    T.G.run(E);
+    REQUIRE( T.check() );
+
+    gnl::task_graph empty;
+    empty.run(P);
+    empty.run();
+
+    // graphs destroyed as soon as run( ) returns, while the worker which
+    // ran the last node may still be finishing up
+    for(int run=0; run < 200; run++)
+    {
+        std::atomic<int> count(0);
+        {
+            gnl::task_graph G;
+            G.add( [&]{ ++count; } );
+            G.add( [&]{ ++count; } );
+            G.run(P);
+        }
+        REQUIRE( count == 2 );
+    }
+}
+
+TEST_CASE( "Task graph errors" )
+{
+    gnl::task_graph G;
+    auto a = G.add( []{} );
+    auto b = G.add( []{} );
+    auto c = G.add( []{} );
+
+    REQUIRE_THROWS_AS( G.add_edge(a, 10), std::invalid_argument & );
+    REQUIRE_THROWS_AS( G.add_edge(a, a), std::logic_error & );
+
+    G.add_edge(a, b);
+    G.add_edge(b, c);
+    G.add_edge(c, a);
+    REQUIRE_THROWS_AS( G.compile(), std::logic_error & );
+
+    // the nodes after the one that throws are skipped
+    gnl::task_graph H;
+    int ran = 0;
+    auto x = H.add( [&]{ ++ran; } );
+    auto y = H.add( []{ throw std::runtime_error("y"); } );
+    auto z = H.add( [&]{ ++ran; } );
+    H.add_edge(x, y);
+    H.add_edge(y, z);
+
+    gnl::thread_pool P(2);
+    REQUIRE_THROWS_AS( H.run(P), std::runtime_error & );
+    REQUIRE( ran == 1 );
+
+    // and it can run again afterwards
+    REQUIRE_THROWS_AS( H.run(), std::runtime_error & );
+    REQUIRE( ran == 2 );
+}
+
+TEST_CASE( "Task graph run from a task on the same pool" )
+{
+    gnl::task_graph G;
+    std::atomic<int> count(0);
+    auto a = G.add( [&]{ ++count; } );
+    auto b = G.add( [&]{ ++count; } );
+    auto c = G.add( [&]{ ++count; } );
+    G.add_edge(a, c);
+    G.add_edge(b, c);
+
+    // the only worker is the one waiting for the graph
+    gnl::thread_pool P(1);
+    P.push( [&]{ G.run(P); } ).wait();
+    REQUIRE( count == 3 );
+    REQUIRE( !P.is_worker() );
+}
+
+TEST_CASE( "Running a compiled task graph does not allocate" )
+{
+    test_graph T(200);
+    T.G.compile();
+
+    std::size_t before = g_allocations;
+    for(int run=0; run < 10; run++)
+        T.G.run();
+    std::size_t after = g_allocations;
+
+    REQUIRE( after - before == 0 );
+
+    // the pool recycles its task memory, so once it has grown enough the
+    // runs stop allocating too
+    gnl::thread_pool P(2);
+    std::size_t allocations = 1;
+    for(int rounds=0; rounds < 10 && allocations != 0; rounds++)
+    {
+        before = g_allocations;
+        for(int run=0; run < 100; run++)
+            T.G.run(P);
+        allocations = g_allocations - before;
+    }
+    REQUIRE( allocations == 0 );
+}
@@ -3,8 +3,693 @@
 #define CATCH_CONFIG_MAIN  // This tells Catch to provide a main() - only do this in one cpp file
 #include "catch.hpp"
 #include <string>
+#include <atomic>
+#include <array>
+#include <memory>
+#include <chrono>
+#include <vector>
+#include <new>
+#include <cstdlib>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+
+// counts every allocation made by the program. These are kept out of line
+// so the compiler does not match the malloc/free inside against new/delete
+static std::atomic<std::size_t> g_allocations(0);
+
+#if defined __GNUC__
+    #define TEST_NOINLINE __attribute__((noinline))
+#else
+    #define TEST_NOINLINE
+#endif
+
+TEST_NOINLINE void * operator new(std::size_t size)
+{
+    ++g_allocations;
+    if( void * p = std::malloc(size ? size : 1) )
+        return p;
+    throw std::bad_alloc();
+}
+
+TEST_NOINLINE void operator delete(void * p) noexcept
+{
+    std::free(p);
+}
+
+TEST_NOINLINE void operator delete(void * p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace
+{
+    // waits until the counter reaches the value, or a few seconds pass
+    bool wait_for(std::atomic<int> & counter, int value)
+    {
+        auto end = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while( counter.load() != value )
+        {
+            if( std::chrono::steady_clock::now() > end )
+                return false;
+            std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+        }
+        return true;
+    }
+
+    // every task pushes two more until depth reaches 0
+    template<typename Pool>
+    void spawn_tree(Pool & P, std::atomic<int> & count, int depth)
+    {
+        ++count;
+        if( depth == 0 )
+            return;
+        P.push( spawn_tree<Pool>, std::ref(P), std::ref(count), depth - 1 );
+        P.push( spawn_tree<Pool>, std::ref(P), std::ref(count), depth - 1 );
+    }
+}
 
 TEST_CASE( "Testing thread pool class" )
 {
-    // coming soon
+    gnl::thread_pool P(4);
+
+    REQUIRE( P.num_workers() == 4 );
+
+    auto f1 = P.push( [](int x){ return x * 2; }, 21 );
+    auto f2 = P.push( [](std::string s){ return s + " world"; }, std::string("hello") );
+
+    REQUIRE( f1.get() == 42 );
+    REQUIRE( f2.get() == "hello world" );
+
+    std::vector< std::future<int> > results;
+    for(int i=0; i < 1000; i++)
+        results.push_back( P.push( [i]{ return i; } ) );
+
+    int sum = 0;
+    for(auto & r : results)
+        sum += r.get();
+    REQUIRE( sum == 999 * 1000 / 2 );
+}
+
+TEST_CASE( "Tasks pushed before there are workers" )
+{
+    gnl::thread_pool P;
+
+    std::atomic<int> count(0);
+    for(int i=0; i < 10; i++)
+        P.push( [&count]{ ++count; } );
+
+    REQUIRE( P.num_tasks() == 10 );
+
+    P.create_workers(2);
+    REQUIRE( wait_for(count, 10) );
+    REQUIRE( P.num_tasks() == 0 );
+
+    P.remove_worker();
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while( P.num_workers() != 1 && std::chrono::steady_clock::now() < end )
+        std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+    REQUIRE( P.num_workers() == 1 );
+
+    REQUIRE( P.push( []{ return 5; } ).get() == 5 );
+}
+
+TEST_CASE( "Work stealing" )
+{
+    gnl::thread_pool_options options;
+    options.work_stealing = true;
+
+    gnl::thread_pool P(4, options);
+    REQUIRE( P.work_stealing() );
+
+    // tasks pushed by tasks go onto the workers' own deques
+    std::atomic<int> count(0);
+    P.push( spawn_tree<gnl::thread_pool>, std::ref(P), std::ref(count), 12 );
+    REQUIRE( wait_for(count, (1 << 13) - 1) );
+
+    // and results still come back through the futures
+    std::vector< std::future<int> > results;
+    for(int i=0; i < 1000; i++)
+        results.push_back( P.push( [i]{ return i; } ) );
+
+    int sum = 0;
+    for(auto & r : results)
+        sum += r.get();
+    REQUIRE( sum == 999 * 1000 / 2 );
+
+    // workers can be added and removed
+    P.create_workers(2);
+    P.remove_worker();
+    P.remove_worker();
+    count = 0;
+    P.push( spawn_tree<gnl::thread_pool>, std::ref(P), std::ref(count), 10 );
+    REQUIRE( wait_for(count, (1 << 11) - 1) );
+}
+
+TEST_CASE( "Clearing tasks" )
+{
+    gnl::thread_pool_options options;
+    options.work_stealing = true;
+
+    gnl::thread_pool P(0, options);
+
+    std::atomic<int> count(0);
+    for(int i=0; i < 10; i++)
+        P.push( [&count]{ ++count; } );
+
+    REQUIRE( P.num_tasks() == 10 );
+    P.clear_tasks();
+    REQUIRE( P.num_tasks() == 0 );
+
+    P.create_workers(1);
+    REQUIRE( P.push( []{ return 1; } ).get() == 1 );
+    REQUIRE( count == 0 );
+}
+
+TEST_CASE( "Move-only tasks" )
+{
+    gnl::unique_task empty;
+    REQUIRE( !empty );
+
+    int value = 0;
+    std::unique_ptr<int> p( new int(5) );
+    gnl::unique_task t( std::bind( [&value](std::unique_ptr<int> & x){ value = *x; }, std::move(p) ) );
+    REQUIRE( static_cast<bool>(t) );
+
+    gnl::unique_task moved( std::move(t) );
+    REQUIRE( !t );
+    moved();
+    REQUIRE( value == 5 );
+
+    // large callables go on the heap
+    std::array<char, 256> big;
+    big.fill('x');
+    REQUIRE( (!gnl::unique_task::fits_inline< std::array<char,256> >()) );
+    gnl::unique_task large( [big, &value]{ value = big[10]; } );
+    large();
+    REQUIRE( value == 'x' );
+}
+
+TEST_CASE( "Post and submit" )
+{
+    gnl::thread_pool P(2);
+
+    std::atomic<int> count(0);
+    for(int i=0; i < 100; i++)
+        P.post( [&count](int x){ count += x; }, 1 );
+    REQUIRE( wait_for(count, 100) );
+
+    auto a = P.submit( [](int x, int y){ return x * y; }, 6, 7 );
+    auto b = P.submit( []{ } );
+    auto c = P.submit( []() -> int { throw std::runtime_error("failed"); } );
+
+    REQUIRE( a.get() == 42 );
+    REQUIRE( !a.valid() );
+    b.get();
+    REQUIRE_THROWS_AS( c.get(), std::runtime_error & );
+
+    // results which are not copyable
+    auto d = P.submit( []{ return std::unique_ptr<int>( new int(3) ); } );
+    REQUIRE( *d.get() == 3 );
+
+    gnl::task_future<int> broken;
+    {
+        gnl::task_promise<int> promise;
+        broken = promise.get_future();
+    }
+    REQUIRE( broken.ready() );
+    REQUIRE_THROWS_AS( broken.get(), std::future_error & );
+}
+
+TEST_CASE( "Posting small tasks does not allocate" )
+{
+    gnl::thread_pool P(2);
+
+    std::atomic<int> count(0);
+    auto run = [&](int n)
+    {
+        count = 0;
+        for(int i=0; i < n; i++)
+        {
+            P.post( [&count]{ ++count; } );
+            auto f = P.submit( [i]{ return i; } );
+            f.get();
+        }
+        return wait_for(count, n);
+    };
+
+    // the pools grow a batch at a time until every thread has what it
+    // needs, after that the memory is only ever recycled
+    std::size_t allocations = 1;
+    int         rounds      = 0;
+    for( ; rounds < 10 && allocations != 0; rounds++)
+    {
+        std::size_t before = g_allocations;
+        bool        ok     = run(10000);
+        allocations        = g_allocations - before;
+
+        REQUIRE( ok );
+    }
+
+    REQUIRE( allocations == 0 );
+}
+
+TEST_CASE( "Bulk submission" )
+{
+    gnl::thread_pool P(2);
+
+    std::atomic<int> count(0);
+    std::vector< std::function<void()> > tasks( 1000, [&count]{ ++count; } );
+
+    P.push_bulk( tasks.begin(), tasks.end() );
+    REQUIRE( wait_for(count, 1000) );
+
+    // from inside a task, onto the worker's deque
+    gnl::thread_pool_options options;
+    options.work_stealing = true;
+    gnl::thread_pool S(2, options);
+
+    count = 0;
+    S.post( [&]{ S.push_bulk( tasks.begin(), tasks.end() ); } );
+    REQUIRE( wait_for(count, 1000) );
+}
+
+TEST_CASE( "Parallel algorithms" )
+{
+    gnl::thread_pool P(3);
+
+    std::vector<int> v(100000, 0);
+    P.parallel_for( std::size_t(0), v.size(), 0, [&](std::size_t i){ v[i] += static_cast<int>(i % 7); } );
+
+    long long expected = 0;
+    for(std::size_t i=0; i < v.size(); i++)
+        expected += static_cast<long long>(i % 7);
+
+    long long sum = P.parallel_reduce( std::size_t(0), v.size(), 100, 0LL,
+                                       [&](std::size_t i){ return static_cast<long long>(v[i]); },
+                                       [](long long a, long long b){ return a + b; } );
+    REQUIRE( sum == expected );
+
+    std::vector<double> out( v.size() );
+    auto end = P.parallel_transform( v.begin(), v.end(), out.begin(), 0, [](int x){ return 2.0 * x; } );
+    REQUIRE( (end == out.end()) );
+    REQUIRE( out[12345] == 2.0 * (12345 % 7) );
+
+    // empty and negative ranges do nothing
+    P.parallel_for( 10, 0, 1, [](int){ throw std::runtime_error("called"); } );
+    REQUIRE( P.parallel_reduce( 5, 5, 1, 3, [](int i){ return i; }, [](int a, int b){ return a + b; } ) == 3 );
+
+    // the first exception is passed back to the caller
+    REQUIRE_THROWS_AS( P.parallel_for( 0, 1000, 1, [](int i){ if( i == 500 ) throw std::runtime_error("500"); } ), std::runtime_error & );
+
+    // the caller takes part, so a task can wait on its own parallel_for
+    // even when every worker is busy
+    gnl::thread_pool Q(1);
+    auto f = Q.submit( [&Q]
+    {
+        return Q.parallel_reduce( 0, 1000, 1, 0, [](int i){ return i; }, [](int a, int b){ return a + b; } );
+    });
+    REQUIRE( f.get() == 499500 );
+
+    // without workers it all runs on the calling thread
+    gnl::thread_pool E;
+    int calls = 0;
+    E.parallel_for( 0, 100, 1, [&](int){ ++calls; } );
+    REQUIRE( calls == 100 );
+}
+
+TEST_CASE( "Lock-free queue" )
+{
+    using lockfree_pool = gnl::basic_thread_pool<gnl::lockfree_queue>;
+
+    // more tasks than the ring holds, from several threads at once
+    lockfree_pool P;
+    std::atomic<int> count(0);
+    std::vector<std::thread> producers;
+    for(int t=0; t < 4; t++)
+    {
+        producers.emplace_back( [&P, &count]
+        {
+            for(int i=0; i < 2000; i++)
+                P.post( [&count]{ ++count; } );
+        });
+    }
+    for(auto & t : producers)
+        t.join();
+
+    REQUIRE( P.num_tasks() == 8000 );
+    P.create_workers(3);
+    REQUIRE( wait_for(count, 8000) );
+    REQUIRE( P.num_tasks() == 0 );
+
+    REQUIRE( P.submit( [](int x){ return x + 1; }, 41 ).get() == 42 );
+    REQUIRE( P.parallel_reduce( 0, 1000, 1, 0, [](int i){ return i; }, [](int a, int b){ return a + b; } ) == 499500 );
+
+    P.remove_worker();
+    P.remove_worker();
+    count = 0;
+    P.push( spawn_tree<lockfree_pool>, std::ref(P), std::ref(count), 10 );
+    REQUIRE( wait_for(count, (1 << 11) - 1) );
+
+    gnl::thread_pool_options options;
+    options.work_stealing = true;
+    lockfree_pool S(2, options);
+    count = 0;
+    S.push( spawn_tree<lockfree_pool>, std::ref(S), std::ref(count), 12 );
+    REQUIRE( wait_for(count, (1 << 13) - 1) );
+
+    // clearing empties the ring and the overflow list
+    lockfree_pool E;
+    for(int i=0; i < 5000; i++)
+        E.post( [&count]{ ++count; } );
+    E.clear_tasks();
+    REQUIRE( E.num_tasks() == 0 );
+}
+
+TEST_CASE( "Task priorities" )
+{
+    gnl::thread_pool P;
+
+    std::mutex       order_mutex;
+    std::vector<int> order;
+    auto record = [&](int x)
+    {
+        std::lock_guard<std::mutex> L(order_mutex);
+        order.push_back(x);
+    };
+
+    std::atomic<int> count(0);
+    for(int i=0; i < 20; i++)
+    {
+        P.post( gnl::task_priority::low,    [&]{ record(2); ++count; } );
+        P.post( gnl::task_priority::normal, [&]{ record(1); ++count; } );
+        P.post( gnl::task_priority::high,   [&]{ record(0); ++count; } );
+    }
+    REQUIRE( P.num_tasks() == 60 );
+
+    P.create_workers(1);
+    REQUIRE( wait_for(count, 60) );
+
+    // high priority tasks go first, but the others still get a turn
+    REQUIRE( order.front() == 0 );
+    REQUIRE( std::count(order.begin(), order.begin() + 16, 0) == 12 );
+    REQUIRE( std::count(order.begin(), order.begin() + 16, 1) == 3 );
+    REQUIRE( std::count(order.begin(), order.begin() + 16, 2) == 1 );
+
+    auto f = P.submit( gnl::task_priority::high, [](int x){ return x * 3; }, 5 );
+    REQUIRE( f.get() == 15 );
+
+    P.remove_worker();
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while( P.num_workers() != 0 && std::chrono::steady_clock::now() < end )
+        std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+
+    P.post( gnl::task_priority::low, [&]{ ++count; } );
+    P.post( gnl::task_priority::high, [&]{ ++count; } );
+    REQUIRE( P.num_tasks() == 2 );
+    P.clear_tasks();
+    REQUIRE( P.num_tasks() == 0 );
+}
+
+TEST_CASE( "Task priorities with work stealing" )
+{
+    gnl::thread_pool_options options;
+    options.work_stealing = true;
+    gnl::thread_pool P(1, options);
+
+    std::mutex       order_mutex;
+    std::vector<int> order;
+    auto record = [&](int x)
+    {
+        std::lock_guard<std::mutex> L(order_mutex);
+        order.push_back(x);
+    };
+
+    // posted from the worker, the normal tasks go into its own deque
+    std::atomic<int> count(0);
+    P.post( [&]
+    {
+        for(int i=0; i < 20; i++)
+            P.post( [&]{ record(1); ++count; } );
+        for(int i=0; i < 100; i++)
+            P.post( gnl::task_priority::high, [&]{ record(0); ++count; } );
+    });
+    REQUIRE( wait_for(count, 120) );
+
+    // they still get their share while high priority tasks are waiting
+    // (with no low priority tasks, their turn goes to the high ones)
+    REQUIRE( std::count(order.begin(), order.begin() + 16, 1) == 3 );
+    REQUIRE( std::count(order.begin(), order.begin() + 16, 0) == 13 );
+}
+
+TEST_CASE( "Worker placement" )
+{
+    auto cpus = gnl::detail::parse_cpu_list("0-3,8,10-11");
+    REQUIRE( cpus.size() == 7 );
+    REQUIRE( cpus[3] == 3 );
+    REQUIRE( cpus[4] == 8 );
+    REQUIRE( cpus[6] == 11 );
+    REQUIRE( gnl::detail::parse_cpu_list("").empty() );
+
+    auto nodes = gnl::numa_topology();
+    REQUIRE( !nodes.empty() );
+    for(auto & n : nodes)
+        REQUIRE( !n.cpus.empty() );
+
+    gnl::thread_pool_options options;
+    options.affinity    = gnl::thread_affinity::cpu;
+    options.numa_aware  = true;
+    options.thread_name = "gnl-test";
+
+    gnl::thread_pool P(2, options);
+    REQUIRE( P.numa_nodes() == nodes.size() );
+
+    std::atomic<int> count(0);
+    for(std::size_t n=0; n < P.numa_nodes(); n++)
+        P.post_to_node( n, [&count]{ ++count; } );
+    REQUIRE( wait_for(count, static_cast<int>(P.numa_nodes())) );
+    REQUIRE_THROWS_AS( P.post_to_node( P.numa_nodes(), []{} ), std::out_of_range & );
+
+#if defined __linux__
+    // each worker is pinned to a single CPU and named
+    auto f = P.submit( []
+    {
+        char name[16] = {0};
+        pthread_getname_np( pthread_self(), name, sizeof(name) );
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        pthread_getaffinity_np( pthread_self(), sizeof(set), &set );
+        return std::make_pair( std::string(name), CPU_COUNT(&set) );
+    });
+    auto r = f.get();
+    REQUIRE( r.first.compare(0, 9, "gnl-test-") == 0 );
+    REQUIRE( r.second == 1 );
+#endif
+}
+
+TEST_CASE( "Spinning and automatic scaling" )
+{
+    gnl::thread_pool_options options;
+    options.spin_count   = 100;
+    options.yield_count  = 10;
+    options.auto_scale   = true;
+    options.min_threads  = 1;
+    options.max_threads  = 4;
+    options.idle_timeout = std::chrono::milliseconds(50);
+
+    gnl::thread_pool P(0, options);
+    REQUIRE( P.num_workers() == 1 );
+
+    // blocking tasks keep every worker busy, so more are started
+    std::atomic<int> running(0);
+    std::atomic<int> most(0);
+    std::atomic<int> count(0);
+    for(int i=0; i < 16; i++)
+    {
+        P.post( [&]
+        {
+            int r = ++running;
+            int m = most.load();
+            while( r > m && !most.compare_exchange_weak(m, r) )
+            {
+            }
+            std::this_thread::sleep_for( std::chrono::milliseconds(20) );
+            --running;
+            ++count;
+        });
+    }
+    REQUIRE( wait_for(count, 16) );
+    REQUIRE( most > 1 );
+    REQUIRE( most <= 4 );
+    REQUIRE( P.num_workers() <= 4 );
+
+    // and once there is nothing to do they exit again
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while( P.num_workers() > 1 && std::chrono::steady_clock::now() < end )
+        std::this_thread::sleep_for( std::chrono::milliseconds(5) );
+    REQUIRE( P.num_workers() == 1 );
+
+    // the pool still works, and grows again when it is needed
+    REQUIRE( P.submit( []{ return 7; } ).get() == 7 );
+    count = 0;
+    for(int i=0; i < 8; i++)
+        P.post( [&]{ std::this_thread::sleep_for( std::chrono::milliseconds(10) ); ++count; } );
+    REQUIRE( wait_for(count, 8) );
+}
+
+TEST_CASE( "Metrics" )
+{
+    // without collect_metrics only the counts are filled in
+    {
+        gnl::thread_pool P(1);
+        REQUIRE( P.submit( []{ return 1; } ).get() == 1 );
+        gnl::thread_pool_metrics m = P.metrics();
+        REQUIRE( (m.workers == 1) );
+        REQUIRE( (m.tasks_submitted == 0) );
+        REQUIRE( (m.execution.count() == 0) );
+    }
+
+    std::atomic<int> traced(0);
+
+    gnl::thread_pool_options options;
+    options.collect_metrics = true;
+    options.trace_hook = [&](gnl::task_trace const & t)
+    {
+        if( t.worker < 2 )
+            ++traced;
+    };
+
+    gnl::thread_pool P(2, options);
+
+    std::atomic<int> count(0);
+    for(int i=0; i < 50; i++)
+        P.post( [&]{ std::this_thread::sleep_for( std::chrono::microseconds(100) ); ++count; } );
+    P.post( gnl::task_priority::high, [&]{ ++count; } );
+    REQUIRE( wait_for(count, 51) );
+
+    // the counters are updated after the task returns
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while( P.metrics().tasks_completed < 51 && std::chrono::steady_clock::now() < end )
+        std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+
+    gnl::thread_pool_metrics m = P.metrics();
+    REQUIRE( (m.tasks_submitted == 51) );
+    REQUIRE( (m.tasks_completed == 51) );
+    REQUIRE( (m.execution.count() == 51) );
+    REQUIRE( (m.queue_wait.count() == 51) );
+    REQUIRE( (m.peak_queue_depth >= 1) );
+    REQUIRE( (m.busy_ns >= 50 * 100000ull) );
+    REQUIRE( (m.execution.percentile(50) >= 100000) );
+    REQUIRE( (m.queued == 0) );
+    REQUIRE( (traced == 51) );
+
+    // workers which exit still count
+    P.remove_worker();
+    end = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while( P.num_workers() > 1 && std::chrono::steady_clock::now() < end )
+        std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+    REQUIRE( (P.metrics().tasks_completed == 51) );
+}
+
+TEST_CASE( "Continuations" )
+{
+    gnl::thread_pool P(1);
+
+    auto a = P.submit( []{ return 2; } )
+              .then( [](gnl::task_future<int> r){ return r.get() * 3; } )
+              .then( [](gnl::task_future<int> r){ return std::to_string( r.get() ); } );
+    REQUIRE( a.get() == "6" );
+
+    // exceptions are passed along to the continuation
+    auto b = P.submit( []() -> int { throw std::runtime_error("failed"); } )
+              .then( [](gnl::task_future<int> r)
+              {
+                  try
+                  {
+                      return r.get();
+                  }
+                  catch(std::runtime_error &)
+                  {
+                      return -1;
+                  }
+              });
+    REQUIRE( b.get() == -1 );
+
+    auto c = P.submit( []{ } ).then( [](gnl::task_future<void>) -> int { throw std::runtime_error("failed"); } );
+    REQUIRE_THROWS_AS( c.get(), std::runtime_error & );
+
+    // a continuation waiting on a promise does not hold up the only worker
+    std::thread::id worker;
+    gnl::task_promise<int> gate;
+    auto d = gate.get_future().then( P, [&worker](gnl::task_future<int> r)
+    {
+        worker = std::this_thread::get_id();
+        return r.get() + 1;
+    });
+    REQUIRE( P.submit( []{ return 5; } ).get() == 5 );
+    REQUIRE( !d.ready() );
+    gate.set_value(1);
+    REQUIRE( d.get() == 2 );
+    REQUIRE( worker != std::this_thread::get_id() );
+
+    // attaching to a future which is already ready
+    gnl::task_promise<int> done;
+    done.set_value(4);
+    REQUIRE( done.get_future().then( P, [](gnl::task_future<int> r){ return r.get(); } ).get() == 4 );
+
+    // continuations of cleared tasks see a broken promise
+    gnl::thread_pool Q(0);
+    auto e = Q.submit( []{ return 1; } ).then( [](gnl::task_future<int> r)
+    {
+        try
+        {
+            return r.get();
+        }
+        catch(std::future_error &)
+        {
+            return -1;
+        }
+    });
+    Q.clear_tasks();
+    Q.create_workers(1);
+    REQUIRE( e.get() == -1 );
+}
+
+TEST_CASE( "when_all and when_any" )
+{
+    gnl::thread_pool P(2);
+
+    std::vector< gnl::task_future<int> > futures;
+    for(int i=0; i < 10; i++)
+        futures.push_back( P.submit( [i]{ return i; } ) );
+
+    auto sum = gnl::when_all( std::move(futures) ).then( [](gnl::task_future< std::vector< gnl::task_future<int> > > all)
+    {
+        int s = 0;
+        for(gnl::task_future<int> & f : all.get())
+            s += f.get();
+        return s;
+    });
+    REQUIRE( sum.get() == 45 );
+
+    REQUIRE( gnl::when_all( std::vector< gnl::task_future<int> >() ).get().empty() );
+
+    gnl::task_promise<int> never;
+    std::vector< gnl::task_future<int> > race;
+    race.push_back( never.get_future() );
+    race.push_back( P.submit( []{ return 7; } ) );
+
+    gnl::when_any_result<int> first = gnl::when_any( std::move(race) ).get();
+    REQUIRE( first.index == 1 );
+    REQUIRE( first.futures.size() == 2 );
+    REQUIRE( first.futures[1].get() == 7 );
+    REQUIRE( !first.futures[0].ready() );
+
+    never.set_value(3);
+    REQUIRE( first.futures[0].get() == 3 );
+
+    REQUIRE( gnl::when_any( std::vector< gnl::task_future<int> >() ).get().index == static_cast<std::size_t>(-1) );
 }